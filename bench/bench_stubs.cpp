@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file bench_stubs.cpp
+ * @brief The few libfreeswitch functions the benchmarked sources call
+ *
+ * The benchmark compiles against the real FreeSWITCH headers but does not
+ * link libfreeswitch, which cannot be used without a running core. Logging
+ * is discarded and time comes from the monotonic clock.
+ */
+#include <switch.h>
+
+#include <time.h>
+
+void switch_log_printf(switch_text_channel_t channel,
+                       const char *file,
+                       const char *func,
+                       int line,
+                       const char *userdata,
+                       switch_log_level_t level,
+                       const char *fmt,
+                       ...)
+{
+    (void)channel;
+    (void)file;
+    (void)func;
+    (void)line;
+    (void)userdata;
+    (void)level;
+    (void)fmt;
+}
+
+switch_time_t switch_micro_time_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (switch_time_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
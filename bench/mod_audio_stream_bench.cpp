@@ -0,0 +1,452 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file mod_audio_stream_bench.cpp
+ * @brief Micro-benchmarks of the media hot path
+ *
+ * Runs the module's buffer, serializer, codec, resampler and inbound decode
+ * code outside FreeSWITCH and prints one JSON document with the time per
+ * operation of each case, so results can be compared between releases.
+ *
+ * Usage: mod_audio_stream_bench [--filter text] [--min-time-ms ms]
+ *
+ * Every case repeats its operation in growing batches until at least
+ * min-time-ms (default 200) has been spent, after a short warm-up.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <speex/speex_resampler.h>
+#include <switch.h>
+
+#include "adaptive_buffer.hpp"
+#include "base64.hpp"
+#include "g711_codec.h"
+#include "message_scanner.hpp"
+#include "playback_decoder.hpp"
+#include "playback_ring.h"
+#include "stream_resampler.hpp"
+#include "stream_serializer.hpp"
+#include "stream_utils.hpp"
+#include "voice_activity.hpp"
+
+#ifndef MOD_AUDIO_STREAM_VERSION
+#define MOD_AUDIO_STREAM_VERSION "unknown"
+#endif
+
+namespace
+{
+struct BenchResult
+{
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    size_t bytes_per_op;
+};
+
+std::vector<BenchResult> results;
+std::string filter;
+double min_time_ms = 200.0;
+
+// results of the measured operations end up here so the compiler cannot drop them
+volatile uint64_t sink;
+
+template <typename Op> void run(const std::string &name, size_t bytes_per_op, Op op)
+{
+    if (!filter.empty() && name.find(filter) == std::string::npos)
+        return;
+
+    // warm caches, pools and lazily selected kernels
+    for (int i = 0; i < 100; i++)
+        op();
+
+    uint64_t batch = 64;
+    uint64_t iterations = 0;
+    double elapsed_ns = 0;
+    while (elapsed_ns < min_time_ms * 1e6)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < batch; i++)
+            op();
+        elapsed_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        iterations += batch;
+        if (batch < (1u << 20))
+            batch *= 2;
+    }
+    results.push_back({name, iterations, elapsed_ns / (double)iterations, bytes_per_op});
+}
+
+// speech-like test audio, so codecs and base64 see realistic bytes
+std::vector<int16_t> make_samples(size_t count, int rate)
+{
+    std::vector<int16_t> samples(count);
+    uint32_t noise = 12345;
+    for (size_t i = 0; i < count; i++)
+    {
+        noise = noise * 1103515245u + 12345u;
+        int tone = (int)(((i * 440 * 2 / rate) & 1) ? 6000 : -6000);
+        samples[i] = (int16_t)(tone + (int)((noise >> 16) & 0x7ff) - 0x400);
+    }
+    return samples;
+}
+
+void bench_buffer(void)
+{
+    static const struct
+    {
+        const char *name;
+        int chunk_bytes;
+    } cases[] = {{"l16_8k", L16_FRAME_SIZE_8KHZ_20MS},
+                 {"l16_16k", L16_FRAME_SIZE_8KHZ_20MS * 2},
+                 {"ulaw_8k", ULAW_FRAME_SIZE_8KHZ_20MS}};
+
+    for (const auto &c : cases)
+    {
+        std::string stream_id = "bench";
+        Buffer buffer(stream_id, (size_t)c.chunk_bytes * 50 * 40, c.chunk_bytes, 20);
+        std::vector<uint8_t> in(c.chunk_bytes, 0x55);
+        std::vector<uint8_t> out(c.chunk_bytes);
+        chunk_stamps_t stamps{};
+        stamps.captured_ns = 1;
+        stamps.enqueued_ns = 2;
+        run(std::string("buffer_write_read/") + c.name, c.chunk_bytes, [&]() {
+            buffer.write(in.data(), stamps);
+            buffer.read(out.data(), &stamps);
+            sink += out[0];
+        });
+    }
+}
+
+void bench_serializer(void)
+{
+    const std::string uuid = "6c5f0f3c-3b7e-4d8a-9a55-0d6b0c4a1f21";
+    const std::string stream_id = "bench-stream-0001";
+    const std::string extra_headers = "{\"callerId\":\"+15551234567\",\"account\":\"bench\"}";
+    SendBuffer out;
+
+    run("serialize/start", 0, [&]() {
+        out.clear();
+        serialize_start_event(out, 1, uuid, stream_id, "inbound", extra_headers, L16, 8000, FRAMING_JSON, 1);
+        sink += out.length();
+    });
+
+    static const struct
+    {
+        const char *name;
+        size_t chunk_bytes;
+        uint32_t chunks;
+    } media[] = {{"l16_8k", L16_FRAME_SIZE_8KHZ_20MS, 1},
+                 {"l16_16k", L16_FRAME_SIZE_8KHZ_20MS * 2, 1},
+                 {"ulaw_8k", ULAW_FRAME_SIZE_8KHZ_20MS, 1},
+                 {"l16_8k_x5", L16_FRAME_SIZE_8KHZ_20MS, 5}};
+    for (const auto &m : media)
+    {
+        size_t len = m.chunk_bytes * m.chunks;
+        std::vector<int16_t> samples = make_samples(len / 2 + 1, 8000);
+        const uint8_t *audio = (const uint8_t *)samples.data();
+        run(std::string("serialize/media/") + m.name, len, [&]() {
+            out.clear();
+            serialize_media_event(out, 42, stream_id, "inbound", audio, len, 1700000000000000ll, 7, m.chunks, extra_headers);
+            sink += out.length();
+        });
+    }
+
+    // a realtime session's input_audio_buffer.append, 20ms of PCM16 at 24 kHz
+    std::vector<int16_t> realtime = make_samples(REALTIME_SAMPLE_RATE / 50, REALTIME_SAMPLE_RATE);
+    run("serialize/realtime_append/l16_24k", realtime.size() * sizeof(int16_t), [&]() {
+        out.clear();
+        serialize_realtime_append(out, (const uint8_t *)realtime.data(), realtime.size() * sizeof(int16_t));
+        sink += out.length();
+    });
+
+    run("serialize/stop", 0, [&]() {
+        out.clear();
+        serialize_stop_event(out, 100, uuid, stream_id, extra_headers);
+        sink += out.length();
+    });
+
+    run("serialize/played", 0, [&]() {
+        out.clear();
+        serialize_played_event(out, 100, stream_id.c_str(), "greeting-checkpoint");
+        sink += out.length();
+    });
+}
+
+void bench_base64(void)
+{
+    static const size_t sizes[] = {ULAW_FRAME_SIZE_8KHZ_20MS, L16_FRAME_SIZE_8KHZ_20MS, L16_FRAME_SIZE_8KHZ_20MS * 2};
+    for (size_t size : sizes)
+    {
+        std::vector<int16_t> samples = make_samples(size / 2, 8000);
+        const unsigned char *bytes = (const unsigned char *)samples.data();
+        std::string encoded = base64::base64_encode(bytes, (unsigned int)size);
+        std::vector<unsigned char> decoded(size);
+        std::string suffix = "/" + std::to_string(size);
+
+        run("base64/encode" + suffix, size, [&]() {
+            std::string text = base64::base64_encode(bytes, (unsigned int)size);
+            sink += text.size();
+        });
+        run("base64/decode" + suffix, size, [&]() {
+            std::string raw = base64::base64_decode(encoded);
+            sink += raw.size();
+        });
+        run("base64/decode_into" + suffix, size, [&]() {
+            bool finished = false;
+            sink += base64::base64_decode_into(encoded.data(), encoded.size(), true, decoded.data(), &finished);
+        });
+    }
+}
+
+void bench_g711(void)
+{
+    static const char *const kernels[] = {"avx2", "sse4.1", "neon", "scalar"};
+    const size_t samples = ULAW_FRAME_SIZE_8KHZ_20MS;
+    std::vector<int16_t> linear = make_samples(samples, 8000);
+    std::vector<uint8_t> ulaw(samples);
+    std::vector<int16_t> decoded(samples);
+    std::string selected = g711_codec_init();
+
+    for (const char *kernel : kernels)
+    {
+        if (!g711_codec_force_implementation(kernel))
+            continue;
+        run(std::string("g711/encode/") + kernel, samples * sizeof(int16_t), [&]() {
+            g711_ulaw_encode(linear.data(), ulaw.data(), samples);
+            sink += ulaw[0];
+        });
+    }
+    g711_codec_force_implementation(selected.c_str());
+
+    run("g711/decode", samples, [&]() {
+        g711_ulaw_decode(ulaw.data(), decoded.data(), samples);
+        sink += (uint16_t)decoded[0];
+    });
+}
+
+void bench_resampler(void)
+{
+    static const struct
+    {
+        const char *name;
+        int from;
+        int to;
+    } cases[] = {{"8k_to_16k", 8000, 16000}, {"16k_to_8k", 16000, 8000}, {"24k_to_8k", 24000, 8000}};
+
+    for (const auto &c : cases)
+    {
+        // one 20ms frame, as the media bug hands it over
+        std::vector<int16_t> in = make_samples(c.from / 50, c.from);
+        std::vector<int16_t> out(c.to / 50 + 64);
+
+        // speex at the same quality is the baseline the integer kernels replace
+        int err = 0;
+        SpeexResamplerState *speex = speex_resampler_init(1, c.from, c.to, SWITCH_RESAMPLE_QUALITY, &err);
+        if (speex)
+        {
+            run(std::string("resample_speex/") + c.name, in.size() * sizeof(int16_t), [&]() {
+                spx_uint32_t in_len = (spx_uint32_t)in.size();
+                spx_uint32_t out_len = (spx_uint32_t)out.size();
+                speex_resampler_process_interleaved_int(speex, in.data(), &in_len, out.data(), &out_len);
+                sink += out_len;
+            });
+            speex_resampler_destroy(speex);
+        }
+        else
+        {
+            fprintf(stderr, "resample_speex/%s: speex_resampler_init failed (%d)\n", c.name, err);
+        }
+
+        StreamResampler *resampler = StreamResampler::create(1, c.from, c.to, SWITCH_RESAMPLE_QUALITY);
+        if (!resampler)
+        {
+            fprintf(stderr, "resample/%s: StreamResampler::create failed\n", c.name);
+            continue;
+        }
+        run(std::string("resample/") + c.name, in.size() * sizeof(int16_t), [&]() {
+            size_t out_len = 0;
+            resampler->process(in.data(), in.size(), out_len);
+            sink += out_len;
+        });
+        delete resampler;
+    }
+}
+
+void bench_vad(void)
+{
+    // one 20ms frame at 8 and 16 kHz, the cost silence suppression adds to every captured frame
+    for (int rate : {8000, 16000})
+    {
+        std::vector<int16_t> frame = make_samples(rate / 50, rate);
+        VoiceActivityDetector vad(VAD_DEFAULT_THRESHOLD_DB, VAD_DEFAULT_HANGOVER_MS);
+        run("vad/" + std::to_string(rate / 1000) + "k", frame.size() * sizeof(int16_t), [&]() {
+            sink += vad.is_voice(frame.data(), frame.size()) ? 1 : 0;
+            vad.take_silence();
+        });
+    }
+}
+
+void bench_adaptive_buffer(void)
+{
+    AdaptiveBufferManager manager;
+    buffer_config_t config = BufferConfigurations::Balanced;
+    const std::string stream_id = "bench";
+    if (!manager.initialize(config) || !manager.create_buffer(stream_id, config))
+    {
+        fprintf(stderr, "adaptive_buffer: unable to create a buffer\n");
+        return;
+    }
+
+    buffered_message_t message;
+    message.sequence_number = 1;
+    message.priority = PRIORITY_NORMAL;
+    message.data.resize(L16_FRAME_SIZE_8KHZ_20MS);
+    message.timestamp = std::chrono::system_clock::now();
+    message.deadline = message.timestamp + std::chrono::hours(24);
+    message.retry_count = 0;
+    message.stream_id = stream_id;
+    buffered_message_t received;
+
+    run("adaptive_buffer/enqueue_dequeue", message.data.size(), [&]() {
+        // a dropped message would leave dequeue_message waiting forever
+        if (manager.enqueue_message(stream_id, message) &&
+            manager.dequeue_message(stream_id, received, std::chrono::milliseconds(1)))
+            sink += received.data.size();
+    });
+
+    // steady state of a producer that recycles its message: no allocations
+    run("adaptive_buffer/move_enqueue_dequeue", message.data.size(), [&]() {
+        if (manager.enqueue_message(stream_id, std::move(message)) &&
+            manager.dequeue_message(stream_id, message, std::chrono::milliseconds(1)))
+            sink += message.data.size();
+    });
+    manager.destroy_buffer(stream_id);
+}
+
+// the media.play path of processIncomingMessage, and the response.audio.delta one of a realtime session: scan,
+// base64 decode into the playback ring, then the write thread's 20ms reads that drain it again
+void bench_inbound(void)
+{
+    static const struct
+    {
+        const char *name;
+        int rate;
+        int channel_rate;
+        int duration_ms;
+        bool realtime;
+    } cases[] = {{"l16_8k_20ms", 8000, 8000, 20, false},
+                 {"l16_8k_500ms", 8000, 8000, 500, false},
+                 {"l16_16k_to_8k_100ms", 16000, 8000, 100, false},
+                 {"l16_24k_to_8k_100ms", REALTIME_SAMPLE_RATE, 8000, 100, true}};
+
+    for (const auto &c : cases)
+    {
+        std::vector<int16_t> samples = make_samples((size_t)c.rate * c.duration_ms / 1000, c.rate);
+        size_t audio_len = samples.size() * sizeof(int16_t);
+        std::string payload = base64::base64_encode((const unsigned char *)samples.data(), (unsigned int)audio_len);
+        std::string message;
+        if (c.realtime)
+            message = "{\"type\":\"response.audio.delta\",\"event_id\":\"event_bench\",\"response_id\":\"resp_bench\","
+                      "\"item_id\":\"item_bench\",\"output_index\":0,\"content_index\":0,\"delta\":\"" +
+                      payload + "\"}";
+        else
+            message = "{\"event\":\"media.play\",\"streamId\":\"bench-stream-0001\",\"media\":{\"contentType\":"
+                      "\"audio/x-l16\",\"sampleRate\":" +
+                      std::to_string(c.rate) + ",\"payload\":\"" + payload + "\"}}";
+        std::string name = std::string(c.realtime ? "inbound_realtime_delta/" : "inbound_media_play/") + c.name;
+
+        playback_ring_t *ring = playback_ring_create();
+        PlaybackDecoder decoder;
+        StreamResampler *resampler =
+            (c.rate != c.channel_rate) ? StreamResampler::create(1, c.rate, c.channel_rate, SWITCH_RESAMPLE_QUALITY)
+                                       : nullptr;
+        if (!ring || (c.rate != c.channel_rate && !resampler))
+        {
+            fprintf(stderr, "%s: setup failed\n", name.c_str());
+            playback_ring_destroy(ring);
+            continue;
+        }
+
+        int16_t frame[L16_FRAME_SIZE_8KHZ_20MS];
+        size_t frame_bytes = (size_t)c.channel_rate / 50 * sizeof(int16_t);
+        if (frame_bytes > sizeof(frame))
+            frame_bytes = sizeof(frame);
+        run(name, audio_len, [&]() {
+            media_play_view_t view;
+            json_string_view_t delta;
+            size_t queued = 0;
+            if (c.realtime ? scan_realtime_audio_delta(message.data(), message.size(), delta)
+                           : scan_media_play(message.data(), message.size(), view))
+            {
+                const json_string_view_t &audio = c.realtime ? delta : view.payload;
+                decoder.decode_base64(ring, audio.data, audio.len, L16, resampler, queued);
+            }
+            while (playback_ring_read(ring, frame, frame_bytes, nullptr) > 0)
+            {
+            }
+            sink += queued;
+        });
+
+        delete resampler;
+        playback_ring_destroy(ring);
+    }
+}
+
+void print_json(void)
+{
+    printf("{\"benchmark\":\"mod_audio_stream\",\"version\":\"%s\",\"g711\":\"%s\",\"minTimeMs\":%.0f,\"results\":[",
+           MOD_AUDIO_STREAM_VERSION,
+           g711_codec_implementation(),
+           min_time_ms);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        printf("%s\n  {\"name\":\"%s\",\"iterations\":%llu,\"nsPerOp\":%.1f,\"opsPerSec\":%.0f",
+               i ? "," : "",
+               r.name.c_str(),
+               (unsigned long long)r.iterations,
+               r.ns_per_op,
+               1e9 / r.ns_per_op);
+        if (r.bytes_per_op)
+            printf(",\"bytesPerOp\":%zu,\"mbPerSec\":%.1f", r.bytes_per_op, (double)r.bytes_per_op * 1e3 / r.ns_per_op);
+        printf("}");
+    }
+    printf("\n]}\n");
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "--filter") && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "--min-time-ms") && i + 1 < argc)
+        {
+            min_time_ms = atof(argv[++i]);
+            if (min_time_ms <= 0)
+                min_time_ms = 1;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--filter text] [--min-time-ms ms]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench_buffer();
+    bench_serializer();
+    bench_base64();
+    bench_g711();
+    bench_resampler();
+    bench_vad();
+    bench_adaptive_buffer();
+    bench_inbound();
+    print_json();
+    return 0;
+}
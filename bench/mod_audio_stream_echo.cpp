@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file mod_audio_stream_echo.cpp
+ * @brief High-throughput WebSocket echo server for load testing
+ *
+ * Speaks the mod_audio_stream protocol well enough to load test it: accepts
+ * any number of streams, counts start/media/stop messages and echoes media
+ * back as media.play so the bidirectional path is exercised too. JSON media
+ * is answered with a media.play carrying the same payload and, up front, the
+ * chunk index of the media message so mod_audio_stream_load can match echoes
+ * to chunks. Binary media frames are sent back unchanged.
+ *
+ * Built on libwebsockets with one event loop per service thread, so several
+ * thousand streams cost no more than a couple of cores and the server is not
+ * what a load test ends up measuring.
+ *
+ * Usage: mod_audio_stream_echo [--port 8080] [--threads 2] [--echo-every 1]
+ *                              [--stats-secs 10]
+ *
+ *   --echo-every n   echo one media message in n, 0 only sinks the audio
+ */
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libwebsockets.h>
+#include <signal.h>
+#include <time.h>
+
+/* echoes queued per connection before the oldest are dropped */
+#define ECHO_MAX_QUEUED 256
+
+namespace
+{
+struct EchoMessage
+{
+    std::vector<unsigned char> buffer; // LWS_PRE headroom followed by the payload
+    bool binary;
+};
+
+// per connection state, constructed in place in the lws per-session storage
+struct EchoSession
+{
+    std::string rx;
+    bool rx_binary = false;
+    int sample_rate = 8000;
+    bool mulaw = false;
+    unsigned long media_received = 0;
+    std::deque<EchoMessage> tx;
+};
+
+unsigned int echo_every = 1;
+std::atomic<bool> stopping{false};
+std::atomic<long> sessions{0};
+std::atomic<unsigned long long> messages_in{0};
+std::atomic<unsigned long long> bytes_in{0};
+std::atomic<unsigned long long> messages_out{0};
+std::atomic<unsigned long long> dropped_out{0};
+
+// number following "key": in the first limit bytes of the message, or fallback
+long find_number(const std::string &text, const char *key, size_t limit, long fallback)
+{
+    size_t at = text.find(key);
+    if (at == std::string::npos || at > limit)
+        return fallback;
+    return strtol(text.c_str() + at + strlen(key), nullptr, 10);
+}
+
+void queue_message(struct lws *wsi, EchoSession *session, const char *data, size_t len, bool binary)
+{
+    if (session->tx.size() >= ECHO_MAX_QUEUED)
+    {
+        session->tx.pop_front();
+        dropped_out.fetch_add(1, std::memory_order_relaxed);
+    }
+    session->tx.emplace_back();
+    EchoMessage &message = session->tx.back();
+    message.buffer.resize(LWS_PRE + len);
+    memcpy(message.buffer.data() + LWS_PRE, data, len);
+    message.binary = binary;
+    lws_callback_on_writable(wsi);
+}
+
+void handle_text(struct lws *wsi, EchoSession *session)
+{
+    const std::string &text = session->rx;
+    if (text.find("\"event\":\"media\"") != std::string::npos)
+    {
+        if (!echo_every || ++session->media_received % echo_every)
+            return;
+
+        static const char payload_key[] = "\"payload\":\"";
+        size_t payload = text.find(payload_key);
+        if (payload == std::string::npos)
+            return;
+        payload += sizeof(payload_key) - 1;
+        size_t payload_end = text.find('"', payload);
+        if (payload_end == std::string::npos)
+            return;
+
+        char head[160];
+        int head_len = snprintf(head,
+                                sizeof(head),
+                                "{\"event\":\"media.play\",\"chunk\":%ld,\"media\":{\"contentType\":\"%s\","
+                                "\"sampleRate\":%d,\"payload\":\"",
+                                find_number(text, "\"chunk\":", text.size(), 0),
+                                session->mulaw ? "audio/x-mulaw" : "audio/x-l16",
+                                session->sample_rate);
+        std::string reply;
+        reply.reserve(head_len + (payload_end - payload) + 3);
+        reply.append(head, head_len);
+        reply.append(text, payload, payload_end - payload);
+        reply.append("\"}}");
+        queue_message(wsi, session, reply.data(), reply.size(), false);
+    }
+    else if (text.find("\"event\":\"start\"") != std::string::npos)
+    {
+        session->sample_rate = (int)find_number(text, "\"sampleRate\":", text.size(), 8000);
+        session->mulaw = text.find("audio/x-mulaw") != std::string::npos;
+    }
+}
+
+int echo_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+{
+    EchoSession *session = static_cast<EchoSession *>(user);
+    switch (reason)
+    {
+        case LWS_CALLBACK_ESTABLISHED:
+            new (session) EchoSession();
+            sessions.fetch_add(1, std::memory_order_relaxed);
+            break;
+
+        case LWS_CALLBACK_CLOSED:
+            session->~EchoSession();
+            sessions.fetch_sub(1, std::memory_order_relaxed);
+            break;
+
+        case LWS_CALLBACK_RECEIVE:
+            if (lws_is_first_fragment(wsi))
+            {
+                session->rx.clear();
+                session->rx_binary = lws_frame_is_binary(wsi);
+            }
+            session->rx.append((const char *)in, len);
+            if (!lws_is_final_fragment(wsi))
+                break;
+
+            messages_in.fetch_add(1, std::memory_order_relaxed);
+            bytes_in.fetch_add(session->rx.size(), std::memory_order_relaxed);
+            if (!session->rx_binary)
+                handle_text(wsi, session);
+            else if (echo_every && 0 == ++session->media_received % echo_every)
+                queue_message(wsi, session, session->rx.data(), session->rx.size(), true);
+            break;
+
+        case LWS_CALLBACK_SERVER_WRITEABLE:
+        {
+            if (session->tx.empty())
+                break;
+            EchoMessage &message = session->tx.front();
+            size_t n = message.buffer.size() - LWS_PRE;
+            if (lws_write(wsi, message.buffer.data() + LWS_PRE, n, message.binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT) <
+                (int)n)
+                return -1;
+            session->tx.pop_front();
+            messages_out.fetch_add(1, std::memory_order_relaxed);
+            if (!session->tx.empty())
+                lws_callback_on_writable(wsi);
+            break;
+        }
+
+        default:
+            break;
+    }
+    return 0;
+}
+
+void service(struct lws_context *context, int tsi)
+{
+    while (!stopping && lws_service_tsi(context, 0, tsi) >= 0)
+    {
+    }
+}
+
+void on_signal(int)
+{
+    stopping = true;
+}
+
+int usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--port 8080] [--threads 2] [--echo-every 1] [--stats-secs 10]\n", name);
+    return 1;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int port = 8080;
+    unsigned int threads = 2;
+    unsigned int stats_secs = 10;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        int value = atoi(argv[i + 1]);
+        if (0 == strcmp(argv[i], "--port"))
+            port = value;
+        else if (0 == strcmp(argv[i], "--threads"))
+            threads = value > 0 ? (unsigned int)value : 1;
+        else if (0 == strcmp(argv[i], "--echo-every"))
+            echo_every = value > 0 ? (unsigned int)value : 0;
+        else if (0 == strcmp(argv[i], "--stats-secs"))
+            stats_secs = value > 0 ? (unsigned int)value : 1;
+        else
+            return usage(argv[0]);
+    }
+    if (argc % 2 == 0)
+        return usage(argv[0]);
+
+    const char *protocol = std::getenv("MOD_AUDIO_STREAM_SUBPROTOCOL_NAME");
+    struct lws_protocols protocols[] = {
+        {protocol ? protocol : "audio.freeswitch.org", echo_callback, sizeof(EchoSession), 65536, 0, nullptr, 0},
+        {nullptr, nullptr, 0, 0, 0, nullptr, 0}};
+
+    struct lws_context_creation_info info;
+    memset(&info, 0, sizeof(info));
+    info.port = port;
+    info.protocols = protocols;
+    // one event loop per thread, accepted connections are spread across them
+    info.count_threads = threads;
+
+    lws_set_log_level(LLL_ERR | LLL_WARN, nullptr);
+    struct lws_context *context = lws_create_context(&info);
+    if (!context)
+    {
+        fprintf(stderr, "mod_audio_stream_echo: unable to listen on port %d\n", port);
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; i++)
+        workers.emplace_back(service, context, (int)i);
+
+    fprintf(stderr,
+            "mod_audio_stream_echo: port %d, %u threads, echoing %s\n",
+            port,
+            threads,
+            echo_every ? (echo_every == 1 ? "every media message" : "one media message in n") : "nothing");
+
+    std::thread stats([stats_secs]() {
+        unsigned long long last_in = 0, last_out = 0;
+        while (!stopping)
+        {
+            for (unsigned int i = 0; i < stats_secs * 10 && !stopping; i++)
+            {
+                struct timespec ts = {0, 100000000};
+                nanosleep(&ts, nullptr);
+            }
+            unsigned long long in = messages_in.load(), out = messages_out.load();
+            fprintf(stderr,
+                    "{\"sessions\":%ld,\"messagesInPerSec\":%.0f,\"messagesOutPerSec\":%.0f,\"mbInTotal\":%.1f,"
+                    "\"droppedEchoes\":%llu}\n",
+                    sessions.load(),
+                    (double)(in - last_in) / stats_secs,
+                    (double)(out - last_out) / stats_secs,
+                    (double)bytes_in.load() / 1048576.0,
+                    dropped_out.load());
+            last_in = in;
+            last_out = out;
+        }
+    });
+
+    service(context, 0);
+    stopping = true;
+    lws_cancel_service(context);
+    for (auto &worker : workers)
+        worker.join();
+    stats.join();
+    lws_context_destroy(context);
+    return 0;
+}
@@ -0,0 +1,581 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file mod_audio_stream_load.cpp
+ * @brief Multi-stream load generator and soak harness
+ *
+ * Drives N concurrent AudioPipe instances against a WebSocket server (normally
+ * mod_audio_stream_echo) without FreeSWITCH, feeding synthetic audio into each
+ * stream buffer at real-time cadence exactly where the media bug would. The
+ * stream count is ramped through a list of steps; for every step one JSON line
+ * reports CPU per stream, memory per stream, send queue depth and, when the
+ * server echoes media.play back, round-trip latency percentiles measured from
+ * the moment a chunk was enqueued to the moment its echo arrived.
+ *
+ * Usage: mod_audio_stream_load --url ws://host:port/path [options]
+ *
+ *   --steps 100,250,500    stream counts to ramp through (default 100..5000)
+ *   --step-secs 30         measured seconds per step, after a 2s settle
+ *   --threads 4            lws service threads
+ *   --connect-rate 500     new connections per second
+ *   --rate 8000            L16 sampling rate, 8000 or 16000
+ *   --chunks-per-message 1 20ms chunks per media message
+ *   --binary               negotiate binary media framing
+ *   --insecure             accept self-signed certificates for wss://
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio_pipe.hpp"
+#include "latency_metrics.h"
+#include "stream_utils.hpp"
+
+#ifndef MOD_AUDIO_STREAM_VERSION
+#define MOD_AUDIO_STREAM_VERSION "unknown"
+#endif
+
+/* capture times kept per stream to match echoes against, must exceed the echo delay in chunks */
+#define LOAD_SENT_SLOTS 1024
+
+/* audio buffered per stream before writes fail, as with MOD_AUDIO_STREAM_BUFFER_SECS */
+#define LOAD_BUFFER_SECS 10
+
+namespace
+{
+struct LoadOptions
+{
+    std::string host;
+    std::string path = "/";
+    unsigned int port = 80;
+    int ssl_flags = 0;
+    std::vector<unsigned int> steps = {100, 250, 500, 1000, 2000, 3000, 4000, 5000};
+    unsigned int step_secs = 30;
+    unsigned int threads = 4;
+    unsigned int connect_rate = 500;
+    int rate = 8000;
+    unsigned int chunks_per_message = 1;
+    bool binary = false;
+};
+
+struct LoadStream
+{
+    // guards pipe against the lws threads deleting it
+    std::mutex mutex;
+    AudioPipe *pipe = nullptr;
+    stream_latency_t *latency = nullptr;
+    std::atomic<bool> connected{false};
+    std::atomic<bool> failed{false};
+    // chunks written so far; the k-th chunk is sent with chunk index k
+    uint32_t chunks_written = 0;
+    std::atomic<uint64_t> sent_at[LOAD_SENT_SLOTS];
+    // round-trip samples of the current step in microseconds, guarded by mutex
+    std::vector<uint32_t> round_trips;
+};
+
+LoadOptions options;
+std::vector<std::unique_ptr<LoadStream>> streams;
+std::atomic<size_t> active_streams{0};
+std::atomic<bool> stopping{false};
+std::atomic<uint64_t> write_failures{0};
+std::atomic<uint64_t> echoes{0};
+std::atomic<uint64_t> feeder_lag_max_ns{0};
+std::vector<int16_t> tone;
+
+void load_log(int level, const char *line)
+{
+    if (level & (LLL_ERR | LLL_WARN))
+        fprintf(stderr, "%s", line);
+}
+
+LoadStream *find_stream(const char *session_id)
+{
+    // session ids are "load-<index>"
+    size_t index = strtoul(session_id + 5, nullptr, 10);
+    return index < streams.size() ? streams[index].get() : nullptr;
+}
+
+void record_echo(LoadStream *stream, uint32_t chunk)
+{
+    uint64_t sent = stream->sent_at[chunk % LOAD_SENT_SLOTS].load(std::memory_order_relaxed);
+    if (!sent)
+        return;
+    uint64_t round_trip = (latency_now_ns() - sent) / 1000;
+    std::lock_guard<std::mutex> lk(stream->mutex);
+    stream->round_trips.push_back((uint32_t)std::min<uint64_t>(round_trip, UINT32_MAX));
+    echoes.fetch_add(1, std::memory_order_relaxed);
+}
+
+void load_event(const char *session_id, const char *stream_id, AudioPipe::NotifyEvent_t event, const char *message)
+{
+    (void)stream_id;
+    LoadStream *stream = find_stream(session_id);
+    if (!stream)
+        return;
+
+    switch (event)
+    {
+        case AudioPipe::CONNECT_SUCCESS:
+            stream->connected = true;
+            break;
+        case AudioPipe::CONNECT_FAIL:
+        {
+            // as in lws_glue, nobody else frees a pipe that never connected
+            std::lock_guard<std::mutex> lk(stream->mutex);
+            delete stream->pipe;
+            stream->pipe = nullptr;
+            stream->connected = false;
+            stream->failed = true;
+            break;
+        }
+        case AudioPipe::CONNECTION_DROPPED:
+        case AudioPipe::CONNECTION_CLOSED_GRACEFULLY:
+        {
+            // the pipe deletes itself right after this callback
+            std::lock_guard<std::mutex> lk(stream->mutex);
+            stream->pipe = nullptr;
+            stream->connected = false;
+            if (event == AudioPipe::CONNECTION_DROPPED)
+                stream->failed = true;
+            break;
+        }
+        case AudioPipe::MESSAGE:
+        {
+            // mod_audio_stream_echo puts the chunk index of the echoed media message up front
+            const char *chunk = message ? strstr(message, "\"chunk\":") : nullptr;
+            if (chunk)
+                record_echo(stream, (uint32_t)strtoul(chunk + 8, nullptr, 10));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void load_binary(const char *session_id, const char *stream_id, const uint8_t *data, size_t len)
+{
+    (void)stream_id;
+    binary_media_header_t header;
+    LoadStream *stream = find_stream(session_id);
+    if (stream && decode_binary_media_header(data, len, header))
+        record_echo(stream, header.chunk);
+}
+
+void open_stream(size_t index)
+{
+    char uuid[32];
+    snprintf(uuid, sizeof(uuid), "load-%zu", index);
+    LoadStream *stream = streams[index].get();
+    size_t chunk_bytes = L16_FRAME_SIZE_8KHZ_20MS * (options.rate / 8000);
+
+    AudioPipe *ap = new AudioPipe(uuid,
+                                  uuid,
+                                  options.host.c_str(),
+                                  options.port,
+                                  options.path.c_str(),
+                                  options.ssl_flags,
+                                  chunk_bytes * 50 * LOAD_BUFFER_SECS,
+                                  nullptr,
+                                  nullptr,
+                                  load_event,
+                                  "inbound",
+                                  "",
+                                  L16,
+                                  options.rate,
+                                  1,
+                                  options.binary ? FRAMING_BINARY : FRAMING_JSON,
+                                  load_binary,
+                                  options.chunks_per_message);
+    stream->latency = stream_latency_create(uuid);
+    ap->setLatency(stream->latency);
+    {
+        std::lock_guard<std::mutex> lk(stream->mutex);
+        stream->pipe = ap;
+    }
+    ap->connect();
+}
+
+// Writes one 20ms chunk per connected stream every 20ms, like the media bug does
+void feeder(void)
+{
+    size_t chunk_bytes = L16_FRAME_SIZE_8KHZ_20MS * (options.rate / 8000);
+    size_t chunks_in_tone = tone.size() * sizeof(int16_t) / chunk_bytes;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!stopping)
+    {
+        next.tv_nsec += 20000000;
+        if (next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+
+        uint64_t deadline = (uint64_t)next.tv_sec * 1000000000ull + (uint64_t)next.tv_nsec;
+        size_t active = active_streams.load();
+        for (size_t i = 0; i < active; i++)
+        {
+            LoadStream *stream = streams[i].get();
+            if (!stream->connected)
+                continue;
+
+            std::lock_guard<std::mutex> lk(stream->mutex);
+            AudioPipe *ap = stream->pipe;
+            if (!ap || ap->getLwsState() != AudioPipe::LWS_CLIENT_CONNECTED)
+                continue;
+
+            const uint8_t *audio = (const uint8_t *)tone.data() + (stream->chunks_written % chunks_in_tone) * chunk_bytes;
+            chunk_stamps_t stamps;
+            stamps.captured_ns = stamps.enqueued_ns = latency_now_ns();
+            if (ap->m_audio_buffer->write((void *)audio, stamps))
+            {
+                stream->sent_at[stream->chunks_written % LOAD_SENT_SLOTS].store(stamps.enqueued_ns,
+                                                                               std::memory_order_relaxed);
+                stream->chunks_written++;
+                ap->addPendingWrite(ap);
+            }
+            else
+            {
+                write_failures.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        uint64_t lag = latency_now_ns() - deadline;
+        uint64_t max = feeder_lag_max_ns.load(std::memory_order_relaxed);
+        while (lag > max && !feeder_lag_max_ns.compare_exchange_weak(max, lag))
+        {
+        }
+    }
+}
+
+double cpu_seconds(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+size_t resident_bytes(void)
+{
+    unsigned long size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+double monotonic_seconds(void)
+{
+    return (double)latency_now_ns() / 1e9;
+}
+
+double percentile_ms(const std::vector<uint32_t> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t)(p * (double)(sorted.size() - 1) + 0.5);
+    return sorted[rank] / 1000.0;
+}
+
+struct QueueDepth
+{
+    double sum = 0;
+    size_t max = 0;
+    size_t samples = 0;
+};
+
+void sample_queue_depth(QueueDepth &depth)
+{
+    size_t active = active_streams.load();
+    for (size_t i = 0; i < active; i++)
+    {
+        LoadStream *stream = streams[i].get();
+        std::lock_guard<std::mutex> lk(stream->mutex);
+        if (!stream->pipe || !stream->connected)
+            continue;
+        size_t queued = stream->pipe->m_audio_buffer->chunks_available();
+        depth.sum += (double)queued;
+        depth.max = std::max(depth.max, queued);
+        depth.samples++;
+    }
+}
+
+void run_step(unsigned int index, unsigned int target, size_t baseline_rss)
+{
+    // open the new streams at the configured rate
+    auto ramp_start = std::chrono::steady_clock::now();
+    for (size_t i = active_streams.load(); i < target && !stopping; i++)
+    {
+        open_stream(i);
+        active_streams = i + 1;
+        if (options.connect_rate)
+        {
+            auto due = ramp_start + std::chrono::microseconds((i + 1) * 1000000ull / options.connect_rate);
+            std::this_thread::sleep_until(due);
+        }
+    }
+
+    // connections still in flight get up to 10s, then 2s to settle
+    for (int i = 0; i < 100 && !stopping; i++)
+    {
+        size_t pending = 0;
+        for (size_t s = 0; s < target; s++)
+            pending += (!streams[s]->connected && !streams[s]->failed) ? 1 : 0;
+        if (!pending)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    for (size_t s = 0; s < target; s++)
+    {
+        std::lock_guard<std::mutex> lk(streams[s]->mutex);
+        streams[s]->round_trips.clear();
+    }
+    write_failures = 0;
+    echoes = 0;
+    feeder_lag_max_ns = 0;
+    double cpu_start = cpu_seconds();
+    double wall_start = monotonic_seconds();
+
+    QueueDepth depth;
+    for (unsigned int second = 0; second < options.step_secs && !stopping; second++)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        sample_queue_depth(depth);
+    }
+
+    double wall = monotonic_seconds() - wall_start;
+    double cpu = cpu_seconds() - cpu_start;
+    size_t connected = 0, failed = 0;
+    std::vector<uint32_t> round_trips;
+    for (size_t s = 0; s < target; s++)
+    {
+        LoadStream *stream = streams[s].get();
+        connected += stream->connected ? 1 : 0;
+        failed += stream->failed ? 1 : 0;
+        std::lock_guard<std::mutex> lk(stream->mutex);
+        round_trips.insert(round_trips.end(), stream->round_trips.begin(), stream->round_trips.end());
+    }
+    std::sort(round_trips.begin(), round_trips.end());
+    size_t rss = resident_bytes();
+    double cpu_percent = wall > 0 ? cpu / wall * 100.0 : 0;
+
+    printf("{\"step\":%u,\"streams\":%u,\"connected\":%zu,\"failed\":%zu,\"seconds\":%.1f,"
+           "\"cpuPercent\":%.1f,\"cpuPerStreamPercent\":%.4f,\"rssMb\":%.1f,\"memoryPerStreamKb\":%.1f,"
+           "\"sendQueueChunks\":{\"avg\":%.2f,\"max\":%zu},\"bufferWriteFailures\":%llu,\"feederLagMsMax\":%.2f,"
+           "\"echoes\":%llu,\"roundTripMs\":{\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"p999\":%.2f,\"max\":%.2f}}\n",
+           index,
+           target,
+           connected,
+           failed,
+           wall,
+           cpu_percent,
+           connected ? cpu_percent / (double)connected : 0.0,
+           (double)rss / 1048576.0,
+           connected && rss > baseline_rss ? (double)(rss - baseline_rss) / 1024.0 / (double)connected : 0.0,
+           depth.samples ? depth.sum / (double)depth.samples : 0.0,
+           depth.max,
+           (unsigned long long)write_failures.load(),
+           (double)feeder_lag_max_ns.load() / 1e6,
+           (unsigned long long)echoes.load(),
+           percentile_ms(round_trips, 0.5),
+           percentile_ms(round_trips, 0.9),
+           percentile_ms(round_trips, 0.99),
+           percentile_ms(round_trips, 0.999),
+           round_trips.empty() ? 0.0 : round_trips.back() / 1000.0);
+    fflush(stdout);
+}
+
+void close_streams(void)
+{
+    size_t active = active_streams.load();
+    for (size_t i = 0; i < active; i++)
+    {
+        std::lock_guard<std::mutex> lk(streams[i]->mutex);
+        if (streams[i]->pipe && streams[i]->connected)
+            streams[i]->pipe->graceful_shutdown();
+    }
+    // everything buffered is flushed, then the pipes close and delete themselves
+    for (int i = 0; i < 100; i++)
+    {
+        size_t open = 0;
+        for (size_t s = 0; s < active; s++)
+            open += streams[s]->connected ? 1 : 0;
+        if (!open)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+bool parse_url(const char *url)
+{
+    const char *p;
+    if (0 == strncmp(url, "ws://", 5))
+    {
+        p = url + 5;
+        options.port = 80;
+    }
+    else if (0 == strncmp(url, "wss://", 6))
+    {
+        p = url + 6;
+        options.port = 443;
+        options.ssl_flags |= LCCSCF_USE_SSL;
+    }
+    else
+    {
+        return false;
+    }
+
+    const char *slash = strchr(p, '/');
+    std::string authority = slash ? std::string(p, slash - p) : std::string(p);
+    options.path = slash ? slash : "/";
+    size_t colon = authority.rfind(':');
+    if (colon != std::string::npos)
+    {
+        options.port = (unsigned int)atoi(authority.c_str() + colon + 1);
+        authority.resize(colon);
+    }
+    options.host = authority;
+    return !options.host.empty() && options.port > 0;
+}
+
+bool parse_steps(const char *list)
+{
+    options.steps.clear();
+    for (const char *p = list; *p;)
+    {
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        if (end == p || n == 0 || (!options.steps.empty() && n <= options.steps.back()))
+            return false;
+        options.steps.push_back((unsigned int)n);
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return !options.steps.empty();
+}
+
+void on_signal(int)
+{
+    stopping = true;
+}
+
+int usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s --url ws://host:port/path [--steps 100,250,...] [--step-secs 30] [--threads 4]\n"
+            "       [--connect-rate 500] [--rate 8000|16000] [--chunks-per-message n] [--binary] [--insecure]\n",
+            name);
+    return 1;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bool have_url = false;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (0 == strcmp(arg, "--binary"))
+        {
+            options.binary = true;
+            continue;
+        }
+        if (0 == strcmp(arg, "--insecure"))
+        {
+            options.ssl_flags |= LCCSCF_ALLOW_SELFSIGNED | LCCSCF_SKIP_SERVER_CERT_HOSTNAME_CHECK;
+            continue;
+        }
+
+        // every other option takes a value
+        if (i + 1 >= argc)
+            return usage(argv[0]);
+        const char *value = argv[++i];
+        if (0 == strcmp(arg, "--url"))
+            have_url = parse_url(value);
+        else if (0 == strcmp(arg, "--steps"))
+        {
+            if (!parse_steps(value))
+                return usage(argv[0]);
+        }
+        else if (0 == strcmp(arg, "--step-secs"))
+            options.step_secs = std::max(1, atoi(value));
+        else if (0 == strcmp(arg, "--threads"))
+            options.threads = std::max(1, std::min(atoi(value), MAX_SERVICE_CONTEXTS));
+        else if (0 == strcmp(arg, "--connect-rate"))
+            options.connect_rate = (unsigned int)std::max(0, atoi(value));
+        else if (0 == strcmp(arg, "--rate"))
+            options.rate = (atoi(value) == 16000) ? 16000 : 8000;
+        else if (0 == strcmp(arg, "--chunks-per-message"))
+            options.chunks_per_message = (unsigned int)std::max(1, std::min(atoi(value), MAX_CHUNKS_PER_MESSAGE));
+        else
+            return usage(argv[0]);
+    }
+    if (!have_url)
+        return usage(argv[0]);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // one second of a square wave, repeated by every stream
+    tone.resize(options.rate);
+    for (size_t i = 0; i < tone.size(); i++)
+        tone[i] = ((i * 880 / options.rate) & 1) ? 4000 : -4000;
+
+    streams.reserve(options.steps.back());
+    for (unsigned int i = 0; i < options.steps.back(); i++)
+    {
+        streams.emplace_back(new LoadStream());
+        for (auto &slot : streams.back()->sent_at)
+            slot.store(0, std::memory_order_relaxed);
+    }
+
+    const char *protocol = std::getenv("MOD_AUDIO_STREAM_SUBPROTOCOL_NAME");
+    AudioPipe::initialize(protocol ? protocol : "audio.freeswitch.org", options.threads, LLL_ERR | LLL_WARN, load_log);
+    size_t baseline_rss = resident_bytes();
+    std::thread feed(feeder);
+
+    fprintf(stderr,
+            "mod_audio_stream_load %s: %zu steps up to %u streams against %s:%u%s\n",
+            MOD_AUDIO_STREAM_VERSION,
+            options.steps.size(),
+            options.steps.back(),
+            options.host.c_str(),
+            options.port,
+            options.path.c_str());
+    for (size_t i = 0; i < options.steps.size() && !stopping; i++)
+        run_step((unsigned int)i, options.steps[i], baseline_rss);
+
+    close_streams();
+    stopping = true;
+    feed.join();
+
+    // the per-stage histograms of every stream, e.g. bufferWait and mouthToWire
+    char *latency = module_latency_json();
+    printf("{\"summary\":{\"streams\":%zu,\"latency\":%s}}\n", active_streams.load(), latency ? latency : "{}");
+    free(latency);
+    for (auto &stream : streams)
+        stream_latency_release(stream->latency);
+
+    AudioPipe::deinitialize();
+    return 0;
+}
@@ -5,10 +5,11 @@
  */
 #include "adaptive_buffer.hpp"
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 
 // AdaptiveBufferManager implementation
-AdaptiveBufferManager::AdaptiveBufferManager() : monitoring_active_(false)
+AdaptiveBufferManager::AdaptiveBufferManager() : monitoring_active_(false), wheel_(current_tick())
 {
     // Initialize default configuration
     default_config_ = BufferConfigurations::Balanced;
@@ -17,8 +18,16 @@ AdaptiveBufferManager::AdaptiveBufferManager() : monitoring_active_(false)
 AdaptiveBufferManager::~AdaptiveBufferManager()
 {
     stop_monitoring();
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    buffers_.clear();
+    for (auto &shard : shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto &pair : shard.buffers)
+        {
+            std::lock_guard<std::mutex> wheel_lock(wheel_mutex_);
+            wheel_.cancel(&pair.second->adaptation_timer);
+        }
+        shard.buffers.clear();
+    }
 }
 
 bool AdaptiveBufferManager::initialize(const buffer_config_t &config)
@@ -29,15 +38,15 @@ bool AdaptiveBufferManager::initialize(const buffer_config_t &config)
 
 bool AdaptiveBufferManager::create_buffer(const std::string &stream_id, const buffer_config_t &config)
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-
     // Create new buffer context
-    auto context = std::make_unique<BufferContext>();
+    auto context = std::make_shared<BufferContext>();
     context->stream_id = stream_id;
     context->config = config;
     context->current_state = BUFFER_NORMAL;
     context->adaptive_enabled = true;
     context->expected_sequence = 0;
+    context->queued_messages = 0;
+    context->queued_bytes = 0;
     context->should_stop = false;
     context->current_window_size = config.window_size;
     context->token_bucket_tokens = config.token_bucket_capacity;
@@ -65,54 +74,159 @@ bool AdaptiveBufferManager::create_buffer(const std::string &stream_id, const bu
     context->network_condition.is_stable = true;
     context->network_condition.last_measurement = std::chrono::system_clock::now();
 
-    buffers_[stream_id] = std::move(context);
+    context->adaptation_timer.owner = context.get();
+
+    BufferShard &shard = shards_[shard_index(stream_id)];
+    std::shared_ptr<BufferContext> replaced;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::shared_ptr<BufferContext> &slot = shard.buffers[stream_id];
+        replaced = std::move(slot);
+        slot = context;
+    }
+
+    if (replaced)
+    {
+        {
+            std::lock_guard<std::mutex> context_lock(replaced->context_mutex);
+            replaced->should_stop.store(true, std::memory_order_release);
+        }
+        replaced->data_available.notify_all();
+    }
+
+    std::lock_guard<std::mutex> wheel_lock(wheel_mutex_);
+    if (replaced)
+    {
+        wheel_.cancel(&replaced->adaptation_timer);
+    }
+    wheel_.schedule(&context->adaptation_timer, current_tick() + interval_ticks(*context));
 
     return true;
 }
 
 bool AdaptiveBufferManager::destroy_buffer(const std::string &stream_id)
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    BufferShard &shard = shards_[shard_index(stream_id)];
+    std::shared_ptr<BufferContext> context;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.buffers.find(stream_id);
+        if (it == shard.buffers.end())
+        {
+            return false;
+        }
+        context = std::move(it->second);
+        shard.buffers.erase(it);
+    }
+
+    // Wake consumers blocked in dequeue_message; they hold their own reference
+    {
+        std::lock_guard<std::mutex> context_lock(context->context_mutex);
+        context->should_stop.store(true, std::memory_order_release);
+    }
+    context->data_available.notify_all();
+
+    // Set before cancelling so the monitor cannot schedule it again
+    std::lock_guard<std::mutex> wheel_lock(wheel_mutex_);
+    wheel_.cancel(&context->adaptation_timer);
+    return true;
+}
+
+bool AdaptiveBufferManager::enqueue_message(const std::string &stream_id, const buffered_message_t &message)
+{
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        it->second->should_stop = true;
-        it->second->data_available.notify_all();
-        buffers_.erase(it);
+        BufferContext &context = *buffer;
+        std::lock_guard<std::mutex> context_lock(context.context_mutex);
+
+        QueuedMessage *slot = reserve_slot(context, message.priority, message.data.size(), message.deadline);
+        if (!slot)
+        {
+            return false;
+        }
+
+        slot->sequence_number = message.sequence_number;
+        slot->retry_count = message.retry_count;
+        slot->timestamp = message.timestamp;
+        slot->deadline = message.deadline;
+        slot->data.assign(message.data.begin(), message.data.end());
+        slot->has_metadata = !message.metadata.empty();
+        if (slot->has_metadata)
+        {
+            context.metadata[slot_key(message.priority, slot - context.rings[message.priority].slots.data())] =
+                message.metadata;
+        }
+
+        commit_slot(context, message.priority, *slot);
         return true;
     }
     return false;
 }
 
-bool AdaptiveBufferManager::enqueue_message(const std::string &stream_id, const buffered_message_t &message)
+bool AdaptiveBufferManager::enqueue_message(const std::string &stream_id, buffered_message_t &&message)
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::lock_guard<std::mutex> context_lock(it->second->context_mutex);
+        BufferContext &context = *buffer;
+        std::lock_guard<std::mutex> context_lock(context.context_mutex);
 
-        // Check if we should drop the message
-        if (should_drop_message(*it->second, message))
+        QueuedMessage *slot = reserve_slot(context, message.priority, message.data.size(), message.deadline);
+        if (!slot)
         {
-            it->second->statistics.dropped_messages++;
             return false;
         }
 
-        // Add to priority queue
-        it->second->message_queue.push(message);
-        it->second->statistics.current_message_count = it->second->message_queue.size();
-        it->second->statistics.total_messages++;
+        slot->sequence_number = message.sequence_number;
+        slot->retry_count = message.retry_count;
+        slot->timestamp = message.timestamp;
+        slot->deadline = message.deadline;
+        // hand the caller the slot's old slab in exchange
+        slot->data.swap(message.data);
+        slot->has_metadata = !message.metadata.empty();
+        if (slot->has_metadata)
+        {
+            context.metadata[slot_key(message.priority, slot - context.rings[message.priority].slots.data())] =
+                std::move(message.metadata);
+            message.metadata.clear();
+        }
 
-        // Update statistics
-        update_buffer_statistics(*it->second);
+        commit_slot(context, message.priority, *slot);
+        return true;
+    }
+    return false;
+}
+
+bool AdaptiveBufferManager::emplace_message(const std::string &stream_id,
+                                            message_priority_t priority,
+                                            uint32_t sequence_number,
+                                            const void *data,
+                                            size_t len,
+                                            std::chrono::system_clock::time_point timestamp,
+                                            std::chrono::system_clock::time_point deadline)
+{
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
+    {
+        BufferContext &context = *buffer;
+        std::lock_guard<std::mutex> context_lock(context.context_mutex);
 
-        // Check buffer conditions
-        check_buffer_conditions(*it->second);
+        QueuedMessage *slot = reserve_slot(context, priority, len, deadline);
+        if (!slot)
+        {
+            return false;
+        }
 
-        // Notify waiting threads
-        it->second->data_available.notify_one();
+        slot->sequence_number = sequence_number;
+        slot->retry_count = 0;
+        slot->timestamp = timestamp;
+        slot->deadline = deadline;
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        slot->data.assign(bytes, bytes + len);
+        slot->has_metadata = false;
 
+        commit_slot(context, priority, *slot);
         return true;
     }
     return false;
@@ -122,54 +236,99 @@ bool AdaptiveBufferManager::dequeue_message(const std::string &stream_id,
                                             buffered_message_t &message,
                                             std::chrono::milliseconds timeout)
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::unique_lock<std::mutex> context_lock(it->second->context_mutex);
+        BufferContext &context = *buffer;
+        std::unique_lock<std::mutex> context_lock(context.context_mutex);
 
-        // Wait for data or timeout
-        if (timeout.count() > 0)
+        if (!wait_for_message(context, context_lock, timeout))
         {
-            it->second->data_available.wait_for(
-                context_lock, timeout, [&it] { return !it->second->message_queue.empty() || it->second->should_stop; });
+            return false;
         }
-        else
+
+        message_priority_t priority = static_cast<message_priority_t>(front_priority(context));
+        PriorityRing &ring = context.rings[priority];
+        QueuedMessage &slot = ring.slots[ring.head];
+        size_t size = slot.data.size();
+
+        message.sequence_number = slot.sequence_number;
+        message.priority = priority;
+        message.timestamp = slot.timestamp;
+        message.deadline = slot.deadline;
+        message.retry_count = slot.retry_count;
+        // only reassigned for a different stream, so a reused message does not allocate
+        if (message.stream_id != context.stream_id)
         {
-            it->second->data_available.wait(
-                context_lock, [&it] { return !it->second->message_queue.empty() || it->second->should_stop; });
+            message.stream_id = context.stream_id;
+        }
+        message.data.swap(slot.data);
+        message.metadata.clear();
+        if (slot.has_metadata)
+        {
+            auto parked = context.metadata.find(slot_key(priority, ring.head));
+            if (parked != context.metadata.end())
+            {
+                message.metadata = std::move(parked->second);
+            }
         }
 
-        if (it->second->should_stop)
+        release_slot(context, priority, size);
+        return true;
+    }
+    return false;
+}
+
+bool AdaptiveBufferManager::dequeue_message(const std::string &stream_id,
+                                            void *destination,
+                                            size_t max_len,
+                                            size_t &len,
+                                            std::chrono::milliseconds timeout)
+{
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
+    {
+        BufferContext &context = *buffer;
+        std::unique_lock<std::mutex> context_lock(context.context_mutex);
+
+        if (!wait_for_message(context, context_lock, timeout))
         {
             return false;
         }
 
-        if (!it->second->message_queue.empty())
-        {
-            message = it->second->message_queue.top();
-            it->second->message_queue.pop();
-            it->second->statistics.current_message_count = it->second->message_queue.size();
+        message_priority_t priority = static_cast<message_priority_t>(front_priority(context));
+        PriorityRing &ring = context.rings[priority];
+        const QueuedMessage &slot = ring.slots[ring.head];
 
-            // Update statistics
-            update_buffer_statistics(*it->second);
+        len = std::min(slot.data.size(), max_len);
+        memcpy(destination, slot.data.data(), len);
 
-            return true;
-        }
+        release_slot(context, priority, slot.data.size());
+        return true;
     }
     return false;
 }
 
-bool AdaptiveBufferManager::peek_message(const std::string &stream_id, buffered_message_t &message) const
+bool AdaptiveBufferManager::peek_message(const std::string &stream_id, buffered_message_view_t &view) const
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::lock_guard<std::mutex> context_lock(it->second->context_mutex);
-        if (!it->second->message_queue.empty())
+        const BufferContext &context = *buffer;
+        std::lock_guard<std::mutex> context_lock(context.context_mutex);
+
+        int priority = front_priority(context);
+        if (priority >= 0)
         {
-            message = it->second->message_queue.top();
+            const PriorityRing &ring = context.rings[priority];
+            const QueuedMessage &slot = ring.slots[ring.head];
+            view.sequence_number = slot.sequence_number;
+            view.priority = static_cast<message_priority_t>(priority);
+            view.data = slot.data.data();
+            view.size = slot.data.size();
+            view.timestamp = slot.timestamp;
+            view.deadline = slot.deadline;
+            view.retry_count = slot.retry_count;
             return true;
         }
     }
@@ -178,51 +337,47 @@ bool AdaptiveBufferManager::peek_message(const std::string &stream_id, buffered_
 
 buffer_statistics_t AdaptiveBufferManager::get_buffer_statistics(const std::string &stream_id) const
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::lock_guard<std::mutex> context_lock(it->second->context_mutex);
-        return it->second->statistics;
+        std::lock_guard<std::mutex> context_lock(buffer->context_mutex);
+        return buffer->statistics;
     }
     return {}; // Return empty statistics
 }
 
 void AdaptiveBufferManager::update_network_condition(const std::string &stream_id, const network_condition_t &condition)
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::lock_guard<std::mutex> context_lock(it->second->context_mutex);
-        it->second->network_condition = condition;
+        std::lock_guard<std::mutex> context_lock(buffer->context_mutex);
+        buffer->network_condition = condition;
 
-        if (it->second->adaptive_enabled)
+        if (buffer->adaptive_enabled)
         {
-            adapt_buffer_size(*it->second);
+            adapt_buffer_size(*buffer);
         }
     }
 }
 
 buffer_state_t AdaptiveBufferManager::get_buffer_state(const std::string &stream_id) const
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        return it->second->current_state;
+        return buffer->current_state;
     }
     return BUFFER_NORMAL;
 }
 
 bool AdaptiveBufferManager::adapt_buffer(const std::string &stream_id)
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::lock_guard<std::mutex> context_lock(it->second->context_mutex);
-        adapt_buffer_size(*it->second);
+        std::lock_guard<std::mutex> context_lock(buffer->context_mutex);
+        adapt_buffer_size(*buffer);
         return true;
     }
     return false;
@@ -230,54 +385,45 @@ bool AdaptiveBufferManager::adapt_buffer(const std::string &stream_id)
 
 void AdaptiveBufferManager::set_adaptive_enabled(const std::string &stream_id, bool enabled)
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::lock_guard<std::mutex> context_lock(it->second->context_mutex);
-        it->second->adaptive_enabled = enabled;
+        std::lock_guard<std::mutex> context_lock(buffer->context_mutex);
+        buffer->adaptive_enabled = enabled;
     }
 }
 
 bool AdaptiveBufferManager::is_adaptive_enabled(const std::string &stream_id) const
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        return it->second->adaptive_enabled;
+        return buffer->adaptive_enabled;
     }
     return false;
 }
 
 bool AdaptiveBufferManager::flush_buffer(const std::string &stream_id, message_priority_t min_priority)
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::lock_guard<std::mutex> context_lock(it->second->context_mutex);
+        BufferContext &context = *buffer;
+        std::lock_guard<std::mutex> context_lock(context.context_mutex);
 
-        // Create a new queue with only high-priority messages
-        auto new_queue = decltype(it->second->message_queue)();
-        while (!it->second->message_queue.empty())
+        // Keep only the rings at min_priority or more important
+        for (int level = min_priority + 1; level < ADAPTIVE_BUFFER_PRIORITY_LEVELS; level++)
         {
-            auto msg = it->second->message_queue.top();
-            it->second->message_queue.pop();
-
-            if (msg.priority <= min_priority)
+            PriorityRing &ring = context.rings[level];
+            message_priority_t priority = static_cast<message_priority_t>(level);
+            while (ring.count)
             {
-                new_queue.push(msg);
-            }
-            else
-            {
-                it->second->statistics.dropped_messages++;
+                context.statistics.dropped_messages++;
+                release_slot(context, priority, ring.slots[ring.head].data.size());
             }
         }
 
-        it->second->message_queue = std::move(new_queue);
-        it->second->statistics.current_message_count = it->second->message_queue.size();
-        it->second->current_state = BUFFER_DRAINING;
+        context.current_state = BUFFER_DRAINING;
 
         return true;
     }
@@ -286,14 +432,13 @@ bool AdaptiveBufferManager::flush_buffer(const std::string &stream_id, message_p
 
 double AdaptiveBufferManager::get_buffer_utilization(const std::string &stream_id) const
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::lock_guard<std::mutex> context_lock(it->second->context_mutex);
-        if (it->second->config.max_size_bytes > 0)
+        std::lock_guard<std::mutex> context_lock(buffer->context_mutex);
+        if (buffer->config.max_size_bytes > 0)
         {
-            return static_cast<double>(it->second->statistics.current_size_bytes) / it->second->config.max_size_bytes;
+            return static_cast<double>(buffer->statistics.current_size_bytes) / buffer->config.max_size_bytes;
         }
     }
     return 0.0;
@@ -301,12 +446,11 @@ double AdaptiveBufferManager::get_buffer_utilization(const std::string &stream_i
 
 size_t AdaptiveBufferManager::get_recommended_buffer_size(const std::string &stream_id) const
 {
-    std::lock_guard<std::mutex> lock(buffers_mutex_);
-    auto it = buffers_.find(stream_id);
-    if (it != buffers_.end())
+    auto buffer = find_buffer(stream_id);
+    if (buffer)
     {
-        std::lock_guard<std::mutex> context_lock(it->second->context_mutex);
-        return calculate_optimal_buffer_size(*it->second);
+        std::lock_guard<std::mutex> context_lock(buffer->context_mutex);
+        return calculate_optimal_buffer_size(*buffer);
     }
     return default_config_.initial_size_bytes;
 }
@@ -335,25 +479,75 @@ void AdaptiveBufferManager::stop_monitoring()
 }
 
 // Private implementation methods (stubs)
+size_t AdaptiveBufferManager::shard_index(const std::string &stream_id)
+{
+    return std::hash<std::string>()(stream_id) % ADAPTIVE_BUFFER_SHARDS;
+}
+
+std::shared_ptr<AdaptiveBufferManager::BufferContext>
+AdaptiveBufferManager::find_buffer(const std::string &stream_id) const
+{
+    const BufferShard &shard = shards_[shard_index(stream_id)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.buffers.find(stream_id);
+    return it != shard.buffers.end() ? it->second : nullptr;
+}
+
+uint64_t AdaptiveBufferManager::current_tick()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count() / ADAPTIVE_BUFFER_TICK_MS;
+}
+
+uint64_t AdaptiveBufferManager::interval_ticks(const BufferContext &context)
+{
+    uint64_t ticks = context.config.adaptation_interval_ms / ADAPTIVE_BUFFER_TICK_MS;
+    return ticks ? ticks : 1;
+}
+
 void AdaptiveBufferManager::monitoring_worker()
 {
+    std::vector<std::shared_ptr<BufferContext>> due;
     while (monitoring_active_)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        std::this_thread::sleep_for(std::chrono::milliseconds(ADAPTIVE_BUFFER_TICK_MS));
 
-        // Update all buffers
-        std::lock_guard<std::mutex> lock(buffers_mutex_);
-        for (auto &pair : buffers_)
+        // Collect the streams whose own adaptation interval has elapsed
         {
-            std::lock_guard<std::mutex> context_lock(pair.second->context_mutex);
-            update_buffer_statistics(*pair.second);
-            check_buffer_conditions(*pair.second);
+            std::lock_guard<std::mutex> wheel_lock(wheel_mutex_);
+            wheel_.advance(current_tick(), [&due](TimerWheelEntry *entry) {
+                due.push_back(static_cast<BufferContext *>(entry->owner)->shared_from_this());
+            });
+        }
+        if (due.empty())
+        {
+            continue;
+        }
 
-            if (pair.second->adaptive_enabled)
+        // Update each of them under its own lock only
+        for (auto &context : due)
+        {
+            std::lock_guard<std::mutex> context_lock(context->context_mutex);
+            update_buffer_statistics(*context);
+            check_buffer_conditions(*context);
+
+            if (context->adaptive_enabled)
             {
-                adapt_buffer_size(*pair.second);
+                adapt_buffer_size(*context);
             }
         }
+
+        uint64_t now = current_tick();
+        std::lock_guard<std::mutex> wheel_lock(wheel_mutex_);
+        for (auto &context : due)
+        {
+            // a stream stopped after this check has its timer cancelled once we release wheel_mutex_
+            if (!context->should_stop.load(std::memory_order_acquire))
+            {
+                wheel_.schedule(&context->adaptation_timer, now + interval_ticks(*context));
+            }
+        }
+        due.clear();
     }
 }
 
@@ -387,14 +581,16 @@ void AdaptiveBufferManager::update_buffer_statistics(BufferContext &context)
     auto now = std::chrono::system_clock::now();
 
     // Update basic statistics
-    context.statistics.current_size_bytes = context.message_queue.size() * 1024; // Rough estimate
+    context.statistics.current_size_bytes = context.queued_bytes;
     context.statistics.last_update = now;
 
-    // Calculate latency (simplified)
-    if (!context.message_queue.empty())
+    // Latency of the message that would be dequeued next
+    int priority = front_priority(context);
+    if (priority >= 0)
     {
-        auto oldest_msg = context.message_queue.top();
-        auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(now - oldest_msg.timestamp).count();
+        const PriorityRing &ring = context.rings[priority];
+        auto latency =
+            std::chrono::duration_cast<std::chrono::milliseconds>(now - ring.slots[ring.head].timestamp).count();
         context.statistics.current_latency_ms = latency;
 
         // Update running average
@@ -413,7 +609,7 @@ void AdaptiveBufferManager::check_buffer_conditions(BufferContext &context)
     buffer_state_t old_state = context.current_state;
 
     // Check for underrun
-    if (context.message_queue.empty())
+    if (context.queued_messages == 0)
     {
         if (context.current_state != BUFFER_UNDERRUN)
         {
@@ -453,17 +649,20 @@ void AdaptiveBufferManager::apply_flow_control(BufferContext &context)
     // TODO: Implement flow control based on strategy
 }
 
-bool AdaptiveBufferManager::should_drop_message(const BufferContext &context, const buffered_message_t &message) const
+bool AdaptiveBufferManager::should_drop_message(const BufferContext &context,
+                                                message_priority_t priority,
+                                                size_t size,
+                                                const std::chrono::system_clock::time_point &deadline) const
 {
     // Drop if buffer is at capacity and this is not a critical message
-    if (context.statistics.current_size_bytes >= context.config.max_size_bytes)
+    if (context.queued_bytes + size > context.config.max_size_bytes)
     {
-        return message.priority > PRIORITY_HIGH;
+        return priority > PRIORITY_HIGH;
     }
 
     // Drop expired messages
     auto now = std::chrono::system_clock::now();
-    if (message.deadline < now)
+    if (deadline < now)
     {
         return true;
     }
@@ -471,6 +670,99 @@ bool AdaptiveBufferManager::should_drop_message(const BufferContext &context, co
     return false;
 }
 
+AdaptiveBufferManager::QueuedMessage *
+AdaptiveBufferManager::reserve_slot(BufferContext &context,
+                                    message_priority_t priority,
+                                    size_t size,
+                                    const std::chrono::system_clock::time_point &deadline)
+{
+    if (static_cast<int>(priority) < 0 || priority >= ADAPTIVE_BUFFER_PRIORITY_LEVELS ||
+        should_drop_message(context, priority, size, deadline))
+    {
+        context.statistics.dropped_messages++;
+        return nullptr;
+    }
+
+    PriorityRing &ring = context.rings[priority];
+    if (ring.slots.empty())
+    {
+        ring.slots.resize(ADAPTIVE_BUFFER_RING_SLOTS);
+    }
+    // A full ring rejects rather than overwrites, like a full buffer
+    if (ring.count == ADAPTIVE_BUFFER_RING_SLOTS)
+    {
+        context.statistics.dropped_messages++;
+        return nullptr;
+    }
+    return &ring.slots[(ring.head + ring.count) & (ADAPTIVE_BUFFER_RING_SLOTS - 1)];
+}
+
+void AdaptiveBufferManager::commit_slot(BufferContext &context, message_priority_t priority, QueuedMessage &slot)
+{
+    context.rings[priority].count++;
+    context.queued_messages++;
+    context.queued_bytes += slot.data.size();
+    context.statistics.current_message_count = context.queued_messages;
+    context.statistics.total_messages++;
+
+    // Update statistics
+    update_buffer_statistics(context);
+
+    // Check buffer conditions
+    check_buffer_conditions(context);
+
+    // Notify waiting threads
+    context.data_available.notify_one();
+}
+
+int AdaptiveBufferManager::front_priority(const BufferContext &context)
+{
+    for (int level = 0; level < ADAPTIVE_BUFFER_PRIORITY_LEVELS; level++)
+    {
+        if (context.rings[level].count)
+        {
+            return level;
+        }
+    }
+    return -1;
+}
+
+void AdaptiveBufferManager::release_slot(BufferContext &context, message_priority_t priority, size_t size)
+{
+    PriorityRing &ring = context.rings[priority];
+    if (ring.slots[ring.head].has_metadata)
+    {
+        context.metadata.erase(slot_key(priority, ring.head));
+        ring.slots[ring.head].has_metadata = false;
+    }
+    ring.head = (ring.head + 1) & (ADAPTIVE_BUFFER_RING_SLOTS - 1);
+    ring.count--;
+    context.queued_messages--;
+    context.queued_bytes -= size;
+    context.statistics.current_message_count = context.queued_messages;
+
+    // Update statistics
+    update_buffer_statistics(context);
+}
+
+bool AdaptiveBufferManager::wait_for_message(BufferContext &context,
+                                             std::unique_lock<std::mutex> &lock,
+                                             std::chrono::milliseconds timeout)
+{
+    // Wait for data or timeout
+    auto ready = [&context] { return context.queued_messages > 0 || context.should_stop; };
+    if (timeout.count() > 0)
+    {
+        context.data_available.wait_for(lock, timeout, ready);
+    }
+    else
+    {
+        context.data_available.wait(lock, ready);
+    }
+
+    return !context.should_stop && context.queued_messages > 0;
+}
+
 void AdaptiveBufferManager::expire_old_messages(BufferContext &context)
 {
     // TODO: Implement message expiration logic
@@ -15,6 +15,7 @@
 
 #include "connection_manager.hpp"
 #include "mod_audio_stream.h"
+#include "timer_wheel.hpp"
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
@@ -113,6 +114,35 @@ typedef struct buffered_message
     std::unordered_map<std::string, std::string> metadata;
 } buffered_message_t;
 
+/**
+ * @brief Read-only view of a queued message
+ *
+ * Points into the queue's own payload slab; see
+ * AdaptiveBufferManager::peek_message for how long it stays valid.
+ */
+typedef struct buffered_message_view
+{
+    uint32_t sequence_number;
+    message_priority_t priority;
+    const uint8_t *data;
+    size_t size;
+    std::chrono::system_clock::time_point timestamp;
+    std::chrono::system_clock::time_point deadline;
+    uint32_t retry_count;
+} buffered_message_view_t;
+
+/* one ring per message_priority_t level */
+#define ADAPTIVE_BUFFER_PRIORITY_LEVELS (PRIORITY_BULK + 1)
+
+/* slots per priority ring, a power of two; 256 is ~5 s of 20 ms frames */
+#define ADAPTIVE_BUFFER_RING_SLOTS 256
+
+/* independently locked partitions of the stream map */
+#define ADAPTIVE_BUFFER_SHARDS 16
+
+/* resolution of the per-stream adaptation timers */
+#define ADAPTIVE_BUFFER_TICK_MS 10
+
 /**
  * @brief Buffer statistics
  */
@@ -198,20 +228,62 @@ class AdaptiveBufferManager
 
     /**
      * @brief Enqueue message with priority
+     *
+     * The payload is copied into a pooled slab of the priority's ring, so
+     * this allocates only until the slab has grown to the payload size.
      */
     bool enqueue_message(const std::string &stream_id, const buffered_message_t &message);
 
+    /**
+     * @brief Enqueue message with priority, taking over its payload
+     *
+     * The payload vector is swapped with the slot's slab: message is left
+     * holding a recycled buffer of unspecified contents that the caller can
+     * fill again, which keeps a steady producer allocation free.
+     */
+    bool enqueue_message(const std::string &stream_id, buffered_message_t &&message);
+
+    /**
+     * @brief Enqueue a payload without building a buffered_message_t
+     */
+    bool emplace_message(const std::string &stream_id,
+                         message_priority_t priority,
+                         uint32_t sequence_number,
+                         const void *data,
+                         size_t len,
+                         std::chrono::system_clock::time_point timestamp,
+                         std::chrono::system_clock::time_point deadline);
+
     /**
      * @brief Dequeue message (blocking)
+     *
+     * Highest priority first, FIFO within a priority. The payload vector is
+     * swapped with the slot's slab, so passing the same message every time
+     * recycles its buffer instead of allocating.
      */
     bool dequeue_message(const std::string &stream_id,
                          buffered_message_t &message,
                          std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
 
+    /**
+     * @brief Dequeue message payload into a caller buffer (blocking)
+     *
+     * Copies at most max_len bytes and stores the copied length in len;
+     * metadata of the message is discarded.
+     */
+    bool dequeue_message(const std::string &stream_id,
+                         void *destination,
+                         size_t max_len,
+                         size_t &len,
+                         std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
     /**
      * @brief Peek at next message without removing
+     *
+     * The view points into the queue and is valid until the next dequeue,
+     * flush or destroy on the stream, so only the consumer should peek.
      */
-    bool peek_message(const std::string &stream_id, buffered_message_t &message) const;
+    bool peek_message(const std::string &stream_id, buffered_message_view_t &view) const;
 
     /**
      * @brief Get buffer statistics
@@ -276,6 +348,10 @@ class AdaptiveBufferManager
 
     /**
      * @brief Start buffer monitoring
+     *
+     * Each stream gets statistics, condition checks and adaptation every
+     * adaptation_interval_ms of its own config, driven from a timer wheel,
+     * and only that stream's lock is held while it runs.
      */
     bool start_monitoring();
 
@@ -309,10 +385,33 @@ class AdaptiveBufferManager
     };
 
   private:
+    /**
+     * @brief A queued message without its metadata
+     */
+    struct QueuedMessage
+    {
+        uint32_t sequence_number;
+        uint32_t retry_count;
+        std::chrono::system_clock::time_point timestamp;
+        std::chrono::system_clock::time_point deadline;
+        std::vector<uint8_t> data; // payload slab, keeps its capacity across reuse
+        bool has_metadata;         // metadata is parked in BufferContext::metadata
+    };
+
+    /**
+     * @brief Bounded FIFO of one priority level
+     */
+    struct PriorityRing
+    {
+        std::vector<QueuedMessage> slots; // ADAPTIVE_BUFFER_RING_SLOTS, allocated on first use
+        size_t head = 0;
+        size_t count = 0;
+    };
+
     /**
      * @brief Buffer context for internal management
      */
-    struct BufferContext
+    struct BufferContext : std::enable_shared_from_this<BufferContext>
     {
         std::string stream_id;
         buffer_config_t config;
@@ -321,7 +420,11 @@ class AdaptiveBufferManager
         network_condition_t network_condition;
 
         // Message storage
-        std::priority_queue<buffered_message_t, std::vector<buffered_message_t>, MessageComparator> message_queue;
+        PriorityRing rings[ADAPTIVE_BUFFER_PRIORITY_LEVELS];
+        size_t queued_messages;
+        size_t queued_bytes;
+        // metadata of queued messages that carry any, keyed by slot
+        std::unordered_map<size_t, std::unordered_map<std::string, std::string>> metadata;
 
         // Flow control state
         size_t current_window_size;
@@ -340,25 +443,44 @@ class AdaptiveBufferManager
         // Threading
         mutable std::mutex context_mutex;
         std::condition_variable data_available;
+        // written under context_mutex for data_available, atomic because the monitor reads it under wheel_mutex_
         std::atomic<bool> should_stop;
+
+        // Monitoring, guarded by wheel_mutex_
+        TimerWheelEntry adaptation_timer;
+    };
+
+    /**
+     * @brief One partition of the stream map
+     */
+    struct BufferShard
+    {
+        std::unordered_map<std::string, std::shared_ptr<BufferContext>> buffers;
+        mutable std::mutex mutex;
     };
 
     // Configuration
     buffer_config_t default_config_;
 
-    // Buffer storage
-    std::unordered_map<std::string, std::unique_ptr<BufferContext>> buffers_;
-    mutable std::mutex buffers_mutex_;
+    // Buffer storage; lookups hold a shard lock only for the map access and
+    // keep the context alive through the shared_ptr afterwards
+    BufferShard shards_[ADAPTIVE_BUFFER_SHARDS];
 
     // Monitoring
     std::atomic<bool> monitoring_active_;
     std::thread monitoring_thread_;
+    TimerWheel wheel_;
+    std::mutex wheel_mutex_;
 
     // Callbacks
     BufferEventCallback buffer_event_callback_;
     FlowControlCallback flow_control_callback_;
 
     // Internal methods
+    static size_t shard_index(const std::string &stream_id);
+    std::shared_ptr<BufferContext> find_buffer(const std::string &stream_id) const;
+    static uint64_t current_tick();
+    static uint64_t interval_ticks(const BufferContext &context);
     void monitoring_worker();
     void adapt_buffer_size(BufferContext &context);
     void update_buffer_statistics(BufferContext &context);
@@ -366,7 +488,24 @@ class AdaptiveBufferManager
     void handle_out_of_order_messages(BufferContext &context);
     void apply_flow_control(BufferContext &context);
 
-    bool should_drop_message(const BufferContext &context, const buffered_message_t &message) const;
+    bool should_drop_message(const BufferContext &context,
+                             message_priority_t priority,
+                             size_t size,
+                             const std::chrono::system_clock::time_point &deadline) const;
+    QueuedMessage *reserve_slot(BufferContext &context,
+                                message_priority_t priority,
+                                size_t size,
+                                const std::chrono::system_clock::time_point &deadline);
+    void commit_slot(BufferContext &context, message_priority_t priority, QueuedMessage &slot);
+    static int front_priority(const BufferContext &context);
+    static size_t slot_key(message_priority_t priority, size_t index)
+    {
+        return priority * ADAPTIVE_BUFFER_RING_SLOTS + index;
+    }
+    void release_slot(BufferContext &context, message_priority_t priority, size_t size);
+    bool wait_for_message(BufferContext &context,
+                          std::unique_lock<std::mutex> &lock,
+                          std::chrono::milliseconds timeout);
     void expire_old_messages(BufferContext &context);
     void reorder_messages(BufferContext &context);
 
@@ -201,32 +201,35 @@ extern "C"
 
         try
         {
-            // Create buffered message
-            buffered_message_t msg;
-            msg.data.resize(data_len);
-            memcpy(msg.data.data(), audio_data, data_len);
-            msg.sequence_number = sequence_number;
-            msg.timestamp = std::chrono::system_clock::now();
-            msg.deadline = msg.timestamp + std::chrono::milliseconds(5000); // 5 second deadline
+            auto timestamp = std::chrono::system_clock::now();
+            auto deadline = timestamp + std::chrono::milliseconds(5000); // 5 second deadline
 
             // Map priority
+            message_priority_t message_priority;
             switch (priority)
             {
                 case 0:
-                    msg.priority = PRIORITY_CRITICAL;
+                    message_priority = PRIORITY_CRITICAL;
                     break;
                 case 1:
-                    msg.priority = PRIORITY_HIGH;
+                    message_priority = PRIORITY_HIGH;
                     break;
                 case 2:
-                    msg.priority = PRIORITY_NORMAL;
+                    message_priority = PRIORITY_NORMAL;
                     break;
                 default:
-                    msg.priority = PRIORITY_LOW;
+                    message_priority = PRIORITY_LOW;
                     break;
             }
 
-            if (!g_adaptive_buffer_manager->enqueue_message(std::string(stream_id), msg))
+            // Copied straight into the queue's payload slab
+            if (!g_adaptive_buffer_manager->emplace_message(std::string(stream_id),
+                                                            message_priority,
+                                                            sequence_number,
+                                                            audio_data,
+                                                            data_len,
+                                                            timestamp,
+                                                            deadline))
             {
                 return SWITCH_STATUS_FALSE;
             }
@@ -254,20 +257,16 @@ extern "C"
 
         try
         {
-            buffered_message_t msg;
             std::chrono::milliseconds timeout(timeout_ms);
 
-            if (!g_adaptive_buffer_manager->dequeue_message(std::string(stream_id), msg, timeout))
+            // Copy data to output buffer
+            if (!g_adaptive_buffer_manager->dequeue_message(
+                    std::string(stream_id), audio_data, max_len, *data_len, timeout))
             {
                 *data_len = 0;
                 return SWITCH_STATUS_FALSE;
             }
 
-            // Copy data to output buffer
-            size_t copy_len = std::min(msg.data.size(), max_len);
-            memcpy(audio_data, msg.data.data(), copy_len);
-            *data_len = copy_len;
-
             return SWITCH_STATUS_SUCCESS;
         }
         catch (const std::exception &e)
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: MIT
+#include "advanced_api.h"
+
+#include <cstring>
+
+#include "latency_metrics.h"
+#include "stream_registry.h"
+
+void format_api_response(api_response_t *response,
+                         api_response_status_t status,
+                         const char *message,
+                         const char *data_json)
+{
+    response->status = status;
+    switch_copy_string(response->message, message ? message : "", sizeof(response->message));
+    switch_copy_string(response->data, data_json ? data_json : "{}", sizeof(response->data));
+    response->timestamp = switch_micro_time_now();
+}
+
+api_response_t handle_get_metrics_command(const metrics_query_params_t *params)
+{
+    api_response_t response;
+    memset(&response, 0, sizeof(response));
+
+    if (!params || (params->format[0] && strcasecmp(params->format, "json") != 0))
+    {
+        format_api_response(&response, API_ERROR_INVALID_ARGUMENTS, "only the json format is supported", NULL);
+        return response;
+    }
+
+    bool global = params->stream_id[0] == '\0';
+    char *latency = global ? module_latency_json() : stream_latency_json_by_id(params->stream_id);
+    if (!latency)
+    {
+        format_api_response(&response,
+                            global ? API_ERROR_INTERNAL_ERROR : API_ERROR_STREAM_NOT_FOUND,
+                            global ? "unable to build metrics" : "no running stream with this id",
+                            NULL);
+        return response;
+    }
+
+    char *data = global ? switch_mprintf("{\"latency\":%s}", latency)
+                        : switch_mprintf("{\"streamId\":\"%s\",\"latency\":%s}", params->stream_id, latency);
+    if (data && strlen(data) < sizeof(response.data))
+    {
+        format_api_response(&response, API_SUCCESS, "", data);
+    }
+    else
+    {
+        format_api_response(&response, API_ERROR_INTERNAL_ERROR, "metrics do not fit the response", NULL);
+    }
+    switch_safe_free(data);
+    switch_safe_free(latency);
+    return response;
+}
+
+uint32_t get_active_stream_count(void)
+{
+    return stream_registry_active();
+}
+
+char *get_stream_list_json(switch_core_session_t *session)
+{
+    return stream_registry_json(session ? switch_core_session_get_uuid(session) : NULL);
+}
+
+system_health_t get_system_health(void)
+{
+    stream_registry_totals_t totals;
+    stream_registry_snapshot(&totals);
+
+    system_health_t health;
+    memset(&health, 0, sizeof(health));
+    // every running stream without its connection is unhealthy, some of them or backpressure is degraded
+    const char *status = "healthy";
+    if (totals.active > 0 && totals.disconnected == totals.active)
+        status = "unhealthy";
+    else if (totals.disconnected > 0 || totals.gauges[STREAM_GAUGE_DEGRADATION] > 0)
+        status = "degraded";
+    switch_copy_string(health.overall_status, status, sizeof(health.overall_status));
+    health.active_streams = totals.active;
+    health.total_streams = (uint32_t)totals.started;
+    health.failed_streams = (uint32_t)totals.failed;
+    health.uptime = switch_core_uptime();
+    health.last_check = switch_micro_time_now();
+    return health;
+}
+
+char *get_metrics_exposition(const char *format)
+{
+    bool prometheus = format && 0 == strcasecmp(format, "prometheus");
+    char *streams = prometheus ? stream_registry_prometheus() : stream_registry_json(NULL);
+    char *latency = prometheus ? module_latency_prometheus() : module_latency_json();
+    char *text = NULL;
+    if (streams && latency)
+    {
+        if (prometheus)
+        {
+            text = switch_mprintf("%s%s", streams, latency);
+        }
+        else
+        {
+            system_health_t health = get_system_health();
+            text = switch_mprintf(
+                "{\"status\":\"%s\",\"registry\":%s,\"latency\":%s}", health.overall_status, streams, latency);
+        }
+    }
+    switch_safe_free(streams);
+    switch_safe_free(latency);
+    return text;
+}
@@ -14,6 +14,7 @@
 #define __ADVANCED_API_H__
 
 #include "mod_audio_stream.h"
+#include <stdbool.h>
 #include <switch.h>
 
 #ifdef __cplusplus
@@ -273,6 +274,17 @@ extern "C"
     uint32_t get_active_stream_count(void);
     char *get_stream_list_json(switch_core_session_t *session);
 
+    /**
+     * @brief Stream registry totals and the latency summary for metrics scrapes
+     *
+     * Built from one pass over the stream registry, without locking any
+     * session. Unlike the api_response_t handlers the result has no size cap.
+     *
+     * @param format "prometheus" for the Prometheus text format, otherwise compact JSON
+     * @return malloc'd text, or NULL on allocation failure
+     */
+    char *get_metrics_exposition(const char *format);
+
     /**
      * @brief Configuration and profile management
      */
@@ -1,20 +1,32 @@
 // SPDX-License-Identifier: MIT
 #include "audio_pipe.hpp"
+#include "backpressure_ladder.hpp"
+#include "message_scanner.hpp"
 #include "mod_audio_stream.h"
 #include "stream_utils.hpp"
 
 #include "switch.h"
 #include "switch_buffer.h"
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <climits>
+#include <cstdint>
 #include <iostream>
 #include <mutex>
 #include <string>
 #include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 /* discard incoming messages over the socket that are longer than this */
 /* Bytes per minute = (sample rate x bit depth x number of channels x 60 seconds) / 8 */
 #define MAX_RECV_BUF_SIZE (16000 * 16 * 1 * 60 * 5 / 8)     //  5 mins worth of l16 16k data  ~19 mb.
 #define RECV_BUF_REALLOC_SIZE (16000 * 16 * 1 * 60 * 1 / 8) //  1 mins worth of l16 16k data  ~1.9 mb
+#define RECV_BUF_INITIAL_SIZE (16 * 1024)                   //  typical control and media.play messages
+#define RECV_BUF_RETAIN_SIZE RECV_BUF_REALLOC_SIZE          //  larger arenas are released after the message
 
 namespace
 {
@@ -50,6 +62,11 @@ int AudioPipe::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, v
         (struct AudioPipe::lws_per_vhost_data *)lws_protocol_vh_priv_get(lws_get_vhost(wsi), lws_get_protocol(wsi));
     AudioPipe **ppAp = (AudioPipe **)user;
 
+    // shared connections have no pipe of their own either, but unlike pool connections they carry streams
+    int result = 0;
+    if (muxConnections > 0 && ppAp && !*ppAp && muxCallback(wsi, reason, ppAp, in, len, result))
+        return result;
+
     switch (reason)
     {
         case LWS_CALLBACK_PROTOCOL_INIT:
@@ -62,96 +79,66 @@ int AudioPipe::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, v
 
         case LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER:
         {
-            AudioPipe *ap = findPendingConnect(wsi);
+            AudioPipe *ap = ppAp ? *ppAp : nullptr;
             if (ap && ap->hasBasicAuth())
             {
-                unsigned char **p = (unsigned char **)in, *end = (*p) + len;
-                char b[128];
-                std::string username, password;
-
-                ap->getBasicAuth(username, password);
                 lwsl_notice("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER username: %s, "
                             "password: xxxxxx\n",
-                            username.c_str());
-                if (dch_lws_http_basic_auth_gen(username.c_str(), password.c_str(), b, sizeof(b)))
-                    break;
-                if (lws_add_http_header_by_token(
-                        wsi, WSI_TOKEN_HTTP_AUTHORIZATION, (unsigned char *)b, strlen(b), p, end))
+                            ap->m_username.c_str());
+                if (appendBasicAuth(wsi, in, len, ap->m_username, ap->m_password))
                     return -1;
             }
+            else if (ap && ap->appendBearerAuth(wsi, in, len))
+            {
+                return -1;
+            }
         }
         break;
 
         case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
-            processPendingConnects(vhd);
-            processPendingDisconnects(vhd);
-            processPendingWrites();
-            break;
-
-        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
         {
-            AudioPipe *ap = findAndRemovePendingConnect(wsi);
-            if (!ap)
+            ServiceQueue *queue = (ServiceQueue *)lws_context_user(lws_get_context(wsi));
+            if (queue)
             {
-                ap = findAndRemovePendingReconnect(wsi);
-                if (!ap)
-                {
-                    lwsl_err(
-                        "AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_CONNECTION_ERROR unable to find wsi %p.\n",
-                        wsi);
-                    return 0;
-                }
+                processPendingConnects(queue, vhd);
+                processPendingDisconnects(queue);
+                processPendingWrites(queue);
             }
-            if (ap->m_connection_attempts <= MAX_CONNECTION_ATTEMPTS)
+        }
+        break;
+
+        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+        {
+            AudioPipe *ap = ppAp ? *ppAp : nullptr;
+            if (!ap && warmCallback(wsi, reason, ppAp))
+                return 0;
+            if (!ap || (ap->m_state != LWS_CLIENT_CONNECTING && ap->m_state != LWS_CLIENT_RECONNECTING))
             {
-                /* static struct sul_user_data custom_sul; */
-                lwsl_notice("%s: mod_audio_stream:(%s) connection error(%s).. retrying again. current attempts(%d)",
-                            AUDIO_STREAM_LOGGING_PREFIX,
-                            ap->m_streamid.c_str(),
-                            ((in == NULL) ? "" : (char *)in),
-                            ap->m_connection_attempts);
-                struct sul_user_data *custom_sul;
-                custom_sul = (struct sul_user_data *)malloc(sizeof(struct sul_user_data));
-                memset(custom_sul, 0, sizeof(struct sul_user_data));
-                custom_sul->sul.list.owner = NULL;
-                custom_sul->sul.list.prev = NULL;
-                custom_sul->sul.list.next = NULL;
-                custom_sul->ap = ap;
-                ap->m_state = LWS_CLIENT_FAILED;
-                lws_sul_schedule(ap->m_vhd->context,
-                                 0,
-                                 &custom_sul->sul,
-                                 ap->reconnect,
-                                 RECONNECTION_DELAY_SECONDS * LWS_US_PER_SEC);
+                lwsl_err("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_CONNECTION_ERROR unable to find wsi %p.\n",
+                         wsi);
                 return 0;
             }
-            ap->m_state = LWS_CLIENT_FAILED;
-            ap->m_callback(ap->m_uuid.c_str(), ap->m_streamid.c_str(), AudioPipe::CONNECT_FAIL, (char *)in);
+            // reported from inside lws_client_connect_via_info, startConnect() sees the failure itself
+            if (ap->m_connect_in_progress)
+                return 0;
+            ap->cancelTimer();
+            circuitFailure(&serviceQueues[ap->m_context_index], ap->m_endpoint);
+            ap->retryOrFail((in == NULL) ? "" : (char *)in);
         }
         break;
 
         case LWS_CALLBACK_CLIENT_ESTABLISHED:
         {
-            AudioPipe *ap = findAndRemovePendingConnect(wsi);
-            if (!ap)
-            {
-                ap = findAndRemovePendingReconnect(wsi);
-                if (!ap)
-                {
-                    lwsl_err("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_ESTABLISHED. unable to find wsi %p.\n",
-                             wsi);
-                    return 0;
-                }
-            }
-            *ppAp = ap;
-            ap->m_vhd = vhd;
-            ap->m_connection_attempts = 0;
-            ap->m_state = LWS_CLIENT_CONNECTED;
-            if (!ap->m_stream_started)
+            AudioPipe *ap = ppAp ? *ppAp : nullptr;
+            if (!ap && warmCallback(wsi, reason, ppAp))
+                return 0;
+            if (!ap || (ap->m_state != LWS_CLIENT_CONNECTING && ap->m_state != LWS_CLIENT_RECONNECTING))
             {
-                ap->m_callback(ap->m_uuid.c_str(), ap->m_streamid.c_str(), AudioPipe::CONNECT_SUCCESS, NULL);
-                ap->m_stream_started = true;
+                lwsl_err("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_ESTABLISHED. unable to find wsi %p.\n",
+                         wsi);
+                return 0;
             }
+            ap->connectionEstablished(vhd);
         }
         break;
         case LWS_CALLBACK_CLIENT_CLOSED:
@@ -159,58 +146,12 @@ int AudioPipe::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, v
             AudioPipe *ap = *ppAp;
             if (!ap)
             {
+                if (warmCallback(wsi, reason, ppAp))
+                    return 0;
                 lwsl_err("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_CLOSED unable to find wsi %p..\n", wsi);
                 return 0;
             }
-            if (ap->isGracefulShutdown() || ap->m_state == LWS_CLIENT_DISCONNECTING)
-            {
-                // closed by us
-                ap->m_callback(
-                    ap->m_uuid.c_str(), ap->m_streamid.c_str(), AudioPipe::CONNECTION_CLOSED_GRACEFULLY, NULL);
-            }
-            else if (ap->m_state == LWS_CLIENT_CONNECTED)
-            {
-                // closed by far end
-                if (ap->m_connection_attempts <= MAX_CONNECTION_ATTEMPTS)
-                {
-                    struct sul_user_data *custom_sul = (struct sul_user_data *)malloc(sizeof(struct sul_user_data));
-                    memset(custom_sul, 0, sizeof(struct sul_user_data));
-                    custom_sul->sul.list.owner = NULL;
-                    custom_sul->sul.list.prev = NULL;
-                    custom_sul->sul.list.next = NULL;
-                    custom_sul->ap = ap;
-                    ap->m_state = LWS_CLIENT_DISCONNECTED;
-
-                    lwsl_notice("%s: mod_audio_stream(%s):(%s) connection closed by far end.. retrying again. current "
-                                "attempts(%d)",
-                                AUDIO_STREAM_LOGGING_PREFIX,
-                                ap->m_streamid.c_str(),
-                                ap->m_uuid.c_str(),
-                                ap->m_connection_attempts);
-                    lws_sul_schedule(ap->m_vhd->context,
-                                     0,
-                                     &(custom_sul->sul),
-                                     ap->reconnect,
-                                     RECONNECTION_DELAY_SECONDS * LWS_US_PER_SEC);
-                    return 0;
-                }
-                lwsl_notice("mod_audio_stream(%s): (%s) socket closed by far end.\n",
-                            ap->m_streamid.c_str(),
-                            ap->m_uuid.c_str());
-                ap->m_callback(ap->m_uuid.c_str(), ap->m_streamid.c_str(), AudioPipe::CONNECTION_DROPPED, NULL);
-            }
-            lwsl_notice("%s: mod_audio_stream(%s): (%s) connection disconnected.\n",
-                        AUDIO_STREAM_LOGGING_PREFIX,
-                        ap->m_streamid.c_str(),
-                        ap->m_uuid.c_str());
-
-            ap->m_state = LWS_CLIENT_DISCONNECTED;
-
-            // NB: after receiving any of the events above, any holder of a
-            // pointer or reference to this object must treat is as no longer valid
-
-            *ppAp = NULL;
-            delete ap;
+            ap->connectionClosed();
         }
         break;
 
@@ -219,6 +160,8 @@ int AudioPipe::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, v
             AudioPipe *ap = *ppAp;
             if (!ap)
             {
+                if (warmCallback(wsi, reason, ppAp))
+                    return 0;
                 lwsl_err("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_RECEIVE unable to find wsi %p..\n", wsi);
                 return 0;
             }
@@ -229,7 +172,7 @@ int AudioPipe::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, v
                 return 0;
             }
 
-            if (lws_frame_is_binary(wsi))
+            if (lws_frame_is_binary(wsi) && (!ap->isBinaryFraming() || !ap->m_binary_callback))
             {
                 lwsl_err("mod_audio_stream:(%s) received binary frame, discarding.\n", ap->m_streamid.c_str());
                 return 0;
@@ -237,70 +180,61 @@ int AudioPipe::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, v
 
             if (lws_is_first_fragment(wsi))
             {
+                ap->m_recv_started_ns = latency_now_ns();
+                ap->m_recv_binary = lws_frame_is_binary(wsi);
                 lwsl_debug("mod_audio_stream(%s) stream-in: first fragment recieved\n", ap->m_streamid.c_str());
-                if (nullptr != ap->m_recv_buf)
+                if (nullptr != ap->m_recv_buf_ptr)
                 {
                     lwsl_err(
                         "mod_audio_stream:(%s) first fragment received before prev final, discarding older data.\n",
                         ap->m_streamid.c_str());
-                    free(ap->m_recv_buf);
                 }
-                // allocate a buffer for the entire chunk of memory needed
-                ap->m_recv_buf_len = len + lws_remaining_packet_payload(wsi);
-                ap->m_recv_buf = (uint8_t *)malloc(ap->m_recv_buf_len);
-                ap->m_recv_buf_ptr = ap->m_recv_buf;
+                // the arena is kept between messages, it only grows when a message needs more room
+                ap->m_recv_buf_ptr =
+                    ap->reserveRecvBuffer(len + lws_remaining_packet_payload(wsi)) ? ap->m_recv_buf : nullptr;
             }
 
-            size_t write_offset = ap->m_recv_buf_ptr - ap->m_recv_buf;
-            size_t remaining_space = ap->m_recv_buf_len - write_offset;
+            if (nullptr == ap->m_recv_buf_ptr)
+            {
+                if (lws_is_final_fragment(wsi))
+                    lwsl_err("mod_audio_stream:(%s) payload not recieved.\n", ap->m_streamid.c_str());
+                return 0;
+            }
 
-            if (remaining_space < len)
+            size_t write_offset = ap->m_recv_buf_ptr - ap->m_recv_buf;
+            if (!ap->reserveRecvBuffer(write_offset + len))
             {
-                lwsl_notice("mod_audio_stream(%s) buffer realloc needed.\n", ap->m_streamid.c_str());
-                size_t newlen = ap->m_recv_buf_len + RECV_BUF_REALLOC_SIZE;
-                if (newlen > MAX_RECV_BUF_SIZE)
-                {
-                    free(ap->m_recv_buf);
-                    ap->m_recv_buf = ap->m_recv_buf_ptr = nullptr;
-                    ap->m_recv_buf_len = 0;
-                    lwsl_notice("mod_audio_stream(%s): max buffer exceeded, truncating message.\n",
-                                ap->m_streamid.c_str());
-                }
-                else
-                {
-                    ap->m_recv_buf = (uint8_t *)realloc(ap->m_recv_buf, newlen);
-                    if (nullptr != ap->m_recv_buf)
-                    {
-                        ap->m_recv_buf_len = newlen;
-                        ap->m_recv_buf_ptr = ap->m_recv_buf + write_offset;
-                    }
-                }
+                ap->m_recv_buf_ptr = nullptr;
+                lwsl_notice("mod_audio_stream(%s): max buffer exceeded, truncating message.\n",
+                            ap->m_streamid.c_str());
+                return 0;
             }
+            ap->m_recv_buf_ptr = ap->m_recv_buf + write_offset;
 
-            if (nullptr != ap->m_recv_buf)
+            if (len > 0)
+            {
+                memcpy(ap->m_recv_buf_ptr, in, len);
+                ap->m_recv_buf_ptr += len;
+            }
+            if (lws_is_final_fragment(wsi))
             {
-                if (len > 0)
+                lwsl_debug("mod_audio_stream(%s): stream-in: final fragment recieved\n", ap->m_streamid.c_str());
+                size_t message_len = ap->m_recv_buf_ptr - ap->m_recv_buf;
+                ap->m_recv_buf_ptr = nullptr;
+                stream_registry_count(ap->m_registry, STREAM_COUNTER_MESSAGES_RECEIVED, 1);
+                stream_registry_count(ap->m_registry, STREAM_COUNTER_BYTES_RECEIVED, message_len);
+                if (ap->m_recv_binary)
                 {
-                    memcpy(ap->m_recv_buf_ptr, in, len);
-                    ap->m_recv_buf_ptr += len;
+                    ap->m_binary_callback(ap->m_uuid.c_str(), ap->m_streamid.c_str(), ap->m_recv_buf, message_len);
                 }
-                if (lws_is_final_fragment(wsi))
+                else
                 {
-                    lwsl_debug("mod_audio_stream(%s): stream-in: final fragment recieved\n", ap->m_streamid.c_str());
-                    if (nullptr != ap->m_recv_buf)
-                    {
-                        std::string msg((char *)ap->m_recv_buf, ap->m_recv_buf_ptr - ap->m_recv_buf);
-                        ap->m_callback(ap->m_uuid.c_str(), ap->m_streamid.c_str(), AudioPipe::MESSAGE, msg.c_str());
-                        if (nullptr != ap->m_recv_buf)
-                            free(ap->m_recv_buf);
-                    }
-                    else
-                    {
-                        lwsl_err("mod_audio_stream:(%s) payload not recieved.\n", ap->m_streamid.c_str());
-                    }
-                    ap->m_recv_buf = ap->m_recv_buf_ptr = nullptr;
-                    ap->m_recv_buf_len = 0;
+                    // terminated in place, the handler reads the message straight from the arena
+                    ap->m_recv_buf[message_len] = '\0';
+                    ap->m_callback(
+                        ap->m_uuid.c_str(), ap->m_streamid.c_str(), AudioPipe::MESSAGE, (const char *)ap->m_recv_buf);
                 }
+                ap->releaseRecvBuffer();
             }
         }
         break;
@@ -311,201 +245,12 @@ int AudioPipe::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, v
             AudioPipe *ap = *ppAp;
             if (!ap)
             {
+                if (warmCallback(wsi, reason, ppAp))
+                    return 0;
                 lwsl_err("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_WRITEABLE unable to find wsi %p..\n", wsi);
                 return 0;
             }
-            switch_time_t cur_time;
-            if (ap->isGracefulShutdown())
-            {
-                cur_time = switch_epoch_time_now(NULL);
-                if (cur_time >= ap->m_gracefulShutdown_at + 60)
-                {
-                    ap->m_state = LWS_CLIENT_DISCONNECTING;
-                    lwsl_err("mod_audio_stream(%s): (%s) waited for too long. closing the connection.\n",
-                             ap->m_streamid.c_str(),
-                             ap->m_uuid.c_str());
-                    lws_close_reason(wsi, LWS_CLOSE_STATUS_NORMAL, NULL, 0);
-                    return -1;
-                }
-                /* no data available on both buffers, */
-                if (ap->allBuffersAreEmpty() && !ap->m_lastMsgSent)
-                {
-                    char *payload = generate_json_data_event(CLIENT_EVENT_STOP,
-                                                             ap->m_sequenceNumber,
-                                                             ap->m_uuid,
-                                                             ap->m_streamid,
-                                                             ap->m_track,
-                                                             NULL,
-                                                             ap->m_extra_headers,
-                                                             ap->m_codec,
-                                                             ap->m_sampling);
-                    int n = strlen(payload);
-                    uint8_t buf[n + LWS_PRE];
-                    memcpy(buf + LWS_PRE, payload, n);
-                    free(payload);
-                    ap->increaseSequenceNumber();
-                    int sent = lws_write(wsi, buf + LWS_PRE, n, LWS_WRITE_TEXT);
-                    if (sent < n)
-                    {
-                        lwsl_err("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_WRITEABLE %s attemped to send %lu "
-                                 "only sent %d wsi %p..\n",
-                                 ap->m_uuid.c_str(),
-                                 n,
-                                 sent,
-                                 wsi);
-                    }
-                    ap->m_lastMsgSent = true;
-                    ap->m_state = LWS_CLIENT_DISCONNECTING;
-                    lwsl_notice("mod_audio_stream(%s) stop message sent.\n", ap->m_streamid.c_str());
-                    lws_callback_on_writable(wsi);
-                    return 0;
-                }
-            }
-
-            {
-                if (!ap->m_firstMsgSent)
-                {
-                    char *payload = generate_json_data_event(CLIENT_EVENT_START,
-                                                             ap->m_sequenceNumber,
-                                                             ap->m_uuid,
-                                                             ap->m_streamid,
-                                                             ap->m_track,
-                                                             NULL,
-                                                             ap->m_extra_headers,
-                                                             ap->m_codec,
-                                                             ap->m_sampling);
-                    int n = strlen(payload);
-                    uint8_t buf[n + LWS_PRE];
-                    memcpy(buf + LWS_PRE, payload, n);
-                    free(payload);
-                    ap->increaseSequenceNumber();
-                    int sent = lws_write(wsi, buf + LWS_PRE, n, LWS_WRITE_TEXT);
-                    if (sent < n)
-                    {
-                        lwsl_err("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_WRITEABLE %s attemped to send %lu "
-                                 "only sent %d wsi %p..\n",
-                                 ap->m_uuid.c_str(),
-                                 n,
-                                 sent,
-                                 wsi);
-                    }
-                    ap->m_firstMsgSent = true;
-                    lwsl_notice("mod_audio_stream(%s) First message sent for strameid.\n", ap->m_streamid.c_str());
-                    lws_callback_on_writable(wsi);
-                    return 0;
-                }
-            }
-            // check for events to send
-            {
-                std::string data = ap->getEventData();
-                if (data != "")
-                {
-                    uint8_t buf[data.length() + LWS_PRE];
-                    memcpy(buf + LWS_PRE, data.c_str(), data.length());
-                    int n = data.length();
-                    int m = lws_write(wsi, buf + LWS_PRE, n, LWS_WRITE_TEXT);
-                    if (m < n)
-                    {
-                        return -1;
-                    }
-
-                    // there may be audio data, but only one write per writeable event
-                    // get it next time
-                    lws_callback_on_writable(wsi);
-
-                    return 0;
-                }
-            }
-
-            if (ap->m_state == LWS_CLIENT_DISCONNECTING)
-            {
-                lwsl_notice("%s: mod_audio_stream(%s): (%s) closing the websocket connection.",
-                            AUDIO_STREAM_LOGGING_PREFIX,
-                            ap->m_streamid.c_str(),
-                            ap->m_uuid.c_str());
-                lws_close_reason(wsi, LWS_CLOSE_STATUS_NORMAL, NULL, 0);
-                return -1;
-            }
-
-            {
-                std::string inbound_str = "inbound";
-                std::string outbound_str = "outbound";
-                Buffer *audioBuffer;
-                int type = 0;
-
-                if (ap->needsBothTracks())
-                {
-                    if (ap->m_switch)
-                    {
-                        type = 1;
-                        audioBuffer = ap->m_ob_audio_buffer;
-                    }
-                    else
-                    {
-                        type = 0;
-                        audioBuffer = ap->m_audio_buffer;
-                    }
-                }
-                else
-                {
-                    type = (ap->m_track == "inbound") ? 0 : 1;
-                    audioBuffer = ap->m_audio_buffer;
-                }
-
-                /* lwsl_err("lws_callback type(%d)", type); */
-                if (NULL == audioBuffer)
-                    return 0;
-
-                if (audioBuffer->try_lock())
-                {
-                    char *payload = generate_json_data_event(CLIENT_EVENT_MEDIA,
-                                                             ap->m_sequenceNumber,
-                                                             ap->m_uuid,
-                                                             ap->m_streamid,
-                                                             (type == 0) ? inbound_str : outbound_str,
-                                                             audioBuffer,
-                                                             ap->m_extra_headers,
-                                                             ap->m_codec,
-                                                             ap->m_sampling);
-
-                    if (!payload)
-                    {
-                        /* lwsl_err("mod_audio_stream:(%s) AudioPipe::lws_service_thread: no payload to send",
-                         * ap->m_streamid.c_str()); */
-
-                        if (ap->needsBothTracks())
-                            ap->m_switch = !ap->m_switch;
-                        if (ap->isGracefulShutdown())
-                            lws_callback_on_writable(wsi);
-
-                        audioBuffer->unlock();
-                        return 0;
-                    }
-
-                    int n = strlen(payload);
-                    uint8_t buf[n + LWS_PRE];
-                    memcpy(buf + LWS_PRE, payload, n);
-                    free(payload);
-                    ap->increaseSequenceNumber();
-                    int sent = lws_write(wsi, buf + LWS_PRE, n, LWS_WRITE_TEXT);
-                    if (sent < n)
-                    {
-                        lwsl_err("mod_audio_stream(%s) AudioPipe::lws_service_thread: attemped to send (%lu) only sent "
-                                 "(%d) wsi %p..\n",
-                                 ap->m_streamid.c_str(),
-                                 n,
-                                 sent,
-                                 wsi);
-                    }
-
-                    if (ap->needsBothTracks())
-                        ap->m_switch = !ap->m_switch;
-                    lws_callback_on_writable(wsi);
-
-                    audioBuffer->unlock();
-                }
-            }
-            return 0;
+            return ap->onWritable(wsi);
         }
         break;
 
@@ -517,241 +262,737 @@ int AudioPipe::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, v
 
 // static members
 
-struct lws_context *AudioPipe::contexts[] = {
-    nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+struct lws_context *AudioPipe::contexts[MAX_SERVICE_CONTEXTS] = {};
+ServiceQueue AudioPipe::serviceQueues[MAX_SERVICE_CONTEXTS];
+ContextLoad AudioPipe::contextLoads[MAX_SERVICE_CONTEXTS] = {};
+std::vector<int> AudioPipe::serviceThreadCpus;
+std::vector<WarmEndpoint> AudioPipe::warmEndpoints;
+unsigned int AudioPipe::warmIdleSecs = 60;
+unsigned int AudioPipe::tlsSessionCacheSize = 64;
+unsigned int AudioPipe::muxConnections = 0;
+unsigned int AudioPipe::muxCredit = MUX_DEFAULT_CREDIT;
 unsigned int AudioPipe::numContexts = 0;
 bool AudioPipe::lws_initialized = false;
 bool AudioPipe::lws_stopping = false;
-unsigned int AudioPipe::nchild = 0;
 std::string AudioPipe::protocolName;
-std::mutex AudioPipe::mutex_connects;
-std::mutex AudioPipe::mutex_reconnects;
-std::mutex AudioPipe::mutex_disconnects;
-std::mutex AudioPipe::mutex_writes;
-std::list<AudioPipe *> AudioPipe::pendingConnects;
-std::list<AudioPipe *> AudioPipe::pendingReconnects;
-std::list<AudioPipe *> AudioPipe::pendingDisconnects;
-std::list<AudioPipe *> AudioPipe::pendingWrites;
+// the fixed retries of earlier releases, now spread with exponential backoff and jitter
+reconnection_policy_t AudioPipe::reconnectionPolicy = {
+    true,                               // enable_reconnection
+    MAX_CONNECTION_ATTEMPTS,            // max_reconnect_attempts
+    RECONNECTION_DELAY_SECONDS * 1000,  // initial_delay_ms
+    RECONNECTION_DELAY_SECONDS * 8000,  // max_delay_ms
+    2.0,                                // backoff_multiplier
+    10000,                              // connection_timeout_ms, as lws' own timeout_secs
+    20000,                              // health_check_interval_ms
+    true,                               // enable_circuit_breaker
+    5,                                  // circuit_breaker_threshold
+    30000                               // circuit_breaker_timeout_ms
+};
+unsigned int AudioPipe::drainMaxChunks = 1;
+size_t AudioPipe::drainMaxBytes = 65536;
 AudioPipe::log_emit_function AudioPipe::logger;
 
-void AudioPipe::processPendingConnects(lws_per_vhost_data *vhd)
+void AudioPipe::processPendingConnects(ServiceQueue *queue, lws_per_vhost_data *vhd)
 {
-    std::list<AudioPipe *> connects;
+    AudioPipe *next;
+    for (AudioPipe *ap = queue->connects.take_all(); ap; ap = next)
     {
-        std::lock_guard<std::mutex> guard(mutex_connects);
-        for (auto it = pendingConnects.begin(); it != pendingConnects.end(); ++it)
+        next = ap->m_next_connect;
+        if (ap->m_state != LWS_CLIENT_IDLE && ap->m_state != LWS_CLIENT_RECONNECTING)
+            continue;
+
+        if (ap->m_state == LWS_CLIENT_IDLE && ap->canMultiplex())
         {
-            if ((*it)->m_state == LWS_CLIENT_IDLE || (*it)->m_state == LWS_CLIENT_RECONNECTING)
-            {
-                connects.push_back(*it);
-                (*it)->m_state = LWS_CLIENT_CONNECTING;
-            }
+            ap->m_state = LWS_CLIENT_CONNECTING;
+            ap->m_vhd = vhd;
+            if (!ap->joinMux(queue))
+                ap->retryOrFail("unable to connect to service url");
+            continue;
         }
+        if (ap->m_state == LWS_CLIENT_IDLE && claimWarmConnection(queue, ap, vhd))
+            continue;
+        if (false == ap->connect_client(vhd))
+            ap->retryOrFail("unable to connect to service url");
     }
-    for (auto it = connects.begin(); it != connects.end(); ++it)
+}
+
+uint64_t ServiceScheduler::now(void) const
+{
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+    return (ns - epoch_ns) / (SERVICE_TIMER_TICK_MS * 1000000ull);
+}
+
+uint32_t ServiceScheduler::next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)(rng >> 32);
+}
+
+// Sets the context's lws timer for the first tick its wheel has work at, unless it already fires earlier.
+void AudioPipe::armServiceTimer(ServiceQueue *queue)
+{
+    ServiceScheduler &scheduler = queue->scheduler;
+    contextLoads[scheduler.index].timers.store(scheduler.wheel.pending(), std::memory_order_relaxed);
+    if (0 == scheduler.wheel.pending())
+        return;
+    uint64_t due = scheduler.wheel.next_due();
+    if (scheduler.armed_tick <= due)
+        return;
+    uint64_t now = scheduler.now();
+    scheduler.armed_tick = due;
+    lws_sul_schedule(scheduler.context,
+                     0,
+                     &scheduler.sul.sul,
+                     AudioPipe::serviceTimerCallback,
+                     due > now ? (int64_t)(due - now) * SERVICE_TIMER_TICK_MS * 1000 : 1);
+}
+
+void AudioPipe::serviceTimerCallback(lws_sorted_usec_list_t *sul)
+{
+    struct service_sul *container = lws_container_of(sul, struct service_sul, sul);
+    ServiceQueue *queue = container->queue;
+    queue->scheduler.armed_tick = UINT64_MAX;
+    queue->scheduler.wheel.advance(queue->scheduler.now(), [queue](TimerWheelEntry *entry) {
+        if (entry == &queue->pool.refill)
+            refillWarmPool(queue);
+        else
+            static_cast<AudioPipe *>(entry->owner)->timerExpired();
+    });
+    // pipes rearming from their timers may have set it for a tick that has been processed since
+    queue->scheduler.armed_tick = UINT64_MAX;
+    armServiceTimer(queue);
+}
+
+// Callbacks of pool connections, which have no pipe yet; false when the wsi is not one of them.
+bool AudioPipe::warmCallback(struct lws *wsi, enum lws_callback_reasons reason, AudioPipe **user)
+{
+    ServiceQueue *queue = (ServiceQueue *)lws_context_user(lws_get_context(wsi));
+    if (!queue || !user)
+        return false;
+    WarmPool &pool = queue->pool;
+    size_t n = 0;
+    while (n < pool.connections.size() && &pool.connections[n]->ap != user)
+        n++;
+    if (n == pool.connections.size())
+        return false;
+
+    WarmConnection &conn = *pool.connections[n];
+    const WarmEndpoint &endpoint = warmEndpoints[conn.endpoint];
+    std::string key = endpoint.host + ":" + std::to_string(endpoint.port);
+    switch (reason)
     {
-        AudioPipe *ap = *it;
-        if (false == ap->connect_client(vhd))
-        {
-            struct sul_user_data *custom_sul;
-            if (ap->m_connection_attempts > MAX_CONNECTION_ATTEMPTS)
+        case LWS_CALLBACK_CLIENT_ESTABLISHED:
+            conn.state = WarmConnection::WARM_IDLE;
+            conn.ready_at = queue->scheduler.now();
+            circuitSuccess(queue, key);
+            countWarmConnections(queue);
+            return true;
+
+        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+            if (pool.connecting == &conn)
             {
-                lwsl_err("mod_audio_stream(%s): unable to connect to service url", ap->m_streamid.c_str());
-                ap->m_state = LWS_CLIENT_FAILED;
-                ap->m_callback(ap->m_uuid.c_str(),
-                               ap->m_streamid.c_str(),
-                               AudioPipe::CONNECT_FAIL,
-                               "unable to connect to service url");
-                return;
+                conn.state = WarmConnection::WARM_FAILED;
+                return true;
             }
-            lwsl_err("%s mod_audio_stream(%s): unable to connect to service url. retrying..(%d)",
-                     AUDIO_STREAM_LOGGING_PREFIX,
-                     ap->m_streamid,
-                     ap->m_connection_attempts);
-            custom_sul = (struct sul_user_data *)malloc(sizeof(struct sul_user_data));
-            memset(custom_sul, 0, sizeof(struct sul_user_data));
-            custom_sul->sul.list.owner = NULL;
-            custom_sul->sul.list.prev = NULL;
-            custom_sul->sul.list.next = NULL;
-            custom_sul->ap = ap;
-            ap->m_state = LWS_CLIENT_FAILED;
-            lws_sul_schedule(
-                ap->m_vhd->context, 0, &custom_sul->sul, ap->reconnect, RECONNECTION_DELAY_SECONDS * LWS_US_PER_SEC);
-        }
+            lwsl_notice("mod_audio_stream: warm connection to %s%s failed\n", key.c_str(), endpoint.path.c_str());
+            circuitFailure(queue, key);
+            break;
+
+        case LWS_CALLBACK_CLIENT_CLOSED:
+            break;
+
+        default:
+            // nothing is sent on an unclaimed connection and whatever the server sends is dropped
+            return true;
     }
+    pool.connections[n] = std::move(pool.connections.back());
+    pool.connections.pop_back();
+    countWarmConnections(queue);
+    return true;
 }
 
-void AudioPipe::processPendingDisconnects(lws_per_vhost_data *vhd)
+// Hands an idle pool connection to the pipe, which starts its stream on it as on a connection of its own.
+bool AudioPipe::claimWarmConnection(ServiceQueue *queue, AudioPipe *ap, lws_per_vhost_data *vhd)
 {
-    std::list<AudioPipe *> disconnects;
-    {
-        std::lock_guard<std::mutex> guard(mutex_disconnects);
-        for (auto it = pendingDisconnects.begin(); it != pendingDisconnects.end(); ++it)
-        {
-            if ((*it)->m_state == LWS_CLIENT_DISCONNECTING)
-                disconnects.push_back(*it);
-        }
-        pendingDisconnects.clear();
-    }
-    for (auto it = disconnects.begin(); it != disconnects.end(); ++it)
+    // pool connections are upgraded without credentials
+    if (ap->hasBasicAuth() || !ap->m_bearer_token.empty())
+        return false;
+    WarmPool &pool = queue->pool;
+    for (size_t n = 0; n < pool.connections.size(); n++)
     {
-        AudioPipe *ap = *it;
-        if (NULL != ap && ap->m_wsi != nullptr)
-        {
-            lws_callback_on_writable(ap->m_wsi);
-        }
-        else
-        {
-            lwsl_debug("mod_audio_stream: processPendingDisconnects: null wsi");
-        }
+        const WarmConnection &conn = *pool.connections[n];
+        const WarmEndpoint &endpoint = warmEndpoints[conn.endpoint];
+        if (conn.state != WarmConnection::WARM_IDLE || endpoint.port != ap->m_port ||
+            endpoint.ssl_flags != ap->m_sslFlags || endpoint.host != ap->m_host || endpoint.path != ap->m_path)
+            continue;
+
+        struct lws *wsi = conn.wsi;
+        pool.connections[n] = std::move(pool.connections.back());
+        pool.connections.pop_back();
+        countWarmConnections(queue);
+
+        lws_set_wsi_user(wsi, &ap->m_wsi_user);
+        ap->m_wsi_user = ap;
+        ap->m_wsi = wsi;
+        ap->m_state = LWS_CLIENT_CONNECTING;
+        lwsl_notice("mod_audio_stream(%s) %s claimed a warm connection, wsi is %p\n",
+                    ap->m_streamid.c_str(),
+                    ap->m_uuid.c_str(),
+                    wsi);
+        ap->connectionEstablished(vhd);
+
+        // replace it now rather than at the next refill
+        queue->scheduler.wheel.schedule(&pool.refill, queue->scheduler.now());
+        armServiceTimer(queue);
+        return true;
     }
+    return false;
+}
+
+bool AudioPipe::openWarmConnection(ServiceQueue *queue, unsigned int endpoint)
+{
+    const WarmEndpoint &warm = warmEndpoints[endpoint];
+    WarmPool &pool = queue->pool;
+    struct lws_client_connect_info i;
+
+    pool.connections.emplace_back(new WarmConnection());
+    WarmConnection *conn = pool.connections.back().get();
+    conn->endpoint = endpoint;
+
+    memset(&i, 0, sizeof(i));
+    i.context = queue->scheduler.context;
+    i.port = warm.port;
+    i.address = warm.host.c_str();
+    i.path = warm.path.c_str();
+    i.host = i.address;
+    i.origin = i.address;
+    i.ssl_connection = warm.ssl_flags;
+    i.protocol = protocolName.c_str();
+    i.userdata = &conn->ap;
+
+    pool.connecting = conn;
+    conn->wsi = lws_client_connect_via_info(&i);
+    pool.connecting = nullptr;
+    if (conn->wsi && conn->state != WarmConnection::WARM_FAILED)
+        return true;
+
+    circuitFailure(queue, warm.host + ":" + std::to_string(warm.port));
+    pool.connections.pop_back();
+    return false;
 }
 
-void AudioPipe::processPendingWrites()
+// Recycles connections idle for warmIdleSecs, before the server's own idle timeout drops them, and opens new ones
+// until every endpoint has its size again; an endpoint whose circuit is open is left alone.
+void AudioPipe::refillWarmPool(ServiceQueue *queue)
 {
-    std::list<AudioPipe *> writes;
+    WarmPool &pool = queue->pool;
+    uint64_t now = queue->scheduler.now();
+    uint64_t idle_ticks = (uint64_t)warmIdleSecs * 1000 / SERVICE_TIMER_TICK_MS;
+    for (auto &conn : pool.connections)
     {
-        std::lock_guard<std::mutex> guard(mutex_writes);
-        for (auto it = pendingWrites.begin(); it != pendingWrites.end(); ++it)
+        if (conn->state == WarmConnection::WARM_IDLE && now - conn->ready_at >= idle_ticks)
         {
-            if ((*it)->m_state == LWS_CLIENT_CONNECTED)
-                writes.push_back(*it);
+            conn->state = WarmConnection::WARM_CLOSING;
+            lws_set_timeout(conn->wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
         }
-        pendingWrites.clear();
     }
-    for (auto it = writes.begin(); it != writes.end(); ++it)
+
+    for (unsigned int endpoint = 0; endpoint < warmEndpoints.size(); endpoint++)
     {
-        AudioPipe *ap = *it;
-        if (NULL != ap && ap->m_wsi != nullptr)
-        {
-            lws_callback_on_writable(ap->m_wsi);
-        }
-        else
-        {
-            lwsl_debug("mod_audio_stream: processPendingWrites: null wsi");
-        }
+        unsigned int count = 0;
+        for (auto &conn : pool.connections)
+            if (conn->endpoint == endpoint && conn->state != WarmConnection::WARM_CLOSING)
+                count++;
+        std::string key = warmEndpoints[endpoint].host + ":" + std::to_string(warmEndpoints[endpoint].port);
+        while (count < warmEndpoints[endpoint].size && circuitAllows(queue, key) &&
+               openWarmConnection(queue, endpoint))
+            count++;
     }
+
+    countWarmConnections(queue);
+    queue->scheduler.wheel.schedule(&pool.refill, now + WARM_POOL_REFILL_MS / SERVICE_TIMER_TICK_MS);
+    armServiceTimer(queue);
 }
 
-AudioPipe *AudioPipe::findAndRemovePendingReconnect(struct lws *wsi)
+void AudioPipe::countWarmConnections(ServiceQueue *queue)
 {
-    AudioPipe *ap = NULL;
-    std::list<AudioPipe *> toRemove;
-    std::lock_guard<std::mutex> guard(mutex_reconnects);
-
-    for (auto it = pendingReconnects.begin(); it != pendingReconnects.end() && !ap; ++it)
-    {
-        int state = (*it)->m_state;
+    unsigned int idle = 0;
+    for (auto &conn : queue->pool.connections)
+        if (conn->state == WarmConnection::WARM_IDLE)
+            idle++;
+    contextLoads[queue->scheduler.index].warm_connections.store(idle, std::memory_order_relaxed);
+}
 
-        lwsl_debug("checking for pending reconnects (%p)", (*it));
-        if ((*it)->m_wsi == nullptr)
-            toRemove.push_back(*it);
+// Adds basic auth credentials to a client handshake; -1 if the header does not fit.
+int AudioPipe::appendBasicAuth(struct lws *wsi, void *in, size_t len, const std::string &user, const std::string &pass)
+{
+    unsigned char **p = (unsigned char **)in, *end = (*p) + len;
+    char b[128];
 
-        if ((state == LWS_CLIENT_RECONNECTING) && (*it)->m_wsi == wsi)
-            ap = *it;
-    }
+    if (dch_lws_http_basic_auth_gen(user.c_str(), pass.c_str(), b, sizeof(b)))
+        return 0;
+    if (lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_AUTHORIZATION, (unsigned char *)b, strlen(b), p, end))
+        return -1;
+    return 0;
+}
 
-    for (auto it = toRemove.begin(); it != toRemove.end(); ++it)
-        pendingReconnects.remove(*it);
+// Adds the bearer token, and on realtime framing the beta opt-in the API asks for; -1 if the headers do not fit.
+int AudioPipe::appendBearerAuth(struct lws *wsi, void *in, size_t len)
+{
+    unsigned char **p = (unsigned char **)in, *end = (*p) + len;
 
-    if (ap)
+    if (!m_bearer_token.empty())
     {
-        pendingReconnects.remove(ap);
+        std::string value = "Bearer " + m_bearer_token;
+        if (lws_add_http_header_by_token(
+                wsi, WSI_TOKEN_HTTP_AUTHORIZATION, (const unsigned char *)value.data(), (int)value.size(), p, end))
+            return -1;
     }
-
-    return ap;
+    if (isRealtimeFraming() &&
+        lws_add_http_header_by_name(wsi, (const unsigned char *)"OpenAI-Beta:", (const unsigned char *)"realtime=v1",
+                                    11, p, end))
+        return -1;
+    return 0;
 }
 
-AudioPipe *AudioPipe::findAndRemovePendingConnect(struct lws *wsi)
+// Callbacks of shared connections; false when the wsi is not one of them. result is what lws gets back.
+bool AudioPipe::muxCallback(
+    struct lws *wsi, enum lws_callback_reasons reason, AudioPipe **user, void *in, size_t len, int &result)
 {
-    AudioPipe *ap = NULL;
-    std::lock_guard<std::mutex> guard(mutex_connects);
-    std::list<AudioPipe *> toRemove;
+    ServiceQueue *queue = (ServiceQueue *)lws_context_user(lws_get_context(wsi));
+    if (!queue)
+        return false;
+    MuxPool &pool = queue->mux;
+    size_t n = 0;
+    while (n < pool.connections.size() && &pool.connections[n]->ap != user)
+        n++;
+    if (n == pool.connections.size())
+        return false;
 
-    for (auto it = pendingConnects.begin(); it != pendingConnects.end() && !ap; ++it)
+    MuxConnection &conn = *pool.connections[n];
+    result = 0;
+    switch (reason)
     {
-        int state = (*it)->m_state;
+        case LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER:
+            if (!conn.username.empty() && !conn.password.empty())
+                result = appendBasicAuth(wsi, in, len, conn.username, conn.password);
+            return true;
+
+        case LWS_CALLBACK_CLIENT_ESTABLISHED:
+        {
+            struct lws_per_vhost_data *vhd = (struct lws_per_vhost_data *)lws_protocol_vh_priv_get(
+                lws_get_vhost(wsi), lws_get_protocol(wsi));
+            conn.state = MuxConnection::MUX_OPEN;
+            circuitSuccess(queue, conn.host + ":" + std::to_string(conn.port));
+            lwsl_notice("mod_audio_stream: shared connection %p to %s:%u%s is up, starting %u streams\n",
+                        wsi,
+                        conn.host.c_str(),
+                        conn.port,
+                        conn.path.c_str(),
+                        (unsigned int)conn.members.size());
+            // CONNECT_SUCCESS handlers cannot take a pipe off the connection, still walk a copy
+            std::vector<AudioPipe *> members = conn.members;
+            for (AudioPipe *ap : members)
+            {
+                if (ap->m_state == LWS_CLIENT_CONNECTING || ap->m_state == LWS_CLIENT_RECONNECTING)
+                    ap->connectionEstablished(vhd);
+            }
+            lws_callback_on_writable(wsi);
+            return true;
+        }
 
-        if ((*it)->m_wsi == nullptr)
-            toRemove.push_back(*it);
+        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+            if (pool.connecting == &conn)
+            {
+                conn.state = MuxConnection::MUX_FAILED;
+                return true;
+            }
+            lwsl_notice("mod_audio_stream: shared connection to %s:%u%s failed (%s)\n",
+                        conn.host.c_str(),
+                        conn.port,
+                        conn.path.c_str(),
+                        in ? (const char *)in : "");
+            circuitFailure(queue, conn.host + ":" + std::to_string(conn.port));
+            muxConnectionLost(queue, n, in ? (const char *)in : "");
+            return true;
 
-        if ((state == LWS_CLIENT_CONNECTING) && (*it)->m_wsi == wsi)
-            ap = *it;
-    }
+        case LWS_CALLBACK_CLIENT_CLOSED:
+            muxConnectionLost(queue, n, nullptr);
+            return true;
+
+        case LWS_CALLBACK_CLIENT_RECEIVE:
+            if (lws_is_first_fragment(wsi))
+            {
+                conn.recv.clear();
+                conn.recv_started_ns = latency_now_ns();
+                // binary frames carry no stream id, binary framed streams do not share connections
+                conn.recv_discard = lws_frame_is_binary(wsi);
+                if (conn.recv_discard)
+                    lwsl_err("mod_audio_stream: binary frame on shared connection %p, discarding.\n", wsi);
+            }
+            if (!conn.recv_discard && conn.recv.size() + len + 1 > MAX_RECV_BUF_SIZE)
+            {
+                conn.recv_discard = true;
+                lwsl_notice("mod_audio_stream: max buffer exceeded on shared connection %p, dropping message.\n",
+                            wsi);
+            }
+            if (!conn.recv_discard && len > 0)
+                conn.recv.insert(conn.recv.end(), (const uint8_t *)in, (const uint8_t *)in + len);
+            if (lws_is_final_fragment(wsi))
+            {
+                if (!conn.recv_discard)
+                    muxDeliver(conn);
+                conn.recv.clear();
+                if (conn.recv.capacity() > RECV_BUF_RETAIN_SIZE)
+                    conn.recv.shrink_to_fit();
+            }
+            return true;
 
-    for (auto it = toRemove.begin(); it != toRemove.end(); ++it)
-        pendingConnects.remove(*it);
+        case LWS_CALLBACK_CLIENT_WRITEABLE:
+            result = muxWritable(conn, wsi);
+            return true;
 
-    if (ap)
-    {
-        pendingConnects.remove(ap);
+        default:
+            return false;
     }
-
-    return ap;
 }
 
-AudioPipe *AudioPipe::findPendingConnect(struct lws *wsi)
+// A shared connection failed or closed: it is forgotten and each of its pipes goes on as if its own connection had,
+// retrying, reconnecting or ending its stream.
+void AudioPipe::muxConnectionLost(ServiceQueue *queue, size_t index, const char *reason)
 {
-    AudioPipe *ap = NULL;
-    std::lock_guard<std::mutex> guard(mutex_connects);
-
-    for (auto it = pendingConnects.begin(); it != pendingConnects.end() && !ap; ++it)
+    MuxPool &pool = queue->mux;
+    std::unique_ptr<MuxConnection> conn = std::move(pool.connections[index]);
+    pool.connections[index] = std::move(pool.connections.back());
+    pool.connections.pop_back();
+
+    // detached first, a pipe deleted by its handler must not find its way back to the connection
+    std::vector<AudioPipe *> members;
+    members.swap(conn->members);
+    for (AudioPipe *ap : members)
+        ap->m_mux = nullptr;
+    countMuxConnections(queue);
+
+    for (AudioPipe *ap : members)
     {
-        int state = (*it)->m_state;
-        if ((state == LWS_CLIENT_CONNECTING) && (*it)->m_wsi == wsi)
-            ap = *it;
+        if (ap->m_state == LWS_CLIENT_CONNECTING || ap->m_state == LWS_CLIENT_RECONNECTING)
+        {
+            ap->cancelTimer();
+            ap->retryOrFail(reason ? reason : "shared connection closed");
+        }
+        else
+        {
+            ap->connectionClosed();
+        }
     }
-    return ap;
 }
 
-void AudioPipe::addPendingConnect(AudioPipe *ap)
+// Hands a complete message received on a shared connection to the stream named in it.
+void AudioPipe::muxDeliver(MuxConnection &conn)
 {
+    size_t len = conn.recv.size();
+    conn.recv.push_back('\0');
+    const char *message = (const char *)conn.recv.data();
+
+    json_string_view_t stream_id;
+    if (!scan_stream_id(message, len, stream_id))
+    {
+        lwsl_err("mod_audio_stream: message without streamId on shared connection %p, discarding.\n", conn.wsi);
+        return;
+    }
+    for (AudioPipe *ap : conn.members)
     {
-        std::lock_guard<std::mutex> guard(mutex_connects);
-        pendingConnects.push_back(ap);
-        if (pendingConnects.size() > 100)
+        if (!stream_id.equals(ap->m_streamid.c_str()))
+            continue;
+        if (!ap->m_is_bidirectional)
         {
-            lwsl_err("mod_audio_stream(%s) : (%s) pending connects count high. (%d)\n",
-                     ap->m_streamid.c_str(),
-                     ap->m_uuid.c_str(),
-                     pendingConnects.size());
+            lwsl_notice("mod_audio_stream(%s) is not of type bidirectonal.\n", ap->m_streamid.c_str());
+            return;
         }
-        lwsl_notice("mod_audio_stream(%s): %s after adding connect there are %lu pending connects\n",
-                    ap->m_streamid.c_str(),
-                    ap->m_uuid.c_str(),
-                    pendingConnects.size());
+        ap->m_recv_started_ns = conn.recv_started_ns;
+        stream_registry_count(ap->m_registry, STREAM_COUNTER_MESSAGES_RECEIVED, 1);
+        stream_registry_count(ap->m_registry, STREAM_COUNTER_BYTES_RECEIVED, len);
+        ap->m_callback(ap->m_uuid.c_str(), ap->m_streamid.c_str(), AudioPipe::MESSAGE, message);
+        return;
     }
-    lws_cancel_service(contexts[nchild++ % numContexts]);
+    lwsl_notice("mod_audio_stream: no stream %.*s on shared connection %p, discarding message.\n",
+                (int)stream_id.len,
+                stream_id.data,
+                conn.wsi);
 }
 
-void AudioPipe::addPendingDisconnect(AudioPipe *ap)
+// Gives each pipe on the connection a turn of at most muxCredit messages, starting with the one whose turn was cut
+// short last time, until every pipe had one or the socket is choked.
+int AudioPipe::muxWritable(MuxConnection &conn, struct lws *wsi)
 {
-    ap->m_state = LWS_CLIENT_DISCONNECTING;
+    size_t turns = conn.members.size();
+    while (turns-- > 0 && !conn.members.empty())
     {
-        std::lock_guard<std::mutex> guard(mutex_disconnects);
-        pendingDisconnects.push_back(ap);
-        lwsl_notice("mod_audio_stream(%s) :%s after adding disconnect there are %lu pending disconnects\n",
-                    ap->m_streamid.c_str(),
-                    ap->m_uuid.c_str(),
-                    pendingDisconnects.size());
+        if (conn.cursor >= conn.members.size())
+            conn.cursor = 0;
+        AudioPipe *ap = conn.members[conn.cursor];
+        size_t members = conn.members.size();
+        if ((ap->m_state == LWS_CLIENT_CONNECTED || ap->m_state == LWS_CLIENT_DISCONNECTING) &&
+            ap->onWritable(wsi) < 0)
+            return -1;
+        // a pipe that left moved the next one into its place
+        if (conn.members.size() == members)
+            conn.cursor++;
+        if (lws_send_pipe_choked(wsi))
+        {
+            lws_callback_on_writable(wsi);
+            break;
+        }
     }
-    lws_cancel_service(ap->m_vhd->context);
+    return 0;
 }
 
-void AudioPipe::addPendingWrite(AudioPipe *ap)
+// Puts the pipe on the least loaded shared connection to its endpoint, opening a new one while there are fewer than
+// muxConnections of them. false if a new connection was needed and could not be started.
+bool AudioPipe::joinMux(ServiceQueue *queue)
 {
+    std::string key = m_host + ":" + std::to_string(m_port) + m_path + "|" + std::to_string(m_sslFlags) + "|" +
+                      m_username + ":" + m_password;
+    MuxPool &pool = queue->mux;
+    MuxConnection *best = nullptr;
+    unsigned int count = 0;
+
+    m_connection_attempts++;
+    m_wsi = nullptr;
+    for (auto &conn : pool.connections)
+    {
+        if (conn->key != key || conn->state == MuxConnection::MUX_CLOSING)
+            continue;
+        count++;
+        // incoming messages are routed by stream id, which therefore has to be unique on a connection
+        bool taken = std::any_of(conn->members.begin(), conn->members.end(), [this](AudioPipe *ap) {
+            return ap->m_streamid == m_streamid;
+        });
+        if (!taken && (!best || conn->members.size() < best->members.size()))
+            best = conn.get();
+    }
+
+    if (!best || (count < muxConnections && !best->members.empty()))
+    {
+        if (!circuitAllows(queue, m_endpoint))
+        {
+            lwsl_notice("mod_audio_stream(%s) %s circuit open for %s, not connecting\n",
+                        m_streamid.c_str(),
+                        m_uuid.c_str(),
+                        m_endpoint.c_str());
+            return false;
+        }
+        pool.connections.emplace_back(new MuxConnection());
+        best = pool.connections.back().get();
+        best->key = key;
+        best->host = m_host;
+        best->port = m_port;
+        best->path = m_path;
+        best->ssl_flags = m_sslFlags;
+        best->username = m_username;
+        best->password = m_password;
+        if (!openMuxConnection(queue, best))
+        {
+            circuitFailure(queue, m_endpoint);
+            pool.connections.pop_back();
+            return false;
+        }
+    }
+
+    m_mux = best;
+    m_wsi = best->wsi;
+    best->members.push_back(this);
+    countMuxConnections(queue);
+    lwsl_notice("mod_audio_stream(%s) %s streaming over shared connection %p, %u streams on it\n",
+                m_streamid.c_str(),
+                m_uuid.c_str(),
+                m_wsi,
+                (unsigned int)best->members.size());
+    if (best->state == MuxConnection::MUX_OPEN)
     {
-        std::lock_guard<std::mutex> guard(mutex_writes);
-        pendingWrites.push_back(ap);
+        connectionEstablished(m_vhd);
+        lws_callback_on_writable(m_wsi);
     }
-    lws_cancel_service(ap->m_vhd->context);
+    else
+    {
+        armTimer(TIMER_CONNECT_TIMEOUT, reconnectionPolicy.connection_timeout_ms);
+    }
+    return true;
 }
 
-bool AudioPipe::lws_service_thread(unsigned int nServiceThread)
+bool AudioPipe::openMuxConnection(ServiceQueue *queue, MuxConnection *conn)
 {
-    struct lws_context_creation_info info;
+    MuxPool &pool = queue->mux;
+    struct lws_client_connect_info i;
 
-    const struct lws_protocols protocols[] = {{
+    memset(&i, 0, sizeof(i));
+    i.context = queue->scheduler.context;
+    i.port = conn->port;
+    i.address = conn->host.c_str();
+    i.path = conn->path.c_str();
+    i.host = i.address;
+    i.origin = i.address;
+    i.ssl_connection = conn->ssl_flags;
+    i.protocol = protocolName.c_str();
+    i.userdata = &conn->ap;
+
+    pool.connecting = conn;
+    conn->wsi = lws_client_connect_via_info(&i);
+    pool.connecting = nullptr;
+    lwsl_notice("mod_audio_stream: opening shared connection to %s:%u%s, wsi is %p\n",
+                conn->host.c_str(),
+                conn->port,
+                conn->path.c_str(),
+                conn->wsi);
+    return conn->wsi && conn->state != MuxConnection::MUX_FAILED;
+}
+
+// Takes the pipe off its shared connection, which is closed once no stream is left on it.
+void AudioPipe::leaveMux(void)
+{
+    MuxConnection *conn = m_mux;
+    auto it = std::find(conn->members.begin(), conn->members.end(), this);
+    if (it != conn->members.end())
+    {
+        if ((size_t)(it - conn->members.begin()) < conn->cursor)
+            conn->cursor--;
+        conn->members.erase(it);
+    }
+    m_mux = nullptr;
+    m_wsi = nullptr;
+    if (conn->members.empty() && conn->state != MuxConnection::MUX_CLOSING)
+    {
+        lwsl_notice("mod_audio_stream: last stream left shared connection %p, closing it\n", conn->wsi);
+        conn->state = MuxConnection::MUX_CLOSING;
+        lws_set_timeout(conn->wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+    }
+    countMuxConnections(&serviceQueues[m_context_index]);
+}
+
+void AudioPipe::countMuxConnections(ServiceQueue *queue)
+{
+    unsigned int connections = 0, streams = 0;
+    for (auto &conn : queue->mux.connections)
+    {
+        if (conn->state == MuxConnection::MUX_CLOSING)
+            continue;
+        connections++;
+        streams += conn->members.size();
+    }
+    contextLoads[queue->scheduler.index].mux_connections.store(connections, std::memory_order_relaxed);
+    contextLoads[queue->scheduler.index].mux_streams.store(streams, std::memory_order_relaxed);
+}
+
+void AudioPipe::processPendingDisconnects(ServiceQueue *queue)
+{
+    AudioPipe *next;
+    for (AudioPipe *ap = queue->disconnects.take_all(); ap; ap = next)
+    {
+        next = ap->m_next_disconnect;
+        if (ap->m_state != LWS_CLIENT_DISCONNECTING)
+            continue;
+        if (ap->m_wsi != nullptr)
+        {
+            lws_callback_on_writable(ap->m_wsi);
+        }
+        else
+        {
+            lwsl_debug("mod_audio_stream: processPendingDisconnects: null wsi");
+        }
+    }
+}
+
+void AudioPipe::processPendingWrites(ServiceQueue *queue)
+{
+    AudioPipe *next;
+    for (AudioPipe *ap = queue->writes.take_all(); ap; ap = next)
+    {
+        next = ap->m_next_write;
+        // from here on producers may queue the pipe again
+        ap->m_write_scheduled.store(false, std::memory_order_release);
+        if (ap->m_state != LWS_CLIENT_CONNECTED)
+            continue;
+        if (ap->m_wsi != nullptr)
+        {
+            lws_callback_on_writable(ap->m_wsi);
+        }
+        else
+        {
+            lwsl_debug("mod_audio_stream: processPendingWrites: null wsi");
+        }
+    }
+}
+
+bool AudioPipe::canMultiplex(void)
+{
+    // binary frames do not say which stream they belong to, and a realtime session is the whole connection
+    return muxConnections > 0 && m_framing == FRAMING_JSON;
+}
+
+// Picks the context with the lowest active stream count weighted by what it is actually sending.
+unsigned int AudioPipe::selectLeastLoadedContext(void)
+{
+    unsigned int best = 0;
+    uint64_t best_score = UINT64_MAX;
+    for (unsigned int i = 0; i < numContexts; i++)
+    {
+        if (nullptr == contexts[i])
+            continue;
+        uint64_t score =
+            contextLoads[i].bytes_per_sec.load(std::memory_order_relaxed) +
+            (uint64_t)contextLoads[i].active_streams.load(std::memory_order_relaxed) * NOMINAL_STREAM_BYTES_PER_SEC;
+        if (score < best_score)
+        {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+void AudioPipe::addPendingConnect(AudioPipe *ap)
+{
+    ap->m_context_index = selectLeastLoadedContext();
+    contextLoads[ap->m_context_index].active_streams.fetch_add(1, std::memory_order_relaxed);
+    lwsl_notice("mod_audio_stream(%s): %s queueing connect on service context %d\n",
+                ap->m_streamid.c_str(),
+                ap->m_uuid.c_str(),
+                ap->m_context_index);
+    if (serviceQueues[ap->m_context_index].connects.push(ap))
+        lws_cancel_service(contexts[ap->m_context_index]);
+}
+
+void AudioPipe::addPendingDisconnect(AudioPipe *ap)
+{
+    ap->m_state = LWS_CLIENT_DISCONNECTING;
+    lwsl_notice("mod_audio_stream(%s) :%s queueing disconnect on service context %d\n",
+                ap->m_streamid.c_str(),
+                ap->m_uuid.c_str(),
+                ap->m_context_index);
+    if (serviceQueues[ap->m_context_index].disconnects.push(ap))
+        lws_cancel_service(contexts[ap->m_context_index]);
+}
+
+void AudioPipe::addPendingWrite(AudioPipe *ap)
+{
+    if (ap->m_context_index < 0)
+        return;
+    // already queued for the next wakeup of the owning service thread
+    if (ap->m_write_scheduled.exchange(true, std::memory_order_acq_rel))
+        return;
+    if (serviceQueues[ap->m_context_index].writes.push(ap))
+        lws_cancel_service(contexts[ap->m_context_index]);
+}
+
+bool AudioPipe::lws_service_thread(unsigned int nServiceThread)
+{
+    struct lws_context_creation_info info;
+
+    const struct lws_protocols protocols[] = {{
                                                   protocolName.c_str(),
                                                   AudioPipe::lws_callback,
                                                   sizeof(void *),
@@ -763,6 +1004,7 @@ bool AudioPipe::lws_service_thread(unsigned int nServiceThread)
     info.port = CONTEXT_PORT_NO_LISTEN;
     info.protocols = protocols;
     info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+    info.user = &serviceQueues[nServiceThread];
 
     info.ka_time = 60;               // tcp keep-alive timer
     info.ka_probes = 4;              // number of times to try ka before closing connection
@@ -771,6 +1013,36 @@ bool AudioPipe::lws_service_thread(unsigned int nServiceThread)
     info.keepalive_timeout = 5;      // seconds to allow remote client to hold on to an idle HTTP/1.1 connection
     info.ws_ping_pong_interval = 20; // interval in seconds between sending PINGs on idle websocket connections
     info.timeout_secs_ah_idle = 10;  // secs to allow a client to hold an ah without using it
+#if defined(LWS_WITH_TLS_SESSIONS)
+    // reconnects and new streams to a server seen before resume its TLS session instead of a full handshake
+    if (tlsSessionCacheSize > 0)
+        info.tls_session_cache_max = tlsSessionCacheSize;
+    else
+        info.options |= LWS_SERVER_OPTION_DISABLE_TLS_SESSION_CACHE;
+#endif
+
+    contextLoads[nServiceThread].cpu.store(-1);
+    if (!serviceThreadCpus.empty())
+    {
+        int cpu = serviceThreadCpus[nServiceThread % serviceThreadCpus.size()];
+#ifdef __linux__
+        cpu_set_t cpuset;
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            cpu = 0;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+        if (rc == 0)
+            contextLoads[nServiceThread].cpu.store(cpu);
+        else
+            lwsl_err("AudioPipe::lws_service_thread unable to pin service thread %d to cpu %d (%d)\n",
+                     nServiceThread,
+                     cpu,
+                     rc);
+#else
+        lwsl_err("AudioPipe::lws_service_thread cpu pinning is not supported on this platform\n");
+#endif
+    }
 
     lwsl_notice("AudioPipe::lws_service_thread creating context in service thread %d..\n", nServiceThread);
 
@@ -781,10 +1053,39 @@ bool AudioPipe::lws_service_thread(unsigned int nServiceThread)
         return false;
     }
 
+    ServiceScheduler &scheduler = serviceQueues[nServiceThread].scheduler;
+    scheduler.context = contexts[nServiceThread];
+    scheduler.index = nServiceThread;
+    scheduler.sul.queue = &serviceQueues[nServiceThread];
+    scheduler.epoch_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now().time_since_epoch())
+                             .count();
+    // distinct per context, so pipes of different contexts that failed together do not retry together either
+    scheduler.rng = (scheduler.epoch_ns | 1) * 0x9e3779b97f4a7c15ull + nServiceThread;
+    if (!warmEndpoints.empty())
+    {
+        scheduler.wheel.schedule(&serviceQueues[nServiceThread].pool.refill, 0);
+        armServiceTimer(&serviceQueues[nServiceThread]);
+    }
+
+    ContextLoad &load = contextLoads[nServiceThread];
+    switch_time_t window_start = switch_micro_time_now();
+    uint64_t window_bytes = load.bytes_sent.load(std::memory_order_relaxed);
     int n;
     do
     {
         n = lws_service(contexts[nServiceThread], 50);
+
+        // refresh the send rate used for placing new streams about once a second
+        switch_time_t now = switch_micro_time_now();
+        if (now - window_start >= 1000000)
+        {
+            uint64_t bytes = load.bytes_sent.load(std::memory_order_relaxed);
+            load.bytes_per_sec.store((bytes - window_bytes) * 1000000 / (now - window_start),
+                                     std::memory_order_relaxed);
+            window_bytes = bytes;
+            window_start = now;
+        }
     } while (n >= 0 && !lws_stopping);
 
     lwsl_notice("AudioPipe::lws_service_thread ending in service thread %d\n", nServiceThread);
@@ -792,10 +1093,52 @@ bool AudioPipe::lws_service_thread(unsigned int nServiceThread)
     return true;
 }
 
+void AudioPipe::setDrainLimits(unsigned int maxChunks, size_t maxBytes)
+{
+    drainMaxChunks = maxChunks > 0 ? maxChunks : 1;
+    drainMaxBytes = maxBytes > 0 ? maxBytes : 1;
+}
+
+void AudioPipe::setServiceThreadCpus(const std::vector<int> &cpus)
+{
+    assert(!lws_initialized);
+    serviceThreadCpus = cpus;
+}
+
+void AudioPipe::setWarmPool(const std::vector<WarmEndpoint> &endpoints, unsigned int idleSecs)
+{
+    assert(!lws_initialized);
+    warmEndpoints = endpoints;
+    warmIdleSecs = std::max(idleSecs, 1u);
+}
+
+void AudioPipe::setTlsSessionCache(unsigned int sessions)
+{
+    assert(!lws_initialized);
+    tlsSessionCacheSize = sessions;
+}
+
+void AudioPipe::setMultiplexing(unsigned int connections, unsigned int credit)
+{
+    assert(!lws_initialized);
+    muxConnections = connections;
+    muxCredit = std::max(credit, 1u);
+}
+
+void AudioPipe::setReconnectionPolicy(const reconnection_policy_t &policy)
+{
+    assert(!lws_initialized);
+    reconnectionPolicy = policy;
+    // the delays are split in half for jitter and counted in timer ticks
+    reconnectionPolicy.initial_delay_ms = std::max(reconnectionPolicy.initial_delay_ms, 2u * SERVICE_TIMER_TICK_MS);
+    reconnectionPolicy.max_delay_ms = std::max(reconnectionPolicy.max_delay_ms, reconnectionPolicy.initial_delay_ms);
+    reconnectionPolicy.backoff_multiplier = std::max(reconnectionPolicy.backoff_multiplier, 1.0);
+}
+
 void AudioPipe::initialize(const char *protocol, unsigned int nThreads, int loglevel, log_emit_function logger)
 {
     assert(!lws_initialized);
-    assert(nThreads > 0 && nThreads <= 10);
+    assert(nThreads > 0 && nThreads <= MAX_SERVICE_CONTEXTS);
 
     numContexts = nThreads;
     protocolName = protocol;
@@ -833,14 +1176,28 @@ AudioPipe::AudioPipe(const char *uuid,
                      const char *extraHeaders,
                      streaming_codec_t codec,
                      int sampling,
-                     int is_bidirectional)
-    : m_uuid(uuid), m_streamid(stream_id), m_host(host), m_port(port), m_path(path), m_sslFlags(sslFlags),
-      m_audio_buffer_max_len(bufLen), m_callback(callback), m_track(track), m_extra_headers(extraHeaders), m_codec(L16),
-      m_sampling(8000), m_gracefulShutdown(false), m_audio_buffer(NULL), m_ob_audio_buffer(NULL), m_recv_buf(nullptr),
-      m_recv_buf_ptr(nullptr), m_state(LWS_CLIENT_IDLE), m_wsi(nullptr), m_vhd(nullptr), m_firstMsgSent(false),
-      m_lastMsgSent(false), m_bothTracks(false), m_is_bidirectional(0), m_connection_attempts(0),
-      m_stream_started(false)
+                     int is_bidirectional,
+                     streaming_framing_t framing,
+                     binaryHandler_t binaryCallback,
+                     unsigned int chunksPerMessage,
+                     int codecBitrate)
+    : m_audio_buffer(NULL), m_ob_audio_buffer(NULL), m_is_bidirectional(0), m_uuid(uuid), m_streamid(stream_id),
+      m_codec(L16), m_connection_attempts(0), m_events(MAX_PENDING_EVENTS), m_callback(callback),
+      m_binary_callback(binaryCallback), m_state(LWS_CLIENT_IDLE), m_sampling(8000), m_host(host), m_port(port),
+      m_path(path), m_track(track), m_extra_headers(extraHeaders), m_sslFlags(sslFlags), m_wsi(nullptr),
+      m_audio_buffer_max_len(bufLen), m_recv_buf(nullptr), m_recv_buf_len(0), m_recv_buf_ptr(nullptr),
+      m_recv_binary(false), m_recv_started_ns(0), m_framing(framing),
+      m_chunks_per_message(std::max(1u, std::min(chunksPerMessage, (unsigned int)MAX_CHUNKS_PER_MESSAGE))),
+      m_event_scratch(MAX_COALESCED_EVENTS), m_event_coalesce_ns(0), m_timer_kind(TIMER_CONNECT_TIMEOUT),
+      m_reconnect_disabled(false), m_connect_in_progress(false), m_bytes_sent(0), m_health_bytes_sent(0),
+      m_health_stalls(0), m_latency(nullptr), m_registry(nullptr), m_trace_every(0), m_preroll_chunks(0),
+      m_trace_counter(0), m_degradation(0), m_backlog_cap(0), m_backlog_dropped(0), m_vhd(nullptr),
+      m_gracefulShutdown(false), m_firstMsgSent(false), m_lastMsgSent(false), m_bothTracks(false),
+      m_stream_started(false), m_context_index(-1), m_wsi_user(this), m_next_connect(nullptr),
+      m_next_disconnect(nullptr), m_next_write(nullptr), m_write_scheduled(false), m_mux(nullptr)
 {
+    m_timer.owner = this;
+    m_endpoint = m_host + ":" + std::to_string(m_port);
     int step_frame_size;
     int ptime = 20;
 
@@ -853,12 +1210,7 @@ AudioPipe::AudioPipe(const char *uuid,
     m_switch = true;
     m_sequenceNumber = 0;
 
-    step_frame_size = L16_FRAME_SIZE_8KHZ_20MS * (sampling / 8000);
-
-    if (codec == ULAW)
-    {
-        step_frame_size = ULAW_FRAME_SIZE_8KHZ_20MS * (sampling / 8000);
-    }
+    step_frame_size = (int)stream_codec_chunk_bytes(codec, sampling, codecBitrate);
 
     if (m_track == "both")
     {
@@ -874,17 +1226,36 @@ AudioPipe::AudioPipe(const char *uuid,
     m_sampling = sampling;
     m_is_bidirectional = is_bidirectional;
     m_codec = codec;
+
+    // size the send buffer for the largest steady state message up front
+    size_t message_audio_len = step_frame_size * m_chunks_per_message;
+    m_chunk_scratch.resize(message_audio_len);
+    m_send_buffer.reserve(BINARY_MEDIA_HEADER_SIZE + (message_audio_len + 2) / 3 * 4 + m_streamid.size() +
+                          m_uuid.size() + m_extra_headers.size() * 6 + 256);
 }
 
 AudioPipe::~AudioPipe()
 {
     lwsl_notice("mod_audio_stream:(%s) callid(%s) deleting audiopipe.", m_streamid.c_str(), m_uuid.c_str());
+    // pipes are deleted on their owning service thread; flush its queues so no link to us survives
+    if (m_context_index >= 0)
+    {
+        if (m_mux)
+            leaveMux();
+        m_state = LWS_CLIENT_DISCONNECTED;
+        cancelTimer();
+        processPendingDisconnects(&serviceQueues[m_context_index]);
+        processPendingWrites(&serviceQueues[m_context_index]);
+        contextLoads[m_context_index].active_streams.fetch_sub(1, std::memory_order_relaxed);
+    }
     if (m_audio_buffer)
         delete m_audio_buffer;
     if (m_ob_audio_buffer)
         delete m_ob_audio_buffer;
     if (nullptr != m_recv_buf)
         free(m_recv_buf);
+    stream_latency_release(m_latency);
+    stream_registry_release(m_registry);
 }
 
 void AudioPipe::connect(void)
@@ -892,39 +1263,50 @@ void AudioPipe::connect(void)
     addPendingConnect(this);
 }
 
-void AudioPipe::reconnect(lws_sorted_usec_list_t *sul)
+void AudioPipe::setLatency(stream_latency_t *latency)
 {
-    struct lws_client_connect_info i;
-    struct sul_user_data *container = lws_container_of(sul, struct sul_user_data, sul);
-    AudioPipe *ap = container->ap;
-    ap->m_wsi = nullptr;
+    stream_latency_retain(latency);
+    stream_latency_release(m_latency);
+    m_latency = latency;
+}
 
-    lwsl_notice("%s mod_audio_stream(%s): reconnecting to host(%s) path(%s)",
-                AUDIO_STREAM_LOGGING_PREFIX,
-                ap->m_streamid.c_str(),
-                ap->m_host.c_str(),
-                ap->m_path.c_str());
-    memset(&i, 0, sizeof(i));
-    i.context = ap->m_vhd->context;
-    i.port = ap->m_port;
-    i.address = ap->m_host.c_str();
-    i.path = ap->m_path.c_str();
-    i.host = i.address;
-    i.origin = i.address;
-    i.ssl_connection = ap->m_sslFlags;
-    i.protocol = protocolName.c_str();
-    i.pwsi = &(ap->m_wsi);
+void AudioPipe::setRegistryEntry(stream_entry_t *entry)
+{
+    stream_registry_retain(entry);
+    stream_registry_release(m_registry);
+    m_registry = entry;
+}
+
+bool AudioPipe::reserveRecvBuffer(size_t needed)
+{
+    // one spare byte to terminate text messages in place
+    if (needed + 1 <= m_recv_buf_len)
+        return true;
+    if (needed + 1 > MAX_RECV_BUF_SIZE)
+        return false;
+
+    size_t newlen = std::max(std::max(needed + 1, m_recv_buf_len * 2), (size_t)RECV_BUF_INITIAL_SIZE);
+    newlen = std::min(newlen, (size_t)MAX_RECV_BUF_SIZE);
+    if (m_recv_buf_len > 0)
+        lwsl_notice("mod_audio_stream(%s) buffer realloc needed.\n", m_streamid.c_str());
 
-    ap->m_connection_attempts++;
-    ap->m_state = LWS_CLIENT_RECONNECTING;
+    uint8_t *grown = (uint8_t *)realloc(m_recv_buf, newlen);
+    if (nullptr == grown)
+        return false;
+    m_recv_buf = grown;
+    m_recv_buf_len = newlen;
+    return true;
+}
 
+void AudioPipe::releaseRecvBuffer(void)
+{
+    // keep the arena for the next message unless a one-off huge message inflated it
+    if (m_recv_buf_len > RECV_BUF_RETAIN_SIZE)
     {
-        std::lock_guard<std::mutex> guard(mutex_reconnects);
-        pendingReconnects.push_back(ap);
+        free(m_recv_buf);
+        m_recv_buf = nullptr;
+        m_recv_buf_len = 0;
     }
-
-    ap->m_wsi = lws_client_connect_via_info(&i);
-    free(container);
 }
 
 bool AudioPipe::connect_client(struct lws_per_vhost_data *vhd)
@@ -932,10 +1314,233 @@ bool AudioPipe::connect_client(struct lws_per_vhost_data *vhd)
     assert(m_audio_buffer != nullptr);
     assert(m_vhd == nullptr);
 
+    m_state = LWS_CLIENT_CONNECTING;
+    m_vhd = vhd;
+    return startConnect();
+}
+
+void AudioPipe::connectionEstablished(struct lws_per_vhost_data *vhd)
+{
+    m_vhd = vhd;
+    m_connection_attempts = 0;
+    m_state = LWS_CLIENT_CONNECTED;
+    stream_registry_count(m_registry, STREAM_COUNTER_CONNECTS, 1);
+    stream_registry_set(m_registry, STREAM_GAUGE_CONNECTED, 1);
+    circuitSuccess(&serviceQueues[m_context_index], m_endpoint);
+    m_health_bytes_sent = m_bytes_sent;
+    m_health_stalls = 0;
+    // audio captured while connecting goes out at link speed, only the pre-roll window of it; this thread
+    // is the buffers' consumer so the older chunks are dropped here rather than by the media bug. A spooling
+    // stream that reconnects keeps all of it.
+    if (m_preroll_chunks > 0 && !(spools() && m_stream_started))
+    {
+        for (Buffer *buffer : {m_audio_buffer, m_ob_audio_buffer})
+        {
+            size_t queued = buffer ? buffer->chunks_available() : 0;
+            if (queued > m_preroll_chunks)
+                buffer->discard(queued - m_preroll_chunks);
+        }
+    }
+    if (reconnectionPolicy.health_check_interval_ms > 0)
+        armTimer(TIMER_HEALTH_CHECK, reconnectionPolicy.health_check_interval_ms);
+    else
+        cancelTimer();
+    if (!m_stream_started)
+    {
+        m_callback(m_uuid.c_str(), m_streamid.c_str(), AudioPipe::CONNECT_SUCCESS, NULL);
+        m_stream_started = true;
+    }
+}
+
+// The pipe's connection is gone: reconnects if the far end dropped it and the policy allows, otherwise reports how
+// the stream ended and deletes the pipe.
+void AudioPipe::connectionClosed(void)
+{
+    cancelTimer();
+    stream_registry_set(m_registry, STREAM_GAUGE_CONNECTED, 0);
+    if (isGracefulShutdown() || m_state == LWS_CLIENT_DISCONNECTING)
+    {
+        // closed by us
+        m_callback(
+            m_uuid.c_str(), m_streamid.c_str(), AudioPipe::CONNECTION_CLOSED_GRACEFULLY, NULL);
+    }
+    else if (m_state == LWS_CLIENT_CONNECTED)
+    {
+        // closed by far end
+        if (canReconnect())
+        {
+            m_state = LWS_CLIENT_DISCONNECTED;
+            m_wsi = nullptr;
+
+            uint32_t delay_ms = reconnectDelayMs();
+            lwsl_notice("%s: mod_audio_stream(%s):(%s) connection closed by far end.. retrying in %u ms. "
+                        "current attempts(%d)",
+                        AUDIO_STREAM_LOGGING_PREFIX,
+                        m_streamid.c_str(),
+                        m_uuid.c_str(),
+                        delay_ms,
+                        m_connection_attempts);
+            armTimer(TIMER_RECONNECT, delay_ms);
+            return;
+        }
+        lwsl_notice("mod_audio_stream(%s): (%s) socket closed by far end.\n",
+                    m_streamid.c_str(),
+                    m_uuid.c_str());
+        m_callback(m_uuid.c_str(), m_streamid.c_str(), AudioPipe::CONNECTION_DROPPED, NULL);
+    }
+    lwsl_notice("%s: mod_audio_stream(%s): (%s) connection disconnected.\n",
+                AUDIO_STREAM_LOGGING_PREFIX,
+                m_streamid.c_str(),
+                m_uuid.c_str());
+
+    m_state = LWS_CLIENT_DISCONNECTED;
+
+    // NB: after receiving any of the events above, any holder of a
+    // pointer or reference to this object must treat is as no longer valid
+
+    m_wsi_user = nullptr;
+    delete this;
+}
+
+// Sends the next message of the stream on a writable connection, the pipe's own or a shared one.
+int AudioPipe::onWritable(struct lws *wsi)
+{
+    switch_time_t cur_time;
+    if (isGracefulShutdown())
+    {
+        cur_time = switch_epoch_time_now(NULL);
+        if (cur_time >= m_gracefulShutdown_at + 60)
+        {
+            m_state = LWS_CLIENT_DISCONNECTING;
+            lwsl_err("mod_audio_stream(%s): (%s) waited for too long. closing the connection.\n",
+                     m_streamid.c_str(),
+                     m_uuid.c_str());
+            return closeConnection(wsi);
+        }
+        /* no data available on both buffers, */
+        if (allBuffersAreEmpty() && !m_lastMsgSent)
+        {
+            // a realtime session just ends, the API has no stop event
+            if (!isRealtimeFraming() &&
+                serialize_stop_event(m_send_buffer, m_sequenceNumber, m_uuid, m_streamid, m_extra_headers))
+            {
+                increaseSequenceNumber();
+                writeSendBuffer(wsi, LWS_WRITE_TEXT);
+            }
+            m_lastMsgSent = true;
+            m_state = LWS_CLIENT_DISCONNECTING;
+            lwsl_notice("mod_audio_stream(%s) stop message sent.\n", m_streamid.c_str());
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+    }
+
+    {
+        if (!m_firstMsgSent && isRealtimeFraming())
+        {
+            // the metadata is the session.update configuring the realtime session, it goes out as given
+            if (!m_extra_headers.empty())
+            {
+                m_send_buffer.clear();
+                m_send_buffer.append(m_extra_headers.data(), m_extra_headers.size());
+                if (m_send_buffer.good())
+                    writeSendBuffer(wsi, LWS_WRITE_TEXT);
+            }
+            m_firstMsgSent = true;
+            lwsl_notice("mod_audio_stream(%s) realtime session configured.\n", m_streamid.c_str());
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+        if (!m_firstMsgSent)
+        {
+            if (serialize_start_event(m_send_buffer,
+                                      m_sequenceNumber,
+                                      m_uuid,
+                                      m_streamid,
+                                      m_track,
+                                      m_extra_headers,
+                                      m_codec,
+                                      m_sampling,
+                                      m_framing,
+                                      m_chunks_per_message))
+            {
+                increaseSequenceNumber();
+                writeSendBuffer(wsi, LWS_WRITE_TEXT);
+            }
+            m_firstMsgSent = true;
+            lwsl_notice("mod_audio_stream(%s) First message sent for strameid.\n", m_streamid.c_str());
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+    }
+    // control events go ahead of audio
+    {
+        int m = writeControlEvent(wsi);
+        if (m < 0)
+            return -1;
+        if (m > 0)
+        {
+            // there may be audio data, but only one write per writeable event
+            // get it next time
+            lws_callback_on_writable(wsi);
+
+            return 0;
+        }
+    }
+
+    if (m_state == LWS_CLIENT_DISCONNECTING)
+    {
+        lwsl_notice("%s: mod_audio_stream(%s): (%s) closing the websocket connection.",
+                    AUDIO_STREAM_LOGGING_PREFIX,
+                    m_streamid.c_str(),
+                    m_uuid.c_str());
+        return closeConnection(wsi);
+    }
+
+    drainMedia(wsi, m_mux ? muxCredit : UINT_MAX);
+    return 0;
+}
+
+// Ends the pipe's use of its connection from a writable callback. Its own connection is closed; a shared one is left
+// after telling the server the stream stopped, the other streams on it carry on.
+int AudioPipe::closeConnection(struct lws *wsi)
+{
+    if (!m_mux)
+    {
+        lws_close_reason(wsi, LWS_CLOSE_STATUS_NORMAL, NULL, 0);
+        return -1;
+    }
+    if (!m_lastMsgSent && !isRealtimeFraming() &&
+        serialize_stop_event(m_send_buffer, m_sequenceNumber, m_uuid, m_streamid, m_extra_headers))
+    {
+        increaseSequenceNumber();
+        writeSendBuffer(wsi, LWS_WRITE_TEXT);
+    }
+    m_lastMsgSent = true;
+    m_state = LWS_CLIENT_DISCONNECTING;
+    leaveMux();
+    connectionClosed();
+    return 0;
+}
+
+// One connection attempt, refused without touching the network while the endpoint's circuit is open.
+bool AudioPipe::startConnect(void)
+{
     struct lws_client_connect_info i;
 
+    m_connection_attempts++;
+    m_wsi = nullptr;
+    if (!circuitAllows(&serviceQueues[m_context_index], m_endpoint))
+    {
+        lwsl_notice("mod_audio_stream(%s) %s circuit open for %s, not connecting\n",
+                    m_streamid.c_str(),
+                    m_uuid.c_str(),
+                    m_endpoint.c_str());
+        return false;
+    }
+
     memset(&i, 0, sizeof(i));
-    i.context = vhd->context;
+    i.context = m_vhd->context;
     i.port = m_port;
     i.address = m_host.c_str();
     i.path = m_path.c_str();
@@ -944,43 +1549,552 @@ bool AudioPipe::connect_client(struct lws_per_vhost_data *vhd)
     i.ssl_connection = m_sslFlags;
     i.protocol = protocolName.c_str();
     i.pwsi = &(m_wsi);
+    i.userdata = &m_wsi_user;
 
-    m_state = LWS_CLIENT_CONNECTING;
-    m_vhd = vhd;
-
+    m_wsi_user = this;
+    m_connect_in_progress = true;
     m_wsi = lws_client_connect_via_info(&i);
+    m_connect_in_progress = false;
     lwsl_notice(
         "mod_audio_stream(%s) %s attempting connection, wsi is %p\n", m_streamid.c_str(), m_uuid.c_str(), m_wsi);
 
-    m_connection_attempts++;
-    return nullptr != m_wsi;
+    if (nullptr == m_wsi)
+    {
+        circuitFailure(&serviceQueues[m_context_index], m_endpoint);
+        return false;
+    }
+    armTimer(TIMER_CONNECT_TIMEOUT, reconnectionPolicy.connection_timeout_ms);
+    return true;
+}
+
+// After a failed attempt: back off and try again while the policy allows, otherwise report CONNECT_FAIL.
+void AudioPipe::retryOrFail(const char *reason)
+{
+    m_state = LWS_CLIENT_FAILED;
+    m_wsi = nullptr;
+    stream_registry_count(m_registry, STREAM_COUNTER_CONNECT_FAILURES, 1);
+    if (canReconnect())
+    {
+        uint32_t delay_ms = reconnectDelayMs();
+        lwsl_notice("%s: mod_audio_stream:(%s) connection error(%s).. retrying in %u ms. current attempts(%d)",
+                    AUDIO_STREAM_LOGGING_PREFIX,
+                    m_streamid.c_str(),
+                    reason,
+                    delay_ms,
+                    m_connection_attempts);
+        armTimer(TIMER_RECONNECT, delay_ms);
+        return;
+    }
+    lwsl_err("mod_audio_stream(%s): unable to connect to service url (%s)", m_streamid.c_str(), reason);
+    // NB: the handler deletes the pipe
+    m_callback(m_uuid.c_str(), m_streamid.c_str(), AudioPipe::CONNECT_FAIL, reason);
+}
+
+bool AudioPipe::canReconnect(void)
+{
+    return reconnectionPolicy.enable_reconnection && !m_reconnect_disabled.load(std::memory_order_relaxed) &&
+           m_connection_attempts <= (int)reconnectionPolicy.max_reconnect_attempts;
+}
+
+// initial_delay_ms * backoff_multiplier^(attempts - 1) capped at max_delay_ms, of which the upper half is random
+// so that the streams of a server that went away do not all come back on the same tick
+uint32_t AudioPipe::reconnectDelayMs(void)
+{
+    double delay = reconnectionPolicy.initial_delay_ms;
+    for (int n = 1; n < m_connection_attempts && delay < reconnectionPolicy.max_delay_ms; n++)
+        delay *= reconnectionPolicy.backoff_multiplier;
+    uint32_t capped = (uint32_t)std::min(delay, (double)reconnectionPolicy.max_delay_ms);
+    return capped / 2 + serviceQueues[m_context_index].scheduler.next_random() % (capped / 2 + 1);
+}
+
+void AudioPipe::armTimer(PipeTimer_t kind, uint32_t delay_ms)
+{
+    ServiceQueue *queue = &serviceQueues[m_context_index];
+    m_timer_kind = kind;
+    queue->scheduler.wheel.schedule(&m_timer,
+                                    queue->scheduler.now() +
+                                        (delay_ms + SERVICE_TIMER_TICK_MS - 1) / SERVICE_TIMER_TICK_MS);
+    armServiceTimer(queue);
+}
+
+void AudioPipe::cancelTimer(void)
+{
+    if (!m_timer.scheduled())
+        return;
+    ServiceScheduler &scheduler = serviceQueues[m_context_index].scheduler;
+    scheduler.wheel.cancel(&m_timer);
+    contextLoads[m_context_index].timers.store(scheduler.wheel.pending(), std::memory_order_relaxed);
+}
+
+void AudioPipe::timerExpired(void)
+{
+    switch (m_timer_kind)
+    {
+        case TIMER_CONNECT_TIMEOUT:
+            if (m_wsi && (m_state == LWS_CLIENT_CONNECTING || m_state == LWS_CLIENT_RECONNECTING))
+            {
+                lwsl_notice("mod_audio_stream(%s) %s no answer from %s within %u ms, abandoning the attempt\n",
+                            m_streamid.c_str(),
+                            m_uuid.c_str(),
+                            m_endpoint.c_str(),
+                            reconnectionPolicy.connection_timeout_ms);
+                // reported back as a connection error, which backs off and retries
+                lws_set_timeout(m_wsi, PENDING_TIMEOUT_AWAITING_CONNECT_RESPONSE, LWS_TO_KILL_ASYNC);
+            }
+            break;
+
+        case TIMER_RECONNECT:
+            if (m_state != LWS_CLIENT_FAILED && m_state != LWS_CLIENT_DISCONNECTED)
+                break;
+            if (m_reconnect_disabled.load(std::memory_order_relaxed))
+            {
+                retryOrFail("stream closed");
+                break;
+            }
+            lwsl_notice("%s mod_audio_stream(%s): reconnecting to host(%s) path(%s)",
+                        AUDIO_STREAM_LOGGING_PREFIX,
+                        m_streamid.c_str(),
+                        m_host.c_str(),
+                        m_path.c_str());
+            m_state = LWS_CLIENT_RECONNECTING;
+            stream_registry_count(m_registry, STREAM_COUNTER_RECONNECTS, 1);
+            if (canMultiplex())
+            {
+                if (!joinMux(&serviceQueues[m_context_index]))
+                    retryOrFail("unable to connect to service url");
+                break;
+            }
+            if (claimWarmConnection(&serviceQueues[m_context_index], this, m_vhd))
+                break;
+            if (!startConnect())
+                retryOrFail("unable to connect to service url");
+            break;
+
+        case TIMER_HEALTH_CHECK:
+            healthCheck();
+            break;
+    }
+}
+
+// Drops a connection that has had audio queued but sent nothing for HEALTH_CHECK_MAX_STALLS intervals, so it goes
+// through the reconnect path instead of waiting for TCP to give up; also keeps a graceful shutdown's deadline honest.
+// Every stream gets its turn on a shared connection, so one of them stalling means the socket did and all reconnect.
+void AudioPipe::healthCheck(void)
+{
+    if (!m_wsi || m_state != LWS_CLIENT_CONNECTED)
+        return;
+    if (isGracefulShutdown())
+    {
+        lws_callback_on_writable(m_wsi);
+    }
+    else if (m_bytes_sent == m_health_bytes_sent && !allBuffersAreEmpty())
+    {
+        if (++m_health_stalls >= HEALTH_CHECK_MAX_STALLS)
+        {
+            lwsl_err("mod_audio_stream(%s) %s nothing sent for %u health checks, dropping the connection\n",
+                     m_streamid.c_str(),
+                     m_uuid.c_str(),
+                     m_health_stalls);
+            lws_set_timeout(m_wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+            return;
+        }
+    }
+    else
+    {
+        m_health_stalls = 0;
+    }
+    m_health_bytes_sent = m_bytes_sent;
+    armTimer(TIMER_HEALTH_CHECK, reconnectionPolicy.health_check_interval_ms);
+}
+
+// Closed: every attempt goes ahead. Open: attempts are refused until circuit_breaker_timeout_ms has passed, then one
+// probe at a time is let through (half open) until one connects or fails.
+bool AudioPipe::circuitAllows(ServiceQueue *queue, const std::string &endpoint)
+{
+    if (!reconnectionPolicy.enable_circuit_breaker)
+        return true;
+    ServiceScheduler &scheduler = queue->scheduler;
+    auto it = scheduler.circuits.find(endpoint);
+    if (it == scheduler.circuits.end() || it->second.state == CIRCUIT_CLOSED)
+        return true;
+    uint64_t now = scheduler.now();
+    if (now < it->second.retry_at)
+        return false;
+    // a probe that never reports back, e.g. its call hung up, only holds the circuit for one connect timeout
+    it->second.state = CIRCUIT_HALF_OPEN;
+    it->second.retry_at = now + reconnectionPolicy.connection_timeout_ms / SERVICE_TIMER_TICK_MS;
+    return true;
+}
+
+void AudioPipe::circuitFailure(ServiceQueue *queue, const std::string &endpoint)
+{
+    if (!reconnectionPolicy.enable_circuit_breaker)
+        return;
+    ServiceScheduler &scheduler = queue->scheduler;
+    EndpointCircuit &circuit = scheduler.circuits[endpoint];
+    circuit.failures++;
+    if (circuit.state == CIRCUIT_CLOSED && circuit.failures < reconnectionPolicy.circuit_breaker_threshold)
+        return;
+    if (circuit.state == CIRCUIT_CLOSED)
+    {
+        contextLoads[scheduler.index].open_circuits.fetch_add(1, std::memory_order_relaxed);
+        lwsl_notice("mod_audio_stream: %d consecutive connection failures to %s, opening its circuit for %u ms\n",
+                    circuit.failures,
+                    endpoint.c_str(),
+                    reconnectionPolicy.circuit_breaker_timeout_ms);
+    }
+    circuit.state = CIRCUIT_OPEN;
+    circuit.retry_at = scheduler.now() + reconnectionPolicy.circuit_breaker_timeout_ms / SERVICE_TIMER_TICK_MS;
+}
+
+void AudioPipe::circuitSuccess(ServiceQueue *queue, const std::string &endpoint)
+{
+    ServiceScheduler &scheduler = queue->scheduler;
+    auto it = scheduler.circuits.find(endpoint);
+    if (it == scheduler.circuits.end())
+        return;
+    if (it->second.state != CIRCUIT_CLOSED)
+    {
+        contextLoads[scheduler.index].open_circuits.fetch_sub(1, std::memory_order_relaxed);
+        lwsl_notice("mod_audio_stream: %s is back, closing its circuit\n", endpoint.c_str());
+    }
+    scheduler.circuits.erase(it);
+}
+
+// Writes the payload staged in m_send_buffer.
+int AudioPipe::writeSendBuffer(struct lws *wsi, enum lws_write_protocol protocol)
+{
+    size_t n = m_send_buffer.length();
+    uint64_t start = latency_now_ns();
+    int sent = lws_write(wsi, m_send_buffer.data(), n, protocol);
+    stream_latency_record(m_latency, LATENCY_STAGE_WS_WRITE, latency_now_ns() - start);
+    if (sent > 0 && m_context_index >= 0)
+    {
+        m_bytes_sent += sent;
+        contextLoads[m_context_index].bytes_sent.fetch_add(sent, std::memory_order_relaxed);
+        stream_registry_count(m_registry, STREAM_COUNTER_MESSAGES_SENT, 1);
+        stream_registry_count(m_registry, STREAM_COUNTER_BYTES_SENT, sent);
+    }
+    if (sent < (int)n)
+    {
+        lwsl_err("mod_audio_stream(%s) AudioPipe::lws_service_thread: attemped to send (%lu) only sent (%d) wsi %p..\n",
+                 m_streamid.c_str(),
+                 n,
+                 sent,
+                 wsi);
+    }
+    return sent;
+}
+
+// Sends the silence marker at the head of audioBuffer as a text "silence" event, whatever the framing.
+// Returns 1 as the marker takes one slot, 0 if the head holds audio.
+int AudioPipe::writeSilenceMarker(struct lws *wsi, Buffer *audioBuffer, int type)
+{
+    switch_time_t timestamp = 0;
+    uint32_t first_chunk = 0;
+    uint32_t chunks = audioBuffer->read_silence(timestamp, first_chunk);
+    if (chunks == 0)
+        return 0;
+
+    if (!serialize_silence_event(m_send_buffer,
+                                 m_sequenceNumber,
+                                 m_streamid,
+                                 (type == 0) ? "inbound" : "outbound",
+                                 timestamp,
+                                 first_chunk,
+                                 chunks,
+                                 chunks * audioBuffer->chunk_duration_ms()))
+    {
+        lwsl_err("mod_audio_stream(%s) unable to grow send buffer, dropping silence marker.\n", m_streamid.c_str());
+        return 1;
+    }
+    increaseSequenceNumber();
+    writeSendBuffer(wsi, LWS_WRITE_TEXT);
+    return 1;
+}
+
+// Sends one media message from audioBuffer using the negotiated framing; runs on the buffer's consumer thread.
+// Realtime framing writes the chunks as one input_audio_buffer.append event, without the stream's metadata.
+// A message carries m_chunks_per_message chunks; a shorter tail is only flushed during graceful shutdown or
+// when a silence marker or a change between L16 and μ-law follows it. Returns the number of chunks sent, 0 when
+// not enough chunks were available. The backpressure ladder raises the batch, and caps the backlog at its last step;
+// audio waiting in a disk spool is also sent in full batches.
+int AudioPipe::writeMediaChunk(struct lws *wsi, Buffer *audioBuffer, int type)
+{
+    size_t chunk_len = audioBuffer->chunk_size_bytes_;
+    size_t available = audioBuffer->chunks_available();
+    int degradation = m_degradation.load(std::memory_order_relaxed);
+    // spooled audio is replayed in full batches, faster than real time
+    size_t count = degradation >= DEGRADE_BATCH || audioBuffer->spooled_chunks() > 0 ? MAX_CHUNKS_PER_MESSAGE
+                                                                                     : m_chunks_per_message;
+
+    if (degradation >= DEGRADE_DROP_OLDEST && m_backlog_cap > 0 && available > m_backlog_cap &&
+        !isGracefulShutdown())
+    {
+        size_t dropped = audioBuffer->discard(available - m_backlog_cap);
+        m_backlog_dropped.fetch_add(dropped, std::memory_order_relaxed);
+        stream_registry_count(m_registry, STREAM_COUNTER_DROPPED, dropped);
+        available -= dropped;
+    }
+
+    if (available > 0 && audioBuffer->silence_at(0))
+        return writeSilenceMarker(wsi, audioBuffer, type);
+    // the audio ahead of a silence marker goes out now rather than waiting for chunks that are not coming
+    bool mulaw = available > 0 && audioBuffer->mulaw_at(0);
+    for (size_t i = 1; i < count && i < available; i++)
+    {
+        if (audioBuffer->silence_at(i) || audioBuffer->mulaw_at(i) != mulaw)
+        {
+            count = i;
+            break;
+        }
+    }
+
+    if (available < count)
+    {
+        if (!isGracefulShutdown() || available == 0)
+            return 0;
+        count = available;
+    }
+
+    uint8_t *audio;
+    if (isBinaryFraming())
+    {
+        m_send_buffer.clear();
+        if (!m_send_buffer.reserve(BINARY_MEDIA_HEADER_SIZE + chunk_len * count))
+            return 0;
+        audio = m_send_buffer.tail() + BINARY_MEDIA_HEADER_SIZE;
+    }
+    else
+    {
+        if (m_chunk_scratch.size() < chunk_len * count)
+            m_chunk_scratch.resize(chunk_len * count);
+        audio = m_chunk_scratch.data();
+    }
+
+    // timestamp and chunk index of the message are those of its first chunk
+    chunk_stamps_t stamps;
+    uint64_t captured[MAX_CHUNKS_PER_MESSAGE];
+    if (!audioBuffer->read(audio, &stamps))
+        return 0;
+    uint64_t dequeued = latency_now_ns();
+    stream_latency_record(m_latency, LATENCY_STAGE_BUFFER_WAIT, dequeued - stamps.enqueued_ns);
+    captured[0] = stamps.captured_ns;
+    switch_time_t timestamp = audioBuffer->last_send_time_;
+    uint32_t first_chunk = audioBuffer->transmitted_chunk_count_;
+    size_t n = 1;
+    while (n < count && audioBuffer->read(audio + n * chunk_len, &stamps))
+    {
+        stream_latency_record(m_latency, LATENCY_STAGE_BUFFER_WAIT, dequeued - stamps.enqueued_ns);
+        captured[n++] = stamps.captured_ns;
+    }
+
+    // μ-law stands in for L16 in the first half of each slot, moved down onto each other
+    size_t audio_len;
+    if (mulaw)
+    {
+        size_t half = chunk_len / 2;
+        for (size_t i = 1; i < n; i++)
+            memmove(audio + i * half, audio + i * chunk_len, half);
+        audio_len = half * n;
+    }
+    else
+    {
+        audio_len = stream_codec_pack_chunks(m_codec, audio, chunk_len, n);
+    }
+
+    if (isBinaryFraming())
+    {
+        binary_media_header_t header;
+        header.track = (uint8_t)type;
+        header.codec = mulaw ? ULAW : m_codec;
+        header.sequence_number = (uint32_t)m_sequenceNumber;
+        header.chunk = first_chunk;
+        header.timestamp = (uint64_t)timestamp;
+        header.sample_rate = (uint32_t)m_sampling;
+        encode_binary_media_header(m_send_buffer.tail(), header);
+        m_send_buffer.commit(BINARY_MEDIA_HEADER_SIZE + audio_len);
+    }
+    else if (isRealtimeFraming())
+    {
+        if (!serialize_realtime_append(m_send_buffer, audio, audio_len))
+        {
+            lwsl_err("mod_audio_stream(%s) unable to grow send buffer, dropping chunk.\n", m_streamid.c_str());
+            return 0;
+        }
+    }
+    else if (!serialize_media_event(m_send_buffer,
+                                    m_sequenceNumber,
+                                    m_streamid,
+                                    (type == 0) ? "inbound" : "outbound",
+                                    audio,
+                                    audio_len,
+                                    timestamp,
+                                    first_chunk,
+                                    (uint32_t)n,
+                                    m_extra_headers,
+                                    mulaw ? stream_codec_content_type(ULAW) : nullptr))
+    {
+        lwsl_err("mod_audio_stream(%s) unable to grow send buffer, dropping chunk.\n", m_streamid.c_str());
+        return 0;
+    }
+    stream_latency_record(m_latency, LATENCY_STAGE_SERIALIZE, latency_now_ns() - dequeued);
+
+    uint32_t sequence_number = (uint32_t)m_sequenceNumber;
+    increaseSequenceNumber();
+    writeSendBuffer(wsi, isBinaryFraming() ? LWS_WRITE_BINARY : LWS_WRITE_TEXT);
+
+    // lws has the bytes now; anything it still buffers is not counted
+    uint64_t sent = latency_now_ns();
+    for (size_t i = 0; i < n; i++)
+        stream_latency_record(m_latency, LATENCY_STAGE_MOUTH_TO_WIRE, sent - captured[i]);
+    if (m_trace_every && ++m_trace_counter >= m_trace_every)
+    {
+        m_trace_counter = 0;
+        char trace[256];
+        snprintf(trace,
+                 sizeof(trace),
+                 "{\"streamId\":\"%s\",\"direction\":\"outbound\",\"sequenceNumber\":%u,\"mouthToWireUs\":%llu}",
+                 m_streamid.c_str(),
+                 sequence_number,
+                 (unsigned long long)((sent - captured[0]) / 1000));
+        m_callback(m_uuid.c_str(), m_streamid.c_str(), AudioPipe::LATENCY_TRACE, trace);
+    }
+    return (int)n;
+}
+
+// Sends queued media until drainMaxChunks/drainMaxBytes or maxMessages are used up, the buffers run dry or
+// the socket stops accepting data. With both tracks the buffers are visited alternately.
+void AudioPipe::drainMedia(struct lws *wsi, unsigned int maxMessages)
+{
+    unsigned int chunks_sent = 0;
+    unsigned int messages = 0;
+    size_t bytes_sent = 0;
+    int idle = 0;
+    int nbuffers = needsBothTracks() ? 2 : 1;
+
+    while (chunks_sent < drainMaxChunks && bytes_sent < drainMaxBytes && messages < maxMessages)
+    {
+        Buffer *audioBuffer;
+        int type = 0;
+
+        if (needsBothTracks())
+        {
+            if (m_switch)
+            {
+                type = 1;
+                audioBuffer = m_ob_audio_buffer;
+            }
+            else
+            {
+                type = 0;
+                audioBuffer = m_audio_buffer;
+            }
+            m_switch = !m_switch;
+        }
+        else
+        {
+            type = (m_track == "inbound") ? 0 : 1;
+            audioBuffer = m_audio_buffer;
+        }
+
+        if (NULL == audioBuffer)
+            return;
+
+        int n = writeMediaChunk(wsi, audioBuffer, type);
+        if (n <= 0)
+        {
+            if (++idle >= nbuffers)
+                break;
+            continue;
+        }
+        idle = 0;
+        messages++;
+        chunks_sent += n;
+        bytes_sent += m_send_buffer.length();
+
+        if (lws_send_pipe_choked(wsi))
+            break;
+    }
+
+    if (chunks_sent > 0 || isGracefulShutdown())
+        lws_callback_on_writable(wsi);
 }
 
 // Message will be sent on the websocket.
-bool AudioPipe::addEventBuffer(std::string text)
+bool AudioPipe::addEventBuffer(const std::string &text)
+{
+    return addControlEvent(text.empty() ? CONTROL_EVENT_WAKE : CONTROL_EVENT_TEXT, text.data(), text.length());
+}
+
+// Queues an event for the service thread, events the module generates are serialized there when they go out.
+bool AudioPipe::addControlEvent(control_event_type_t type, const char *data, size_t len)
 {
     if (m_state != LWS_CLIENT_CONNECTED)
         return false;
+    if (!m_events.push(type, data, len, latency_now_ns()))
     {
-        std::lock_guard<std::mutex> lk(m_events_mutex);
-        m_events.push_back(std::string(text));
+        lwsl_err("mod_audio_stream(%s) dropping event, %d events already pending\n",
+                 m_streamid.c_str(),
+                 MAX_PENDING_EVENTS);
+        return false;
     }
     addPendingWrite(this);
     return true;
 }
 
-std::string AudioPipe::getEventData()
+// Sends the oldest queued event, merged with the ones of its type that follow within the coalescing window.
+// Returns 1 when a message went out, 0 when there was none to send and -1 when the write failed.
+int AudioPipe::writeControlEvent(struct lws *wsi)
 {
+    std::string &data = m_event_scratch[0];
+    control_event_type_t type;
+    uint64_t enqueued_ns;
+    // empty events only wake the service thread
+    do
+    {
+        if (!m_events.pop(data, type, enqueued_ns))
+            return 0;
+    } while (type == CONTROL_EVENT_WAKE);
+
+    bool serialized = false;
+    switch (type)
     {
-        std::lock_guard<std::mutex> lk(m_events_mutex);
-        if (!m_events.empty())
+        case CONTROL_EVENT_PLAYED:
         {
-            std::string data = m_events.front();
-            m_events.erase(m_events.begin());
-            return data;
+            size_t count = 1;
+            if (m_event_coalesce_ns > 0)
+            {
+                uint64_t not_after = enqueued_ns + m_event_coalesce_ns;
+                while (count < m_event_scratch.size() &&
+                       m_events.pop_if(CONTROL_EVENT_PLAYED, not_after, m_event_scratch[count]))
+                    count++;
+            }
+            serialized =
+                serialize_played_events(m_send_buffer, m_sequenceNumber, m_streamid, m_event_scratch.data(), count);
+            break;
         }
+        case CONTROL_EVENT_CLEARED:
+            serialized = serialize_cleared_event(m_send_buffer, m_sequenceNumber, m_streamid);
+            break;
+        case CONTROL_EVENT_INCORRECT_PAYLOAD:
+            serialized = serialize_incorrect_payload_event(m_send_buffer, m_sequenceNumber, m_streamid, data);
+            break;
+        default:
+            m_send_buffer.clear();
+            m_send_buffer.append(data.data(), data.length());
+            serialized = m_send_buffer.good();
+            break;
     }
-    return "";
+    if (!serialized)
+        return -1;
+    if (type != CONTROL_EVENT_TEXT)
+        increaseSequenceNumber();
+
+    int n = (int)m_send_buffer.length();
+    if (writeSendBuffer(wsi, LWS_WRITE_TEXT) < n)
+        return -1;
+    return 1;
 }
 
 bool AudioPipe::allBuffersAreEmpty()
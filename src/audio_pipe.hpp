@@ -2,16 +2,83 @@
 #ifndef __AUDIO_PIPE_HPP__
 #define __AUDIO_PIPE_HPP__
 
-#include <list>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <libwebsockets.h>
 #include <switch.h>
 #include <switch_buffer.h>
 
+#include "connection_manager.hpp"
+#include "latency_metrics.h"
+#include "mpsc_queue.hpp"
+#include "stream_codec.hpp"
+#include "stream_registry.h"
+#include "stream_serializer.hpp"
 #include "stream_utils.hpp"
+#include "timer_wheel.hpp"
+
+/* upper bound for the number of lws service threads / contexts */
+#define MAX_SERVICE_CONTEXTS 128
+
+/* nominal bytes/sec of one 8kHz L16 stream, so idle or just-created streams still weigh on a context */
+#define NOMINAL_STREAM_BYTES_PER_SEC 16000
+
+/* resolution of the per context timers: connect timeouts, reconnect backoff and health checks */
+#define SERVICE_TIMER_TICK_MS 10
+
+/* consecutive health checks without progress on a connection with queued audio before it is dropped */
+#define HEALTH_CHECK_MAX_STALLS 2
+
+/* how often a context tops up its warm connections and recycles the ones idle for too long */
+#define WARM_POOL_REFILL_MS 1000
+
+/* messages a stream on a shared connection may send per turn, unless configured otherwise */
+#define MUX_DEFAULT_CREDIT 4
+
+struct ServiceQueue;
+struct MuxConnection;
+class AudioPipe;
+
+// the one lws timer of a context, it wakes the event loop when the context's timer wheel has work
+struct service_sul
+{
+    struct lws_sorted_usec_list sul;
+    ServiceQueue *queue;
+};
+
+// Endpoint every service context keeps upgraded connections to, for streams to claim instead of connecting.
+struct WarmEndpoint
+{
+    std::string host;
+    unsigned int port;
+    std::string path;
+    int ssl_flags;
+    // idle connections per service context
+    unsigned int size;
+};
+
+// Load counters of one lws service context; written by connect/teardown and its service thread, read anywhere.
+struct ContextLoad
+{
+    std::atomic<unsigned int> active_streams;
+    std::atomic<uint64_t> bytes_sent;
+    std::atomic<uint64_t> bytes_per_sec;
+    // cpu the service thread is pinned to, -1 when not pinned
+    std::atomic<int> cpu;
+    // pipe timers pending on the context and endpoints whose circuit breaker is not closed
+    std::atomic<unsigned int> timers;
+    std::atomic<unsigned int> open_circuits;
+    // upgraded pool connections waiting for a stream
+    std::atomic<unsigned int> warm_connections;
+    // shared connections and the streams riding on them
+    std::atomic<unsigned int> mux_connections;
+    std::atomic<unsigned int> mux_streams;
+};
 
 class AudioPipe
 {
@@ -26,8 +93,8 @@ class AudioPipe
     std::string m_streamid;
     streaming_codec_t m_codec;
     int m_connection_attempts;
-    std::mutex m_events_mutex;
-    std::vector<std::string> m_events;
+    // control events waiting for the service thread, at most MAX_PENDING_EVENTS, sent ahead of any audio
+    EventRing m_events;
 
     enum LwsState_t
     {
@@ -47,14 +114,21 @@ class AudioPipe
         CONNECTION_CLOSED_GRACEFULLY,
         CONNECTION_TIMEOUT,
         CONNECTION_DEGRADED,
-        MESSAGE
+        MESSAGE,
+        LATENCY_TRACE,
+        MEDIA_DEGRADATION
     };
     typedef void (*log_emit_function)(int level, const char *line);
     typedef void (*notifyHandler_t)(const char *session_id,
                                     const char *stream_id,
                                     NotifyEvent_t event,
                                     const char *message);
+    typedef void (*binaryHandler_t)(const char *session_id,
+                                    const char *stream_id,
+                                    const uint8_t *data,
+                                    size_t len);
     notifyHandler_t m_callback;
+    binaryHandler_t m_binary_callback;
 
     struct lws_per_vhost_data
     {
@@ -66,6 +140,31 @@ class AudioPipe
     static void initialize(const char *protocolName, unsigned int nThreads, int loglevel, log_emit_function logger);
     static void deinitialize();
     static bool lws_service_thread(unsigned int nServiceThread);
+    // upper bounds on media sent from a single writable callback
+    static void setDrainLimits(unsigned int maxChunks, size_t maxBytes);
+    // cpus the service threads are pinned to, thread i uses cpus[i % cpus.size()]; empty disables pinning
+    static void setServiceThreadCpus(const std::vector<int> &cpus);
+    // backoff, connect timeout, health check and circuit breaker settings of every pipe
+    static void setReconnectionPolicy(const reconnection_policy_t &policy);
+    static const reconnection_policy_t &getReconnectionPolicy(void)
+    {
+        return reconnectionPolicy;
+    }
+    // endpoints to keep warm connections to, recycled after idleSecs; empty disables the pool
+    static void setWarmPool(const std::vector<WarmEndpoint> &endpoints, unsigned int idleSecs);
+    // TLS sessions each context keeps for resumption, 0 disables; needs lws built with LWS_WITH_TLS_SESSIONS
+    static void setTlsSessionCache(unsigned int sessions);
+    // shared connections per endpoint and context that streams are multiplexed over, 0 gives every stream its own;
+    // credit is how many messages a stream may send before the next stream on the connection gets its turn
+    static void setMultiplexing(unsigned int connections, unsigned int credit);
+    static unsigned int getNumContexts(void)
+    {
+        return numContexts;
+    }
+    static const ContextLoad &getContextLoad(unsigned int index)
+    {
+        return contextLoads[index];
+    }
 
     // constructor
     AudioPipe(const char *uuid,
@@ -82,7 +181,11 @@ class AudioPipe
               const char *extraHeaders,
               streaming_codec_t codec,
               int sampling,
-              int is_bidirectional);
+              int is_bidirectional,
+              streaming_framing_t framing = FRAMING_JSON,
+              binaryHandler_t binaryCallback = nullptr,
+              unsigned int chunksPerMessage = 1,
+              int codecBitrate = STREAM_OPUS_DEFAULT_BITRATE);
     ~AudioPipe();
 
     LwsState_t getLwsState(void)
@@ -91,11 +194,14 @@ class AudioPipe
     }
     void connect(void);
     bool allBuffersAreEmpty();
-    bool getEventBuffer();
-    bool addEventBuffer(std::string data);
-    std::string getEventData();
+    bool addEventBuffer(const std::string &data);
+    bool addControlEvent(control_event_type_t type, const char *data, size_t len);
 
-    static void reconnect(lws_sorted_usec_list_t *sul);
+    // the pipe gives up instead of reconnecting once its connection is lost; any thread
+    void disableReconnect(void)
+    {
+        m_reconnect_disabled.store(true, std::memory_order_relaxed);
+    }
 
     bool hasBasicAuth(void)
     {
@@ -125,6 +231,22 @@ class AudioPipe
         return m_bothTracks;
     }
 
+    bool isBinaryFraming(void)
+    {
+        return m_framing == FRAMING_BINARY;
+    }
+
+    bool isRealtimeFraming(void)
+    {
+        return m_framing == FRAMING_REALTIME;
+    }
+
+    // sent as "Authorization: Bearer <token>" on the handshake when the pipe has no basic auth credentials
+    void setBearerToken(const char *token)
+    {
+        m_bearer_token.assign(token ? token : "");
+    }
+
     int getSequenceNumber()
     {
         return m_sequenceNumber;
@@ -137,6 +259,73 @@ class AudioPipe
 
     void close();
 
+    // histograms of the owning stream, the pipe keeps a reference until it is destroyed
+    void setLatency(stream_latency_t *latency);
+
+    // registry slot of the owning stream, counted into from the lws thread; a reference is kept likewise
+    void setRegistryEntry(stream_entry_t *entry);
+
+    // one LATENCY_TRACE notification per traceEvery outgoing media messages, 0 disables
+    void setTraceSampling(unsigned int traceEvery)
+    {
+        m_trace_every = traceEvery;
+        m_trace_counter = 0;
+    }
+
+    // keep capturing audio while not connected and send up to the last prerollMs of it once connected, 0 discards
+    void setPreroll(unsigned int prerollMs)
+    {
+        m_preroll_chunks = prerollMs / 20;
+    }
+
+    // backpressure ladder level (degradation_level_t) the media bug published, read by writeMediaChunk
+    void setDegradation(int level)
+    {
+        m_degradation.store(level, std::memory_order_relaxed);
+    }
+
+    // queued chunks kept per buffer once the ladder reaches DEGRADE_DROP_OLDEST, older ones are discarded
+    void setBacklogCap(unsigned int chunks)
+    {
+        m_backlog_cap = chunks;
+    }
+
+    // consecutive events of one type queued within this many ms of the first go out as one message, 0 disables
+    void setEventCoalesce(unsigned int coalesceMs)
+    {
+        m_event_coalesce_ns = (uint64_t)coalesceMs * 1000000;
+    }
+
+    // chunks discarded under DEGRADE_DROP_OLDEST so far
+    uint64_t getBacklogDropped(void)
+    {
+        return m_backlog_dropped.load(std::memory_order_relaxed);
+    }
+
+    // true when the buffers spill to disk, audio is then kept across connection outages
+    bool spools(void)
+    {
+        return m_audio_buffer && m_audio_buffer->has_spool();
+    }
+
+    // true when stream_frame should buffer audio although the connection is not up yet
+    bool capturesBeforeConnect(void)
+    {
+        LwsState_t state = m_state;
+        if (state == LWS_CLIENT_DISCONNECTING || state == LWS_CLIENT_FAILED)
+            return false;
+        // a spooling stream that has started also keeps the audio of the backoff before a reconnect
+        if (spools() && m_stream_started)
+            return true;
+        return m_preroll_chunks > 0 && state != LWS_CLIENT_DISCONNECTED;
+    }
+
+    // latency_now_ns() when the first fragment of the message being delivered arrived; lws thread only
+    uint64_t getMessageReceivedAt(void)
+    {
+        return m_recv_started_ns;
+    }
+
     // no default constructor or copying
     AudioPipe() = delete;
     AudioPipe(const AudioPipe &) = delete;
@@ -147,30 +336,79 @@ class AudioPipe
     static int lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
     static bool lws_initialized;
     static bool lws_stopping;
-    static unsigned int nchild;
     static struct lws_context *contexts[];
+    static ServiceQueue serviceQueues[];
+    static ContextLoad contextLoads[];
+    static std::vector<int> serviceThreadCpus;
     static unsigned int numContexts;
     static std::string protocolName;
-    static std::mutex mutex_connects;
-    static std::mutex mutex_reconnects;
-    static std::mutex mutex_disconnects;
-    static std::mutex mutex_writes;
-    static std::list<AudioPipe *> pendingConnects;
-    static std::list<AudioPipe *> pendingReconnects;
-    static std::list<AudioPipe *> pendingDisconnects;
-    static std::list<AudioPipe *> pendingWrites;
+    static reconnection_policy_t reconnectionPolicy;
+    static std::vector<WarmEndpoint> warmEndpoints;
+    static unsigned int warmIdleSecs;
+    static unsigned int tlsSessionCacheSize;
+    static unsigned int muxConnections;
+    static unsigned int muxCredit;
+    static unsigned int drainMaxChunks;
+    static size_t drainMaxBytes;
     static log_emit_function logger;
 
-    static AudioPipe *findAndRemovePendingConnect(struct lws *wsi);
-    static AudioPipe *findAndRemovePendingReconnect(struct lws *wsi);
-    static AudioPipe *findPendingConnect(struct lws *wsi);
+    friend struct ServiceQueue;
+    static unsigned int selectLeastLoadedContext(void);
     static void addPendingConnect(AudioPipe *ap);
     static void addPendingDisconnect(AudioPipe *ap);
-    static void processPendingConnects(lws_per_vhost_data *vhd);
-    static void processPendingDisconnects(lws_per_vhost_data *vhd);
-    static void processPendingWrites(void);
+    static void processPendingConnects(ServiceQueue *queue, lws_per_vhost_data *vhd);
+    static void processPendingDisconnects(ServiceQueue *queue);
+    static void processPendingWrites(ServiceQueue *queue);
+    static void serviceTimerCallback(lws_sorted_usec_list_t *sul);
+    static void armServiceTimer(ServiceQueue *queue);
+    static bool warmCallback(struct lws *wsi, enum lws_callback_reasons reason, AudioPipe **user);
+    static bool claimWarmConnection(ServiceQueue *queue, AudioPipe *ap, lws_per_vhost_data *vhd);
+    static bool openWarmConnection(ServiceQueue *queue, unsigned int endpoint);
+    static void refillWarmPool(ServiceQueue *queue);
+    static void countWarmConnections(ServiceQueue *queue);
+    static int appendBasicAuth(struct lws *wsi, void *in, size_t len, const std::string &user, const std::string &pass);
+    int appendBearerAuth(struct lws *wsi, void *in, size_t len);
+    static bool muxCallback(
+        struct lws *wsi, enum lws_callback_reasons reason, AudioPipe **user, void *in, size_t len, int &result);
+    static bool openMuxConnection(ServiceQueue *queue, MuxConnection *conn);
+    static void muxConnectionLost(ServiceQueue *queue, size_t index, const char *reason);
+    static void muxDeliver(MuxConnection &conn);
+    static int muxWritable(MuxConnection &conn, struct lws *wsi);
+    static void countMuxConnections(ServiceQueue *queue);
+
+    enum PipeTimer_t
+    {
+        TIMER_CONNECT_TIMEOUT,
+        TIMER_RECONNECT,
+        TIMER_HEALTH_CHECK
+    };
 
     bool connect_client(struct lws_per_vhost_data *vhd);
+    bool startConnect(void);
+    void retryOrFail(const char *reason);
+    bool canReconnect(void);
+    uint32_t reconnectDelayMs(void);
+    void armTimer(PipeTimer_t kind, uint32_t delay_ms);
+    void cancelTimer(void);
+    void timerExpired(void);
+    void healthCheck(void);
+    void connectionEstablished(struct lws_per_vhost_data *vhd);
+    void connectionClosed(void);
+    bool canMultiplex(void);
+    bool joinMux(ServiceQueue *queue);
+    void leaveMux(void);
+    int onWritable(struct lws *wsi);
+    int closeConnection(struct lws *wsi);
+    static bool circuitAllows(ServiceQueue *queue, const std::string &endpoint);
+    static void circuitFailure(ServiceQueue *queue, const std::string &endpoint);
+    static void circuitSuccess(ServiceQueue *queue, const std::string &endpoint);
+    int writeSendBuffer(struct lws *wsi, enum lws_write_protocol protocol);
+    int writeControlEvent(struct lws *wsi);
+    int writeMediaChunk(struct lws *wsi, Buffer *audioBuffer, int type);
+    int writeSilenceMarker(struct lws *wsi, Buffer *audioBuffer, int type);
+    void drainMedia(struct lws *wsi, unsigned int maxMessages);
+    bool reserveRecvBuffer(size_t needed);
+    void releaseRecvBuffer(void);
 
     LwsState_t m_state;
     int m_sampling;
@@ -183,13 +421,46 @@ class AudioPipe
     struct lws *m_wsi;
     int m_sequenceNumber;
     size_t m_audio_buffer_max_len;
+    // receive arena reused across messages; m_recv_buf_len is its capacity, m_recv_buf_ptr is null between messages
     uint8_t *m_recv_buf;
     size_t m_recv_buf_len;
     uint8_t *m_recv_buf_ptr;
+    bool m_recv_binary;
+    uint64_t m_recv_started_ns;
+    streaming_framing_t m_framing;
+    unsigned int m_chunks_per_message;
+    // reused for every outgoing message, only touched from the lws service thread
+    SendBuffer m_send_buffer;
+    std::vector<uint8_t> m_chunk_scratch;
+    // popped events, their storage cycles back into m_events on the next pop; [0] also holds single events
+    std::vector<std::string> m_event_scratch;
+    uint64_t m_event_coalesce_ns;
+    // connecting, backing off and connected are exclusive, so one timer in the pipe serves all three
+    TimerWheelEntry m_timer;
+    PipeTimer_t m_timer_kind;
+    std::atomic<bool> m_reconnect_disabled;
+    // set while lws_client_connect_via_info runs, a connection error reported from inside it is handled by the caller
+    bool m_connect_in_progress;
+    // circuit breaker key, host:port
+    std::string m_endpoint;
+    // bytes handed to lws and the count at the last health check
+    uint64_t m_bytes_sent;
+    uint64_t m_health_bytes_sent;
+    unsigned int m_health_stalls;
+    stream_latency_t *m_latency;
+    stream_entry_t *m_registry;
+    unsigned int m_trace_every;
+    // 20ms chunks captured before connecting that are kept for the catch-up flush
+    unsigned int m_preroll_chunks;
+    unsigned int m_trace_counter;
+    std::atomic<int> m_degradation;
+    unsigned int m_backlog_cap;
+    std::atomic<uint64_t> m_backlog_dropped;
     struct lws_per_vhost_data *m_vhd;
     log_emit_function m_logger;
     std::string m_username;
     std::string m_password;
+    std::string m_bearer_token;
     bool m_gracefulShutdown;
     switch_time_t m_gracefulShutdown_at;
     bool m_firstMsgSent;
@@ -197,11 +468,121 @@ class AudioPipe
     bool m_bufferEmpty;
     bool m_bothTracks;
     bool m_stream_started;
+    // service context owning this pipe, chosen at connect(); -1 until then
+    int m_context_index;
+    // handed to lws as the per-session user data, so callbacks find the pipe directly
+    AudioPipe *m_wsi_user;
+    // intrusive links for the owning context's hand-off queues
+    AudioPipe *m_next_connect;
+    AudioPipe *m_next_disconnect;
+    AudioPipe *m_next_write;
+    // set while the pipe sits in the write queue, so it is queued at most once per wakeup
+    std::atomic<bool> m_write_scheduled;
+    // shared connection the pipe streams over, m_wsi is then that connection's; null on a connection of its own
+    MuxConnection *m_mux;
 };
 
-struct sul_user_data
+// Failure tracking of one endpoint; absent from the map while the endpoint is healthy.
+struct EndpointCircuit
 {
-    struct lws_sorted_usec_list sul;
-    AudioPipe *ap;
+    circuit_breaker_state_t state = CIRCUIT_CLOSED;
+    uint32_t failures = 0;
+    // tick at which an open circuit lets the next probe through
+    uint64_t retry_at = 0;
+};
+
+// A pool connection. lws' user data points at ap, which stays null: callbacks find the connection by that address.
+struct WarmConnection
+{
+    AudioPipe *ap = nullptr;
+    struct lws *wsi = nullptr;
+    // index in the configured endpoints
+    unsigned int endpoint = 0;
+    enum
+    {
+        WARM_CONNECTING,
+        WARM_IDLE,
+        WARM_CLOSING,
+        WARM_FAILED
+    } state = WARM_CONNECTING;
+    // tick the upgrade completed at
+    uint64_t ready_at = 0;
+};
+
+// Warm connections of one context; service thread only.
+struct WarmPool
+{
+    std::vector<std::unique_ptr<WarmConnection>> connections;
+    // the connection lws_client_connect_via_info is running for, errors reported from inside it are left to the caller
+    WarmConnection *connecting = nullptr;
+    TimerWheelEntry refill;
+};
+
+// A connection shared by several pipes to the same endpoint. Like a pool connection, lws' user data points at ap,
+// which stays null; members are served round robin from cursor, so a pass cut short by a choked socket resumes
+// with the pipe that was next.
+struct MuxConnection
+{
+    AudioPipe *ap = nullptr;
+    struct lws *wsi = nullptr;
+    // host, port, path, tls flags and credentials: only pipes agreeing on all of them share
+    std::string key;
+    std::string host;
+    unsigned int port = 0;
+    std::string path;
+    int ssl_flags = 0;
+    std::string username;
+    std::string password;
+    std::vector<AudioPipe *> members;
+    size_t cursor = 0;
+    enum
+    {
+        MUX_CONNECTING,
+        MUX_OPEN,
+        MUX_CLOSING,
+        MUX_FAILED
+    } state = MUX_CONNECTING;
+    // incoming message being reassembled, routed to its member by stream id once complete
+    std::vector<uint8_t> recv;
+    bool recv_discard = false;
+    uint64_t recv_started_ns = 0;
+};
+
+// Shared connections of one context; service thread only.
+struct MuxPool
+{
+    std::vector<std::unique_ptr<MuxConnection>> connections;
+    // the connection lws_client_connect_via_info is running for, errors reported from inside it are left to the caller
+    MuxConnection *connecting = nullptr;
+};
+
+// Timers of one context's pipes, all on a single wheel woken by a single lws timer; service thread only.
+struct ServiceScheduler
+{
+    TimerWheel wheel;
+    struct service_sul sul = {};
+    struct lws_context *context = nullptr;
+    unsigned int index = 0;
+    // steady clock origin of tick 0
+    uint64_t epoch_ns = 0;
+    // tick the lws timer is set for, UINT64_MAX when it is not set
+    uint64_t armed_tick = UINT64_MAX;
+    // xorshift state for the reconnect jitter
+    uint64_t rng = 0;
+    std::unordered_map<std::string, EndpointCircuit> circuits;
+
+    uint64_t now(void) const;
+    uint32_t next_random(void);
+};
+
+// Per lws context hand-off queues, filled from any thread and drained by the context's service thread.
+struct ServiceQueue
+{
+    MpscQueue<AudioPipe, &AudioPipe::m_next_connect> connects;
+    MpscQueue<AudioPipe, &AudioPipe::m_next_disconnect> disconnects;
+    MpscQueue<AudioPipe, &AudioPipe::m_next_write> writes;
+    ServiceScheduler scheduler;
+    WarmPool pool;
+    MuxPool mux;
 };
 #endif
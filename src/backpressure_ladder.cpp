@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: MIT
+#include "backpressure_ladder.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+const char *degradation_step_name(int level)
+{
+    switch (level)
+    {
+        case DEGRADE_BATCH:
+            return "batch";
+        case DEGRADE_CODEC:
+            return "codec";
+        case DEGRADE_DROP_OUTBOUND:
+            return "drop_outbound";
+        case DEGRADE_DROP_OLDEST:
+            return "drop_oldest";
+        default:
+            return "none";
+    }
+}
+
+bool degradation_parse_thresholds(const char *spec, unsigned int thresholds_ms[DEGRADE_LEVELS])
+{
+    memset(thresholds_ms, 0, sizeof(unsigned int) * DEGRADE_LEVELS);
+    if (!spec || !*spec || 0 == strcasecmp(spec, "off") || 0 == strcmp(spec, "0"))
+        return false;
+    if (0 == strcasecmp(spec, "on") || 0 == strcasecmp(spec, "true"))
+        spec = DEGRADE_DEFAULT_THRESHOLDS;
+
+    bool any = false;
+    unsigned int floor = 0;
+    const char *p = spec;
+    for (int level = DEGRADE_BATCH; level < DEGRADE_LEVELS && *p; level++)
+    {
+        char *end = nullptr;
+        long ms = strtol(p, &end, 10);
+        if (end == p)
+            return false;
+        if (ms > 0)
+        {
+            unsigned int threshold = (unsigned int)(ms > 600000 ? 600000 : ms);
+            thresholds_ms[level] = threshold < floor ? floor : threshold;
+            floor = thresholds_ms[level];
+            any = true;
+        }
+        p = end;
+        while (*p == ' ' || *p == ',')
+            p++;
+    }
+    return any;
+}
+
+BackpressureLadder::BackpressureLadder(const unsigned int thresholds_ms[DEGRADE_LEVELS],
+                                       unsigned int chunk_ms,
+                                       unsigned int steps)
+    : chunk_ms_(chunk_ms ? chunk_ms : 20), steps_(steps), level_(DEGRADE_NONE), previous_(DEGRADE_NONE),
+      backlog_ms_(0), uplink_percent_(100), window_start_ns_(0), changed_ns_(0), last_min_queued_(0),
+      window_min_queued_(0), level_min_queued_(0), produced_(0), pending_outbound_(0), dropped_outbound_(0),
+      transitions_(0)
+{
+    memcpy(thresholds_ms_, thresholds_ms, sizeof(thresholds_ms_));
+    thresholds_ms_[DEGRADE_NONE] = 0;
+}
+
+// nearest level in direction (+1 or -1) that applies to the stream, DEGRADE_NONE always does
+int BackpressureLadder::next_step(int from, int direction) const
+{
+    for (int level = from + direction; level > DEGRADE_NONE && level < DEGRADE_LEVELS; level += direction)
+    {
+        if (has_step(level))
+            return level;
+    }
+    return direction < 0 ? DEGRADE_NONE : -1;
+}
+
+bool BackpressureLadder::update(uint64_t now_ns, size_t queued_chunks)
+{
+    backlog_ms_ = (unsigned int)(queued_chunks * chunk_ms_);
+    if (window_start_ns_ == 0)
+    {
+        window_start_ns_ = now_ns;
+        last_min_queued_ = window_min_queued_ = level_min_queued_ = queued_chunks;
+        produced_ = 0;
+        return false;
+    }
+    if (queued_chunks < window_min_queued_)
+        window_min_queued_ = queued_chunks;
+    if (queued_chunks < level_min_queued_)
+        level_min_queued_ = queued_chunks;
+
+    int level = level_;
+    // a step has a full window to take effect before the next one is judged on the drain rate or the low point
+    bool settled = now_ns - changed_ns_ >= (uint64_t)DEGRADE_WINDOW_MS * 1000000;
+    if (now_ns - window_start_ns_ >= (uint64_t)DEGRADE_WINDOW_MS * 1000000)
+    {
+        // the lws thread took what was written minus what the queue grew by; the low points of the windows
+        // are compared since batching alone keeps up to a message worth queued
+        long long drained = (long long)produced_ + (long long)last_min_queued_ - (long long)window_min_queued_;
+        if (produced_ == 0)
+            uplink_percent_ = 100;
+        else if (drained <= 0)
+            uplink_percent_ = 0;
+        else
+            uplink_percent_ = (unsigned int)(drained * 100 / produced_);
+
+        if (settled && level_ != DEGRADE_NONE && level_min_queued_ * chunk_ms_ * 2 < thresholds_ms_[level_])
+            level = next_step(level_, -1);
+
+        window_start_ns_ = now_ns;
+        last_min_queued_ = window_min_queued_;
+        window_min_queued_ = level_min_queued_ = queued_chunks;
+        produced_ = 0;
+    }
+
+    if (level == level_)
+    {
+        // a slow uplink moves early, at half the threshold
+        int next = next_step(level_, 1);
+        bool slow = settled && uplink_percent_ < DEGRADE_SLOW_UPLINK_PERCENT;
+        if (next > 0 && (backlog_ms_ >= thresholds_ms_[next] || (slow && backlog_ms_ * 2 >= thresholds_ms_[next])))
+            level = next;
+    }
+
+    if (level == level_)
+        return false;
+    previous_ = level_;
+    level_ = level;
+    changed_ns_ = now_ns;
+    // the low point before the step says nothing about the level now in force
+    level_min_queued_ = queued_chunks;
+    transitions_++;
+    return true;
+}
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file backpressure_ladder.hpp
+ * @brief Stepwise media degradation while the uplink cannot keep up
+ *
+ * The stream Buffer is the flow-control signal: chunks pile up in it when
+ * the socket accepts less than the call produces. Once its backlog passes a
+ * level's threshold (or half of it while the uplink drains less than it is
+ * given) the stream moves one step down the ladder:
+ *
+ *   1. batch          messages carry MAX_CHUNKS_PER_MESSAGE chunks
+ *   2. codec          Opus runs at half its bitrate, L16 is sent as μ-law
+ *   3. drop_outbound  a "both" stream stops sending the outbound track
+ *   4. drop_oldest    the backlog is capped at the last threshold
+ *
+ * Each step back up needs a second in which the backlog fell below half of
+ * the current level's threshold. Steps that do not apply to a stream (no
+ * outbound track, a codec with no cheaper form) are skipped both ways.
+ *
+ * The ladder lives on the media bug thread under the stream mutex; the lws
+ * thread only sees the published level (AudioPipe::setDegradation()).
+ */
+#ifndef __BACKPRESSURE_LADDER_HPP__
+#define __BACKPRESSURE_LADDER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+/** @brief Thresholds used when MOD_AUDIO_STREAM_DEGRADE_MS is "on", ms of backlog per level */
+#define DEGRADE_DEFAULT_THRESHOLDS "200,1000,2000,4000"
+
+/** @brief Uplink share below which a level is entered at half its threshold, percent */
+#define DEGRADE_SLOW_UPLINK_PERCENT 90
+
+/** @brief Window over which drain rate and recovery are judged */
+#define DEGRADE_WINDOW_MS 1000
+
+typedef enum degradation_level
+{
+    DEGRADE_NONE,
+    DEGRADE_BATCH,
+    DEGRADE_CODEC,
+    DEGRADE_DROP_OUTBOUND,
+    DEGRADE_DROP_OLDEST,
+    DEGRADE_LEVELS
+} degradation_level_t;
+
+/**
+ * @brief Name of a level as reported in EVENT_MEDIA_DEGRADATION ("none", "batch", ...)
+ */
+const char *degradation_step_name(int level);
+
+/**
+ * @brief Parse MOD_AUDIO_STREAM_DEGRADE_MS
+ *
+ * "on" takes DEGRADE_DEFAULT_THRESHOLDS; otherwise up to four comma
+ * separated backlogs in ms, for the levels in order. A 0 (or a missing
+ * entry) skips that step; a threshold below the previous one is raised to it.
+ *
+ * @param thresholds_ms Receives DEGRADE_LEVELS entries, [DEGRADE_NONE] is 0
+ * @return false if the value is unset, "off" or has no usable threshold
+ */
+bool degradation_parse_thresholds(const char *spec, unsigned int thresholds_ms[DEGRADE_LEVELS]);
+
+/**
+ * @brief Degradation state of one stream (media bug thread)
+ */
+class BackpressureLadder
+{
+  public:
+    /**
+     * @param thresholds_ms As filled by degradation_parse_thresholds()
+     * @param chunk_ms Audio time of one Buffer chunk
+     * @param steps Bit (1 << level) set for every level that applies to the stream
+     */
+    BackpressureLadder(const unsigned int thresholds_ms[DEGRADE_LEVELS], unsigned int chunk_ms, unsigned int steps);
+
+    /**
+     * @brief Count one slot written into the measured Buffer
+     */
+    void produced()
+    {
+        produced_++;
+    }
+
+    /**
+     * @brief Take a backlog sample, at most one step per call
+     *
+     * @param now_ns latency_now_ns()
+     * @param queued_chunks Slots queued in the measured Buffer
+     * @return true if the level changed
+     */
+    bool update(uint64_t now_ns, size_t queued_chunks);
+
+    int level() const
+    {
+        return level_;
+    }
+
+    int previous() const
+    {
+        return previous_;
+    }
+
+    bool has_step(int level) const
+    {
+        return level > DEGRADE_NONE && level < DEGRADE_LEVELS && thresholds_ms_[level] > 0 &&
+               (steps_ & (1u << level)) != 0;
+    }
+
+    unsigned int threshold_ms(int level) const
+    {
+        return thresholds_ms_[level];
+    }
+
+    /**
+     * @brief Backlog at the last update()
+     */
+    unsigned int backlog_ms() const
+    {
+        return backlog_ms_;
+    }
+
+    /**
+     * @brief Share of the produced slots the lws thread took over the last window, 100 if it kept up
+     */
+    unsigned int uplink_percent() const
+    {
+        return uplink_percent_;
+    }
+
+    bool drops_outbound() const
+    {
+        return level_ >= DEGRADE_DROP_OUTBOUND && has_step(DEGRADE_DROP_OUTBOUND);
+    }
+
+    /**
+     * @brief Count one outbound frame left out, written later as a silence marker
+     */
+    void drop_outbound()
+    {
+        pending_outbound_++;
+        dropped_outbound_++;
+    }
+
+    uint32_t pending_outbound() const
+    {
+        return pending_outbound_;
+    }
+
+    /**
+     * @brief Hand the dropped outbound frames over to a silence marker
+     * @return Chunks the marker stands for
+     */
+    uint32_t take_outbound()
+    {
+        uint32_t pending = pending_outbound_;
+        pending_outbound_ = 0;
+        return pending;
+    }
+
+    uint64_t dropped_outbound() const
+    {
+        return dropped_outbound_;
+    }
+
+    uint64_t transitions() const
+    {
+        return transitions_;
+    }
+
+  private:
+    int next_step(int from, int direction) const;
+
+    unsigned int thresholds_ms_[DEGRADE_LEVELS];
+    unsigned int chunk_ms_;
+    unsigned int steps_;
+    int level_;
+    int previous_;
+    unsigned int backlog_ms_;
+    unsigned int uplink_percent_;
+    uint64_t window_start_ns_;
+    uint64_t changed_ns_;
+    size_t last_min_queued_;
+    size_t window_min_queued_;
+    size_t level_min_queued_;
+    uint32_t produced_;
+    uint32_t pending_outbound_;
+    uint64_t dropped_outbound_;
+    uint64_t transitions_;
+};
+
+#endif /* __BACKPRESSURE_LADDER_HPP__ */
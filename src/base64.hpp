@@ -3,6 +3,7 @@
 
 #include <string>
 #include <cctype>
+#include <cstddef>
 
 namespace base64 {
     
@@ -93,6 +94,72 @@ namespace base64 {
 
         return ret;
     }
+
+    struct decode_table_t {
+        signed char values[256];
+
+        decode_table_t() {
+            const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            for (int i = 0; i < 256; i++)
+                values[i] = -1;
+            for (int i = 0; i < 64; i++)
+                values[(unsigned char)alphabet[i]] = (signed char)i;
+        }
+    };
+
+    static inline const signed char *decode_table() {
+        static const decode_table_t table;
+        return table.values;
+    }
+
+    /**
+     * Decode a slice of base64 text into out without building a string. Like
+     * base64_decode() it stops at padding or the first character outside the
+     * alphabet.
+     *
+     * Unless last is set only whole 4-character groups are decoded, so a long
+     * payload can be fed in slices whose length is a multiple of 4. out needs
+     * room for in_len / 4 * 3 + 2 bytes.
+     *
+     * Returns the number of bytes written; *finished is set once the end of
+     * the encoded data has been reached.
+     */
+    static inline size_t base64_decode_into(const char *in, size_t in_len, bool last, unsigned char *out, bool *finished) {
+        const signed char *table = decode_table();
+        const unsigned char *src = (const unsigned char *)in;
+        size_t i = 0;
+        size_t o = 0;
+
+        while (i + 4 <= in_len) {
+            int a = table[src[i]], b = table[src[i + 1]], c = table[src[i + 2]], d = table[src[i + 3]];
+            if ((a | b | c | d) < 0)
+                break;
+            out[o++] = (unsigned char)((a << 2) | (b >> 4));
+            out[o++] = (unsigned char)((b << 4) | (c >> 2));
+            out[o++] = (unsigned char)((c << 6) | d);
+            i += 4;
+        }
+
+        if (i + 4 > in_len && !last) {
+            *finished = false;
+            return o;
+        }
+
+        // trailing group cut short by padding, an invalid character or the end of the data
+        int v[3];
+        int k = 0;
+        while (k < 3 && i + k < in_len && table[src[i + k]] >= 0) {
+            v[k] = table[src[i + k]];
+            k++;
+        }
+        if (k >= 2)
+            out[o++] = (unsigned char)((v[0] << 2) | (v[1] >> 4));
+        if (k >= 3)
+            out[o++] = (unsigned char)((v[1] << 4) | (v[2] >> 2));
+
+        *finished = true;
+        return o;
+    }
 }
 
 #endif // BASE64_HPP
\ No newline at end of file
@@ -4,6 +4,7 @@
  * @brief Basic implementation stub for connection manager
  */
 #include "connection_manager.hpp"
+#include <cmath>
 #include <iostream>
 #include <algorithm>
 
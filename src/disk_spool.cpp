@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: MIT
+#include "disk_spool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+DiskSpool *DiskSpool::create(const std::string &path, size_t chunk_bytes, size_t max_bytes)
+{
+    // records stay 8 byte aligned so the index entries can be read in place
+    size_t record_bytes = (sizeof(spool_record_header_t) + chunk_bytes + 7) & ~(size_t)7;
+    size_t records = max_bytes / record_bytes;
+    if (chunk_bytes == 0 || records == 0)
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream: spool %s of %zu bytes cannot hold a %zu byte chunk\n",
+                          path.c_str(),
+                          max_bytes,
+                          chunk_bytes);
+        return nullptr;
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream: unable to create spool %s: %s\n",
+                          path.c_str(),
+                          strerror(errno));
+        return nullptr;
+    }
+
+    // sparse until written, blocks are reserved extent by extent in append()
+    size_t file_bytes = records * record_bytes;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)file_bytes) == 0)
+        map = mmap(nullptr, file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream: unable to map spool %s of %zu bytes: %s\n",
+                          path.c_str(),
+                          file_bytes,
+                          strerror(errno));
+        close(fd);
+        unlink(path.c_str());
+        return nullptr;
+    }
+    madvise(map, file_bytes, MADV_SEQUENTIAL);
+
+    DiskSpool *spool =
+        new (std::nothrow) DiskSpool(path, fd, (uint8_t *)map, chunk_bytes, record_bytes, records);
+    if (!spool)
+    {
+        munmap(map, file_bytes);
+        close(fd);
+        unlink(path.c_str());
+    }
+    return spool;
+}
+
+DiskSpool::DiskSpool(
+    const std::string &path, int fd, uint8_t *map, size_t chunk_bytes, size_t record_bytes, size_t records)
+    : path_(path), fd_(fd), map_(map), chunk_bytes_(chunk_bytes), record_bytes_(record_bytes),
+      record_count_(records), write_seq_(0), reserved_bytes_(0), refused_(false), read_seq_(0)
+{
+}
+
+DiskSpool::~DiskSpool()
+{
+    if (write_seq_.load(std::memory_order_relaxed) > 0)
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream: spool %s took %llu chunks, %llu left unsent\n",
+                          path_.c_str(),
+                          (unsigned long long)write_seq_.load(std::memory_order_relaxed),
+                          (unsigned long long)pending());
+    }
+    munmap(map_, record_count_ * record_bytes_);
+    close(fd_);
+    // normally already gone, stream_session_cleanup removes it with the stream's other files
+    unlink(path_.c_str());
+}
+
+bool DiskSpool::append(const void *chunk, const chunk_stamps_t &stamps)
+{
+    uint64_t sequence = write_seq_.load(std::memory_order_relaxed);
+    const char *refusal = nullptr;
+    if (sequence - read_seq_.load(std::memory_order_acquire) >= record_count_)
+        refusal = "full";
+
+    // the first lap through the file reserves its blocks, a full disk shows up here rather than as SIGBUS
+    size_t end = (size_t)(sequence % record_count_ + 1) * record_bytes_;
+    if (!refusal && end > reserved_bytes_)
+    {
+        size_t extent = std::max(end - reserved_bytes_, (size_t)SPOOL_EXTENT_BYTES);
+        extent = std::min(extent, record_count_ * record_bytes_ - reserved_bytes_);
+        int err = posix_fallocate(fd_, (off_t)reserved_bytes_, (off_t)extent);
+        if (err == 0)
+            reserved_bytes_ += extent;
+        else
+            refusal = strerror(err);
+    }
+
+    if (refusal)
+    {
+        if (!refused_)
+        {
+            switch_log_printf(SWITCH_CHANNEL_LOG,
+                              SWITCH_LOG_ERROR,
+                              "mod_audio_stream: spool %s refused a chunk: %s\n",
+                              path_.c_str(),
+                              refusal);
+            refused_ = true;
+        }
+        return false;
+    }
+    refused_ = false;
+
+    spool_record_header_t *header = header_at(sequence);
+    header->sequence = sequence;
+    header->stamps = stamps;
+    if (chunk && stamps.silent_chunks == 0)
+        memcpy(header + 1, chunk, chunk_bytes_);
+    write_seq_.store(sequence + 1, std::memory_order_release);
+    return true;
+}
+
+const chunk_stamps_t *DiskSpool::stamps_at(size_t offset) const
+{
+    uint64_t sequence = read_seq_.load(std::memory_order_relaxed);
+    if (write_seq_.load(std::memory_order_acquire) - sequence <= offset)
+        return nullptr;
+    return &header_at(sequence + offset)->stamps;
+}
+
+bool DiskSpool::read(void *destination, chunk_stamps_t *stamps)
+{
+    uint64_t sequence = read_seq_.load(std::memory_order_relaxed);
+    if (write_seq_.load(std::memory_order_acquire) == sequence)
+        return false;
+
+    const spool_record_header_t *header = header_at(sequence);
+    bool intact = header->sequence == sequence;
+    if (intact)
+    {
+        if (header->stamps.silent_chunks == 0)
+            memcpy(destination, header + 1, chunk_bytes_);
+        if (stamps)
+            *stamps = header->stamps;
+    }
+    else
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream: spool %s record %llu overwritten, skipped\n",
+                          path_.c_str(),
+                          (unsigned long long)sequence);
+    }
+    read_seq_.store(sequence + 1, std::memory_order_release);
+    return intact;
+}
+
+size_t DiskSpool::skip(size_t count)
+{
+    uint64_t sequence = read_seq_.load(std::memory_order_relaxed);
+    size_t available = (size_t)(write_seq_.load(std::memory_order_acquire) - sequence);
+    if (count > available)
+        count = available;
+    read_seq_.store(sequence + count, std::memory_order_release);
+    return count;
+}
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file disk_spool.hpp
+ * @brief Memory-mapped overflow file behind a stream Buffer
+ *
+ * When a stream spools, chunks that do not fit under its in-memory
+ * threshold go to a file instead of being dropped. Each record is a chunk
+ * slot as the Buffer holds it, behind a small index entry with its sequence
+ * number and stamps, so silence markers, μ-law slots and the latency stamps
+ * survive the trip. The file is mapped once at its full size, which is
+ * sparse; disk space is reserved with posix_fallocate() as the producer
+ * first reaches it, so a full disk refuses writes instead of faulting.
+ *
+ * Records are appended at a monotonically increasing sequence and wrap
+ * around at the end of the file, so the file never grows past the cap
+ * however long the consumer trails behind. Like the Buffer there is one
+ * producer (the media bug) and one consumer (the lws service thread),
+ * synchronised by two atomic counters only.
+ */
+#ifndef __DISK_SPOOL_HPP__
+#define __DISK_SPOOL_HPP__
+
+#include "stream_utils.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/** @brief Default cap on one spool file, MB */
+#define SPOOL_DEFAULT_MAX_MB 64
+
+/** @brief Disk space reserved at a time as the producer moves into the file */
+#define SPOOL_EXTENT_BYTES (1024 * 1024)
+
+/**
+ * @brief Index entry in front of every spooled chunk
+ */
+typedef struct spool_record_header
+{
+    /** @brief Sequence the record was appended at, checked when it is read back */
+    uint64_t sequence;
+
+    /** @brief Stamps and flags of the chunk as the Buffer slot held them */
+    chunk_stamps_t stamps;
+} spool_record_header_t;
+
+class DiskSpool
+{
+    // Prevent copying and assignment
+    DiskSpool(const DiskSpool &) = delete;
+    void operator=(const DiskSpool &) = delete;
+
+  public:
+    /**
+     * @brief Create the spool file and map it
+     *
+     * @param path File to create, must not exist yet
+     * @param chunk_bytes Size of one Buffer chunk
+     * @param max_bytes Size of the file, rounded down to whole records
+     * @return nullptr (after logging why) if the file could not be set up
+     */
+    static DiskSpool *create(const std::string &path, size_t chunk_bytes, size_t max_bytes);
+
+    /**
+     * @brief Unmap and remove the file
+     */
+    ~DiskSpool();
+
+    const std::string &path() const
+    {
+        return path_;
+    }
+
+    /**
+     * @brief Append a chunk (producer side)
+     * @param chunk chunk_bytes of audio, nullptr for a silence marker
+     * @param stamps Stamps and flags of the slot
+     * @return false if the spool is full or no disk space could be reserved
+     */
+    bool append(const void *chunk, const chunk_stamps_t &stamps);
+
+    /**
+     * @brief Records written and not read yet, safe from either thread
+     */
+    size_t pending() const
+    {
+        return write_seq_.load(std::memory_order_acquire) - read_seq_.load(std::memory_order_acquire);
+    }
+
+    bool is_full() const
+    {
+        return pending() >= record_count_;
+    }
+
+    /**
+     * @brief Stamps of the record offset records behind the next one to read (consumer side)
+     * @return nullptr if that record is not written yet
+     */
+    const chunk_stamps_t *stamps_at(size_t offset) const;
+
+    /**
+     * @brief Read the next record (consumer side)
+     *
+     * A silence marker leaves destination untouched. A record whose index
+     * entry does not match its sequence is skipped and reported as not read.
+     *
+     * @return false if no record was read
+     */
+    bool read(void *destination, chunk_stamps_t *stamps);
+
+    /**
+     * @brief Drop records unread (consumer side)
+     * @return Records dropped, at most the ones pending
+     */
+    size_t skip(size_t count);
+
+    /**
+     * @brief Records appended over the life of the spool
+     */
+    uint64_t appended() const
+    {
+        return write_seq_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    DiskSpool(const std::string &path, int fd, uint8_t *map, size_t chunk_bytes, size_t record_bytes, size_t records);
+
+    spool_record_header_t *header_at(uint64_t sequence) const
+    {
+        return (spool_record_header_t *)(map_ + (sequence % record_count_) * record_bytes_);
+    }
+
+    std::string path_;
+    int fd_;
+    uint8_t *map_;
+    size_t chunk_bytes_;
+    size_t record_bytes_;
+    size_t record_count_;
+
+    char producer_pad_[STREAM_CACHE_LINE_SIZE];
+
+    /** @brief Sequence of the next record to append, advanced by the producer */
+    std::atomic<uint64_t> write_seq_;
+
+    /** @brief Bytes from the start of the file reserved on disk (producer only) */
+    size_t reserved_bytes_;
+
+    /** @brief Set once a refused append has been logged, cleared by the next one that succeeds */
+    bool refused_;
+
+    char consumer_pad_[STREAM_CACHE_LINE_SIZE];
+
+    /** @brief Sequence of the next record to read, advanced by the consumer */
+    std::atomic<uint64_t> read_seq_;
+};
+
+#endif /* __DISK_SPOOL_HPP__ */
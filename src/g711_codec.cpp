@@ -0,0 +1,278 @@
+// SPDX-License-Identifier: MIT
+#include "g711_codec.h"
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include <g711.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define G711_HAVE_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || (defined(__ARM_NEON) && defined(__arm__))
+#define G711_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* μ-law bias added to the magnitude before segment lookup (as in g711.h) */
+#define G711_ULAW_BIAS 0x84
+
+namespace
+{
+typedef void (*encode_fn)(const int16_t *src, uint8_t *dst, size_t samples, int negative_offset);
+
+struct encoder_kernel_t
+{
+    const char *name;
+    encode_fn encode;
+    bool (*supported)(void);
+};
+
+// Reference encoder, also used for the tails of the vector kernels.
+void encode_scalar(const int16_t *src, uint8_t *dst, size_t samples, int)
+{
+    for (size_t i = 0; i < samples; i++)
+        dst[i] = linear_to_ulaw(src[i]);
+}
+
+bool always_supported(void)
+{
+    return true;
+}
+
+/*
+ * The vector kernels evaluate the g711.h formula without branches:
+ *
+ *   mag  = BIAS + x                 (x >= 0, mask 0xFF)
+ *   mag  = BIAS - x - negoff        (x < 0,  mask 0x7F)
+ *   seg  = top_bit(mag | 0xFF) - 7
+ *   u    = ((seg << 4) | ((mag >> (seg + 3)) & 0x0F)) ^ mask, or 0x7F ^ mask once seg reaches 8
+ *
+ * negoff is 0 or 1 depending on the g711.h revision and is probed at startup.
+ * Without a per-lane 16-bit shift on x86, mag >> (seg + 3) is computed as the
+ * high half of mag * (0x2000 >> seg).
+ */
+
+#ifdef G711_HAVE_X86
+__attribute__((target("sse4.1"))) inline __m128i encode8_sse41(__m128i x, __m128i negoff_adjust)
+{
+    const __m128i bias = _mm_set1_epi16(G711_ULAW_BIAS);
+    __m128i sign = _mm_srai_epi16(x, 15);
+    __m128i mag = _mm_add_epi16(_mm_add_epi16(bias, _mm_xor_si128(x, sign)), _mm_and_si128(sign, negoff_adjust));
+
+    __m128i seg = _mm_setzero_si128();
+    __m128i mul = _mm_set1_epi16(0x2000);
+    for (int k = 0; k < 8; k++)
+    {
+        __m128i threshold = _mm_set1_epi16((short)(0x100 << k));
+        __m128i ge = _mm_cmpeq_epi16(_mm_max_epu16(mag, threshold), mag);
+        seg = _mm_sub_epi16(seg, ge);
+        mul = _mm_blendv_epi8(mul, _mm_srli_epi16(mul, 1), ge);
+    }
+
+    __m128i mantissa = _mm_and_si128(_mm_mulhi_epu16(mag, mul), _mm_set1_epi16(0x0F));
+    __m128i value = _mm_or_si128(_mm_slli_epi16(seg, 4), mantissa);
+    value = _mm_blendv_epi8(value, _mm_set1_epi16(0x7F), _mm_cmpeq_epi16(seg, _mm_set1_epi16(8)));
+    __m128i mask = _mm_xor_si128(_mm_set1_epi16(0xFF), _mm_and_si128(sign, _mm_set1_epi16(0x80)));
+    return _mm_xor_si128(value, mask);
+}
+
+__attribute__((target("sse4.1"))) void
+encode_sse41(const int16_t *src, uint8_t *dst, size_t samples, int negative_offset)
+{
+    const __m128i negoff_adjust = _mm_set1_epi16((short)(1 - negative_offset));
+    size_t i = 0;
+    for (; i + 16 <= samples; i += 16)
+    {
+        __m128i lo = encode8_sse41(_mm_loadu_si128((const __m128i *)(src + i)), negoff_adjust);
+        __m128i hi = encode8_sse41(_mm_loadu_si128((const __m128i *)(src + i + 8)), negoff_adjust);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    encode_scalar(src + i, dst + i, samples - i, negative_offset);
+}
+
+__attribute__((target("avx2"))) inline __m256i encode16_avx2(__m256i x, __m256i negoff_adjust)
+{
+    const __m256i bias = _mm256_set1_epi16(G711_ULAW_BIAS);
+    __m256i sign = _mm256_srai_epi16(x, 15);
+    __m256i mag =
+        _mm256_add_epi16(_mm256_add_epi16(bias, _mm256_xor_si256(x, sign)), _mm256_and_si256(sign, negoff_adjust));
+
+    __m256i seg = _mm256_setzero_si256();
+    __m256i mul = _mm256_set1_epi16(0x2000);
+    for (int k = 0; k < 8; k++)
+    {
+        __m256i threshold = _mm256_set1_epi16((short)(0x100 << k));
+        __m256i ge = _mm256_cmpeq_epi16(_mm256_max_epu16(mag, threshold), mag);
+        seg = _mm256_sub_epi16(seg, ge);
+        mul = _mm256_blendv_epi8(mul, _mm256_srli_epi16(mul, 1), ge);
+    }
+
+    __m256i mantissa = _mm256_and_si256(_mm256_mulhi_epu16(mag, mul), _mm256_set1_epi16(0x0F));
+    __m256i value = _mm256_or_si256(_mm256_slli_epi16(seg, 4), mantissa);
+    value = _mm256_blendv_epi8(value, _mm256_set1_epi16(0x7F), _mm256_cmpeq_epi16(seg, _mm256_set1_epi16(8)));
+    __m256i mask = _mm256_xor_si256(_mm256_set1_epi16(0xFF), _mm256_and_si256(sign, _mm256_set1_epi16(0x80)));
+    return _mm256_xor_si256(value, mask);
+}
+
+__attribute__((target("avx2"))) void
+encode_avx2(const int16_t *src, uint8_t *dst, size_t samples, int negative_offset)
+{
+    const __m256i negoff_adjust = _mm256_set1_epi16((short)(1 - negative_offset));
+    size_t i = 0;
+    for (; i + 32 <= samples; i += 32)
+    {
+        __m256i lo = encode16_avx2(_mm256_loadu_si256((const __m256i *)(src + i)), negoff_adjust);
+        __m256i hi = encode16_avx2(_mm256_loadu_si256((const __m256i *)(src + i + 16)), negoff_adjust);
+        // packus works per 128-bit lane, restore sample order afterwards
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i *)(dst + i), packed);
+    }
+    encode_sse41(src + i, dst + i, samples - i, negative_offset);
+}
+
+bool sse41_supported(void)
+{
+    return __builtin_cpu_supports("sse4.1");
+}
+
+bool avx2_supported(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#ifdef G711_HAVE_NEON
+inline uint8x8_t encode8_neon(int16x8_t x, uint16x8_t negoff_adjust)
+{
+    uint16x8_t sign = vreinterpretq_u16_s16(vshrq_n_s16(x, 15));
+    uint16x8_t mag = vaddq_u16(vaddq_u16(vdupq_n_u16(G711_ULAW_BIAS), veorq_u16(vreinterpretq_u16_s16(x), sign)),
+                               vandq_u16(sign, negoff_adjust));
+
+    // top_bit(mag | 0xFF) - 7 == 8 - clz(mag | 0xFF)
+    uint16x8_t seg = vsubq_u16(vdupq_n_u16(8), vclzq_u16(vorrq_u16(mag, vdupq_n_u16(0xFF))));
+    int16x8_t shift = vnegq_s16(vreinterpretq_s16_u16(vaddq_u16(seg, vdupq_n_u16(3))));
+    uint16x8_t mantissa = vandq_u16(vshlq_u16(mag, shift), vdupq_n_u16(0x0F));
+    uint16x8_t value = vorrq_u16(vshlq_n_u16(seg, 4), mantissa);
+    value = vbslq_u16(vceqq_u16(seg, vdupq_n_u16(8)), vdupq_n_u16(0x7F), value);
+    uint16x8_t mask = veorq_u16(vdupq_n_u16(0xFF), vandq_u16(sign, vdupq_n_u16(0x80)));
+    return vmovn_u16(veorq_u16(value, mask));
+}
+
+void encode_neon(const int16_t *src, uint8_t *dst, size_t samples, int negative_offset)
+{
+    const uint16x8_t negoff_adjust = vdupq_n_u16((uint16_t)(1 - negative_offset));
+    size_t i = 0;
+    for (; i + 8 <= samples; i += 8)
+        vst1_u8(dst + i, encode8_neon(vld1q_s16(src + i), negoff_adjust));
+    encode_scalar(src + i, dst + i, samples - i, negative_offset);
+}
+#endif
+
+// Fastest first; the first supported kernel that matches the reference wins.
+const encoder_kernel_t encoder_kernels[] = {
+#ifdef G711_HAVE_X86
+    {"avx2", encode_avx2, avx2_supported},
+    {"sse4.1", encode_sse41, sse41_supported},
+#endif
+#ifdef G711_HAVE_NEON
+    {"neon", encode_neon, always_supported},
+#endif
+    {"scalar", encode_scalar, always_supported},
+};
+
+const size_t encoder_kernel_count = sizeof(encoder_kernels) / sizeof(encoder_kernels[0]);
+
+struct codec_state_t
+{
+    int16_t decode_table[256];
+    int negative_offset;
+    bool validated[sizeof(encoder_kernels) / sizeof(encoder_kernels[0])];
+    std::atomic<const encoder_kernel_t *> encoder;
+};
+
+// Checks a kernel against linear_to_ulaw() for every 16-bit input, at an odd length to cover the tail path.
+bool matches_reference(const encoder_kernel_t &kernel, int negative_offset)
+{
+    std::vector<int16_t> input(65536 + 7);
+    std::vector<uint8_t> output(input.size());
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = (int16_t)(uint16_t)(i + 32768);
+
+    kernel.encode(input.data(), output.data(), input.size(), negative_offset);
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        if (output[i] != linear_to_ulaw(input[i]))
+            return false;
+    }
+    return true;
+}
+
+codec_state_t &codec_state(void)
+{
+    static codec_state_t *state = []() {
+        codec_state_t *s = new codec_state_t();
+        for (int i = 0; i < 256; i++)
+            s->decode_table[i] = ulaw_to_linear((uint8_t)i);
+
+        // both g711.h revisions agree except for negative inputs just below a mantissa step
+        int16_t probe = -4;
+        int mag = G711_ULAW_BIAS + 4 - 1;
+        uint8_t with_offset = (uint8_t)(((mag >> 3) & 0x0F) ^ 0x7F);
+        s->negative_offset = (linear_to_ulaw(probe) == with_offset) ? 1 : 0;
+
+        const encoder_kernel_t *selected = nullptr;
+        for (size_t k = 0; k < encoder_kernel_count; k++)
+        {
+            s->validated[k] = encoder_kernels[k].supported() && matches_reference(encoder_kernels[k], s->negative_offset);
+            if (s->validated[k] && !selected)
+                selected = &encoder_kernels[k];
+        }
+        // the scalar kernel is the reference itself and always validates
+        s->encoder.store(selected);
+        return s;
+    }();
+    return *state;
+}
+} // namespace
+
+extern "C"
+{
+    const char *g711_codec_init(void)
+    {
+        return codec_state().encoder.load()->name;
+    }
+
+    const char *g711_codec_implementation(void)
+    {
+        return codec_state().encoder.load()->name;
+    }
+
+    int g711_codec_force_implementation(const char *name)
+    {
+        codec_state_t &state = codec_state();
+        for (size_t k = 0; k < encoder_kernel_count; k++)
+        {
+            if (0 == strcmp(encoder_kernels[k].name, name) && state.validated[k])
+            {
+                state.encoder.store(&encoder_kernels[k]);
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    void g711_ulaw_encode(const int16_t *src, uint8_t *dst, size_t samples)
+    {
+        codec_state_t &state = codec_state();
+        state.encoder.load(std::memory_order_relaxed)->encode(src, dst, samples, state.negative_offset);
+    }
+
+    void g711_ulaw_decode(const uint8_t *src, int16_t *dst, size_t samples)
+    {
+        const int16_t *table = codec_state().decode_table;
+        for (size_t i = 0; i < samples; i++)
+            dst[i] = table[src[i]];
+    }
+}
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file g711_codec.h
+ * @brief Table-driven and vectorized G.711 μ-law conversion
+ *
+ * Shared μ-law kernels for the capture path (encode), the playback path
+ * (decode) and any transcoding. Decoding uses a 256-entry table built from
+ * the reference ulaw_to_linear(). Encoding picks the fastest kernel the CPU
+ * supports at runtime (AVX2, SSE4.1, NEON or scalar), and a kernel is only
+ * used if it reproduces the reference linear_to_ulaw() for every one of the
+ * 65536 input values, so the output is bit-exact with FreeSWITCH's g711.h.
+ *
+ * @author FreeSWITCH Community
+ * @version 1.0
+ * @date 2024
+ */
+#ifndef __G711_CODEC_H__
+#define __G711_CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Select and validate the encoder kernel
+     *
+     * Optional; the first encode/decode call does the same. Calling it at
+     * module load keeps the one-off validation off the media path.
+     *
+     * @return Name of the selected encoder ("avx2", "sse4.1", "neon" or "scalar")
+     */
+    const char *g711_codec_init(void);
+
+    /**
+     * @brief Name of the encoder kernel in use
+     */
+    const char *g711_codec_implementation(void);
+
+    /**
+     * @brief Force a specific encoder kernel (testing and benchmarking)
+     *
+     * @param name "avx2", "sse4.1", "neon" or "scalar"
+     * @return 1 if the kernel is available on this CPU and was selected, 0 otherwise
+     */
+    int g711_codec_force_implementation(const char *name);
+
+    /**
+     * @brief Encode linear PCM to μ-law
+     *
+     * @param src Linear 16-bit samples
+     * @param dst Receives one μ-law byte per sample
+     * @param samples Number of samples
+     */
+    void g711_ulaw_encode(const int16_t *src, uint8_t *dst, size_t samples);
+
+    /**
+     * @brief Decode μ-law to linear PCM
+     *
+     * @param src μ-law bytes
+     * @param dst Receives one 16-bit sample per byte
+     * @param samples Number of samples
+     */
+    void g711_ulaw_decode(const uint8_t *src, int16_t *dst, size_t samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __G711_CODEC_H__ */
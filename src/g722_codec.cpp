@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: MIT
+#include "g722_codec.h"
+
+#include <cstring>
+
+/*
+ * Block numbers in the comments are those of the G.722 specification; the
+ * tables are the ones it defines for the 64 kbit/s mode.
+ */
+namespace
+{
+const int qmf_coeffs[12] = {3, -11, 12, 32, -210, 951, 3876, -805, 362, -156, 53, -11};
+
+// low band quantizer decision levels and the codes for each interval
+const int q6[32] = {0,   35,  72,  110, 150, 190,  233,  276,  323,  370,  422,  473,  530,  587,  650,  714,
+                    786, 858, 940, 1023, 1121, 1219, 1339, 1458, 1612, 1765, 1980, 2195, 2557, 2919, 0, 0};
+const int iln[32] = {0,  63, 62, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19,
+                     18, 17, 16, 15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  0};
+const int ilp[32] = {0,  61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48, 47,
+                     46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32, 0};
+
+// low band inverse quantizers, 6 bit for the output and 4 bit for the predictor
+const int qm6[64] = {-136,  -136,  -136,  -136,  -24808, -21904, -19008, -16704, -14984, -13512, -12280,
+                     -11192, -10232, -9360, -8576, -7856,  -7192,  -6576,  -6000,  -5456,  -4944,  -4464,
+                     -4008, -3576, -3168, -2776, -2400,  -2032,  -1688,  -1360,  -1040,  -728,   24808,
+                     21904, 19008, 16704, 14984, 13512,  12280,  11192,  10232,  9360,   8576,   7856,
+                     7192,  6576,  6000,  5456,  4944,   4464,   4008,   3576,   3168,   2776,   2400,
+                     2032,  1688,  1360,  1040,  728,    432,    136,    -432,   -136};
+const int qm4[16] = {0, -20456, -12896, -8968, -6288, -4240, -2584, -1200, 20456, 12896, 8968, 6288, 4240, 2584, 1200, 0};
+const int wl[8] = {-60, -30, 58, 172, 334, 538, 1198, 3042};
+const int rl42[16] = {0, 7, 6, 5, 4, 3, 2, 1, 7, 6, 5, 4, 3, 2, 1, 0};
+
+// scale factor table shared by both bands
+const int ilb[32] = {2048, 2093, 2139, 2186, 2233, 2282, 2332, 2383, 2435, 2489, 2543,
+                     2599, 2656, 2714, 2774, 2834, 2896, 2960, 3025, 3091, 3158, 3228,
+                     3298, 3371, 3444, 3520, 3597, 3676, 3756, 3838, 3922, 4008};
+
+// high band quantizer
+const int qm2[4] = {-7408, -1616, 7408, 1616};
+const int ihn[3] = {0, 1, 0};
+const int ihp[3] = {0, 3, 2};
+const int wh[3] = {0, -214, 798};
+const int rh2[4] = {2, 1, 2, 1};
+
+inline int saturate(int amp)
+{
+    if (amp > 32767)
+        return 32767;
+    if (amp < -32768)
+        return -32768;
+    return amp;
+}
+
+// Blocks 3L/3H, SCALEL/SCALEH: quantizer scale factor from the log scale factor
+inline int scale(int nb, int shift)
+{
+    int wd1 = (nb >> 6) & 31;
+    int wd2 = shift - (nb >> 11);
+    int wd3 = (wd2 < 0) ? (ilb[wd1] << -wd2) : (ilb[wd1] >> wd2);
+    return wd3 << 2;
+}
+
+// Block 4: reconstruction, pole and zero predictor adaptation, next prediction
+void block4(g722_band_t *band, int d)
+{
+    int wd1, wd2, wd3;
+
+    // RECONS, PARREC
+    band->d[0] = d;
+    band->r[0] = saturate(band->s + d);
+    band->p[0] = saturate(band->sz + d);
+
+    // UPPOL2
+    for (int i = 0; i < 3; i++)
+        band->sg[i] = band->p[i] >> 15;
+    wd1 = saturate(band->a[1] * 4);
+    wd2 = (band->sg[0] == band->sg[1]) ? -wd1 : wd1;
+    if (wd2 > 32767)
+        wd2 = 32767;
+    wd3 = (wd2 >> 7) + ((band->sg[0] == band->sg[2]) ? 128 : -128);
+    wd3 += (band->a[2] * 32512) >> 15;
+    if (wd3 > 12288)
+        wd3 = 12288;
+    else if (wd3 < -12288)
+        wd3 = -12288;
+    band->ap[2] = wd3;
+
+    // UPPOL1
+    band->sg[0] = band->p[0] >> 15;
+    band->sg[1] = band->p[1] >> 15;
+    wd1 = (band->sg[0] == band->sg[1]) ? 192 : -192;
+    wd2 = (band->a[1] * 32640) >> 15;
+    band->ap[1] = saturate(wd1 + wd2);
+    wd3 = saturate(15360 - band->ap[2]);
+    if (band->ap[1] > wd3)
+        band->ap[1] = wd3;
+    else if (band->ap[1] < -wd3)
+        band->ap[1] = -wd3;
+
+    // UPZERO
+    wd1 = (d == 0) ? 0 : 128;
+    band->sg[0] = d >> 15;
+    for (int i = 1; i < 7; i++)
+    {
+        band->sg[i] = band->d[i] >> 15;
+        wd2 = (band->sg[i] == band->sg[0]) ? wd1 : -wd1;
+        wd3 = (band->b[i] * 32640) >> 15;
+        band->bp[i] = saturate(wd2 + wd3);
+    }
+
+    // DELAYA
+    for (int i = 6; i > 0; i--)
+    {
+        band->d[i] = band->d[i - 1];
+        band->b[i] = band->bp[i];
+    }
+    for (int i = 2; i > 0; i--)
+    {
+        band->r[i] = band->r[i - 1];
+        band->p[i] = band->p[i - 1];
+        band->a[i] = band->ap[i];
+    }
+
+    // FILTEP
+    wd1 = saturate(band->r[1] + band->r[1]);
+    wd1 = (band->a[1] * wd1) >> 15;
+    wd2 = saturate(band->r[2] + band->r[2]);
+    wd2 = (band->a[2] * wd2) >> 15;
+    band->sp = saturate(wd1 + wd2);
+
+    // FILTEZ
+    band->sz = 0;
+    for (int i = 6; i > 0; i--)
+    {
+        wd1 = saturate(band->d[i] + band->d[i]);
+        band->sz += (band->b[i] * wd1) >> 15;
+    }
+    band->sz = saturate(band->sz);
+
+    // PREDIC
+    band->s = saturate(band->sp + band->sz);
+}
+
+// Blocks 3L/3H, LOGSCL/LOGSCH: log scale factor adaptation
+inline int adapt_log_scale(int nb, int weight, int limit)
+{
+    nb = ((nb * 127) >> 7) + weight;
+    if (nb < 0)
+        return 0;
+    return (nb > limit) ? limit : nb;
+}
+} // namespace
+
+extern "C" void g722_state_init(g722_state_t *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->band[0].det = 32;
+    state->band[1].det = 8;
+}
+
+extern "C" size_t g722_encode(g722_state_t *state, const int16_t *src, uint8_t *dst, size_t samples)
+{
+    size_t out = 0;
+    for (size_t j = 0; j + 1 < samples; j += 2)
+    {
+        // transmit QMF, one low and one high band sample per input pair
+        memmove(state->x, state->x + 2, 22 * sizeof(state->x[0]));
+        state->x[22] = src[j];
+        state->x[23] = src[j + 1];
+        int sumodd = 0;
+        int sumeven = 0;
+        for (int i = 0; i < 12; i++)
+        {
+            sumodd += state->x[2 * i] * qmf_coeffs[i];
+            sumeven += state->x[2 * i + 1] * qmf_coeffs[11 - i];
+        }
+        int xlow = (sumeven + sumodd) >> 14;
+        int xhigh = (sumeven - sumodd) >> 14;
+
+        // Blocks 1L (SUBTRA, QUANTL) and 2L (INVQAL)
+        g722_band_t *low = &state->band[0];
+        int el = saturate(xlow - low->s);
+        int wd = (el >= 0) ? el : -(el + 1);
+        int i = 1;
+        for (; i < 30; i++)
+        {
+            if (wd < ((q6[i] * low->det) >> 12))
+                break;
+        }
+        int ilow = (el < 0) ? iln[i] : ilp[i];
+        int ril = ilow >> 2;
+        int dlow = (low->det * qm4[ril]) >> 15;
+        low->nb = adapt_log_scale(low->nb, wl[rl42[ril]], 18432);
+        low->det = scale(low->nb, 8);
+        block4(low, dlow);
+
+        // Blocks 1H (SUBTRA, QUANTH) and 2H (INVQAH)
+        g722_band_t *high = &state->band[1];
+        int eh = saturate(xhigh - high->s);
+        wd = (eh >= 0) ? eh : -(eh + 1);
+        int mih = (wd >= ((564 * high->det) >> 12)) ? 2 : 1;
+        int ihigh = (eh < 0) ? ihn[mih] : ihp[mih];
+        int dhigh = (high->det * qm2[ihigh]) >> 15;
+        high->nb = adapt_log_scale(high->nb, wh[rh2[ihigh]], 22528);
+        high->det = scale(high->nb, 10);
+        block4(high, dhigh);
+
+        dst[out++] = (uint8_t)((ihigh << 6) | ilow);
+    }
+    return out;
+}
+
+extern "C" size_t g722_decode(g722_state_t *state, const uint8_t *src, int16_t *dst, size_t len)
+{
+    size_t out = 0;
+    for (size_t j = 0; j < len; j++)
+    {
+        int code = src[j];
+        int ilow = code & 0x3F;
+        int ihigh = (code >> 6) & 0x03;
+
+        // Blocks 5L (INVQBL, RECONS, LIMIT) and 2L (INVQAL)
+        g722_band_t *low = &state->band[0];
+        int rlow = low->s + ((low->det * qm6[ilow]) >> 15);
+        if (rlow > 16383)
+            rlow = 16383;
+        else if (rlow < -16384)
+            rlow = -16384;
+        int ril = ilow >> 2;
+        int dlow = (low->det * qm4[ril]) >> 15;
+        low->nb = adapt_log_scale(low->nb, wl[rl42[ril]], 18432);
+        low->det = scale(low->nb, 8);
+        block4(low, dlow);
+
+        // Blocks 2H (INVQAH) and 5H (RECONS, LIMIT)
+        g722_band_t *high = &state->band[1];
+        int dhigh = (high->det * qm2[ihigh]) >> 15;
+        int rhigh = dhigh + high->s;
+        if (rhigh > 16383)
+            rhigh = 16383;
+        else if (rhigh < -16384)
+            rhigh = -16384;
+        high->nb = adapt_log_scale(high->nb, wh[rh2[ihigh]], 22528);
+        high->det = scale(high->nb, 10);
+        block4(high, dhigh);
+
+        // receive QMF, two output samples per code
+        memmove(state->x, state->x + 2, 22 * sizeof(state->x[0]));
+        state->x[22] = rlow + rhigh;
+        state->x[23] = rlow - rhigh;
+        int xout1 = 0;
+        int xout2 = 0;
+        for (int i = 0; i < 12; i++)
+        {
+            xout2 += state->x[2 * i] * qmf_coeffs[i];
+            xout1 += state->x[2 * i + 1] * qmf_coeffs[11 - i];
+        }
+        dst[out++] = (int16_t)saturate(xout1 >> 11);
+        dst[out++] = (int16_t)saturate(xout2 >> 11);
+    }
+    return out;
+}
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file g722_codec.h
+ * @brief G.722 wideband codec at 64 kbit/s
+ *
+ * Sub-band ADPCM as specified in ITU-T G.722: the 16 kHz input is split by a
+ * 24-tap QMF into a low band coded with 6 bits and a high band coded with 2
+ * bits per 8 kHz sample pair, one byte out per two input samples. Only the
+ * 64 kbit/s mode is implemented, the one RTP and WebSocket peers use.
+ *
+ * The state carries the ADPCM predictors and the QMF history from one call
+ * to the next, so a stream has to keep one state per direction and feed it
+ * contiguous audio.
+ */
+#ifndef __G722_CODEC_H__
+#define __G722_CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /** @brief ADPCM state of one sub-band */
+    typedef struct g722_band
+    {
+        int s;
+        int sp;
+        int sz;
+        int r[3];
+        int a[3];
+        int ap[3];
+        int p[3];
+        int d[7];
+        int b[7];
+        int bp[7];
+        int sg[7];
+        int nb;
+        int det;
+    } g722_band_t;
+
+    /** @brief Encoder or decoder state, one per direction of a stream */
+    typedef struct g722_state
+    {
+        /** @brief QMF delay line */
+        int x[24];
+        g722_band_t band[2];
+    } g722_state_t;
+
+    /**
+     * @brief Reset a state to the start of a stream
+     */
+    void g722_state_init(g722_state_t *state);
+
+    /**
+     * @brief Encode 16 kHz linear PCM
+     *
+     * @param state Encoder state
+     * @param src Linear 16-bit samples
+     * @param dst Receives one byte per two samples
+     * @param samples Number of samples, a trailing odd sample is ignored
+     * @return Number of bytes written
+     */
+    size_t g722_encode(g722_state_t *state, const int16_t *src, uint8_t *dst, size_t samples);
+
+    /**
+     * @brief Decode to 16 kHz linear PCM
+     *
+     * @param state Decoder state
+     * @param src G.722 bytes
+     * @param dst Receives two samples per byte
+     * @param len Number of bytes
+     * @return Number of samples written
+     */
+    size_t g722_decode(g722_state_t *state, const uint8_t *src, int16_t *dst, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __G722_CODEC_H__ */
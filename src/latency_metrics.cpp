@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: MIT
+#include "latency_metrics.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <switch.h>
+#include <vector>
+
+/* 16 sub-buckets per power of two */
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+
+/* samples of 2^36 ns (about 68 s) and more share the last bucket, max still holds the exact value */
+#define LATENCY_MAX_EXPONENT 36
+#define LATENCY_BUCKETS ((LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+namespace
+{
+// one stage of one stream; 32 bit counts cover years of 20ms samples and keep a stream's histograms small
+struct StageHistogram
+{
+    std::atomic<uint32_t> counts[LATENCY_BUCKETS];
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+// plain counts, used for snapshots and the module totals of finished streams
+struct StageSnapshot
+{
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t sum;
+    uint64_t max;
+};
+
+inline unsigned int bucket_index(uint64_t value)
+{
+    if (value < LATENCY_SUB_BUCKETS)
+        return (unsigned int)value;
+    if (value >= (1ull << LATENCY_MAX_EXPONENT))
+        return LATENCY_BUCKETS - 1;
+    unsigned int exponent = 63 - __builtin_clzll(value);
+    unsigned int shift = exponent - LATENCY_SUB_BUCKET_BITS;
+    return ((exponent - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS) +
+           (unsigned int)((value >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+// highest value that lands in the bucket, what the percentiles report
+inline uint64_t bucket_upper_bound(unsigned int index)
+{
+    if (index < LATENCY_SUB_BUCKETS)
+        return index;
+    unsigned int shift = (index >> LATENCY_SUB_BUCKET_BITS) - 1;
+    uint64_t lower = (uint64_t)(LATENCY_SUB_BUCKETS + (index & (LATENCY_SUB_BUCKETS - 1))) << shift;
+    return lower + (1ull << shift) - 1;
+}
+
+const char *const stage_names[LATENCY_STAGE_COUNT] = {
+    "capture", "bufferWait", "serialize", "wsWrite", "inboundDecode", "playbackDepth", "mouthToWire", "receiveToPlayout"};
+} // namespace
+
+struct stream_latency
+{
+    std::atomic<int> refs;
+    std::string stream_id;
+    // links of the registry of running streams, guarded by registry_mutex
+    stream_latency *prev;
+    stream_latency *next;
+    StageHistogram stages[LATENCY_STAGE_COUNT];
+};
+
+namespace
+{
+std::mutex registry_mutex;
+stream_latency *registry_head = nullptr;
+// counts of finished streams, guarded by registry_mutex
+StageSnapshot retired[LATENCY_STAGE_COUNT];
+
+void add_stream(StageSnapshot *snapshot, const stream_latency *latency)
+{
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        const StageHistogram &histogram = latency->stages[stage];
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+            snapshot[stage].counts[i] += histogram.counts[i].load(std::memory_order_relaxed);
+        snapshot[stage].sum += histogram.sum.load(std::memory_order_relaxed);
+        uint64_t max = histogram.max.load(std::memory_order_relaxed);
+        if (max > snapshot[stage].max)
+            snapshot[stage].max = max;
+    }
+}
+
+double to_microseconds(uint64_t ns)
+{
+    // one decimal is below the bucket resolution anyway and keeps the JSON short
+    return (double)((ns + 50) / 100) / 10.0;
+}
+
+const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+
+// sample count and the percentiles of one stage, in ns
+uint64_t summarize(const StageSnapshot &s, uint64_t values[4])
+{
+    uint64_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        total += s.counts[i];
+
+    unsigned int index = 0;
+    uint64_t seen = 0;
+    for (int p = 0; p < 4; p++)
+    {
+        uint64_t rank = (uint64_t)(percentiles[p] * (double)total + 0.999999);
+        while (total > 0 && index < LATENCY_BUCKETS && seen + s.counts[index] < rank)
+            seen += s.counts[index++];
+        uint64_t value = (total > 0) ? bucket_upper_bound(index) : 0;
+        if (value > s.max || index == LATENCY_BUCKETS - 1)
+            value = s.max;
+        values[p] = value;
+    }
+    return total;
+}
+
+char *snapshot_json(const StageSnapshot *snapshot)
+{
+    static const char *const percentile_names[] = {"p50", "p90", "p99", "p999"};
+
+    cJSON *root = cJSON_CreateObject();
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        const StageSnapshot &s = snapshot[stage];
+        uint64_t values[4];
+        uint64_t total = summarize(s, values);
+
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToObject(item, "count", cJSON_CreateNumber((double)total));
+        for (int p = 0; p < 4; p++)
+            cJSON_AddItemToObject(item, percentile_names[p], cJSON_CreateNumber(to_microseconds(values[p])));
+        cJSON_AddItemToObject(item, "max", cJSON_CreateNumber(to_microseconds(s.max)));
+        cJSON_AddItemToObject(root, stage_names[stage], item);
+    }
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return json;
+}
+
+char *snapshot_prometheus(const StageSnapshot *snapshot)
+{
+    static const char *const quantile_labels[] = {"0.5", "0.9", "0.99", "0.999"};
+
+    std::string text = "# HELP mod_audio_stream_latency_seconds Hot-path stage latency of all streams\n"
+                       "# TYPE mod_audio_stream_latency_seconds summary\n";
+    std::string max = "# HELP mod_audio_stream_latency_max_seconds Highest sample of each hot-path stage\n"
+                      "# TYPE mod_audio_stream_latency_max_seconds gauge\n";
+    char line[160];
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        const StageSnapshot &s = snapshot[stage];
+        uint64_t values[4];
+        uint64_t total = summarize(s, values);
+        for (int p = 0; p < 4; p++)
+        {
+            snprintf(line,
+                     sizeof(line),
+                     "mod_audio_stream_latency_seconds{stage=\"%s\",quantile=\"%s\"} %.9g\n",
+                     stage_names[stage],
+                     quantile_labels[p],
+                     (double)values[p] / 1e9);
+            text += line;
+        }
+        snprintf(line,
+                 sizeof(line),
+                 "mod_audio_stream_latency_seconds_sum{stage=\"%s\"} %.9g\n"
+                 "mod_audio_stream_latency_seconds_count{stage=\"%s\"} %llu\n",
+                 stage_names[stage],
+                 (double)s.sum / 1e9,
+                 stage_names[stage],
+                 (unsigned long long)total);
+        text += line;
+        snprintf(line,
+                 sizeof(line),
+                 "mod_audio_stream_latency_max_seconds{stage=\"%s\"} %.9g\n",
+                 stage_names[stage],
+                 (double)s.max / 1e9);
+        max += line;
+    }
+    text += max;
+    return strdup(text.c_str());
+}
+std::vector<StageSnapshot> module_snapshot()
+{
+    std::vector<StageSnapshot> snapshot;
+    std::lock_guard<std::mutex> lk(registry_mutex);
+    snapshot.assign(retired, retired + LATENCY_STAGE_COUNT);
+    for (stream_latency *latency = registry_head; latency; latency = latency->next)
+        add_stream(snapshot.data(), latency);
+    return snapshot;
+}
+} // namespace
+
+stream_latency_t *stream_latency_create(const char *stream_id)
+{
+    stream_latency *latency = new (std::nothrow) stream_latency;
+    if (!latency)
+        return nullptr;
+
+    latency->refs.store(1);
+    latency->stream_id = stream_id ? stream_id : "";
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+            latency->stages[stage].counts[i].store(0, std::memory_order_relaxed);
+        latency->stages[stage].sum.store(0, std::memory_order_relaxed);
+        latency->stages[stage].max.store(0, std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lk(registry_mutex);
+    latency->prev = nullptr;
+    latency->next = registry_head;
+    if (registry_head)
+        registry_head->prev = latency;
+    registry_head = latency;
+    return latency;
+}
+
+void stream_latency_retain(stream_latency_t *latency)
+{
+    if (latency)
+        latency->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void stream_latency_release(stream_latency_t *latency)
+{
+    if (!latency || latency->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lk(registry_mutex);
+        if (latency->prev)
+            latency->prev->next = latency->next;
+        else
+            registry_head = latency->next;
+        if (latency->next)
+            latency->next->prev = latency->prev;
+        add_stream(retired, latency);
+    }
+    delete latency;
+}
+
+void stream_latency_record(stream_latency_t *latency, latency_stage_t stage, uint64_t value_ns)
+{
+    if (!latency || (unsigned int)stage >= LATENCY_STAGE_COUNT)
+        return;
+
+    StageHistogram &histogram = latency->stages[stage];
+    histogram.counts[bucket_index(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    histogram.sum.fetch_add(value_ns, std::memory_order_relaxed);
+    uint64_t max = histogram.max.load(std::memory_order_relaxed);
+    while (value_ns > max && !histogram.max.compare_exchange_weak(max, value_ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+char *stream_latency_json(stream_latency_t *latency)
+{
+    if (!latency)
+        return nullptr;
+    std::vector<StageSnapshot> snapshot(LATENCY_STAGE_COUNT, StageSnapshot());
+    add_stream(snapshot.data(), latency);
+    return snapshot_json(snapshot.data());
+}
+
+char *stream_latency_json_by_id(const char *stream_id)
+{
+    std::vector<StageSnapshot> snapshot(LATENCY_STAGE_COUNT, StageSnapshot());
+    bool found = false;
+    {
+        std::lock_guard<std::mutex> lk(registry_mutex);
+        for (stream_latency *latency = registry_head; latency; latency = latency->next)
+        {
+            if (latency->stream_id == stream_id)
+            {
+                add_stream(snapshot.data(), latency);
+                found = true;
+                break;
+            }
+        }
+    }
+    return found ? snapshot_json(snapshot.data()) : nullptr;
+}
+
+char *module_latency_json(void)
+{
+    return snapshot_json(module_snapshot().data());
+}
+
+char *module_latency_prometheus(void)
+{
+    return snapshot_prometheus(module_snapshot().data());
+}
+
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file latency_metrics.h
+ * @brief Per-stage latency histograms for the streaming hot path
+ *
+ * Every stream owns one histogram per hot-path stage. Samples are counted in
+ * log-linear buckets (16 per power of two, so a reported percentile is within
+ * about 6% of the true value) with relaxed atomic adds, which keeps recording
+ * cheap enough to stay enabled in production. When a stream ends its counts are
+ * folded into module-wide totals; module-wide queries add the streams that are
+ * still running.
+ *
+ * All samples are durations in nanoseconds and are reported in microseconds.
+ * The playback depth stage records how much audio was queued for playback when
+ * the write thread consumed a frame, expressed as playing time. The two
+ * end-to-end stages follow a chunk across threads: mouth-to-wire from the media
+ * bug read to the lws_write that carried it, receive-to-playout from the first
+ * fragment of an audio message to the WRITE_REPLACE that started playing it.
+ *
+ * @author FreeSWITCH Community
+ * @version 1.0
+ * @date 2024
+ */
+#ifndef __LATENCY_METRICS_H__
+#define __LATENCY_METRICS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Hot-path stages with a latency histogram
+     */
+    typedef enum latency_stage
+    {
+        /** @brief Media bug read plus resample/encode into the stream buffer */
+        LATENCY_STAGE_CAPTURE = 0,
+
+        /** @brief Time a chunk spent in the stream buffer before being sent */
+        LATENCY_STAGE_BUFFER_WAIT,
+
+        /** @brief Building one outgoing media message */
+        LATENCY_STAGE_SERIALIZE,
+
+        /** @brief One lws_write call */
+        LATENCY_STAGE_WS_WRITE,
+
+        /** @brief Decoding one incoming audio message into the playback ring */
+        LATENCY_STAGE_INBOUND_DECODE,
+
+        /** @brief Audio queued for playback at WRITE_REPLACE */
+        LATENCY_STAGE_PLAYBACK_DEPTH,
+
+        /** @brief Media bug read of a chunk until lws_write returned with it */
+        LATENCY_STAGE_MOUTH_TO_WIRE,
+
+        /** @brief First fragment of an audio message received until WRITE_REPLACE played its first sample */
+        LATENCY_STAGE_RECEIVE_TO_PLAYOUT,
+
+        LATENCY_STAGE_COUNT
+    } latency_stage_t;
+
+    typedef struct stream_latency stream_latency_t;
+
+    /**
+     * @brief Monotonic clock used for all latency samples
+     * @return Nanoseconds since an arbitrary fixed point
+     */
+    static inline uint64_t latency_now_ns(void)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    }
+
+    /**
+     * @brief Create the histograms of a stream
+     *
+     * The stream is registered for module-wide and per-stream queries until
+     * its last reference is released.
+     *
+     * @param stream_id Stream identifier used for lookups
+     * @return New object holding one reference, or NULL on allocation failure
+     */
+    stream_latency_t *stream_latency_create(const char *stream_id);
+
+    /**
+     * @brief Take an additional reference
+     */
+    void stream_latency_retain(stream_latency_t *latency);
+
+    /**
+     * @brief Drop a reference; the last one folds the counts into the module totals
+     */
+    void stream_latency_release(stream_latency_t *latency);
+
+    /**
+     * @brief Record one sample (any thread, NULL is ignored)
+     *
+     * @param latency Stream histograms
+     * @param stage Stage the sample belongs to
+     * @param value_ns Duration in nanoseconds
+     */
+    void stream_latency_record(stream_latency_t *latency, latency_stage_t stage, uint64_t value_ns);
+
+    /**
+     * @brief Percentile summary of one stream as JSON
+     *
+     * @return malloc'd JSON object keyed by stage, or NULL on allocation failure
+     */
+    char *stream_latency_json(stream_latency_t *latency);
+
+    /**
+     * @brief Percentile summary of a running stream looked up by id
+     *
+     * @return malloc'd JSON object, or NULL if no such stream is running
+     */
+    char *stream_latency_json_by_id(const char *stream_id);
+
+    /**
+     * @brief Module-wide percentile summary over finished and running streams
+     *
+     * @return malloc'd JSON object, or NULL on allocation failure
+     */
+    char *module_latency_json(void);
+
+    /**
+     * @brief Module-wide summary in the Prometheus text exposition format
+     *
+     * One summary per stage in seconds, with the same quantiles as the JSON
+     * summary plus the sum and count of the samples, and the maximum as a gauge.
+     *
+     * @return malloc'd text, or NULL on allocation failure
+     */
+    char *module_latency_prometheus(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LATENCY_METRICS_H__ */
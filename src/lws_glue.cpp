@@ -4,22 +4,34 @@
 #include <cstdlib>
 #include <fstream>
 #include <functional>
-#include <g711.h>
 #include <list>
 #include <mutex>
+#include <new>
 #include <regex>
-#include <speex/speex_config_types.h>
 #include <sstream>
 #include <string.h>
 #include <string>
 #include <switch_json.h>
 #include <thread>
+#include <vector>
 
 #include "audio_pipe.hpp"
-#include "base64.hpp"
+#include "backpressure_ladder.hpp"
+#include "disk_spool.hpp"
+#include "g711_codec.h"
+#include "latency_metrics.h"
 #include "lws_glue.h"
+#include "message_scanner.hpp"
 #include "mod_audio_stream.h"
+#include "openai_adapter.h"
+#include "playback_decoder.hpp"
+#include "playback_ring.h"
+#include "stream_codec.hpp"
+#include "stream_registry.h"
+#include "stream_resampler.hpp"
+#include "stream_serializer.hpp"
 #include "stream_utils.hpp"
+#include "voice_activity.hpp"
 #include "switch.h"
 #include "switch_buffer.h"
 #include "switch_cJSON.h"
@@ -28,6 +40,9 @@
 
 #define RTP_PACKETIZATION_PERIOD 20
 
+/* smallest name slot of a pooled checkpoint, so most names fit any recycled node */
+#define CHECKPOINT_NAME_MIN_CAPACITY 32
+
 extern "C"
 {
     SWITCH_STANDARD_SCHED_FUNC(stream_timeout_callback)
@@ -78,6 +93,9 @@ extern "C"
     }
 }
 
+/* highest cpu index accepted in MOD_AUDIO_STREAM_SERVICE_THREAD_CPUS (glibc CPU_SETSIZE) */
+#define MAX_SERVICE_THREAD_CPU 1024
+
 namespace
 {
 static const char *requestedBufferSecs = std::getenv("MOD_AUDIO_STREAM_BUFFER_SECS");
@@ -86,31 +104,109 @@ static const char *requestedNumServiceThreads = std::getenv("MOD_AUDIO_STREAM_SE
 static const char *mySubProtocolName = std::getenv("MOD_AUDIO_STREAM_SUBPROTOCOL_NAME")
                                            ? std::getenv("MOD_AUDIO_STREAM_SUBPROTOCOL_NAME")
                                            : "audio.freeswitch.org";
-static unsigned int nServiceThreads =
-    std::max(1, std::min(requestedNumServiceThreads ? ::atoi(requestedNumServiceThreads) : 2, 5));
-static unsigned int idxCallCount = 0;
-static uint32_t play_count = 0;
 
-static switch_status_t
-g711u_decode(const void *encoded_data, uint32_t encoded_data_len, void *decoded_data, uint32_t *decoded_data_len)
+// "auto" sizes the pool to the number of cores, otherwise an explicit count
+static unsigned int parseServiceThreads(const char *requested)
 {
-    short *dbuf;
-    unsigned char *ebuf;
-    uint32_t i;
-
-    dbuf = (short *)decoded_data;
-    ebuf = (unsigned char *)encoded_data;
+    int n = 2;
+    if (requested && 0 == strcasecmp(requested, "auto"))
+        n = (int)std::thread::hardware_concurrency();
+    else if (requested)
+        n = ::atoi(requested);
+    return std::max(1, std::min(n, MAX_SERVICE_CONTEXTS));
+}
 
-    for (i = 0; i < encoded_data_len; i++)
+// "auto" pins thread i to cpu i, otherwise a list such as "0-15,32-47" (e.g. the cores of one NUMA node)
+static std::vector<int> parseServiceThreadCpus(const char *requested)
+{
+    std::vector<int> cpus;
+    if (!requested || !*requested)
+        return cpus;
+    if (0 == strcasecmp(requested, "auto"))
     {
-        dbuf[i] = ulaw_to_linear(ebuf[i]);
+        unsigned int ncpus = std::thread::hardware_concurrency();
+        for (unsigned int i = 0; i < ncpus; i++)
+            cpus.push_back(i);
+        return cpus;
     }
 
-    *decoded_data_len = i * 2;
+    std::stringstream ss(requested);
+    std::string range;
+    while (std::getline(ss, range, ','))
+    {
+        int first = -1, last = -1;
+        int fields = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (fields < 1 || first < 0)
+            continue;
+        if (fields == 1)
+            last = first;
+        for (int cpu = first; cpu <= last && cpu < MAX_SERVICE_THREAD_CPU; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
 
-    return SWITCH_STATUS_SUCCESS;
+// "conservative", "aggressive" or "balanced" presets, "none" never reconnects; otherwise the built-in default
+static reconnection_policy_t parseReconnectionPolicy(const char *requested, const char *attempts)
+{
+    reconnection_policy_t policy = AudioPipe::getReconnectionPolicy();
+    if (requested && 0 == strcasecmp(requested, "conservative"))
+        policy = ReconnectionPolicies::Conservative;
+    else if (requested && 0 == strcasecmp(requested, "aggressive"))
+        policy = ReconnectionPolicies::Aggressive;
+    else if (requested && 0 == strcasecmp(requested, "balanced"))
+        policy = ReconnectionPolicies::Balanced;
+    else if (requested && 0 == strcasecmp(requested, "none"))
+        policy.enable_reconnection = false;
+    if (attempts)
+        policy.max_reconnect_attempts = std::max(0, std::min(::atoi(attempts), 100));
+    return policy;
 }
 
+static unsigned int nServiceThreads = parseServiceThreads(requestedNumServiceThreads);
+static const char *requestedServiceThreadCpus = std::getenv("MOD_AUDIO_STREAM_SERVICE_THREAD_CPUS");
+static const char *requestedReconnectPolicy = std::getenv("MOD_AUDIO_STREAM_RECONNECT_POLICY");
+static const char *requestedReconnectAttempts = std::getenv("MOD_AUDIO_STREAM_RECONNECT_ATTEMPTS");
+static const char *requestedWarmPoolUrls = std::getenv("MOD_AUDIO_STREAM_WARM_POOL_URLS");
+static const char *requestedWarmPoolSize = std::getenv("MOD_AUDIO_STREAM_WARM_POOL_SIZE");
+static unsigned int nWarmPoolSize =
+    std::max(1, std::min(requestedWarmPoolSize ? ::atoi(requestedWarmPoolSize) : 2, 64));
+static const char *requestedWarmPoolIdleSecs = std::getenv("MOD_AUDIO_STREAM_WARM_POOL_IDLE_SECS");
+static unsigned int nWarmPoolIdleSecs =
+    std::max(5, std::min(requestedWarmPoolIdleSecs ? ::atoi(requestedWarmPoolIdleSecs) : 60, 3600));
+static const char *requestedTlsSessionCache = std::getenv("MOD_AUDIO_STREAM_TLS_SESSION_CACHE");
+static unsigned int nTlsSessionCache =
+    std::max(0, std::min(requestedTlsSessionCache ? ::atoi(requestedTlsSessionCache) : 64, 4096));
+static const char *requestedMuxConnections = std::getenv("MOD_AUDIO_STREAM_MUX_CONNECTIONS");
+static unsigned int nMuxConnections =
+    std::max(0, std::min(requestedMuxConnections ? ::atoi(requestedMuxConnections) : 0, 64));
+static const char *requestedMuxCredit = std::getenv("MOD_AUDIO_STREAM_MUX_CREDIT");
+static unsigned int nMuxCredit =
+    std::max(1, std::min(requestedMuxCredit ? ::atoi(requestedMuxCredit) : MUX_DEFAULT_CREDIT, 250));
+static const char *requestedDrainMaxChunks = std::getenv("MOD_AUDIO_STREAM_DRAIN_MAX_CHUNKS");
+static unsigned int nDrainMaxChunks =
+    std::max(1, std::min(requestedDrainMaxChunks ? ::atoi(requestedDrainMaxChunks) : 1, 250));
+static const char *requestedDrainMaxBytes = std::getenv("MOD_AUDIO_STREAM_DRAIN_MAX_BYTES");
+static size_t nDrainMaxBytes =
+    std::max(1024, std::min(requestedDrainMaxBytes ? ::atoi(requestedDrainMaxBytes) : 65536, 1048576));
+static const char *requestedBufferPoolMB = std::getenv("MOD_AUDIO_STREAM_BUFFER_POOL_MB");
+static unsigned int nBufferPoolMB = std::max(
+    0, std::min(requestedBufferPoolMB ? ::atoi(requestedBufferPoolMB) : BUFFER_STORAGE_POOL_DEFAULT_BYTES >> 20, 4096));
+static const char *requestedBufferBudgetMB = std::getenv("MOD_AUDIO_STREAM_BUFFER_BUDGET_MB");
+static unsigned int nBufferBudgetMB =
+    std::max(0, std::min(requestedBufferBudgetMB ? ::atoi(requestedBufferBudgetMB) : 0, 1048576));
+static const char *requestedSpoolDir = std::getenv("MOD_AUDIO_STREAM_SPOOL_DIR");
+static const char *requestedSpoolMaxMB = std::getenv("MOD_AUDIO_STREAM_SPOOL_MAX_MB");
+static unsigned int nSpoolMaxMB =
+    std::max(1, std::min(requestedSpoolMaxMB ? ::atoi(requestedSpoolMaxMB) : SPOOL_DEFAULT_MAX_MB, 4096));
+static const char *requestedResampleQuality = std::getenv("MOD_AUDIO_STREAM_RESAMPLE_QUALITY");
+static int nResampleQuality = std::max(
+    STREAM_RESAMPLE_MIN_QUALITY,
+    std::min(requestedResampleQuality ? ::atoi(requestedResampleQuality) : SWITCH_RESAMPLE_QUALITY,
+             STREAM_RESAMPLE_MAX_QUALITY));
+static unsigned int idxCallCount = 0;
+static uint32_t play_count = 0;
+
 // Send Events On Service URL, statusCallbackURL.
 void sendIncorrectPayloadEvent(private_data_t *tech_pvt,
                                switch_core_session_t *session,
@@ -120,12 +216,11 @@ void sendIncorrectPayloadEvent(private_data_t *tech_pvt,
     if (tech_pvt->invalid_stream_input_notified != 0)
         return;
 
-    cJSON *data = cJSON_CreateObject();
+    cJSON *data = NULL;
     char *result = NULL;
     cJSON *member = NULL;
 
     tech_pvt->invalid_stream_input_notified = 1;
-    std::stringstream msg;
     AudioPipe *audio_pipe_ptr = static_cast<AudioPipe *>(tech_pvt->audio_pipe_ptr);
     switch_log_printf(SWITCH_CHANNEL_LOG,
                       SWITCH_LOG_INFO,
@@ -133,29 +228,8 @@ void sendIncorrectPayloadEvent(private_data_t *tech_pvt,
                       tech_pvt->stream_id,
                       payload);
 
-    member = cJSON_CreateString("incorrectPayload");
-    cJSON_AddItemToObject(data, "event", member);
-
-    member = cJSON_CreateString(audio_pipe_ptr->m_streamid.c_str());
-    cJSON_AddItemToObject(data, "stream_id", member);
-
-    member = cJSON_CreateString(payload);
-    cJSON_AddItemToObject(data, "payload", member);
-
-    member = cJSON_CreateNumber(audio_pipe_ptr->getSequenceNumber());
-    cJSON_AddItemToObject(data, "sequenceNumber", member);
-
-    result = cJSON_Print(data);
-    cJSON_Delete(data);
-
-    if (result == NULL)
-    {
-        return;
-    }
-
-    audio_pipe_ptr->increaseSequenceNumber();
-    audio_pipe_ptr->addEventBuffer(std::string(result));
-    free(result);
+    // serialized and numbered on the service thread
+    audio_pipe_ptr->addControlEvent(CONTROL_EVENT_INCORRECT_PAYLOAD, payload, strlen(payload));
 
     data = cJSON_CreateObject();
 
@@ -180,62 +254,71 @@ void sendIncorrectPayloadEvent(private_data_t *tech_pvt,
 
 void storePayload(private_data_t *tech_pvt,
                   switch_core_session_t *session,
-                  std::string rawAudio,
+                  const char *payload,
+                  size_t payload_len,
+                  bool base64_encoded,
                   streaming_codec_t codec,
                   int rcvd_samplerate,
                   int current_samplerate)
 {
-    switch_size_t written = 0;
-    int err;
-    switch_mutex_lock(tech_pvt->write_buffer_mutex);
+    // decoded on the lws thread in bounded slices straight into ring segments, the write thread never waits on this
+    PlaybackDecoder *decoder = static_cast<PlaybackDecoder *>(tech_pvt->playback_decoder);
+    size_t written = 0;
 
-    if (codec == ULAW)
+    if (!decoder->set_format(codec, rcvd_samplerate))
     {
-        uint32_t len;
-        uint16_t decoded_data[rawAudio.size() * 2 + 1];
-        g711u_decode(rawAudio.data(), rawAudio.size(), &decoded_data, &len);
-        written = switch_buffer_write(tech_pvt->write_buffer, decoded_data, len);
-        tech_pvt->stream_input_received += len;
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s): unable to decode %s at %d, payload dropped\n",
+                          tech_pvt->stream_id,
+                          stream_codec_content_type(codec),
+                          rcvd_samplerate);
+        return;
     }
-    else if (codec == L16)
-    {
-        if (rcvd_samplerate != current_samplerate)
-        {
-            // Resampling..
-            spx_int16_t out[rawAudio.size()];
-            spx_uint32_t out_len = rawAudio.size();
-            spx_uint32_t ip_len = rawAudio.size();
-            std::ofstream op;
-            size_t input_len = rawAudio.size() / sizeof(uint16_t);
-            uint16_t input[input_len];
-            memcpy((void *)input, rawAudio.data(), rawAudio.size());
-            ip_len = input_len;
-
-            if (!tech_pvt->resampler_outbound)
-            {
-                tech_pvt->resampler_outbound =
-                    speex_resampler_init(1, rcvd_samplerate, current_samplerate, SWITCH_RESAMPLE_QUALITY, &err);
-                switch_log_printf(
-                    SWITCH_CHANNEL_SESSION_LOG(session),
-                    SWITCH_LOG_INFO,
-                    "mod_audio_stream(%s): initializing resampler for streamIn. rcvd(%d) cur(%d) err(%d)\n",
-                    tech_pvt->stream_id,
-                    rcvd_samplerate,
-                    current_samplerate,
-                    err);
-            }
 
-            speex_resampler_process_interleaved_int(
-                tech_pvt->resampler_outbound, (const spx_int16_t *)input, &ip_len, out, &out_len);
-            written = switch_buffer_write(tech_pvt->write_buffer, out, sizeof(spx_int16_t) * out_len);
-            tech_pvt->stream_input_received += sizeof(spx_int16_t) * out_len;
-        }
-        else
-        {
-            written = switch_buffer_write(tech_pvt->write_buffer, rawAudio.data(), rawAudio.size());
-            tech_pvt->stream_input_received += rawAudio.size();
-        }
+    // playback has its own resampler, the capture ones belong to the media bug thread and run the other way
+    StreamResampler *resampler = static_cast<StreamResampler *>(tech_pvt->playback_resampler);
+    if (rcvd_samplerate != current_samplerate && (!resampler || resampler->in_rate() != rcvd_samplerate))
+    {
+        delete resampler;
+        resampler = StreamResampler::create(1, rcvd_samplerate, current_samplerate, tech_pvt->resample_quality);
+        tech_pvt->playback_resampler = resampler;
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          resampler ? SWITCH_LOG_INFO : SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s): initializing resampler for streamIn. rcvd(%d) cur(%d) %s\n",
+                          tech_pvt->stream_id,
+                          rcvd_samplerate,
+                          current_samplerate,
+                          resampler ? resampler->implementation() : "failed");
+        if (!resampler)
+            return;
+    }
+    if (rcvd_samplerate == current_samplerate)
+        resampler = nullptr;
+
+    // receive-to-playout runs from the message's first fragment to the write thread playing its first byte
+    AudioPipe *audio_pipe = static_cast<AudioPipe *>(tech_pvt->audio_pipe_ptr);
+    if (audio_pipe)
+        playback_ring_mark(tech_pvt->write_buffer, audio_pipe->getMessageReceivedAt());
+
+    uint64_t decode_start = latency_now_ns();
+    bool complete = base64_encoded
+                        ? decoder->decode_base64(tech_pvt->write_buffer, payload, payload_len, codec, resampler, written)
+                        : decoder->decode_raw(
+                              tech_pvt->write_buffer, (const uint8_t *)payload, payload_len, codec, resampler, written);
+    stream_latency_record(tech_pvt->latency, LATENCY_STAGE_INBOUND_DECODE, latency_now_ns() - decode_start);
+    if (!complete)
+    {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_WARNING,
+                          "mod_audio_stream(%s): playback queue full, dropped the rest of a %u byte payload\n",
+                          tech_pvt->stream_id,
+                          (unsigned int)payload_len);
     }
+
+    // only this thread updates the received count, the lock orders it with checkpoints and clears
+    switch_mutex_lock(tech_pvt->write_buffer_mutex);
+    tech_pvt->stream_input_received += written;
     switch_mutex_unlock(tech_pvt->write_buffer_mutex);
 }
 
@@ -253,7 +336,7 @@ void processClearEvent(private_data_t *tech_pvt, switch_core_session_t *session,
                       tech_pvt->stream_id,
                       tech_pvt->stream_input_received,
                       tech_pvt->stream_input_played);
-    switch_buffer_zero(tech_pvt->write_buffer);
+    playback_ring_clear(tech_pvt->write_buffer);
 
     // clear all the checkpoints.
     while (NULL != tech_pvt->checkpoints)
@@ -266,26 +349,14 @@ void processClearEvent(private_data_t *tech_pvt, switch_core_session_t *session,
                           AUDIO_STREAM_LOGGING_PREFIX,
                           tech_pvt->stream_id,
                           temp->name);
-        free(temp->name);
-        free(temp);
+        stream_release_checkpoint(tech_pvt, temp);
     }
     tech_pvt->stream_input_played = 0;
     tech_pvt->stream_input_received = 0;
 
     switch_mutex_unlock(tech_pvt->write_buffer_mutex);
 
-    msg << "{"
-           "\"sequenceNumber\":"
-        << audio_pipe_ptr->getSequenceNumber()
-        << ","
-           "\"streamId\":\""
-        << tech_pvt->stream_id
-        << "\","
-           "\"event\":\"media.cleared\""
-           "}";
-    audio_pipe_ptr->addEventBuffer(msg.str());
-    audio_pipe_ptr->increaseSequenceNumber();
-    msg.str("");
+    audio_pipe_ptr->addControlEvent(CONTROL_EVENT_CLEARED, nullptr, 0);
 
     msg << "{";
     msg << "\"streamId\":\"" << audio_pipe_ptr->m_streamid << "\",";
@@ -295,6 +366,32 @@ void processClearEvent(private_data_t *tech_pvt, switch_core_session_t *session,
     tech_pvt->response_handler(session, EVENT_CLEARED_AUDIO, msg.str().c_str());
 }
 
+// Take a checkpoint from the free list if its name fits, otherwise carve node and name from the session pool.
+// Called with write_buffer_mutex held.
+stream_checkpoints_t *acquireCheckpoint(private_data_t *tech_pvt, switch_core_session_t *session, const char *name)
+{
+    size_t len = strlen(name) + 1;
+    stream_checkpoints_t **link = &tech_pvt->free_checkpoints;
+    stream_checkpoints_t *checkpoint = NULL;
+
+    while (*link && (*link)->name_capacity < len)
+        link = &(*link)->next;
+    if (*link)
+    {
+        checkpoint = *link;
+        *link = checkpoint->next;
+    }
+    else
+    {
+        size_t capacity = std::max(len, (size_t)CHECKPOINT_NAME_MIN_CAPACITY);
+        checkpoint = (stream_checkpoints_t *)switch_core_session_alloc(session, sizeof(stream_checkpoints_t) + capacity);
+        checkpoint->name = (char *)(checkpoint + 1);
+        checkpoint->name_capacity = capacity;
+    }
+    memcpy(checkpoint->name, name, len);
+    return checkpoint;
+}
+
 void processCheckpointEvent(private_data_t *tech_pvt, switch_core_session_t *session, cJSON *checkpoint)
 {
     const char *name = cJSON_GetObjectCstr(checkpoint, "name");
@@ -327,9 +424,7 @@ void processCheckpointEvent(private_data_t *tech_pvt, switch_core_session_t *ses
         return;
     }
 
-    stream_checkpoints_t *new_checkpoint = (stream_checkpoints_t *)malloc(sizeof(stream_checkpoints_t));
-    new_checkpoint->name = (char *)malloc(strlen(name) + 1);
-    strcpy(new_checkpoint->name, name);
+    stream_checkpoints_t *new_checkpoint = acquireCheckpoint(tech_pvt, session, name);
 
     new_checkpoint->position = tech_pvt->stream_input_received;
     new_checkpoint->next = NULL;
@@ -357,13 +452,117 @@ void processCheckpointEvent(private_data_t *tech_pvt, switch_core_session_t *ses
     switch_mutex_unlock(tech_pvt->write_buffer_mutex);
 }
 
-void processPlayAudioEvent(private_data_t *tech_pvt, switch_core_session_t *session, const char *payload, cJSON *json)
+void playAudioPayload(private_data_t *tech_pvt,
+                      switch_core_session_t *session,
+                      const char *payload,
+                      const json_string_view_t &contentType,
+                      int rcvd_samplerate,
+                      const json_string_view_t &audio)
 {
-    // dont send actual audio bytes in event message
-    int rcvd_samplerate = 8000;
-    int current_samplerate = rcvd_samplerate;
+    int current_samplerate = 8000;
     streaming_codec_t codec = L16;
     switch_codec_t *read_codec;
+
+    if (rcvd_samplerate != 8000 && rcvd_samplerate != 16000)
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_DEBUG,
+                          "mod_audio_stream:(%s) - samplerate (%d) unsupported. defaulting to (8000)\n",
+                          tech_pvt->stream_id,
+                          rcvd_samplerate);
+        rcvd_samplerate = 8000;
+    }
+
+    if (contentType.equals("audio/x-l16"))
+    {
+        codec = L16;
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream(%s): received content type (%.*s).\n",
+                          tech_pvt->stream_id,
+                          (int)contentType.len,
+                          contentType.data);
+    }
+    else if (contentType.equals("audio/x-mulaw"))
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream(%s): received content type (%.*s).\n",
+                          tech_pvt->stream_id,
+                          (int)contentType.len,
+                          contentType.data);
+        codec = ULAW;
+        if (rcvd_samplerate != 8000)
+        {
+            switch_log_printf(SWITCH_CHANNEL_LOG,
+                              SWITCH_LOG_ERROR,
+                              "mod_audio_stream(%s): Unsupported combination of codec(%.*s), samplerate (%d)\n",
+                              tech_pvt->stream_id,
+                              (int)contentType.len,
+                              contentType.data,
+                              rcvd_samplerate);
+            sendIncorrectPayloadEvent(tech_pvt, session, payload, "Unsupported combination of codec, samplerate");
+            return;
+        }
+    }
+    else if (contentType.equals("audio/opus") || contentType.equals("audio/G722") || contentType.equals("audio/g722"))
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream(%s): received content type (%.*s).\n",
+                          tech_pvt->stream_id,
+                          (int)contentType.len,
+                          contentType.data);
+        codec = contentType.equals("audio/opus") ? OPUS : G722;
+        // G.722 is always 16 kHz audio, whatever RTP style clock rate the sender put in sampleRate
+        if (codec == G722)
+            rcvd_samplerate = 16000;
+        if (const char *reason = stream_codec_unsupported(codec, rcvd_samplerate))
+        {
+            switch_log_printf(SWITCH_CHANNEL_LOG,
+                              SWITCH_LOG_ERROR,
+                              "mod_audio_stream(%s): Unsupported codec(%.*s): %s\n",
+                              tech_pvt->stream_id,
+                              (int)contentType.len,
+                              contentType.data,
+                              reason);
+            sendIncorrectPayloadEvent(tech_pvt, session, payload, "Unsupported codec");
+            return;
+        }
+    }
+    else if (contentType.equals("raw") || contentType.equals("wav"))
+    {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream(%s): received '%.*s' contentType. setting default codec to l16.\n",
+                          tech_pvt->stream_id,
+                          (int)contentType.len,
+                          contentType.data);
+        codec = L16;
+    }
+    else
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream:(%s) - unsupported contentType: %.*s\n",
+                          tech_pvt->stream_id,
+                          (int)contentType.len,
+                          contentType.data);
+        sendIncorrectPayloadEvent(tech_pvt, session, payload, "Invalid Content type");
+        return;
+    }
+
+    read_codec = switch_core_session_get_read_codec(session);
+    if (NULL != read_codec && read_codec->implementation != NULL)
+    {
+        current_samplerate = read_codec->implementation->actual_samples_per_second;
+    }
+
+    storePayload(tech_pvt, session, audio.data, audio.len, true, codec, rcvd_samplerate, current_samplerate);
+}
+
+void processPlayAudioEvent(private_data_t *tech_pvt, switch_core_session_t *session, const char *payload, cJSON *json)
+{
     switch_channel_t *channel = NULL;
 
     /* Get channel var */
@@ -417,7 +616,30 @@ void processPlayAudioEvent(private_data_t *tech_pvt, switch_core_session_t *sess
         return;
     }
 
-    rcvd_samplerate = jsonSampleRate->valueint;
+    json_string_view_t contentType = {jsonContentType, strlen(jsonContentType)};
+    json_string_view_t audio = {jsonPayload, strlen(jsonPayload)};
+    playAudioPayload(tech_pvt, session, payload, contentType, jsonSampleRate->valueint, audio);
+}
+
+void processPlayAudioBinary(private_data_t *tech_pvt, switch_core_session_t *session, const uint8_t *data, size_t len)
+{
+    binary_media_header_t header;
+    int rcvd_samplerate = 8000;
+    int current_samplerate = rcvd_samplerate;
+    switch_codec_t *read_codec;
+
+    if (!decode_binary_media_header(data, len, header))
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream:(%s) - invalid binary media header, len(%lu).\n",
+                          tech_pvt->stream_id,
+                          len);
+        sendIncorrectPayloadEvent(tech_pvt, session, "binary media frame", "Invalid binary media header");
+        return;
+    }
+
+    rcvd_samplerate = header.sample_rate;
     if (rcvd_samplerate != 8000 && rcvd_samplerate != 16000)
     {
         switch_log_printf(SWITCH_CHANNEL_LOG,
@@ -428,63 +650,131 @@ void processPlayAudioEvent(private_data_t *tech_pvt, switch_core_session_t *sess
         rcvd_samplerate = 8000;
     }
 
-    if (0 == strcmp(jsonContentType, "audio/x-l16"))
+    if (header.codec == ULAW && rcvd_samplerate != 8000)
     {
-        codec = L16;
         switch_log_printf(SWITCH_CHANNEL_LOG,
-                          SWITCH_LOG_INFO,
-                          "mod_audio_stream(%s): received content type (%s).\n",
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s): Unsupported combination of codec(audio/x-mulaw), samplerate (%d)\n",
                           tech_pvt->stream_id,
-                          jsonContentType);
+                          rcvd_samplerate);
+        sendIncorrectPayloadEvent(
+            tech_pvt, session, "binary media frame", "Unsupported combination of codec, samplerate");
+        return;
     }
-    else if (0 == strcmp(jsonContentType, "audio/x-mulaw"))
+
+    if (header.codec == G722)
+        rcvd_samplerate = 16000;
+    if (const char *reason = stream_codec_unsupported(header.codec, rcvd_samplerate))
     {
         switch_log_printf(SWITCH_CHANNEL_LOG,
-                          SWITCH_LOG_INFO,
-                          "mod_audio_stream(%s): received content type (%s).\n",
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s): Unsupported codec(%s): %s\n",
                           tech_pvt->stream_id,
-                          jsonContentType);
-        codec = ULAW;
-        if (rcvd_samplerate != 8000)
-        {
-            switch_log_printf(SWITCH_CHANNEL_LOG,
-                              SWITCH_LOG_ERROR,
-                              "mod_audio_stream(%s): Unsupported combination of codec(%s), samplerate (%d)\n",
-                              tech_pvt->stream_id,
-                              jsonContentType,
-                              rcvd_samplerate);
-            sendIncorrectPayloadEvent(tech_pvt, session, payload, "Unsupported combination of codec, samplerate");
-            return;
-        }
+                          stream_codec_content_type(header.codec),
+                          reason);
+        sendIncorrectPayloadEvent(tech_pvt, session, "binary media frame", "Unsupported codec");
+        return;
     }
-    else if (0 == strcmp(jsonContentType, "raw") || 0 == strcmp(jsonContentType, "wav"))
+
+    read_codec = switch_core_session_get_read_codec(session);
+    if (NULL != read_codec && read_codec->implementation != NULL)
     {
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
-                          SWITCH_LOG_INFO,
-                          "mod_audio_stream(%s): received '%s' contentType. setting default codec to l16.\n",
-                          tech_pvt->stream_id,
-                          jsonContentType);
-        codec = L16;
+        current_samplerate = read_codec->implementation->actual_samples_per_second;
     }
-    else
+
+    storePayload(tech_pvt,
+                 session,
+                 (const char *)data + BINARY_MEDIA_HEADER_SIZE,
+                 len - BINARY_MEDIA_HEADER_SIZE,
+                 false,
+                 header.codec,
+                 rcvd_samplerate,
+                 current_samplerate);
+}
+
+// OpenAI Realtime events. Audio deltas go to the playback ring, the events a dialplan acts on are raised as
+// mod_audio_stream::openai_* and everything else as message_received.
+void processRealtimeMessage(private_data_t *tech_pvt, switch_core_session_t *session, const char *message)
+{
+    int current_samplerate = 8000;
+    switch_codec_t *read_codec = switch_core_session_get_read_codec(session);
+    if (NULL != read_codec && read_codec->implementation != NULL)
+    {
+        current_samplerate = read_codec->implementation->actual_samples_per_second;
+    }
+
+    // nearly all of the bytes a session receives, decoded from the receive buffer without a DOM
+    json_string_view_t delta;
+    if (scan_realtime_audio_delta(message, strlen(message), delta))
+    {
+        if (tech_pvt->is_bidirectional)
+            storePayload(tech_pvt, session, delta.data, delta.len, true, L16, REALTIME_SAMPLE_RATE, current_samplerate);
+        return;
+    }
+
+    cJSON *json = cJSON_Parse(message);
+    const char *type = json ? cJSON_GetObjectCstr(json, "type") : NULL;
+    if (type == NULL)
     {
         switch_log_printf(SWITCH_CHANNEL_LOG,
                           SWITCH_LOG_ERROR,
-                          "mod_audio_stream:(%s) - unsupported contentType: %s\n",
+                          "mod_audio_stream(%s) - could not parse realtime message: %s\n",
                           tech_pvt->stream_id,
-                          jsonContentType);
-        sendIncorrectPayloadEvent(tech_pvt, session, payload, "Invalid Content type");
+                          message);
+        sendIncorrectPayloadEvent(tech_pvt, session, message, json ? "No type key" : "Invalid Json");
+        cJSON_Delete(json);
         return;
     }
 
-    std::string rawAudio = base64::base64_decode(jsonPayload);
-    read_codec = switch_core_session_get_read_codec(session);
-    if (NULL != read_codec && read_codec->implementation != NULL)
+    switch_log_printf(SWITCH_CHANNEL_LOG,
+                      SWITCH_LOG_DEBUG,
+                      "mod_audio_stream:(%s) - received realtime %s event.\n",
+                      tech_pvt->stream_id,
+                      type);
+
+    if (0 == strcmp(type, "response.audio.delta") || 0 == strcmp(type, "response.output_audio.delta"))
     {
-        current_samplerate = read_codec->implementation->actual_samples_per_second;
+        // escaped base64, rare enough to take the long way
+        const char *audio = cJSON_GetObjectCstr(json, "delta");
+        if (audio && tech_pvt->is_bidirectional)
+            storePayload(tech_pvt, session, audio, strlen(audio), true, L16, REALTIME_SAMPLE_RATE, current_samplerate);
     }
-
-    storePayload(tech_pvt, session, rawAudio, codec, rcvd_samplerate, current_samplerate);
+    else if (0 == strcmp(type, "session.created"))
+    {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream(%s) realtime session created\n",
+                          tech_pvt->stream_id);
+        tech_pvt->response_handler(session, EVENT_OPENAI_SESSION_CREATED, message);
+    }
+    else if (0 == strcmp(type, "response.audio_transcript.delta"))
+    {
+        tech_pvt->response_handler(session, EVENT_OPENAI_TRANSCRIPTION_DELTA, message);
+    }
+    else if (0 == strcmp(type, "input_audio_buffer.speech_started"))
+    {
+        tech_pvt->response_handler(session, EVENT_OPENAI_SPEECH_STARTED, message);
+    }
+    else if (0 == strcmp(type, "input_audio_buffer.speech_stopped"))
+    {
+        tech_pvt->response_handler(session, EVENT_OPENAI_SPEECH_STOPPED, message);
+    }
+    else if (0 == strcmp(type, "error"))
+    {
+        cJSON *error = cJSON_GetObjectItem(json, "error");
+        const char *reason = error ? cJSON_GetObjectCstr(error, "message") : NULL;
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s) realtime error: %s\n",
+                          tech_pvt->stream_id,
+                          reason ? reason : "unknown");
+        tech_pvt->response_handler(session, EVENT_OPENAI_ERROR, message);
+    }
+    else
+    {
+        tech_pvt->response_handler(session, EVENT_JSON, message);
+    }
+    cJSON_Delete(json);
 }
 
 void processIncomingMessage(private_data_t *tech_pvt, switch_core_session_t *session, const char *message)
@@ -500,6 +790,24 @@ void processIncomingMessage(private_data_t *tech_pvt, switch_core_session_t *ses
         return;
     }
 
+    if (tech_pvt->realtime)
+    {
+        processRealtimeMessage(tech_pvt, session, message);
+        return;
+    }
+
+    // media.play carries the bulk of the bytes, take it straight from the receive buffer without a DOM
+    media_play_view_t play;
+    if (scan_media_play(message, strlen(message), play))
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_DEBUG,
+                          "mod_audio_stream:(%s) - processing media.play event.\n",
+                          tech_pvt->stream_id);
+        playAudioPayload(tech_pvt, session, message, play.content_type, play.sample_rate, play.payload);
+        return;
+    }
+
     json = cJSON_Parse(message);
     if (json == NULL)
     {
@@ -583,6 +891,54 @@ void processIncomingMessage(private_data_t *tech_pvt, switch_core_session_t *ses
     cJSON_Delete(json);
 }
 
+// Puts the ladder's new level into force and reports the step; media bug thread, under tech_pvt->mutex.
+static void applyDegradation(private_data_t *tech_pvt, AudioPipe *audio_pipe_ptr, BackpressureLadder *ladder)
+{
+    int level = ladder->level();
+    audio_pipe_ptr->setDegradation(level);
+    stream_registry_set(tech_pvt->registry, STREAM_GAUGE_DEGRADATION, (uint64_t)level);
+    bool reduced = level >= DEGRADE_CODEC && ladder->has_step(DEGRADE_CODEC);
+    for (void *encoder : {tech_pvt->encoder, tech_pvt->encoder_outbound})
+    {
+        if (encoder)
+            static_cast<StreamEncoder *>(encoder)->reduce_bitrate(reduced);
+    }
+
+    char json[384];
+    snprintf(json,
+             sizeof(json),
+             "{\"streamId\":\"%s\",\"level\":%d,\"step\":\"%s\",\"previousStep\":\"%s\",\"backlogMs\":%u,"
+             "\"uplinkPercent\":%u,\"droppedChunks\":%llu}",
+             tech_pvt->stream_id,
+             level,
+             degradation_step_name(level),
+             degradation_step_name(ladder->previous()),
+             ladder->backlog_ms(),
+             ladder->uplink_percent(),
+             (unsigned long long)(ladder->dropped_outbound() + audio_pipe_ptr->getBacklogDropped()));
+    audio_pipe_ptr->m_callback(
+        audio_pipe_ptr->m_uuid.c_str(), audio_pipe_ptr->m_streamid.c_str(), AudioPipe::MEDIA_DEGRADATION, json);
+}
+
+// Writes the silence runs still held back so the stream's timeline reaches its end before the stop message; under
+// tech_pvt->mutex, which keeps the media bug from producing into the buffers meanwhile.
+static void flushPendingSilence(private_data_t *tech_pvt, AudioPipe *audio_pipe_ptr)
+{
+    chunk_stamps_t stamps{};
+    stamps.captured_ns = stamps.enqueued_ns = latency_now_ns();
+    Buffer *outboundBuffer = audio_pipe_ptr->needsBothTracks() ? audio_pipe_ptr->m_ob_audio_buffer : NULL;
+    VoiceActivityDetector *vad = static_cast<VoiceActivityDetector *>(tech_pvt->vad);
+    if (vad && vad->pending_silence() > 0)
+        audio_pipe_ptr->m_audio_buffer->write_silence(vad->take_silence(), stamps);
+    vad = static_cast<VoiceActivityDetector *>(tech_pvt->vad_outbound);
+    if (outboundBuffer && vad && vad->pending_silence() > 0)
+        outboundBuffer->write_silence(vad->take_silence(), stamps);
+    BackpressureLadder *ladder = static_cast<BackpressureLadder *>(tech_pvt->backpressure);
+    if (outboundBuffer && ladder && ladder->pending_outbound() > 0 &&
+        outboundBuffer->write_silence(ladder->pending_outbound(), stamps))
+        ladder->take_outbound();
+}
+
 static void
 eventCallback(const char *session_id, const char *stream_id, AudioPipe::NotifyEvent_t event, const char *message)
 {
@@ -741,6 +1097,21 @@ eventCallback(const char *session_id, const char *stream_id, AudioPipe::NotifyEv
                         processIncomingMessage(tech_pvt, session, message);
                         break;
                     }
+                    case AudioPipe::LATENCY_TRACE:
+                    {
+                        stream_publish_latency_trace(session, message);
+                        break;
+                    }
+                    case AudioPipe::MEDIA_DEGRADATION:
+                    {
+                        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                                          SWITCH_LOG_WARNING,
+                                          "mod_audio_stream(%s) media degradation: %s\n",
+                                          tech_pvt->stream_id,
+                                          message);
+                        tech_pvt->response_handler(session, EVENT_MEDIA_DEGRADATION, (char *)message);
+                        break;
+                    }
                 }
             }
         }
@@ -755,6 +1126,42 @@ eventCallback(const char *session_id, const char *stream_id, AudioPipe::NotifyEv
     }
 }
 
+// Binary frames are only delivered when the stream negotiated binary framing;
+// they carry media.play audio behind a binary_media_header_t.
+static void binaryEventCallback(const char *session_id, const char *stream_id, const uint8_t *data, size_t len)
+{
+    switch_core_session_t *session = switch_core_session_locate(session_id);
+    if (session)
+    {
+        switch_channel_t *channel = switch_core_session_get_channel(session);
+        switch_media_bug_t *bug = (switch_media_bug_t *)switch_channel_get_private(channel, stream_id);
+        if (bug)
+        {
+            media_bug_callback_args_t *bug_args = (media_bug_callback_args_t *)switch_core_media_bug_get_user_data(bug);
+            private_data_t *tech_pvt = (bug_args) ? bug_args->session_context : NULL;
+            if (tech_pvt)
+            {
+                processPlayAudioBinary(tech_pvt, session, data, len);
+            }
+        }
+        switch_core_session_rwunlock(session);
+    }
+    else
+    {
+        lwsl_notice("mod_audio_stream: (%s) [binaryEventCallback] unable to locate the session (%s).",
+                    stream_id,
+                    session_id);
+    }
+}
+
+// A pipe that was never connected belongs to the thread initialising the stream, so a
+// failure after it was created deletes it here instead of waiting for a close event.
+static void discardAudioPipe(private_data_t *tech_pvt)
+{
+    delete static_cast<AudioPipe *>(tech_pvt->audio_pipe_ptr);
+    tech_pvt->audio_pipe_ptr = nullptr;
+}
+
 switch_status_t stream_data_init(private_data_t *tech_pvt,
                                  char *stream_id,
                                  switch_core_session_t *session,
@@ -764,6 +1171,7 @@ switch_status_t stream_data_init(private_data_t *tech_pvt,
                                  char *path,
                                  int sslFlags,
                                  streaming_codec_t codec,
+                                 streaming_framing_t framing,
                                  int sampling,
                                  int desiredSampling,
                                  int channels,
@@ -776,7 +1184,6 @@ switch_status_t stream_data_init(private_data_t *tech_pvt,
 
     const char *username = nullptr;
     const char *password = nullptr;
-    int err;
     switch_codec_implementation_t read_impl;
     switch_channel_t *channel = switch_core_session_get_channel(session);
 
@@ -787,6 +1194,101 @@ switch_status_t stream_data_init(private_data_t *tech_pvt,
         password = switch_channel_get_variable(channel, "MOD_AUDIO_BASIC_AUTH_PASSWORD");
     }
 
+    // number of 20ms chunks packed into each media message, 1 keeps one message per packet
+    unsigned int chunksPerMessage = 1;
+    if (const char *chunks = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_CHUNKS_PER_MESSAGE"))
+    {
+        chunksPerMessage = std::max(1, std::min(::atoi(chunks), MAX_CHUNKS_PER_MESSAGE));
+    }
+
+    // "replace" drops the channel audio under incoming audio instead of mixing, for media-only bots
+    const char *playbackMode = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_PLAYBACK_MODE");
+    bool playbackReplace = playbackMode && 0 == strcasecmp(playbackMode, "replace");
+
+    // one latency trace event per this many media messages in each direction, unset or 0 disables
+    unsigned int traceEvery = 0;
+    if (const char *trace = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_TRACE_SAMPLE"))
+    {
+        traceEvery = (unsigned int)std::max(0, ::atoi(trace));
+    }
+
+    // audio captured before the connection is up, up to this many ms of it is sent on connect, unset or 0 drops it
+    unsigned int prerollMs = 0;
+    if (const char *preroll = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_PREROLL_MS"))
+    {
+        prerollMs = (unsigned int)std::max(0, std::min(::atoi(preroll), MAX_PREROLL_MS));
+    }
+
+    // playedStream events queued within this many ms of each other go out as one message, unset or 0 sends each
+    unsigned int eventCoalesceMs = 0;
+    if (const char *coalesce = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_EVENT_COALESCE_MS"))
+    {
+        eventCoalesceMs = (unsigned int)std::max(0, std::min(::atoi(coalesce), MAX_EVENT_COALESCE_MS));
+    }
+
+    if (const char *reason = stream_codec_unsupported(codec, desiredSampling))
+    {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s) cannot stream %s at %d: %s\n",
+                          stream_id,
+                          stream_codec_content_type(codec),
+                          desiredSampling,
+                          reason);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    // Opus encoder settings, per stream so each call can trade bandwidth for quality
+    int opusBitrate = STREAM_OPUS_DEFAULT_BITRATE;
+    if (const char *bitrate = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_OPUS_BITRATE"))
+    {
+        opusBitrate = std::max(STREAM_OPUS_MIN_BITRATE, std::min(::atoi(bitrate), STREAM_OPUS_MAX_BITRATE));
+    }
+    int opusComplexity = STREAM_OPUS_DEFAULT_COMPLEXITY;
+    if (const char *complexity = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_OPUS_COMPLEXITY"))
+    {
+        opusComplexity = std::max(0, std::min(::atoi(complexity), 10));
+    }
+    // silence suppression, off unless asked for since a server has to understand the silence events
+    bool vadEnabled = switch_true(switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_VAD"));
+    if (vadEnabled && framing == FRAMING_REALTIME)
+    {
+        // server side turn detection needs the silence to see the end of a turn
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_WARNING,
+                          "mod_audio_stream(%s) no silence suppression on a realtime session\n",
+                          stream_id);
+        vadEnabled = false;
+    }
+    int vadThresholdDb = VAD_DEFAULT_THRESHOLD_DB;
+    if (const char *threshold = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_VAD_THRESHOLD_DB"))
+    {
+        vadThresholdDb = std::max(VAD_MIN_THRESHOLD_DB, std::min(::atoi(threshold), VAD_MAX_THRESHOLD_DB));
+    }
+    unsigned int vadHangoverMs = VAD_DEFAULT_HANGOVER_MS;
+    if (const char *hangover = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_VAD_HANGOVER_MS"))
+    {
+        vadHangoverMs = (unsigned int)std::max(0, std::min(::atoi(hangover), VAD_MAX_HANGOVER_MS));
+    }
+    // audio queued in memory from which the rest spills to a file, unset or 0 keeps it all in memory
+    unsigned int spoolMs = 0;
+    if (const char *spool = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_SPOOL_MS"))
+    {
+        spoolMs = (unsigned int)std::max(0, std::min(::atoi(spool), nAudioBufferSecs * 1000));
+        if (spoolMs > 0 && spoolMs < RTP_PACKETIZATION_PERIOD)
+            spoolMs = RTP_PACKETIZATION_PERIOD;
+    }
+    // backpressure ladder, off unless asked for since its codec step changes what a server receives
+    unsigned int degradeMs[DEGRADE_LEVELS];
+    bool degradeEnabled =
+        degradation_parse_thresholds(switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_DEGRADE_MS"), degradeMs);
+    int resampleQuality = nResampleQuality;
+    if (const char *quality = switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_RESAMPLE_QUALITY"))
+    {
+        resampleQuality =
+            std::max(STREAM_RESAMPLE_MIN_QUALITY, std::min(::atoi(quality), STREAM_RESAMPLE_MAX_QUALITY));
+    }
+
     memset(tech_pvt, 0, sizeof(private_data_t));
 
     strncpy(tech_pvt->session_id, switch_core_session_get_uuid(session), MAX_SESSION_ID_LENGTH);
@@ -808,9 +1310,14 @@ switch_status_t stream_data_init(private_data_t *tech_pvt,
     tech_pvt->is_started = 0;
     tech_pvt->resampler = NULL;
     tech_pvt->resampler_outbound = NULL;
+    tech_pvt->playback_resampler = NULL;
+    tech_pvt->resample_quality = resampleQuality;
     tech_pvt->play_count = 0;
     tech_pvt->channel_closing = 0;
     tech_pvt->invalid_stream_input_notified = 0;
+    tech_pvt->playback_replace = playbackReplace ? 1 : 0;
+    tech_pvt->realtime = framing == FRAMING_REALTIME ? 1 : 0;
+    tech_pvt->trace_every = traceEvery;
     strncpy(tech_pvt->stream_id, stream_id, MAX_SESSION_ID_LENGTH);
 
     if (metadata)
@@ -818,22 +1325,66 @@ switch_status_t stream_data_init(private_data_t *tech_pvt,
 
     if (is_bidirectional)
     {
-        // TODO:: size can be increased
-        int len = desiredSampling / 10 * 2 * channels; // 100 ms
         switch_mutex_init(&tech_pvt->write_buffer_mutex, SWITCH_MUTEX_NESTED, switch_core_session_get_pool(session));
-        switch_buffer_create_dynamic(&tech_pvt->write_buffer, len, len, 0);
+        tech_pvt->write_buffer = playback_ring_create();
+        tech_pvt->playback_decoder = new (std::nothrow) PlaybackDecoder();
+        if (!tech_pvt->write_buffer || !tech_pvt->playback_decoder)
+        {
+            switch_log_printf(
+                SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Error allocating playback buffer\n");
+            return SWITCH_STATUS_FALSE;
+        }
         tech_pvt->stream_input_received = 0;
         tech_pvt->stream_input_played = 0;
         tech_pvt->checkpoints = NULL;
+        tech_pvt->free_checkpoints = NULL;
     }
 
-    size_t buflen = (L16_FRAME_SIZE_8KHZ_20MS * desiredSampling / 8000 * channels * 1000 / RTP_PACKETIZATION_PERIOD *
-                     nAudioBufferSecs);
+    size_t buflen = (stream_codec_chunk_bytes(codec, desiredSampling, opusBitrate) * channels * 1000 /
+                     RTP_PACKETIZATION_PERIOD * nAudioBufferSecs);
 
-    if (codec == ULAW)
+    if (codec == OPUS || codec == G722)
     {
-        buflen = (ULAW_FRAME_SIZE_8KHZ_20MS * desiredSampling / 8000 * channels * 1000 / RTP_PACKETIZATION_PERIOD *
-                  nAudioBufferSecs);
+        tech_pvt->encoder = StreamEncoder::create(codec, desiredSampling, opusBitrate, opusComplexity);
+        if (tech_pvt->encoder && 0 == strcmp(tech_pvt->track, "both"))
+            tech_pvt->encoder_outbound = StreamEncoder::create(codec, desiredSampling, opusBitrate, opusComplexity);
+        if (!tech_pvt->encoder || (0 == strcmp(tech_pvt->track, "both") && !tech_pvt->encoder_outbound))
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                              SWITCH_LOG_ERROR,
+                              "mod_audio_stream(%s) Error creating %s encoder\n",
+                              tech_pvt->stream_id,
+                              stream_codec_content_type(codec));
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream(%s) encoding %s at %d Hz, %d bit/s\n",
+                          tech_pvt->stream_id,
+                          stream_codec_content_type(codec),
+                          desiredSampling,
+                          codec == OPUS ? opusBitrate : 64000);
+    }
+
+    if (vadEnabled)
+    {
+        tech_pvt->vad = new (std::nothrow) VoiceActivityDetector(vadThresholdDb, vadHangoverMs);
+        if (tech_pvt->vad && 0 == strcmp(tech_pvt->track, "both"))
+            tech_pvt->vad_outbound = new (std::nothrow) VoiceActivityDetector(vadThresholdDb, vadHangoverMs);
+        if (!tech_pvt->vad || (0 == strcmp(tech_pvt->track, "both") && !tech_pvt->vad_outbound))
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                              SWITCH_LOG_ERROR,
+                              "mod_audio_stream(%s) Error allocating voice activity detector\n",
+                              tech_pvt->stream_id);
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream(%s) suppressing silence below %d dBFS, %u ms hangover\n",
+                          tech_pvt->stream_id,
+                          vadThresholdDb,
+                          vadHangoverMs);
     }
 
     AudioPipe *ap = new AudioPipe(tech_pvt->session_id,
@@ -850,7 +1401,11 @@ switch_status_t stream_data_init(private_data_t *tech_pvt,
                                   tech_pvt->initial_metadata,
                                   codec,
                                   desiredSampling,
-                                  is_bidirectional);
+                                  is_bidirectional,
+                                  framing,
+                                  binaryEventCallback,
+                                  chunksPerMessage,
+                                  opusBitrate);
 
     if (!ap)
     {
@@ -859,6 +1414,92 @@ switch_status_t stream_data_init(private_data_t *tech_pvt,
     }
 
     tech_pvt->audio_pipe_ptr = static_cast<void *>(ap);
+    ap->setTraceSampling(traceEvery);
+    ap->setPreroll(prerollMs);
+    ap->setEventCoalesce(eventCoalesceMs);
+    if (framing == FRAMING_REALTIME)
+    {
+        // set by openai_start from its api_key argument, otherwise the module's environment
+        const char *apiKey = switch_channel_get_variable(channel, "OPENAI_API_KEY");
+        if (!apiKey)
+            apiKey = std::getenv("OPENAI_API_KEY");
+        if (!apiKey && !username)
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                              SWITCH_LOG_WARNING,
+                              "mod_audio_stream(%s) no OPENAI_API_KEY for the realtime session\n",
+                              tech_pvt->stream_id);
+        }
+        ap->setBearerToken(apiKey);
+    }
+    if (spoolMs > 0)
+    {
+        // one file per buffer, removed by stream_session_cleanup along with the playout files
+        const char *dir = requestedSpoolDir ? requestedSpoolDir : SWITCH_GLOBAL_dirs.temp_dir;
+        for (Buffer *buffer : {ap->m_audio_buffer, ap->m_ob_audio_buffer})
+        {
+            if (!buffer)
+                continue;
+            std::stringstream file;
+            file << dir << "/mod_audio_stream-" << tech_pvt->session_id << "-" << tech_pvt->id << "-"
+                 << (buffer == ap->m_audio_buffer ? "0" : "1") << ".spool";
+            DiskSpool *spool = DiskSpool::create(file.str(), buffer->chunk_size_bytes_, (size_t)nSpoolMaxMB << 20);
+            struct playout *entry = spool ? (struct playout *)malloc(sizeof(struct playout)) : NULL;
+            if (entry)
+                entry->file = strdup(spool->path().c_str());
+            if (!entry || !entry->file)
+            {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                                  SWITCH_LOG_ERROR,
+                                  "mod_audio_stream(%s) Error setting up the disk spool\n",
+                                  tech_pvt->stream_id);
+                free(entry);
+                delete spool;
+                discardAudioPipe(tech_pvt);
+                return SWITCH_STATUS_FALSE;
+            }
+            entry->next = tech_pvt->playout;
+            tech_pvt->playout = entry;
+            buffer->attach_spool(spool, spoolMs / RTP_PACKETIZATION_PERIOD);
+        }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream(%s) spooling audio to %s beyond %u ms in memory, up to %u MB per track\n",
+                          tech_pvt->stream_id,
+                          dir,
+                          spoolMs,
+                          nSpoolMaxMB);
+    }
+    if (degradeEnabled)
+    {
+        // steps with nothing to change for this stream are left out of its ladder, a spooling stream loses nothing
+        unsigned int steps = (1u << DEGRADE_BATCH) | (spoolMs > 0 ? 0 : 1u << DEGRADE_DROP_OLDEST);
+        if (codec == OPUS || (codec == L16 && framing != FRAMING_REALTIME))
+            steps |= 1u << DEGRADE_CODEC;
+        if (0 == strcmp(tech_pvt->track, "both"))
+            steps |= 1u << DEGRADE_DROP_OUTBOUND;
+        BackpressureLadder *ladder = new (std::nothrow) BackpressureLadder(degradeMs, RTP_PACKETIZATION_PERIOD, steps);
+        if (!ladder)
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                              SWITCH_LOG_ERROR,
+                              "mod_audio_stream(%s) Error allocating backpressure ladder\n",
+                              tech_pvt->stream_id);
+            discardAudioPipe(tech_pvt);
+            return SWITCH_STATUS_FALSE;
+        }
+        tech_pvt->backpressure = ladder;
+        if (ladder->has_step(DEGRADE_DROP_OLDEST))
+            ap->setBacklogCap(degradeMs[DEGRADE_DROP_OLDEST] / RTP_PACKETIZATION_PERIOD);
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_INFO,
+                          "mod_audio_stream(%s) degrading media at %u/%u/%u/%u ms of backlog\n",
+                          tech_pvt->stream_id,
+                          ladder->has_step(DEGRADE_BATCH) ? degradeMs[DEGRADE_BATCH] : 0,
+                          ladder->has_step(DEGRADE_CODEC) ? degradeMs[DEGRADE_CODEC] : 0,
+                          ladder->has_step(DEGRADE_DROP_OUTBOUND) ? degradeMs[DEGRADE_DROP_OUTBOUND] : 0,
+                          ladder->has_step(DEGRADE_DROP_OLDEST) ? degradeMs[DEGRADE_DROP_OLDEST] : 0);
+    }
 
     switch_mutex_init(&tech_pvt->mutex, SWITCH_MUTEX_NESTED, switch_core_session_get_pool(session));
     if (desiredSampling == sampling)
@@ -880,15 +1521,25 @@ switch_status_t stream_data_init(private_data_t *tech_pvt,
                           sampling,
                           desiredSampling);
 
-        tech_pvt->resampler = speex_resampler_init(channels, sampling, desiredSampling, SWITCH_RESAMPLE_QUALITY, &err);
-        if (0 != err)
+        StreamResampler *resampler = StreamResampler::create(channels, sampling, desiredSampling, resampleQuality);
+        tech_pvt->resampler = resampler;
+        if (!resampler)
         {
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
                               SWITCH_LOG_ERROR,
-                              "Error initializing resampler: %s.\n",
-                              speex_resampler_strerror(err));
+                              "mod_audio_stream(%s) Error initializing resampler from %u to %u\n",
+                              tech_pvt->stream_id,
+                              sampling,
+                              desiredSampling);
+            discardAudioPipe(tech_pvt);
             return SWITCH_STATUS_FALSE;
         }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                          SWITCH_LOG_DEBUG,
+                          "mod_audio_stream(%s) resampler %s, quality %d\n",
+                          tech_pvt->stream_id,
+                          resampler->implementation(),
+                          resampler->quality());
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
                           SWITCH_LOG_DEBUG,
                           "mod_audio_stream(%s) tech_pvt->track(%s) track(%s)\n",
@@ -906,19 +1557,27 @@ switch_status_t stream_data_init(private_data_t *tech_pvt,
                               sampling,
                               desiredSampling);
             tech_pvt->resampler_outbound =
-                speex_resampler_init(channels, sampling, desiredSampling, SWITCH_RESAMPLE_QUALITY, &err);
-            if (0 != err)
+                StreamResampler::create(channels, sampling, desiredSampling, resampleQuality);
+            if (!tech_pvt->resampler_outbound)
             {
                 switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
                                   SWITCH_LOG_ERROR,
-                                  "mod_audio_stream(%s) Error initializing resampler: %s.\n",
+                                  "mod_audio_stream(%s) Error initializing resampler from %u to %u\n",
                                   tech_pvt->stream_id,
-                                  speex_resampler_strerror(err));
+                                  sampling,
+                                  desiredSampling);
+                discardAudioPipe(tech_pvt);
                 return SWITCH_STATUS_FALSE;
             }
         }
     }
 
+    // registered last: a stream that failed to start never shows up as running
+    tech_pvt->latency = stream_latency_create(tech_pvt->stream_id);
+    ap->setLatency(tech_pvt->latency);
+    tech_pvt->registry = stream_registry_add(tech_pvt->session_id, tech_pvt->stream_id);
+    ap->setRegistryEntry(tech_pvt->registry);
+
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%u) stream_data_init\n", tech_pvt->id);
     return SWITCH_STATUS_SUCCESS;
 }
@@ -927,17 +1586,12 @@ void destroy_tech_pvt(private_data_t *tech_pvt)
 {
     switch_log_printf(
         SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s (%u) destroy_tech_pvt\n", tech_pvt->session_id, tech_pvt->id);
-    stream_checkpoints_t *temp = NULL;
-    if (tech_pvt->resampler)
-    {
-        speex_resampler_destroy(tech_pvt->resampler);
-        tech_pvt->resampler = nullptr;
-    }
-    if (tech_pvt->resampler_outbound)
-    {
-        speex_resampler_destroy(tech_pvt->resampler_outbound);
-        tech_pvt->resampler_outbound = nullptr;
-    }
+    delete static_cast<StreamResampler *>(tech_pvt->resampler);
+    tech_pvt->resampler = nullptr;
+    delete static_cast<StreamResampler *>(tech_pvt->resampler_outbound);
+    tech_pvt->resampler_outbound = nullptr;
+    delete static_cast<StreamResampler *>(tech_pvt->playback_resampler);
+    tech_pvt->playback_resampler = nullptr;
     if (tech_pvt->mutex)
     {
         switch_mutex_destroy(tech_pvt->mutex);
@@ -945,16 +1599,68 @@ void destroy_tech_pvt(private_data_t *tech_pvt)
     }
     if (tech_pvt->write_buffer)
     {
-        switch_buffer_destroy(&tech_pvt->write_buffer);
+        playback_ring_destroy(tech_pvt->write_buffer);
         tech_pvt->write_buffer = nullptr;
     }
-    while (NULL != tech_pvt->checkpoints)
+    if (tech_pvt->playback_decoder)
     {
-        temp = tech_pvt->checkpoints;
-        tech_pvt->checkpoints = tech_pvt->checkpoints->next;
-        free(temp->name);
-        free(temp);
+        delete static_cast<PlaybackDecoder *>(tech_pvt->playback_decoder);
+        tech_pvt->playback_decoder = nullptr;
+    }
+    if (tech_pvt->encoder)
+    {
+        delete static_cast<StreamEncoder *>(tech_pvt->encoder);
+        tech_pvt->encoder = nullptr;
+    }
+    if (tech_pvt->encoder_outbound)
+    {
+        delete static_cast<StreamEncoder *>(tech_pvt->encoder_outbound);
+        tech_pvt->encoder_outbound = nullptr;
+    }
+    for (void **slot : {&tech_pvt->vad, &tech_pvt->vad_outbound})
+    {
+        VoiceActivityDetector *vad = static_cast<VoiceActivityDetector *>(*slot);
+        if (!vad)
+            continue;
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_INFO,
+                          "%s (%u) silence suppression kept back %llu of %llu frames\n",
+                          tech_pvt->session_id,
+                          tech_pvt->id,
+                          (unsigned long long)vad->suppressed(),
+                          (unsigned long long)vad->frames());
+        delete vad;
+        *slot = nullptr;
+    }
+    if (tech_pvt->backpressure)
+    {
+        BackpressureLadder *ladder = static_cast<BackpressureLadder *>(tech_pvt->backpressure);
+        if (ladder->transitions() > 0)
+        {
+            switch_log_printf(SWITCH_CHANNEL_LOG,
+                              SWITCH_LOG_INFO,
+                              "%s (%u) backpressure ladder changed level %llu times, %llu outbound frames dropped\n",
+                              tech_pvt->session_id,
+                              tech_pvt->id,
+                              (unsigned long long)ladder->transitions(),
+                              (unsigned long long)ladder->dropped_outbound());
+        }
+        delete ladder;
+        tech_pvt->backpressure = nullptr;
+    }
+    if (tech_pvt->latency)
+    {
+        stream_latency_release(tech_pvt->latency);
+        tech_pvt->latency = nullptr;
+    }
+    if (tech_pvt->registry)
+    {
+        stream_registry_release(tech_pvt->registry);
+        tech_pvt->registry = nullptr;
     }
+    // checkpoints belong to the session pool and go away with it
+    tech_pvt->checkpoints = NULL;
+    tech_pvt->free_checkpoints = NULL;
 }
 
 void lws_logger(int level, const char *line)
@@ -989,17 +1695,17 @@ extern "C"
         char server[MAX_WEBSOCKET_URL_LENGTH];
         int flags = LCCSCF_USE_SSL;
 
-        if (switch_true(switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_ALLOW_SELFSIGNED")))
+        if (channel && switch_true(switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_ALLOW_SELFSIGNED")))
         {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "parse_ws_uri - allowing self-signed certs\n");
             flags |= LCCSCF_ALLOW_SELFSIGNED;
         }
-        if (switch_true(switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_SKIP_SERVER_CERT_HOSTNAME_CHECK")))
+        if (channel && switch_true(switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_SKIP_SERVER_CERT_HOSTNAME_CHECK")))
         {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "parse_ws_uri - skipping hostname check\n");
             flags |= LCCSCF_SKIP_SERVER_CERT_HOSTNAME_CHECK;
         }
-        if (switch_true(switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_ALLOW_EXPIRED")))
+        if (channel && switch_true(switch_channel_get_variable(channel, "MOD_AUDIO_STREAM_ALLOW_EXPIRED")))
         {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "parse_ws_uri - allowing expired certs\n");
             flags |= LCCSCF_ALLOW_EXPIRED;
@@ -1083,12 +1789,162 @@ extern "C"
                           SWITCH_LOG_NOTICE,
                           "mod_audio_stream: lws service threads:       %d\n",
                           nServiceThreads);
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: drain per writable:        %u chunks / %u bytes\n",
+                          nDrainMaxChunks,
+                          (unsigned int)nDrainMaxBytes);
+
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: buffer storage pool:       %u MB\n",
+                          nBufferPoolMB);
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: spool directory:           %s, at most %u MB per track\n",
+                          requestedSpoolDir ? requestedSpoolDir : SWITCH_GLOBAL_dirs.temp_dir,
+                          nSpoolMaxMB);
+        if (nBufferBudgetMB > 0)
+            switch_log_printf(SWITCH_CHANNEL_LOG,
+                              SWITCH_LOG_NOTICE,
+                              "mod_audio_stream: buffer memory budget:      %u MB\n",
+                              nBufferBudgetMB);
+        else
+            switch_log_printf(SWITCH_CHANNEL_LOG,
+                              SWITCH_LOG_NOTICE,
+                              "mod_audio_stream: buffer memory budget:      unlimited\n");
+
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: g711 u-law encoder:        %s\n",
+                          g711_codec_init());
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: resampler:                 quality %d, %s kernels\n",
+                          nResampleQuality,
+                          stream_resampler_simd());
+
+        reconnection_policy_t policy = parseReconnectionPolicy(requestedReconnectPolicy, requestedReconnectAttempts);
+        AudioPipe::setReconnectionPolicy(policy);
+        policy = AudioPipe::getReconnectionPolicy();
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: reconnect policy:          %s, %u attempts, %u-%u ms backoff x%.1f\n",
+                          requestedReconnectPolicy ? requestedReconnectPolicy : "default",
+                          policy.enable_reconnection ? policy.max_reconnect_attempts : 0,
+                          policy.initial_delay_ms,
+                          policy.max_delay_ms,
+                          policy.backoff_multiplier);
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: connect timeout / health:  %u ms / %u ms\n",
+                          policy.connection_timeout_ms,
+                          policy.health_check_interval_ms);
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: circuit breaker:           %s, %u failures, %u ms open\n",
+                          policy.enable_circuit_breaker ? "on" : "off",
+                          policy.circuit_breaker_threshold,
+                          policy.circuit_breaker_timeout_ms);
+
+        // comma separated ws(s):// urls; tls flags are the defaults, so streams that relax certificate checks
+        // connect on their own
+        std::vector<WarmEndpoint> warm;
+        std::stringstream urls(requestedWarmPoolUrls ? requestedWarmPoolUrls : "");
+        std::string url;
+        while (std::getline(urls, url, ','))
+        {
+            url.erase(0, url.find_first_not_of(" \t"));
+            url.erase(url.find_last_not_of(" \t") + 1);
+            char host[MAX_WEBSOCKET_URL_LENGTH] = {0};
+            char path[MAX_WEBSOCKET_PATH_LENGTH] = {0};
+            unsigned int port = 0;
+            int sslFlags = 0;
+            if (url.empty() || !parse_ws_uri(nullptr, url.c_str(), host, path, &port, &sslFlags))
+                continue;
+            warm.push_back({host, port, path, sslFlags, nWarmPoolSize});
+            switch_log_printf(SWITCH_CHANNEL_LOG,
+                              SWITCH_LOG_NOTICE,
+                              "mod_audio_stream: warm pool:                 %s, %u per service thread, %u secs idle\n",
+                              url.c_str(),
+                              nWarmPoolSize,
+                              nWarmPoolIdleSecs);
+        }
+        AudioPipe::setWarmPool(warm, nWarmPoolIdleSecs);
+
+        AudioPipe::setTlsSessionCache(nTlsSessionCache);
+#if defined(LWS_WITH_TLS_SESSIONS)
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: tls session cache:         %u sessions per service thread\n",
+                          nTlsSessionCache);
+#else
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_NOTICE,
+                          "mod_audio_stream: tls session cache:         not supported by this libwebsockets build\n");
+#endif
+
+        AudioPipe::setMultiplexing(nMuxConnections, nMuxCredit);
+        if (nMuxConnections > 0)
+            switch_log_printf(SWITCH_CHANNEL_LOG,
+                              SWITCH_LOG_NOTICE,
+                              "mod_audio_stream: shared connections:        %u per endpoint and service thread, "
+                              "%u messages per turn\n",
+                              nMuxConnections,
+                              nMuxCredit);
+
+        AudioPipe::setDrainLimits(nDrainMaxChunks, nDrainMaxBytes);
+        Buffer::set_storage_pool_limit((size_t)nBufferPoolMB << 20);
+        Buffer::set_memory_budget((size_t)nBufferBudgetMB << 20);
+
+        std::vector<int> cpus = parseServiceThreadCpus(requestedServiceThreadCpus);
+        if (!cpus.empty())
+        {
+            switch_log_printf(SWITCH_CHANNEL_LOG,
+                              SWITCH_LOG_NOTICE,
+                              "mod_audio_stream: service thread cpus:       %s (%u cpus)\n",
+                              requestedServiceThreadCpus,
+                              (unsigned int)cpus.size());
+            AudioPipe::setServiceThreadCpus(cpus);
+        }
 
         int logs = LLL_ERR | LLL_WARN | LLL_NOTICE;
         AudioPipe::initialize(mySubProtocolName, nServiceThreads, logs, lws_logger);
         return SWITCH_STATUS_SUCCESS;
     }
 
+    char *stream_service_contexts_json(void)
+    {
+        cJSON *root = cJSON_CreateObject();
+        cJSON *contexts = cJSON_CreateArray();
+        for (unsigned int i = 0; i < AudioPipe::getNumContexts(); i++)
+        {
+            const ContextLoad &load = AudioPipe::getContextLoad(i);
+            cJSON *ctx = cJSON_CreateObject();
+            cJSON_AddItemToObject(ctx, "index", cJSON_CreateNumber(i));
+            cJSON_AddItemToObject(ctx, "cpu", cJSON_CreateNumber(load.cpu.load()));
+            cJSON_AddItemToObject(ctx, "activeStreams", cJSON_CreateNumber(load.active_streams.load()));
+            cJSON_AddItemToObject(ctx, "bytesSent", cJSON_CreateNumber((double)load.bytes_sent.load()));
+            cJSON_AddItemToObject(ctx, "bytesPerSec", cJSON_CreateNumber((double)load.bytes_per_sec.load()));
+            cJSON_AddItemToObject(ctx, "timers", cJSON_CreateNumber(load.timers.load()));
+            cJSON_AddItemToObject(ctx, "openCircuits", cJSON_CreateNumber(load.open_circuits.load()));
+            cJSON_AddItemToObject(ctx, "warmConnections", cJSON_CreateNumber(load.warm_connections.load()));
+            cJSON_AddItemToObject(ctx, "muxConnections", cJSON_CreateNumber(load.mux_connections.load()));
+            cJSON_AddItemToObject(ctx, "muxStreams", cJSON_CreateNumber(load.mux_streams.load()));
+            cJSON_AddItemToArray(contexts, ctx);
+        }
+        cJSON_AddItemToObject(root, "contexts", contexts);
+        cJSON *buffers = cJSON_CreateObject();
+        cJSON_AddItemToObject(buffers, "buffers", cJSON_CreateNumber((double)Buffer::live_buffers()));
+        cJSON_AddItemToObject(buffers, "bufferedBytes", cJSON_CreateNumber((double)Buffer::buffered_bytes()));
+        cJSON_AddItemToObject(buffers, "budgetBytes", cJSON_CreateNumber((double)Buffer::memory_budget()));
+        cJSON_AddItemToObject(buffers, "pooledBytes", cJSON_CreateNumber((double)Buffer::pooled_bytes()));
+        cJSON_AddItemToObject(root, "buffers", buffers);
+        char *json = cJSON_PrintUnformatted(root);
+        cJSON_Delete(root);
+        return json;
+    }
+
     switch_status_t stream_cleanup()
     {
         AudioPipe::deinitialize();
@@ -1104,6 +1960,7 @@ extern "C"
                                         unsigned int port,
                                         char *path,
                                         char *codec_str,
+                                        char *framing_str,
                                         int sampling,
                                         int sslFlags,
                                         int channels,
@@ -1115,10 +1972,38 @@ extern "C"
     {
         switch_status_t status;
         streaming_codec_t codec = L16;
+        streaming_framing_t framing = FRAMING_JSON;
+
+        if (!stream_codec_from_name(codec_str, codec))
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                              SWITCH_LOG_WARNING,
+                              "mod_audio_stream(%s) unknown codec %s, streaming l16\n",
+                              stream_id,
+                              codec_str);
+            codec = L16;
+        }
 
-        if (codec_str != NULL && 0 == strcmp(codec_str, "mulaw"))
+        if (framing_str != NULL && 0 == strcmp(framing_str, "binary"))
+        {
+            framing = FRAMING_BINARY;
+        }
+        else if (framing_str != NULL && 0 == strcmp(framing_str, "realtime"))
         {
-            codec = ULAW;
+            framing = FRAMING_REALTIME;
+            // the realtime API takes PCM16 at 24 kHz and nothing else
+            if (codec != L16 || sampling != REALTIME_SAMPLE_RATE)
+            {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
+                                  SWITCH_LOG_NOTICE,
+                                  "mod_audio_stream(%s) realtime session streams l16 at %d instead of %s at %d\n",
+                                  stream_id,
+                                  REALTIME_SAMPLE_RATE,
+                                  stream_codec_content_type(codec),
+                                  sampling);
+                codec = L16;
+                sampling = REALTIME_SAMPLE_RATE;
+            }
         }
 
         // allocate per-session data structure
@@ -1137,6 +2022,7 @@ extern "C"
                                   path,
                                   sslFlags,
                                   codec,
+                                  framing,
                                   samples_per_second,
                                   sampling,
                                   channels,
@@ -1148,6 +2034,16 @@ extern "C"
 
         if (SWITCH_STATUS_SUCCESS != status)
         {
+            struct playout *playout = tech_pvt->playout;
+            while (playout)
+            {
+                std::remove(playout->file);
+                free(playout->file);
+                struct playout *tmp = playout;
+                playout = playout->next;
+                free(tmp);
+            }
+            tech_pvt->playout = NULL;
             destroy_tech_pvt(tech_pvt);
             return SWITCH_STATUS_FALSE;
         }
@@ -1164,41 +2060,21 @@ extern "C"
         if (!tech_pvt)
             return SWITCH_STATUS_FALSE;
 
+        // the realtime API has no such event, checkpoints are only reported locally there; elsewhere only the name
+        // is queued, the service thread serializes it and merges checkpoints that played together
         AudioPipe *audio_pipe_ptr = static_cast<AudioPipe *>(tech_pvt->audio_pipe_ptr);
-        if (audio_pipe_ptr)
-        {
-            cJSON *data = cJSON_CreateObject();
-            char *result = NULL;
-            cJSON *member = NULL;
-
-            member = cJSON_CreateString("playedStream");
-            cJSON_AddItemToObject(data, "event", member);
-
-            member = cJSON_CreateNumber(audio_pipe_ptr->getSequenceNumber());
-            cJSON_AddItemToObject(data, "sequenceNumber", member);
-
-            member = cJSON_CreateString(tech_pvt->stream_id);
-            cJSON_AddItemToObject(data, "stream_id", member);
-
-            member = cJSON_CreateString(name);
-            cJSON_AddItemToObject(data, "name", member);
-
-            result = cJSON_Print(data);
-            cJSON_Delete(data);
-
-            if (result == NULL)
-            {
-                return SWITCH_STATUS_FALSE;
-            }
-
-            audio_pipe_ptr->addEventBuffer(std::string(result));
-            audio_pipe_ptr->increaseSequenceNumber();
-            free(result);
-        }
+        if (audio_pipe_ptr && !tech_pvt->realtime)
+            audio_pipe_ptr->addControlEvent(CONTROL_EVENT_PLAYED, name, strlen(name));
 
         return SWITCH_STATUS_SUCCESS;
     }
 
+    void stream_release_checkpoint(private_data_t *tech_pvt, stream_checkpoints_t *checkpoint)
+    {
+        checkpoint->next = tech_pvt->free_checkpoints;
+        tech_pvt->free_checkpoints = checkpoint;
+    }
+
     switch_status_t stream_ws_close_connection(private_data_t *tech_pvt)
     {
         if (!tech_pvt)
@@ -1208,7 +2084,7 @@ extern "C"
         if (audio_pipe_ptr)
         {
             tech_pvt->channel_closing = 1;
-            audio_pipe_ptr->m_connection_attempts = MAX_CONNECTION_ATTEMPTS + 1;
+            audio_pipe_ptr->disableReconnect();
             audio_pipe_ptr->close();
         }
 
@@ -1371,9 +2247,15 @@ extern "C"
         if (!tech_pvt)
             return SWITCH_STATUS_FALSE;
 
+        AudioPipe *audio_pipe_ptr = static_cast<AudioPipe *>(tech_pvt->audio_pipe_ptr);
+        if (tech_pvt->mutex)
+            switch_mutex_lock(tech_pvt->mutex);
         tech_pvt->graceful_shutdown = 1;
+        if (audio_pipe_ptr)
+            flushPendingSilence(tech_pvt, audio_pipe_ptr);
+        if (tech_pvt->mutex)
+            switch_mutex_unlock(tech_pvt->mutex);
 
-        AudioPipe *audio_pipe_ptr = static_cast<AudioPipe *>(tech_pvt->audio_pipe_ptr);
         if (audio_pipe_ptr)
             audio_pipe_ptr->graceful_shutdown();
 
@@ -1383,19 +2265,9 @@ extern "C"
     static switch_status_t
     g711u_encode(void *decoded_data, uint32_t decoded_data_len, void *encoded_data, uint32_t *encoded_data_len)
     {
-        short *dbuf;
-        unsigned char *ebuf;
-        uint32_t i;
-
-        dbuf = (short int *)decoded_data;
-        ebuf = (unsigned char *)encoded_data;
-
-        for (i = 0; i < decoded_data_len / sizeof(short); i++)
-        {
-            ebuf[i] = linear_to_ulaw(dbuf[i]);
-        }
-
-        *encoded_data_len = i;
+        uint32_t samples = decoded_data_len / sizeof(short);
+        g711_ulaw_encode((const int16_t *)decoded_data, (uint8_t *)encoded_data, samples);
+        *encoded_data_len = samples;
 
         return SWITCH_STATUS_SUCCESS;
     }
@@ -1406,20 +2278,26 @@ extern "C"
         private_data_t *tech_pvt = (bug_args) ? bug_args->session_context : NULL;
         int type;
         Buffer *audioBuffer;
-        SpeexResamplerState *resampler = NULL;
+        StreamResampler *resampler = NULL;
+        StreamEncoder *encoder = NULL;
+        VoiceActivityDetector *vad = NULL;
+        BackpressureLadder *ladder = NULL;
 
         if (!tech_pvt || tech_pvt->audio_paused || tech_pvt->graceful_shutdown || !tech_pvt->mutex)
             return SWITCH_TRUE;
 
         if (switch_mutex_trylock(tech_pvt->mutex) == SWITCH_STATUS_SUCCESS)
         {
-            if (!tech_pvt->audio_pipe_ptr)
+            // a graceful shutdown may have flushed the pending silence since the check above
+            if (!tech_pvt->audio_pipe_ptr || tech_pvt->graceful_shutdown)
             {
                 switch_mutex_unlock(tech_pvt->mutex);
                 return SWITCH_TRUE;
             }
             AudioPipe *audio_pipe_ptr = static_cast<AudioPipe *>(tech_pvt->audio_pipe_ptr);
-            if (audio_pipe_ptr->getLwsState() != AudioPipe::LWS_CLIENT_CONNECTED)
+            // before the connection is up audio is only kept when a pre-roll window is set
+            bool connected = audio_pipe_ptr->getLwsState() == AudioPipe::LWS_CLIENT_CONNECTED;
+            if (!connected && !audio_pipe_ptr->capturesBeforeConnect())
             {
                 switch_mutex_unlock(tech_pvt->mutex);
                 return SWITCH_TRUE;
@@ -1431,61 +2309,140 @@ extern "C"
                 {
                     type = 0;
                     audioBuffer = audio_pipe_ptr->m_audio_buffer;
-                    resampler = tech_pvt->resampler;
+                    resampler = static_cast<StreamResampler *>(tech_pvt->resampler);
+                    encoder = static_cast<StreamEncoder *>(tech_pvt->encoder);
+                    vad = static_cast<VoiceActivityDetector *>(tech_pvt->vad);
                 }
                 else
                 {
                     type = 1;
                     audioBuffer = audio_pipe_ptr->m_ob_audio_buffer;
-                    resampler = tech_pvt->resampler_outbound;
+                    resampler = static_cast<StreamResampler *>(tech_pvt->resampler_outbound);
+                    encoder = static_cast<StreamEncoder *>(tech_pvt->encoder_outbound);
+                    vad = static_cast<VoiceActivityDetector *>(tech_pvt->vad_outbound);
                 }
             }
             else
             {
                 type = (bug_args->stream_direction == MEDIA_BUG_INBOUND) ? 0 : 1;
                 audioBuffer = audio_pipe_ptr->m_audio_buffer;
-                resampler = tech_pvt->resampler;
+                resampler = static_cast<StreamResampler *>(tech_pvt->resampler);
+                encoder = static_cast<StreamEncoder *>(tech_pvt->encoder);
+                vad = static_cast<VoiceActivityDetector *>(tech_pvt->vad);
             }
+            ladder = static_cast<BackpressureLadder *>(tech_pvt->backpressure);
+            bool outboundTrack = audio_pipe_ptr->needsBothTracks() && type == 1;
 
-            if (audioBuffer->lock())
+            // the media bug is the only producer of audioBuffer, no lock needed
             {
                 uint16_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
                 uint16_t encoded_data[SWITCH_RECOMMENDED_BUFFER_SIZE];
                 bool write_success = true;
                 switch_frame_t frame = {};
                 uint32_t encoded_data_len = 0;
+                // frames read and frames never queued, counted into the registry once per callback
+                uint64_t captured = 0;
+                uint64_t dropped = 0;
                 frame.data = data;
                 frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
+                // capture latency covers the bug read and the conversion up to the buffer write
+                uint64_t capture_start = latency_now_ns();
                 while (switch_core_media_bug_read(bug, &frame, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS &&
                        !switch_test_flag((&frame), SFF_CNG))
                 {
+                    // mouth-to-wire starts when the bug hands over the frame
+                    chunk_stamps_t stamps;
+                    stamps.captured_ns = latency_now_ns();
                     if (frame.datalen)
+                        captured++;
+                    // a full buffer while connecting drops the newest audio, the oldest goes on connect anyway
+                    if (frame.datalen && !connected && audioBuffer->is_full())
                     {
-                        if (resampler != NULL)
+                        dropped++;
+                        continue;
+                    }
+                    if (frame.datalen)
+                    {
+                        // drop_outbound keeps the outbound track's timeline only, one silence marker per run (or
+                        // per VAD_MAX_SILENCE_CHUNKS); a marker that does not fit is retried with the next frame
+                        if (ladder != NULL && outboundTrack && ladder->drops_outbound())
+                        {
+                            ladder->drop_outbound();
+                            dropped++;
+                            stamps.enqueued_ns = latency_now_ns();
+                            if (ladder->pending_outbound() >= VAD_MAX_SILENCE_CHUNKS &&
+                                audioBuffer->write_silence(ladder->pending_outbound(), stamps))
+                                ladder->take_outbound();
+                            capture_start = stamps.enqueued_ns;
+                            continue;
+                        }
+                        if (ladder != NULL && outboundTrack && ladder->pending_outbound() > 0)
                         {
-                            spx_int16_t out[SWITCH_RECOMMENDED_BUFFER_SIZE];
-                            spx_uint32_t out_len = SWITCH_RECOMMENDED_BUFFER_SIZE;
-                            spx_uint32_t in_len = frame.samples;
+                            stamps.enqueued_ns = latency_now_ns();
+                            write_success = audioBuffer->write_silence(ladder->pending_outbound(), stamps);
+                            if (write_success)
+                                ladder->take_outbound();
+                        }
 
-                            speex_resampler_process_interleaved_int(
-                                resampler, (const spx_int16_t *)frame.data, (spx_uint32_t *)&in_len, &out[0], &out_len);
+                        void *linear = frame.data;
+                        uint32_t linear_len = frame.datalen;
+                        if (resampler != NULL)
+                        {
+                            // into the resampler's own buffer, reused from frame to frame
+                            size_t out_len = 0;
+                            linear = resampler->process((const int16_t *)frame.data, frame.samples, out_len);
+                            linear_len = (uint32_t)(out_len * sizeof(int16_t));
+                        }
 
-                            write_success = audioBuffer->write(&out[0]);
+                        // suppressed frames only move the timeline: a run goes into the buffer as one silence
+                        // marker, written when voice resumes or once it reaches VAD_MAX_SILENCE_CHUNKS
+                        bool voice =
+                            vad == NULL || vad->is_voice((const int16_t *)linear, linear_len / sizeof(int16_t));
+                        if (vad != NULL && vad->pending_silence() > 0 &&
+                            (voice || vad->pending_silence() >= VAD_MAX_SILENCE_CHUNKS))
+                        {
+                            stamps.enqueued_ns = latency_now_ns();
+                            write_success = audioBuffer->write_silence(vad->take_silence(), stamps);
                         }
-                        else
+                        else if (!voice)
                         {
-                            if (audio_pipe_ptr->m_codec == ULAW)
-                            {
-                                g711u_encode(frame.data, frame.datalen, &encoded_data, &encoded_data_len);
-                                write_success = audioBuffer->write(encoded_data);
-                            }
-                            else
-                            {
-                                write_success = audioBuffer->write(frame.data);
-                            }
+                            capture_start = latency_now_ns();
+                            continue;
                         }
 
-                        if (audioBuffer->current_usage_bytes_ >
+                        if (voice && encoder != NULL)
+                        {
+                            encoder->encode((const int16_t *)linear, (uint8_t *)encoded_data);
+                            stamps.enqueued_ns = latency_now_ns();
+                            write_success = audioBuffer->write(encoded_data, stamps);
+                        }
+                        else if (voice && audio_pipe_ptr->m_codec == ULAW)
+                        {
+                            g711u_encode(linear, linear_len, &encoded_data, &encoded_data_len);
+                            stamps.enqueued_ns = latency_now_ns();
+                            write_success = audioBuffer->write(encoded_data, stamps);
+                        }
+                        else if (voice && ladder != NULL && ladder->level() >= DEGRADE_CODEC &&
+                                 ladder->has_step(DEGRADE_CODEC))
+                        {
+                            // the codec step sends L16 as μ-law, in the first half of the slot
+                            g711u_encode(linear, linear_len, &encoded_data, &encoded_data_len);
+                            stamps.enqueued_ns = latency_now_ns();
+                            write_success = audioBuffer->write(encoded_data, stamps, true);
+                        }
+                        else if (voice)
+                        {
+                            stamps.enqueued_ns = latency_now_ns();
+                            write_success = audioBuffer->write(linear, stamps);
+                        }
+                        stream_latency_record(
+                            tech_pvt->latency, LATENCY_STAGE_CAPTURE, stamps.enqueued_ns - capture_start);
+                        capture_start = stamps.enqueued_ns;
+                        if (ladder != NULL && write_success && !outboundTrack)
+                            ladder->produced();
+
+                        uint32_t buffer_used = audioBuffer->current_usage_bytes();
+                        if (connected && buffer_used >
                             (audioBuffer->maximum_capacity_bytes_ * (audioBuffer->degradation_notification_sent_ * .3)))
                         {
                             switch_log_printf(SWITCH_CHANNEL_LOG,
@@ -1493,7 +2450,7 @@ extern "C"
                                               "(%s) notification (%d) degraded connection. buffer_used(%d) max_len(%d)",
                                               tech_pvt->stream_id,
                                               audioBuffer->degradation_notification_sent_,
-                                              audioBuffer->current_usage_bytes_,
+                                              buffer_used,
                                               audioBuffer->maximum_capacity_bytes_);
                             audio_pipe_ptr->m_callback(audio_pipe_ptr->m_uuid.c_str(),
                                                        audio_pipe_ptr->m_streamid.c_str(),
@@ -1504,6 +2461,7 @@ extern "C"
 
                         if (!write_success)
                         {
+                            dropped++;
                             lwsl_err("mod_audio_stream(%s) buffer writing failed. shutdown.", tech_pvt->stream_id);
                             audio_pipe_ptr->m_callback(audio_pipe_ptr->m_uuid.c_str(),
                                                        audio_pipe_ptr->m_streamid.c_str(),
@@ -1512,9 +2470,30 @@ extern "C"
                         }
                     }
                 }
-                if (write_success)
+                if (captured)
+                    stream_registry_count(tech_pvt->registry, STREAM_COUNTER_FRAMES_CAPTURED, captured);
+                if (dropped)
+                    stream_registry_count(tech_pvt->registry, STREAM_COUNTER_DROPPED, dropped);
+                // queued chunks of both tracks, the buffer indexes are atomics either media bug thread may read
+                Buffer *outboundBuffer = audio_pipe_ptr->m_ob_audio_buffer;
+                Buffer *inboundBuffer = audio_pipe_ptr->m_audio_buffer;
+                stream_registry_set(tech_pvt->registry,
+                                    STREAM_GAUGE_QUEUED_CHUNKS,
+                                    inboundBuffer->chunks_available() +
+                                        (outboundBuffer ? outboundBuffer->chunks_available() : 0));
+                if (audio_pipe_ptr->spools())
+                {
+                    stream_registry_set(tech_pvt->registry,
+                                        STREAM_GAUGE_SPOOLED_CHUNKS,
+                                        inboundBuffer->spooled_chunks() +
+                                            (outboundBuffer ? outboundBuffer->spooled_chunks() : 0));
+                }
+                // the inbound (or only) buffer is the one the ladder measures, once per callback
+                if (ladder != NULL && connected && !outboundTrack &&
+                    ladder->update(latency_now_ns(), audioBuffer->chunks_available()))
+                    applyDegradation(tech_pvt, audio_pipe_ptr, ladder);
+                if (write_success && connected)
                     audio_pipe_ptr->addPendingWrite(audio_pipe_ptr);
-                audioBuffer->unlock();
             }
             switch_mutex_unlock(tech_pvt->mutex);
         }
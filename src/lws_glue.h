@@ -73,6 +73,7 @@ extern "C"
                                         unsigned int port,
                                         char *path,
                                         char *codec,
+                                        char *framing,
                                         int sampling,
                                         int sslFlags,
                                         int channels,
@@ -90,6 +91,17 @@ extern "C"
     switch_status_t stream_service_threads();
     switch_status_t stream_ws_close_connection(private_data_t *tech_pvt);
     switch_status_t stream_ws_send_played_event(private_data_t *tech_pvt, const char *data);
+
+    /**
+     * @brief Return a checkpoint that left the list to the session's free list
+     *
+     * Checkpoints live in the session pool, so they are never freed
+     * individually. The caller holds write_buffer_mutex.
+     *
+     * @param tech_pvt Session private data
+     * @param checkpoint Checkpoint no longer linked into tech_pvt->checkpoints
+     */
+    void stream_release_checkpoint(private_data_t *tech_pvt, stream_checkpoints_t *checkpoint);
 #ifdef __cplusplus
 }
 #endif
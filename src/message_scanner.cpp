@@ -0,0 +1,314 @@
+// SPDX-License-Identifier: MIT
+#include "message_scanner.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+/* nesting limit for skipped values, deeper documents take the generic path */
+#define MESSAGE_SCANNER_MAX_DEPTH 64
+
+namespace
+{
+class JsonCursor
+{
+  public:
+    JsonCursor(const char *data, size_t len) : p_(data), end_(data + len) {}
+
+    void skip_whitespace()
+    {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r'))
+            p_++;
+    }
+
+    bool consume(char c)
+    {
+        skip_whitespace();
+        if (p_ < end_ && *p_ == c)
+        {
+            p_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool peek(char c)
+    {
+        skip_whitespace();
+        return p_ < end_ && *p_ == c;
+    }
+
+    bool at_end()
+    {
+        skip_whitespace();
+        return p_ == end_;
+    }
+
+    // Read a string; escaped is set when the raw text contains escape sequences
+    bool string(json_string_view_t &out, bool &escaped)
+    {
+        if (!consume('"'))
+            return false;
+
+        const char *start = p_;
+        escaped = false;
+        for (;;)
+        {
+            const char *quote = (const char *)memchr(p_, '"', end_ - p_);
+            if (!quote)
+                return false;
+            const char *backslash = (const char *)memchr(p_, '\\', quote - p_);
+            if (!backslash)
+            {
+                p_ = quote + 1;
+                break;
+            }
+            // step over the escape sequence, which may itself be an escaped quote
+            escaped = true;
+            if (backslash + 1 >= end_)
+                return false;
+            p_ = backslash + 2;
+        }
+        out.data = start;
+        out.len = (p_ - 1) - start;
+        return true;
+    }
+
+    bool number(double &out)
+    {
+        skip_whitespace();
+        const char *start = p_;
+        while (p_ < end_ && ((*p_ >= '0' && *p_ <= '9') || *p_ == '-' || *p_ == '+' || *p_ == '.' || *p_ == 'e' ||
+                             *p_ == 'E'))
+            p_++;
+        if (p_ == start || p_ - start > 32)
+            return false;
+
+        char digits[33];
+        memcpy(digits, start, p_ - start);
+        digits[p_ - start] = '\0';
+        char *parsed_end = nullptr;
+        out = strtod(digits, &parsed_end);
+        return parsed_end == digits + (p_ - start);
+    }
+
+    bool skip_value(int depth = 0)
+    {
+        if (depth > MESSAGE_SCANNER_MAX_DEPTH)
+            return false;
+
+        skip_whitespace();
+        if (p_ >= end_)
+            return false;
+
+        json_string_view_t ignored;
+        bool escaped;
+        switch (*p_)
+        {
+            case '"':
+                return string(ignored, escaped);
+            case '{':
+                p_++;
+                if (consume('}'))
+                    return true;
+                do
+                {
+                    if (!string(ignored, escaped) || !consume(':') || !skip_value(depth + 1))
+                        return false;
+                } while (consume(','));
+                return consume('}');
+            case '[':
+                p_++;
+                if (consume(']'))
+                    return true;
+                do
+                {
+                    if (!skip_value(depth + 1))
+                        return false;
+                } while (consume(','));
+                return consume(']');
+            case 't':
+                return literal("true");
+            case 'f':
+                return literal("false");
+            case 'n':
+                return literal("null");
+            default:
+            {
+                double ignored_number;
+                return number(ignored_number);
+            }
+        }
+    }
+
+  private:
+    bool literal(const char *text)
+    {
+        size_t n = strlen(text);
+        if ((size_t)(end_ - p_) < n || memcmp(p_, text, n) != 0)
+            return false;
+        p_ += n;
+        return true;
+    }
+
+    const char *p_;
+    const char *end_;
+};
+
+// Scan the "media" object; fields other than the three the play path uses are skipped
+bool scan_media_object(JsonCursor &cursor, media_play_view_t &view, int &found)
+{
+    if (!cursor.consume('{'))
+        return false;
+    if (cursor.consume('}'))
+        return true;
+
+    do
+    {
+        json_string_view_t key;
+        bool escaped;
+        if (!cursor.string(key, escaped) || !cursor.consume(':'))
+            return false;
+
+        if (key.equals("payload") && cursor.peek('"'))
+        {
+            // duplicate keys are left to cJSON, which keeps the first one
+            if ((found & 1) || !cursor.string(view.payload, escaped) || escaped)
+                return false;
+            found |= 1;
+        }
+        else if (key.equals("contentType") && cursor.peek('"'))
+        {
+            if ((found & 2) || !cursor.string(view.content_type, escaped) || escaped)
+                return false;
+            found |= 2;
+        }
+        else if (key.equals("sampleRate") && !cursor.peek('"'))
+        {
+            double rate;
+            if ((found & 4) || !cursor.number(rate))
+                return false;
+            view.sample_rate = (int)rate;
+            found |= 4;
+        }
+        else if (!cursor.skip_value())
+        {
+            return false;
+        }
+    } while (cursor.consume(','));
+    return cursor.consume('}');
+}
+} // namespace
+
+bool json_string_view::equals(const char *text) const
+{
+    size_t n = strlen(text);
+    return n == len && memcmp(data, text, n) == 0;
+}
+
+bool scan_media_play(const char *message, size_t len, media_play_view_t &view)
+{
+    JsonCursor cursor(message, len);
+    bool is_media_play = false;
+    bool media_seen = false;
+    int found = 0;
+
+    if (!cursor.consume('{'))
+        return false;
+    if (cursor.consume('}'))
+        return false;
+
+    do
+    {
+        json_string_view_t key;
+        bool escaped;
+        if (!cursor.string(key, escaped) || !cursor.consume(':'))
+            return false;
+
+        if (key.equals("event") && cursor.peek('"'))
+        {
+            json_string_view_t event;
+            if (!cursor.string(event, escaped))
+                return false;
+            // no other event is worth scanning the rest of the message for
+            if (escaped || is_media_play || !event.equals("media.play"))
+                return false;
+            is_media_play = true;
+        }
+        else if (key.equals("media") && cursor.peek('{'))
+        {
+            if (media_seen || !scan_media_object(cursor, view, found))
+                return false;
+            media_seen = true;
+        }
+        else if (!cursor.skip_value())
+        {
+            return false;
+        }
+    } while (cursor.consume(','));
+
+    return cursor.consume('}') && cursor.at_end() && is_media_play && found == 7;
+}
+
+bool scan_realtime_audio_delta(const char *message, size_t len, json_string_view_t &delta)
+{
+    JsonCursor cursor(message, len);
+    bool is_delta = false;
+    bool delta_seen = false;
+
+    if (!cursor.consume('{') || cursor.consume('}'))
+        return false;
+
+    do
+    {
+        json_string_view_t key;
+        bool escaped;
+        if (!cursor.string(key, escaped) || !cursor.consume(':'))
+            return false;
+
+        if (key.equals("type") && cursor.peek('"'))
+        {
+            json_string_view_t type;
+            if (!cursor.string(type, escaped))
+                return false;
+            // the provider puts type first, so every other event stops here
+            if (escaped || is_delta ||
+                !(type.equals("response.audio.delta") || type.equals("response.output_audio.delta")))
+                return false;
+            is_delta = true;
+        }
+        else if (key.equals("delta") && cursor.peek('"'))
+        {
+            if (delta_seen || !cursor.string(delta, escaped) || escaped)
+                return false;
+            delta_seen = true;
+        }
+        else if (!cursor.skip_value())
+        {
+            return false;
+        }
+    } while (cursor.consume(','));
+
+    return cursor.consume('}') && cursor.at_end() && is_delta && delta_seen;
+}
+
+bool scan_stream_id(const char *message, size_t len, json_string_view_t &stream_id)
+{
+    JsonCursor cursor(message, len);
+
+    if (!cursor.consume('{') || cursor.consume('}'))
+        return false;
+
+    do
+    {
+        json_string_view_t key;
+        bool escaped;
+        if (!cursor.string(key, escaped) || !cursor.consume(':'))
+            return false;
+
+        if ((key.equals("streamId") || key.equals("stream_id")) && cursor.peek('"'))
+            return cursor.string(stream_id, escaped) && !escaped;
+        if (!cursor.skip_value())
+            return false;
+    } while (cursor.consume(','));
+    return false;
+}
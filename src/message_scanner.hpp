@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file message_scanner.hpp
+ * @brief DOM-free scanning of inbound WebSocket messages
+ *
+ * media.play messages are mostly one large base64 string. Parsing them with
+ * cJSON builds a tree and copies that string once more. The scanner makes a
+ * single pass over the message in place, picks out the few fields the play
+ * path needs as views into the receive buffer and skips everything else.
+ * Other events, and any media.play the scanner cannot take as is, go through
+ * the generic cJSON path. OpenAI Realtime response.audio.delta events are the
+ * same shape of problem and get the same treatment.
+ *
+ * @author FreeSWITCH Community
+ * @version 1.0
+ * @date 2024
+ */
+#ifndef __MESSAGE_SCANNER_HPP__
+#define __MESSAGE_SCANNER_HPP__
+
+#include <cstddef>
+
+/**
+ * @brief Unescaped JSON string inside a message, not NUL terminated
+ */
+typedef struct json_string_view
+{
+    const char *data;
+    size_t len;
+
+    /** @brief Whether the view holds exactly the given text */
+    bool equals(const char *text) const;
+} json_string_view_t;
+
+/**
+ * @brief Fields of a media.play message
+ */
+typedef struct media_play_view
+{
+    /** @brief media.contentType */
+    json_string_view_t content_type;
+
+    /** @brief media.sampleRate */
+    int sample_rate;
+
+    /** @brief media.payload, the base64 audio */
+    json_string_view_t payload;
+} media_play_view_t;
+
+/**
+ * @brief Scan a message for a media.play event the fast path can handle
+ *
+ * Succeeds only for a well-formed object whose "event" is "media.play" and
+ * whose "media" object holds string contentType and payload values without
+ * escape sequences and a numeric sampleRate, in any key order. Anything else,
+ * including malformed JSON, returns false so the generic path can handle it
+ * and report errors exactly as before.
+ *
+ * @param message Message text
+ * @param len Length of the message
+ * @param view Receives the field views on success
+ * @return true if view describes a media.play message
+ */
+bool scan_media_play(const char *message, size_t len, media_play_view_t &view);
+
+/**
+ * @brief Scan an OpenAI Realtime message for an audio delta
+ *
+ * Succeeds only for a well-formed object whose "type" is
+ * "response.audio.delta" (or "response.output_audio.delta") and that holds a
+ * string "delta" without escape sequences, in any key order. As with
+ * media.play, anything else is left to the generic path.
+ *
+ * @param message Message text
+ * @param len Length of the message
+ * @param delta Receives the base64 PCM16 audio on success
+ * @return true if delta holds the audio of the message
+ */
+bool scan_realtime_audio_delta(const char *message, size_t len, json_string_view_t &delta);
+
+/**
+ * @brief Find the stream a message is addressed to
+ *
+ * Looks for a top level "streamId" (or "stream_id") string and skips every
+ * other value, so a large media.play payload costs one memchr. Used to route
+ * the messages of a connection shared by several streams.
+ *
+ * @param message Message text
+ * @param len Length of the message
+ * @param stream_id Receives the stream id on success
+ * @return false if the message is not an object or has no such string
+ */
+bool scan_stream_id(const char *message, size_t len, json_string_view_t &stream_id);
+
+#endif /* __MESSAGE_SCANNER_HPP__ */
@@ -24,9 +24,13 @@
  * @copyright MIT License
  */
 #include "adaptive_buffer_wrapper.h"
+#include "advanced_api.h"
+#include "latency_metrics.h"
 #include "lws_glue.h"
 #include "mod_audio_stream.h"
 #include "openai_adapter.h"
+#include "playback_ring.h"
+#include "stream_registry.h"
 #include "switch_types.h"
 
 #define AUDIO_STREAM_LOGGING_PREFIX "mod_audio_stream"
@@ -155,7 +159,6 @@ voipbit_intelligent_media_processor(switch_media_bug_t *media_processor,
                                     switch_abc_type_t processing_event)
 {
     switch_core_session_t *session = switch_core_media_bug_get_session(media_processor);
-    switch_time_t processing_start_time = switch_time_now();
     static uint64_t frame_sequence_number = 0;
 
     switch (processing_event)
@@ -196,17 +199,18 @@ voipbit_intelligent_media_processor(switch_media_bug_t *media_processor,
                        "VoipBit::GracefulShutdown::CallTerminated");
 
                 // Publish termination event with performance metrics
-                char metrics_payload[1024];
-                switch_snprintf(metrics_payload, sizeof(metrics_payload),
-                                "{\"reason\":\"call_hangup\","
-                                "\"frames_processed\":%llu,"
-                                "\"frames_dropped\":%llu,"
-                                "\"avg_processing_time_ms\":%.2f}",
-                                (unsigned long long)processor_args->performance_metrics.frames_processed,
-                                (unsigned long long)processor_args->performance_metrics.frames_dropped,
-                                processor_args->performance_metrics.avg_processing_time_ms);
+                char *latency_json = stream_latency_json(session_context->latency);
+                char *metrics_payload = switch_mprintf("{\"reason\":\"call_hangup\","
+                                                       "\"frames_processed\":%llu,"
+                                                       "\"frames_dropped\":%llu,"
+                                                       "\"latency\":%s}",
+                                                       (unsigned long long)processor_args->performance_metrics.frames_processed,
+                                                       (unsigned long long)processor_args->performance_metrics.frames_dropped,
+                                                       latency_json ? latency_json : "{}");
 
                 voipbit_structured_event_publisher(session, EVENT_STOP, metrics_payload);
+                switch_safe_free(metrics_payload);
+                switch_safe_free(latency_json);
 
                 // Enhanced session cleanup with resource tracking
                 stream_session_cleanup(session, session_context->stream_id, NULL, 1, 0);
@@ -225,15 +229,8 @@ voipbit_intelligent_media_processor(switch_media_bug_t *media_processor,
                 processor_args->performance_metrics.frames_processed++;
                 
                 // Advanced frame processing with adaptive quality control
-                switch_bool_t processing_result = voipbit_adaptive_frame_processor(session, media_processor, STREAM_DIRECTION_INBOUND);
-                
-                // Update performance metrics
-                switch_time_t processing_duration = switch_time_now() - processing_start_time;
-                processor_args->performance_metrics.avg_processing_time_ms = 
-                    (processor_args->performance_metrics.avg_processing_time_ms * 0.9) + 
-                    (processing_duration / 1000.0 * 0.1);
-                
-                return processing_result;
+                // capture latency is recorded per chunk inside the frame processor
+                return voipbit_adaptive_frame_processor(session, media_processor, STREAM_DIRECTION_INBOUND);
             }
             return SWITCH_FALSE;
         }
@@ -250,15 +247,7 @@ voipbit_intelligent_media_processor(switch_media_bug_t *media_processor,
                 processor_args->performance_metrics.frames_processed++;
                 
                 // Advanced frame processing with circuit breaker patterns
-                switch_bool_t processing_result = voipbit_adaptive_frame_processor(session, media_processor, STREAM_DIRECTION_OUTBOUND);
-                
-                // Update performance metrics with exponential moving average
-                switch_time_t processing_duration = switch_time_now() - processing_start_time;
-                processor_args->performance_metrics.avg_processing_time_ms = 
-                    (processor_args->performance_metrics.avg_processing_time_ms * 0.9) + 
-                    (processing_duration / 1000.0 * 0.1);
-                
-                return processing_result;
+                return voipbit_adaptive_frame_processor(session, media_processor, STREAM_DIRECTION_OUTBOUND);
             }
             return SWITCH_FALSE;
         }
@@ -275,22 +264,42 @@ voipbit_intelligent_media_processor(switch_media_bug_t *media_processor,
             rframe = switch_core_media_bug_get_write_replace_frame(media_processor);
             if (tech_pvt)
             {
-                if (tech_pvt->write_buffer)
+                switch_size_t queued = tech_pvt->write_buffer ? playback_ring_inuse(tech_pvt->write_buffer) : 0;
+                if (tech_pvt->write_buffer && rframe->rate > 0)
                 {
+                    // queued L16 bytes as playing time at the channel rate
+                    stream_latency_record(tech_pvt->latency,
+                                          LATENCY_STAGE_PLAYBACK_DEPTH,
+                                          (uint64_t)queued * 500000000ull / rframe->rate);
+                    stream_registry_set(tech_pvt->registry, STREAM_GAUGE_PLAYBACK_BYTES, queued);
+                }
+                if (tech_pvt->write_buffer && rframe->datalen <= sizeof(int16_t) * SWITCH_RECOMMENDED_BUFFER_SIZE &&
+                    queued >= rframe->datalen)
+                {
+                    // the ring is lock-free, the mutex only covers the checkpoint bookkeeping below
+                    int16_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+                    uint64_t received = 0;
+                    uint64_t playout_ns = 0;
+                    uint32_t clears = playback_ring_clear_count(tech_pvt->write_buffer);
+                    switch_size_t len = playback_ring_read(tech_pvt->write_buffer, data, rframe->datalen, &received);
+
                     switch_mutex_lock(tech_pvt->write_buffer_mutex);
-                    if (switch_buffer_inuse(tech_pvt->write_buffer) >= rframe->datalen)
+                    // a clear that raced the read dropped this audio along with its checkpoints
+                    if (clears == playback_ring_clear_count(tech_pvt->write_buffer))
                     {
-                        uint32_t x;
-                        int16_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
-                        int16_t *fp = rframe->data;
-
-                        switch_size_t len;
-                        len = switch_buffer_read(tech_pvt->write_buffer, data, rframe->datalen);
-                        for (x = 0; x < (uint32_t)rframe->samples; x++)
+                        if (tech_pvt->playback_replace)
                         {
-                            int32_t mixed = fp[x] + (int16_t)data[x];
-                            switch_normalize_to_16bit(mixed);
-                            fp[x] = (int16_t)mixed;
+                            memcpy(rframe->data, data, len);
+                        }
+                        else
+                        {
+                            playback_mix_s16((int16_t *)rframe->data, data, len / sizeof(int16_t));
+                        }
+                        if (received)
+                        {
+                            // the first byte of a received message goes out with this frame
+                            playout_ns = latency_now_ns() - received;
+                            stream_latency_record(tech_pvt->latency, LATENCY_STAGE_RECEIVE_TO_PLAYOUT, playout_ns);
                         }
 
                         // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)),
@@ -299,6 +308,7 @@ voipbit_intelligent_media_processor(switch_media_bug_t *media_processor,
                         //                   tech_pvt->stream_in_played);
 
                         tech_pvt->stream_input_played += len;
+                        stream_registry_count(tech_pvt->registry, STREAM_COUNTER_FRAMES_PLAYED, 1);
                         while (tech_pvt->checkpoints)
                         {
                             char json_str[1024];
@@ -337,12 +347,23 @@ voipbit_intelligent_media_processor(switch_media_bug_t *media_processor,
                                 temp = tech_pvt->checkpoints;
                                 tech_pvt->checkpoints = NULL;
                             }
-                            free(temp->name);
-                            free(temp);
+                            stream_release_checkpoint(tech_pvt, temp);
                         }
                         switch_core_media_bug_set_write_replace_frame(media_processor, rframe);
                     }
                     switch_mutex_unlock(tech_pvt->write_buffer_mutex);
+
+                    if (playout_ns && tech_pvt->trace_every && ++tech_pvt->trace_counter >= tech_pvt->trace_every)
+                    {
+                        char trace[256];
+                        tech_pvt->trace_counter = 0;
+                        switch_snprintf(trace,
+                                        sizeof(trace),
+                                        "{\"streamId\":\"%s\",\"direction\":\"inbound\",\"receiveToPlayoutUs\":%llu}",
+                                        tech_pvt->stream_id,
+                                        (unsigned long long)(playout_ns / 1000));
+                        stream_publish_latency_trace(session, trace);
+                    }
                 }
             }
         }
@@ -393,6 +414,7 @@ static switch_status_t start_capture(switch_core_session_t *session,
                                      unsigned int port,
                                      char *path,
                                      char *codec,
+                                     char *framing,
                                      int desiredSampling,
                                      int sslFlags,
                                      char *track,
@@ -459,6 +481,7 @@ static switch_status_t start_capture(switch_core_session_t *session,
                                                    port,
                                                    path,
                                                    codec,
+                                                   framing,
                                                    desiredSampling,
                                                    sslFlags,
                                                    channels,
@@ -523,6 +546,22 @@ static switch_status_t start_capture(switch_core_session_t *session,
     return SWITCH_STATUS_SUCCESS;
 }
 
+// Fires the stop event; json_str is a JSON object, the stream's latency summary is added to it.
+static void send_stop_event(switch_core_session_t *session, private_data_t *tech_pvt, const char *json_str)
+{
+    char *latency_json = stream_latency_json(tech_pvt->latency);
+    size_t len = strlen(json_str);
+    char *payload = NULL;
+
+    if (latency_json && len > 1 && json_str[len - 1] == '}')
+    {
+        payload = switch_mprintf("%.*s,\"latency\":%s}", (int)(len - 1), json_str, latency_json);
+    }
+    tech_pvt->response_handler(session, EVENT_STOP, payload ? payload : json_str);
+    switch_safe_free(payload);
+    switch_safe_free(latency_json);
+}
+
 switch_status_t do_stop(switch_core_session_t *session, char *stream_id, char *text)
 {
     char json_str[512];
@@ -563,7 +602,7 @@ switch_status_t do_stop(switch_core_session_t *session, char *stream_id, char *t
     bug_args = (media_bug_callback_args_t *)switch_core_media_bug_get_user_data(bug);
     tech_pvt = bug_args->session_context;
     tech_pvt->end_time = switch_epoch_time_now(NULL);
-    tech_pvt->response_handler(session, EVENT_STOP, json_str);
+    send_stop_event(session, tech_pvt, json_str);
 
     strcpy(tech_pvt->stream_termination_reason, TERMINATION_REASON_API_REQUEST);
     status = stream_session_cleanup(session, stream_id, text, 0, 0);
@@ -629,7 +668,7 @@ switch_status_t do_graceful_shutdown(switch_core_session_t *session, char *strea
     bug_args = (media_bug_callback_args_t *)switch_core_media_bug_get_user_data(bug);
     tech_pvt = bug_args->session_context;
     tech_pvt->end_time = switch_epoch_time_now(NULL);
-    tech_pvt->response_handler(session, EVENT_STOP, json_str);
+    send_stop_event(session, tech_pvt, json_str);
     strcpy(tech_pvt->stream_termination_reason, termination_reason);
     switch_log_printf(
         SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "mod_audio_stream(%s): graceful-shutdown\n", stream_id);
@@ -637,6 +676,11 @@ switch_status_t do_graceful_shutdown(switch_core_session_t *session, char *strea
     return status;
 }
 
+void stream_publish_latency_trace(switch_core_session_t *session, const char *json_payload)
+{
+    voipbit_structured_event_publisher(session, EVENT_LATENCY_TRACE, json_payload);
+}
+
 // Basic implementations for missing functions
 void default_response_handler(switch_core_session_t *session, const char *event_name, const char *json_payload)
 {
@@ -713,6 +757,14 @@ switch_status_t do_openai_start(switch_core_session_t *session,
     
     // Generate initial session configuration as metadata
     char *session_config = openai_generate_session_update(config);
+
+    // The realtime API takes a single audio input, the caller's side of the call
+    if (!track || (strcmp(track, "inbound") && strcmp(track, "outbound"))) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_NOTICE,
+                         "mod_audio_stream(%s): OpenAI Realtime streams one track, using inbound instead of %s\n",
+                         stream_id, track ? track : "none");
+        track = "inbound";
+    }
     
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
                      "mod_audio_stream(%s): Starting OpenAI Realtime session with voice=%s\n",
@@ -726,6 +778,7 @@ switch_status_t do_openai_start(switch_core_session_t *session,
                                           port,
                                           path,
                                           "L16",  // Use L16 codec
+                                          "realtime",  // OpenAI Realtime events, PCM16 at 24 kHz
                                           sampling_rate,
                                           sslFlags,
                                           (char*)track,
@@ -769,11 +822,15 @@ static switch_status_t send_text(switch_core_session_t *session, char *stream_id
 
 #define STREAM_API_SYNTAX                                                                                              \
     "<uuid> <streamid> [start | stop | send_text | pause | resume | graceful-shutdown | openai_start ] [wss-url | path] [inbound | "  \
-    "outbound | both] [l16 | mulaw] [8000 | 16000 | 24000 | 32000 | 64000] [timeout] [is_bidirectional] [metadata]\n" \
-    "OpenAI Realtime: <uuid> <streamid> openai_start [voice=alloy] [track=both] [rate=24000] [timeout=0] [api_key=xxx] [instructions=\"...]\""
+    "outbound | both] [l16 | mulaw | opus | g722] [8000 | 16000 | 24000 | 32000 | 64000] [timeout] [is_bidirectional] [metadata] "  \
+    "[framing=json | framing=binary | framing=realtime]\n"                                                          \
+    "Service thread load: contexts\n"                                                                                \
+    "Latency histograms: metrics [streamid]\n"                                                                       \
+    "Stream registry: streams [json | prometheus | <uuid>]\n"                                                        \
+    "OpenAI Realtime: <uuid> <streamid> openai_start [voice=alloy] [track=inbound] [rate=24000] [timeout=0] [api_key=xxx] [instructions=\"...]\""
 SWITCH_STANDARD_API(stream_function)
 {
-    char *mycmd = NULL, *argv[10] = {0};
+    char *mycmd = NULL, *argv[11] = {0};
     int argc = 0;
     switch_status_t status = SWITCH_STATUS_FALSE;
 
@@ -784,6 +841,66 @@ SWITCH_STANDARD_API(stream_function)
     switch_log_printf(
         SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "mod_audio_stream cmd: %s\n", cmd ? cmd : "(null)");
 
+    if (argc == 1 && !strcasecmp(argv[0], "contexts"))
+    {
+        char *json = stream_service_contexts_json();
+        stream->write_function(stream, "%s\n", json ? json : "{}");
+        switch_safe_free(json);
+        goto done;
+    }
+
+    if ((argc == 1 || argc == 2) && !strcasecmp(argv[0], "metrics"))
+    {
+        metrics_query_params_t params;
+        memset(&params, 0, sizeof(params));
+        if (argc == 2)
+        {
+            switch_copy_string(params.stream_id, argv[1], sizeof(params.stream_id));
+        }
+        api_response_t response = handle_get_metrics_command(&params);
+        if (response.status == API_SUCCESS)
+        {
+            stream->write_function(stream, "%s\n", response.data);
+        }
+        else
+        {
+            stream->write_function(stream, "-ERR %s\n", response.message);
+        }
+        goto done;
+    }
+
+    if ((argc == 1 || argc == 2) && !strcasecmp(argv[0], "streams"))
+    {
+        // json and prometheus export the whole registry with the latency summary, a uuid lists that channel
+        char *text = NULL;
+        if (argc == 1 || !strcasecmp(argv[1], "json") || !strcasecmp(argv[1], "prometheus"))
+        {
+            text = get_metrics_exposition(argc == 2 ? argv[1] : "json");
+        }
+        else
+        {
+            switch_core_session_t *lsession = switch_core_session_locate(argv[1]);
+            if (!lsession)
+            {
+                stream->write_function(stream, "-ERR no such session %s\n", argv[1]);
+                goto done;
+            }
+            text = get_stream_list_json(lsession);
+            switch_core_session_rwunlock(lsession);
+        }
+        if (text)
+        {
+            // the Prometheus text ends with its own newline
+            stream->write_function(stream, text[0] == '#' ? "%s" : "%s\n", text);
+        }
+        else
+        {
+            stream->write_function(stream, "-ERR unable to build the stream registry snapshot\n");
+        }
+        switch_safe_free(text);
+        goto done;
+    }
+
     if (zstr(cmd) || argc < 3 || (0 == strcmp(argv[2], "start") && argc < 5))
     {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session),
@@ -832,10 +949,10 @@ SWITCH_STANDARD_API(stream_function)
             else if (!strcasecmp(argv[2], "openai_start"))
             {
                 // OpenAI Realtime API start command
-                // Syntax: <uuid> <stream_id> openai_start [voice=alloy] [track=both] [rate=24000] [timeout=0] [api_key=xxx] [instructions="..."]
+                // Syntax: <uuid> <stream_id> openai_start [voice=alloy] [track=inbound] [rate=24000] [timeout=0] [api_key=xxx] [instructions="..."]
                 const char *voice = "alloy";
                 const char *instructions = NULL;
-                const char *track = "both"; 
+                const char *track = "inbound";
                 int sampling_rate = 24000;
                 int timeout = 0;
                 const char *api_key = NULL;
@@ -866,7 +983,8 @@ SWITCH_STANDARD_API(stream_function)
             }
             else if (!strcasecmp(argv[2], "start"))
             {
-                char *metadata = argc > 9 ? argv[9] : NULL;
+                char *metadata = NULL;
+                char *framing = NULL;
                 char host[MAX_WEBSOCKET_URL_LENGTH], path[MAX_WEBSOCKET_PATH_LENGTH];
                 int is_bidirectional = atoi(argv[8]);
                 int sampling = 8000;
@@ -875,6 +993,19 @@ SWITCH_STANDARD_API(stream_function)
                 switch_channel_t *channel = switch_core_session_get_channel(lsession);
                 unsigned int port;
 
+                // optional trailing args: [metadata] [framing=json|binary|realtime], in either order
+                for (int i = 9; i < argc; i++)
+                {
+                    if (0 == strncmp(argv[i], "framing=", 8))
+                    {
+                        framing = argv[i] + 8;
+                    }
+                    else if (!metadata)
+                    {
+                        metadata = argv[i];
+                    }
+                }
+
                 if ((0 != strcmp(argv[4], "inbound")) && (0 != strcmp(argv[4], "outbound")) &&
                     (0 != strcmp(argv[4], "both")))
                 {
@@ -919,6 +1050,7 @@ SWITCH_STANDARD_API(stream_function)
                                            port,
                                            path,
                                            argv[5],
+                                           framing,
                                            sampling,
                                            sslFlags,
                                            argv[4],
@@ -1046,7 +1178,8 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_audio_stream_load)
         switch_event_reserve_subclass(EVENT_KILL_AUDIO) != SWITCH_STATUS_SUCCESS ||
         switch_event_reserve_subclass(EVENT_ERROR) != SWITCH_STATUS_SUCCESS ||
         switch_event_reserve_subclass(EVENT_DISCONNECT) != SWITCH_STATUS_SUCCESS ||
-        switch_event_reserve_subclass(EVENT_STOP) != SWITCH_STATUS_SUCCESS)
+        switch_event_reserve_subclass(EVENT_STOP) != SWITCH_STATUS_SUCCESS ||
+        switch_event_reserve_subclass(EVENT_LATENCY_TRACE) != SWITCH_STATUS_SUCCESS)
     {
 
         switch_log_printf(SWITCH_CHANNEL_LOG,
@@ -1062,6 +1195,9 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_audio_stream_load)
     switch_console_set_complete("add uuid_audio_stream start wss-url metadata");
     switch_console_set_complete("add uuid_audio_stream start wss-url");
     switch_console_set_complete("add uuid_audio_stream stop");
+    switch_console_set_complete("add uuid_audio_stream contexts");
+    switch_console_set_complete("add uuid_audio_stream streams json");
+    switch_console_set_complete("add uuid_audio_stream streams prometheus");
     switch_console_set_complete("add uuid_audio_stream openai_start");
     switch_console_set_complete("add uuid_audio_stream openai_start voice=alloy");
     switch_console_set_complete("add uuid_audio_stream openai_start voice=echo");
@@ -1110,6 +1246,7 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_audio_stream_shutdown)
     switch_event_free_subclass(EVENT_DISCONNECT);
     switch_event_free_subclass(EVENT_STOP);
     switch_event_free_subclass(EVENT_ERROR);
+    switch_event_free_subclass(EVENT_LATENCY_TRACE);
 
     return SWITCH_STATUS_SUCCESS;
 }
@@ -20,7 +20,6 @@
 #define __MOD_AUDIO_STREAM_VOIPBIT_H__
 
 #include <libwebsockets.h>
-#include <speex/speex_resampler.h>
 #include <switch.h>
 #include <unistd.h>
 
@@ -105,6 +104,12 @@
 /** @brief Event type for transcription data received */
 #define EVENT_TRANSCRIPTION_RECEIVED "mod_audio_stream::transcription_received"
 
+/** @brief Event type for sampled per-message latency traces */
+#define EVENT_LATENCY_TRACE "mod_audio_stream::latency_trace"
+
+/** @brief Event type for a step of the backpressure degradation ladder, either way */
+#define EVENT_MEDIA_DEGRADATION "mod_audio_stream::media_degradation"
+
 /** @brief Stream termination reason: API request */
 #define TERMINATION_REASON_API_REQUEST "API Request"
 
@@ -201,6 +206,9 @@ typedef struct stream_checkpoints
 
     /** @brief Checkpoint name/identifier */
     char *name;
+
+    /** @brief Bytes available for name, including the terminator */
+    size_t name_capacity;
 } stream_checkpoints_t;
 
 /**
@@ -224,11 +232,17 @@ struct voipbit_session_context
     /** @brief Audio track type: "inbound", "outbound", or "both" */
     char track[16];
 
-    /** @brief Speex resampler for inbound audio */
-    SpeexResamplerState *resampler;
+    /** @brief StreamResampler for inbound audio (opaque pointer) */
+    void *resampler;
+
+    /** @brief StreamResampler for outbound audio (opaque pointer) */
+    void *resampler_outbound;
 
-    /** @brief Speex resampler for outbound audio */
-    SpeexResamplerState *resampler_outbound;
+    /** @brief StreamResampler from the playback rate to the channel rate (opaque pointer, lws thread) */
+    void *playback_resampler;
+
+    /** @brief Resampler quality of this stream, 0-10 */
+    int resample_quality;
 
     /** @brief Function pointer for handling responses and events */
     response_handler_t response_handler;
@@ -290,6 +304,12 @@ struct voipbit_session_context
     /** @brief Bit flag: invalid stream input notification sent */
     unsigned int invalid_stream_input_notified : 1;
 
+    /** @brief Bit flag: incoming audio replaces the channel audio instead of being mixed in */
+    unsigned int playback_replace : 1;
+
+    /** @brief Bit flag: the stream speaks the OpenAI Realtime protocol (FRAMING_REALTIME) */
+    unsigned int realtime : 1;
+
     /** @brief Initial metadata JSON sent with stream start */
     char initial_metadata[MAX_METADATA_LENGTH];
 
@@ -305,8 +325,38 @@ struct voipbit_session_context
     /** @brief Count of audio files played */
     int play_count;
 
-    /** @brief Write buffer for incoming audio (bidirectional mode only) */
-    switch_buffer_t *write_buffer;
+    /** @brief Lock-free queue of incoming audio (bidirectional mode only) */
+    struct playback_ring *write_buffer;
+
+    /** @brief PlaybackDecoder feeding write_buffer (bidirectional mode only) */
+    void *playback_decoder;
+
+    /** @brief StreamEncoder of the inbound (or only) buffer, Opus and G.722 streams only */
+    void *encoder;
+
+    /** @brief StreamEncoder of the outbound buffer when both tracks are streamed separately */
+    void *encoder_outbound;
+
+    /** @brief VoiceActivityDetector of the inbound (or only) buffer, silence suppression only */
+    void *vad;
+
+    /** @brief VoiceActivityDetector of the outbound buffer when both tracks are streamed separately */
+    void *vad_outbound;
+
+    /** @brief BackpressureLadder of the stream, MOD_AUDIO_STREAM_DEGRADE_MS only (media bug thread) */
+    void *backpressure;
+
+    /** @brief Per-stage latency histograms of this stream */
+    struct stream_latency *latency;
+
+    /** @brief Slot of this stream in the module-wide stream registry */
+    struct stream_entry *registry;
+
+    /** @brief Publish one inbound latency trace per this many played messages, 0 disables (write thread only) */
+    unsigned int trace_every;
+
+    /** @brief Played messages since the last inbound latency trace */
+    unsigned int trace_counter;
 
     /** @brief Bytes of incoming audio received */
     unsigned int stream_input_received;
@@ -317,12 +367,15 @@ struct voipbit_session_context
     /** @brief Total bytes available for playbook */
     unsigned int total_playable_bytes;
 
-    /** @brief Mutex for thread-safe write buffer access */
+    /** @brief Mutex for the checkpoint list and played/received counters */
     switch_mutex_t *write_buffer_mutex;
 
     /** @brief Linked list of stream checkpoints */
     stream_checkpoints_t *checkpoints;
 
+    /** @brief Played or cleared checkpoints kept for reuse, allocated from the session pool */
+    stream_checkpoints_t *free_checkpoints;
+
     /** @brief Flag indicating if adaptive buffering is enabled */
     int adaptive_buffer_enabled;
 };
@@ -408,11 +461,10 @@ typedef struct voipbit_media_processor_args
     /** @brief Audio stream processing direction */
     media_bug_type_t stream_direction;
 
-    /** @brief Frame processing performance metrics */
+    /** @brief Frame processing counters, timing is kept in the stream's latency histograms */
     struct {
         uint64_t frames_processed;
         uint64_t frames_dropped;
-        double avg_processing_time_ms;
         uint64_t last_update_timestamp;
     } performance_metrics;
 } voipbit_media_processor_args_t;
@@ -440,6 +492,12 @@ extern "C"
      */
     switch_status_t stream_cleanup(void);
 
+    /**
+     * @brief Describe the load of every lws service context
+     * @return JSON text (active streams, bytes sent, send rate, pinned cpu per context); caller frees
+     */
+    char *stream_service_contexts_json(void);
+
     /**
      * @brief Parse WebSocket URI into components
      *
@@ -499,6 +557,14 @@ extern "C"
                                                    switch_media_bug_t *media_processor,
                                                    int direction);
 
+    /**
+     * @brief Publish one sampled latency trace as an EVENT_LATENCY_TRACE event
+     *
+     * @param session FreeSWITCH session pointer
+     * @param json_payload Trace JSON, wrapped by the structured event publisher
+     */
+    void stream_publish_latency_trace(switch_core_session_t *session, const char *json_payload);
+
     /**
      * @brief Default response handler for streaming events
      *
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file mpsc_queue.hpp
+ * @brief Intrusive multi-producer/single-consumer hand-off queue
+ *
+ * Producers on any thread push objects that carry their own link pointer, so
+ * enqueueing never allocates. The single consumer takes the whole queue at
+ * once and walks it in FIFO order.
+ */
+#ifndef __MPSC_QUEUE_HPP__
+#define __MPSC_QUEUE_HPP__
+
+#include <atomic>
+
+/**
+ * @brief Lock-free intrusive MPSC queue
+ *
+ * @tparam T Element type
+ * @tparam Next Pointer to the T member used as the link
+ *
+ * An element must not be pushed again until the consumer has taken it; callers
+ * typically guard push() with a per-element "already queued" flag. The link of
+ * a taken element must be read before that flag is cleared.
+ */
+template <typename T, T *T::*Next> class MpscQueue
+{
+    // Prevent copying and assignment
+    MpscQueue(const MpscQueue &) = delete;
+    void operator=(const MpscQueue &) = delete;
+
+  private:
+    /** @brief Most recently pushed element, elements are linked newest first */
+    std::atomic<T *> head_;
+
+  public:
+    MpscQueue() : head_(nullptr) {}
+
+    /**
+     * @brief Push an element (any thread)
+     * @return true if the queue was empty, i.e. the consumer needs a wakeup
+     */
+    bool push(T *node)
+    {
+        T *head = head_.load(std::memory_order_relaxed);
+        do
+        {
+            node->*Next = head;
+        } while (!head_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    /**
+     * @brief Detach every queued element (consumer thread only)
+     * @return First element in push order, linked through Next, or nullptr
+     */
+    T *take_all()
+    {
+        T *node = head_.exchange(nullptr, std::memory_order_acquire);
+        T *fifo = nullptr;
+        while (node)
+        {
+            T *next = node->*Next;
+            node->*Next = fifo;
+            fifo = node;
+            node = next;
+        }
+        return fifo;
+    }
+
+    /**
+     * @brief Whether the queue is currently empty (snapshot)
+     */
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == nullptr;
+    }
+};
+
+#endif /* __MPSC_QUEUE_HPP__ */
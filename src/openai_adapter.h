@@ -4,8 +4,9 @@
  * @brief OpenAI Realtime API integration for mod_audio_stream
  * 
  * This header provides C interface for integrating OpenAI Realtime API
- * with the existing mod_audio_stream module. It handles message format
- * translation, authentication, and event processing.
+ * with the existing mod_audio_stream module. It builds the session
+ * configuration; the events themselves are written and read by the stream's
+ * realtime framing (FRAMING_REALTIME), which plays response audio directly.
  */
 
 #ifndef __OPENAI_ADAPTER_H__
@@ -19,7 +20,6 @@ extern "C" {
 
 // OpenAI-specific event types
 #define EVENT_OPENAI_SESSION_CREATED        "mod_audio_stream::openai_session_created"
-#define EVENT_OPENAI_RESPONSE_AUDIO_DELTA   "mod_audio_stream::openai_audio_delta"
 #define EVENT_OPENAI_TRANSCRIPTION_DELTA    "mod_audio_stream::openai_transcription_delta"
 #define EVENT_OPENAI_SPEECH_STARTED         "mod_audio_stream::openai_speech_started"
 #define EVENT_OPENAI_SPEECH_STOPPED         "mod_audio_stream::openai_speech_stopped"
@@ -72,14 +72,6 @@ char* openai_get_websocket_url(void);
  */
 char* openai_generate_session_update(const openai_config_t* config);
 
-/**
- * @brief Generate input_audio_buffer.append message
- * 
- * @param base64_audio Base64-encoded audio data
- * @return Allocated JSON string (caller must free)
- */
-char* openai_generate_input_audio_buffer_append(const char* base64_audio);
-
 /**
  * @brief Generate input_audio_buffer.commit message
  * 
@@ -87,18 +79,6 @@ char* openai_generate_input_audio_buffer_append(const char* base64_audio);
  */
 char* openai_generate_input_audio_buffer_commit(void);
 
-/**
- * @brief Parse OpenAI event message and handle appropriately
- * 
- * @param session FreeSWITCH session
- * @param stream_id Stream identifier
- * @param json_message JSON message from OpenAI
- * @return SWITCH_STATUS_SUCCESS on success
- */
-switch_status_t openai_handle_message(switch_core_session_t* session, 
-                                     const char* stream_id, 
-                                     const char* json_message);
-
 /**
  * @brief Check if a WebSocket URL is for OpenAI Realtime API
  * 
@@ -107,18 +87,6 @@ switch_status_t openai_handle_message(switch_core_session_t* session,
  */
 int openai_is_realtime_url(const char* url);
 
-/**
- * @brief Transform regular audio stream message to OpenAI format
- * 
- * @param original_message Original mod_audio_stream message
- * @param stream_id Stream identifier
- * @param is_openai_mode 1 if in OpenAI mode, 0 otherwise
- * @return Transformed message (caller must free) or NULL if no transformation needed
- */
-char* openai_transform_outgoing_message(const char* original_message, 
-                                       const char* stream_id, 
-                                       int is_openai_mode);
-
 #ifdef __cplusplus
 }
 #endif
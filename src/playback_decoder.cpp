@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: MIT
+#include "playback_decoder.hpp"
+
+#include <cstring>
+
+#include "base64.hpp"
+#include "g711_codec.h"
+
+PlaybackDecoder::PlaybackDecoder()
+    : encoded_(PLAYBACK_DECODE_SLICE_BYTES + 2), linear_(PLAYBACK_DECODE_SLICE_BYTES * 2)
+{
+}
+
+bool PlaybackDecoder::set_format(streaming_codec_t codec, int sample_rate)
+{
+    if (codec != G722 && codec != OPUS)
+        return true;
+    return codec_decoder_.prepare(codec, sample_rate);
+}
+
+bool PlaybackDecoder::decode_base64(playback_ring_t *ring,
+                                    const char *payload,
+                                    size_t payload_len,
+                                    streaming_codec_t codec,
+                                    StreamResampler *resampler,
+                                    size_t &queued)
+{
+    const size_t slice_chars = PLAYBACK_DECODE_SLICE_BYTES / 3 * 4;
+    bool finished = false;
+    size_t pos = 0;
+    queued = 0;
+
+    while (!finished)
+    {
+        size_t n = (payload_len - pos < slice_chars) ? payload_len - pos : slice_chars;
+        bool last = (pos + n >= payload_len);
+
+        if (codec == L16 && !resampler)
+        {
+            // nothing to convert, decode straight into the ring segment
+            uint8_t *segment = (uint8_t *)playback_ring_alloc(n / 4 * 3 + 2);
+            if (!segment)
+                return false;
+            size_t len = base64::base64_decode_into(payload + pos, n, last, segment, &finished) & ~(size_t)1;
+            if (!playback_ring_push(ring, segment, len))
+                return false;
+            queued += len;
+        }
+        else
+        {
+            size_t len = base64::base64_decode_into(payload + pos, n, last, encoded_.data(), &finished);
+            if (!queue_slice(ring, encoded_.data(), len, codec, resampler, queued))
+            {
+                pending_.clear();
+                return false;
+            }
+        }
+        pos += n;
+    }
+    // a payload holds whole packets, a truncated one at its end is dropped
+    pending_.clear();
+    return true;
+}
+
+bool PlaybackDecoder::decode_raw(playback_ring_t *ring,
+                                 const uint8_t *audio,
+                                 size_t audio_len,
+                                 streaming_codec_t codec,
+                                 StreamResampler *resampler,
+                                 size_t &queued)
+{
+    queued = 0;
+    for (size_t pos = 0; pos < audio_len; pos += PLAYBACK_DECODE_SLICE_BYTES)
+    {
+        size_t n = (audio_len - pos < PLAYBACK_DECODE_SLICE_BYTES) ? audio_len - pos : PLAYBACK_DECODE_SLICE_BYTES;
+        if (!queue_slice(ring, audio + pos, n, codec, resampler, queued))
+        {
+            pending_.clear();
+            return false;
+        }
+    }
+    pending_.clear();
+    return true;
+}
+
+bool PlaybackDecoder::queue_slice(playback_ring_t *ring,
+                                  const uint8_t *audio,
+                                  size_t audio_len,
+                                  streaming_codec_t codec,
+                                  StreamResampler *resampler,
+                                  size_t &queued)
+{
+    if (audio_len == 0)
+        return true;
+
+    if (codec == ULAW)
+    {
+        if (resampler)
+        {
+            g711_ulaw_decode(audio, linear_.data(), audio_len);
+            return queue_resampled(ring, linear_.data(), audio_len, resampler, queued);
+        }
+
+        int16_t *segment = (int16_t *)playback_ring_alloc(audio_len * sizeof(int16_t));
+        if (!segment)
+            return false;
+        g711_ulaw_decode(audio, segment, audio_len);
+        if (!playback_ring_push(ring, segment, audio_len * sizeof(int16_t)))
+            return false;
+        queued += audio_len * sizeof(int16_t);
+        return true;
+    }
+
+    if (codec == G722)
+    {
+        size_t samples = codec_decoder_.decode(audio, audio_len, linear_.data(), linear_.size());
+        return queue_linear(ring, linear_.data(), samples, resampler, queued);
+    }
+
+    if (codec == OPUS)
+        return queue_opus(ring, audio, audio_len, resampler, queued);
+
+    // L16, a trailing odd byte is not a sample and would shift everything after it
+    size_t len = audio_len & ~(size_t)1;
+    if (resampler)
+    {
+        // copied to keep the samples aligned, binary frames start behind a 12 byte header
+        memcpy(linear_.data(), audio, len);
+        return queue_resampled(ring, linear_.data(), len / sizeof(int16_t), resampler, queued);
+    }
+
+    if (!playback_ring_write(ring, audio, len))
+        return false;
+    queued += len;
+    return true;
+}
+
+bool PlaybackDecoder::queue_opus(playback_ring_t *ring,
+                                 const uint8_t *audio,
+                                 size_t audio_len,
+                                 StreamResampler *resampler,
+                                 size_t &queued)
+{
+    pending_.insert(pending_.end(), audio, audio + audio_len);
+
+    size_t pos = 0;
+    bool ok = true;
+    while (ok && pending_.size() - pos >= 2)
+    {
+        size_t len = ((size_t)pending_[pos] << 8) | pending_[pos + 1];
+        if (pending_.size() - pos - 2 < len)
+            break;
+        // packets that do not decode are skipped, the next one resynchronises the decoder
+        size_t samples = codec_decoder_.decode(pending_.data() + pos + 2, len, linear_.data(), linear_.size());
+        pos += 2 + len;
+        if (samples > 0)
+            ok = queue_linear(ring, linear_.data(), samples, resampler, queued);
+    }
+    pending_.erase(pending_.begin(), pending_.begin() + pos);
+    return ok;
+}
+
+bool PlaybackDecoder::queue_linear(playback_ring_t *ring,
+                                   const int16_t *samples,
+                                   size_t sample_count,
+                                   StreamResampler *resampler,
+                                   size_t &queued)
+{
+    if (sample_count == 0)
+        return true;
+    if (resampler)
+        return queue_resampled(ring, samples, sample_count, resampler, queued);
+
+    if (!playback_ring_write(ring, samples, sample_count * sizeof(int16_t)))
+        return false;
+    queued += sample_count * sizeof(int16_t);
+    return true;
+}
+
+bool PlaybackDecoder::queue_resampled(playback_ring_t *ring,
+                                      const int16_t *samples,
+                                      size_t sample_count,
+                                      StreamResampler *resampler,
+                                      size_t &queued)
+{
+    size_t capacity = resampler->max_output(sample_count);
+
+    while (sample_count > 0)
+    {
+        int16_t *segment = (int16_t *)playback_ring_alloc(capacity * sizeof(int16_t));
+        if (!segment)
+            return false;
+
+        size_t in_len = sample_count;
+        size_t out_len = resampler->process(samples, in_len, segment, capacity);
+        if (!playback_ring_push(ring, segment, out_len * sizeof(int16_t)))
+            return false;
+        queued += out_len * sizeof(int16_t);
+
+        if (in_len == 0)
+            break;
+        samples += in_len;
+        sample_count -= in_len;
+    }
+    return true;
+}
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file playback_decoder.hpp
+ * @brief Incremental decode of incoming audio into the playback ring
+ *
+ * A media.play payload is decoded in bounded slices: base64, then μ-law,
+ * G.722, Opus or L16, then resampling, each slice landing in its own playback
+ * ring segment. Opus packets may straddle slices, the incomplete tail of one
+ * slice is kept until the next.
+ * The scratch buffers are owned by the session and reused, so memory use does
+ * not grow with the payload size, and the write thread can start playing the
+ * first slice while the rest of the message is still being decoded.
+ *
+ * @author FreeSWITCH Community
+ * @version 1.0
+ * @date 2024
+ */
+#ifndef __PLAYBACK_DECODER_HPP__
+#define __PLAYBACK_DECODER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "playback_ring.h"
+#include "stream_codec.hpp"
+#include "stream_resampler.hpp"
+#include "stream_utils.hpp"
+
+/** @brief Decoded bytes per slice; a multiple of 6 keeps every slice whole in both base64 groups and L16 samples */
+#define PLAYBACK_DECODE_SLICE_BYTES 4800
+
+/**
+ * @brief Per-session incoming audio decoder
+ *
+ * Used from the lws service thread only, the single producer of the session's
+ * playback ring.
+ */
+class PlaybackDecoder
+{
+    // Prevent copying and assignment
+    PlaybackDecoder(const PlaybackDecoder &) = delete;
+    void operator=(const PlaybackDecoder &) = delete;
+
+  public:
+    PlaybackDecoder();
+
+    /**
+     * @brief Set up the codec state for the payloads that follow
+     *
+     * Needed before decoding G.722 or Opus; the state carries over from one
+     * payload to the next while codec and rate stay the same.
+     *
+     * @param sample_rate Rate of the decoded audio
+     * @return false if the codec cannot be decoded in this build
+     */
+    bool set_format(streaming_codec_t codec, int sample_rate);
+
+    /**
+     * @brief Decode a base64 payload into the ring
+     *
+     * @param ring Playback ring of the session
+     * @param payload Base64 text, decoding stops at padding or an invalid character
+     * @param payload_len Length of the text
+     * @param codec Encoding of the decoded audio
+     * @param resampler Resampler to the channel rate, or nullptr when the rates match
+     * @param queued Receives the number of linear bytes queued
+     * @return false if a slice could not be queued (ring full or out of memory)
+     */
+    bool decode_base64(playback_ring_t *ring,
+                       const char *payload,
+                       size_t payload_len,
+                       streaming_codec_t codec,
+                       StreamResampler *resampler,
+                       size_t &queued);
+
+    /**
+     * @brief Decode raw audio bytes (binary framing) into the ring
+     *
+     * Same as decode_base64 without the base64 step.
+     */
+    bool decode_raw(playback_ring_t *ring,
+                    const uint8_t *audio,
+                    size_t audio_len,
+                    streaming_codec_t codec,
+                    StreamResampler *resampler,
+                    size_t &queued);
+
+  private:
+    /** @brief Convert one slice of encoded audio and queue it */
+    bool queue_slice(playback_ring_t *ring,
+                     const uint8_t *audio,
+                     size_t audio_len,
+                     streaming_codec_t codec,
+                     StreamResampler *resampler,
+                     size_t &queued);
+
+    /** @brief Decode the complete length-prefixed Opus packets of pending_ plus audio and queue them */
+    bool queue_opus(playback_ring_t *ring,
+                    const uint8_t *audio,
+                    size_t audio_len,
+                    StreamResampler *resampler,
+                    size_t &queued);
+
+    /** @brief Queue linear samples, resampled if needed */
+    bool queue_linear(playback_ring_t *ring,
+                      const int16_t *samples,
+                      size_t sample_count,
+                      StreamResampler *resampler,
+                      size_t &queued);
+
+    /** @brief Resample linear samples into ring segments */
+    bool queue_resampled(playback_ring_t *ring,
+                         const int16_t *samples,
+                         size_t sample_count,
+                         StreamResampler *resampler,
+                         size_t &queued);
+
+    /** @brief Base64 decoded bytes of the current slice */
+    std::vector<uint8_t> encoded_;
+
+    /** @brief Linear samples of the current slice before resampling */
+    std::vector<int16_t> linear_;
+
+    /** @brief G.722 and Opus state */
+    StreamDecoder codec_decoder_;
+
+    /** @brief Opus bytes of a packet not complete at the end of the last slice */
+    std::vector<uint8_t> pending_;
+};
+
+#endif /* __PLAYBACK_DECODER_HPP__ */
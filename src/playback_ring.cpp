@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: MIT
+#include "playback_ring.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* keeps the producer and consumer counters on separate cache lines */
+#define PLAYBACK_CACHE_LINE_SIZE 64
+
+namespace
+{
+struct segment_t
+{
+    /** @brief Bytes stored in the segment */
+    size_t len;
+    /** @brief Bytes already consumed (consumer only) */
+    size_t offset;
+    /** @brief Receive time handed to the consumer with the first byte, 0 if unstamped */
+    uint64_t stamp;
+};
+
+inline uint8_t *segment_data(segment_t *segment)
+{
+    return reinterpret_cast<uint8_t *>(segment + 1);
+}
+
+inline segment_t *data_segment(void *data)
+{
+    return reinterpret_cast<segment_t *>(data) - 1;
+}
+} // namespace
+
+/*
+ * Slot counters only ever grow; a slot index is counter % PLAYBACK_RING_SLOTS.
+ * Byte totals are kept next to them so the consumer can answer "is a full
+ * frame available" without walking the segments.
+ */
+struct playback_ring
+{
+    segment_t *slots[PLAYBACK_RING_SLOTS] = {};
+
+    // producer side
+    std::atomic<uint64_t> write_slot{0};
+    std::atomic<uint64_t> write_bytes{0};
+    std::atomic<uint64_t> discard_slot{0};
+    std::atomic<uint32_t> clear_count{0};
+    uint64_t pending_stamp = 0;
+    char pad0[PLAYBACK_CACHE_LINE_SIZE];
+
+    // consumer side
+    std::atomic<uint64_t> read_slot{0};
+    uint64_t read_bytes = 0;
+    char pad1[PLAYBACK_CACHE_LINE_SIZE];
+};
+
+namespace
+{
+// Release segments dropped by playback_ring_clear (consumer)
+void apply_discard(playback_ring_t *ring)
+{
+    uint64_t discard = ring->discard_slot.load(std::memory_order_acquire);
+    uint64_t read = ring->read_slot.load(std::memory_order_relaxed);
+    if (read >= discard)
+        return;
+
+    while (read < discard)
+    {
+        segment_t *segment = ring->slots[read % PLAYBACK_RING_SLOTS];
+        ring->read_bytes += segment->len - segment->offset;
+        free(segment);
+        read++;
+    }
+    ring->read_slot.store(read, std::memory_order_release);
+}
+} // namespace
+
+extern "C"
+{
+    playback_ring_t *playback_ring_create(void)
+    {
+        return new (std::nothrow) playback_ring();
+    }
+
+    void playback_ring_destroy(playback_ring_t *ring)
+    {
+        if (!ring)
+            return;
+        uint64_t write = ring->write_slot.load(std::memory_order_acquire);
+        for (uint64_t read = ring->read_slot.load(std::memory_order_relaxed); read < write; read++)
+            free(ring->slots[read % PLAYBACK_RING_SLOTS]);
+        delete ring;
+    }
+
+    void *playback_ring_alloc(size_t len)
+    {
+        segment_t *segment = (segment_t *)malloc(sizeof(segment_t) + len);
+        if (!segment)
+            return nullptr;
+        segment->len = len;
+        segment->offset = 0;
+        segment->stamp = 0;
+        return segment_data(segment);
+    }
+
+    int playback_ring_push(playback_ring_t *ring, void *data, size_t len)
+    {
+        segment_t *segment = data_segment(data);
+        uint64_t write = ring->write_slot.load(std::memory_order_relaxed);
+        if (len == 0 || write - ring->read_slot.load(std::memory_order_acquire) >= PLAYBACK_RING_SLOTS)
+        {
+            free(segment);
+            return len == 0;
+        }
+
+        segment->len = len;
+        if (ring->pending_stamp)
+        {
+            segment->stamp = ring->pending_stamp;
+            ring->pending_stamp = 0;
+        }
+        ring->slots[write % PLAYBACK_RING_SLOTS] = segment;
+        ring->write_slot.store(write + 1, std::memory_order_release);
+        ring->write_bytes.store(ring->write_bytes.load(std::memory_order_relaxed) + len, std::memory_order_release);
+        return 1;
+    }
+
+    int playback_ring_write(playback_ring_t *ring, const void *data, size_t len)
+    {
+        void *segment = playback_ring_alloc(len);
+        if (!segment)
+            return 0;
+        memcpy(segment, data, len);
+        return playback_ring_push(ring, segment, len);
+    }
+
+    void playback_ring_mark(playback_ring_t *ring, uint64_t stamp_ns)
+    {
+        ring->pending_stamp = stamp_ns;
+    }
+
+    void playback_ring_clear(playback_ring_t *ring)
+    {
+        ring->discard_slot.store(ring->write_slot.load(std::memory_order_relaxed), std::memory_order_release);
+        ring->clear_count.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    uint32_t playback_ring_clear_count(const playback_ring_t *ring)
+    {
+        return ring->clear_count.load(std::memory_order_acquire);
+    }
+
+    size_t playback_ring_inuse(playback_ring_t *ring)
+    {
+        apply_discard(ring);
+        return (size_t)(ring->write_bytes.load(std::memory_order_acquire) - ring->read_bytes);
+    }
+
+    size_t playback_ring_read(playback_ring_t *ring, void *dst, size_t len, uint64_t *stamp_ns)
+    {
+        apply_discard(ring);
+        if (stamp_ns)
+            *stamp_ns = 0;
+
+        uint8_t *out = (uint8_t *)dst;
+        size_t copied = 0;
+        uint64_t read = ring->read_slot.load(std::memory_order_relaxed);
+        uint64_t write = ring->write_slot.load(std::memory_order_acquire);
+        while (copied < len && read < write)
+        {
+            segment_t *segment = ring->slots[read % PLAYBACK_RING_SLOTS];
+            size_t n = segment->len - segment->offset;
+            if (n > len - copied)
+                n = len - copied;
+            if (stamp_ns && segment->offset == 0 && segment->stamp && !*stamp_ns)
+                *stamp_ns = segment->stamp;
+            memcpy(out + copied, segment_data(segment) + segment->offset, n);
+            segment->offset += n;
+            copied += n;
+
+            if (segment->offset == segment->len)
+            {
+                free(segment);
+                read++;
+            }
+        }
+        ring->read_bytes += copied;
+        ring->read_slot.store(read, std::memory_order_release);
+        return copied;
+    }
+
+    void playback_mix_s16(int16_t *dst, const int16_t *src, size_t samples)
+    {
+        size_t i = 0;
+#if defined(__SSE2__)
+        for (; i + 8 <= samples; i += 8)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epi16(a, b));
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 8 <= samples; i += 8)
+            vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), vld1q_s16(src + i)));
+#endif
+        for (; i < samples; i++)
+        {
+            int32_t mixed = (int32_t)dst[i] + src[i];
+            if (mixed > INT16_MAX)
+                mixed = INT16_MAX;
+            else if (mixed < INT16_MIN)
+                mixed = INT16_MIN;
+            dst[i] = (int16_t)mixed;
+        }
+    }
+}
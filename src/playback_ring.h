@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file playback_ring.h
+ * @brief Lock-free playback queue and saturating mixer for bidirectional streams
+ *
+ * Audio received from the WebSocket (media.play) is decoded on the lws service
+ * thread straight into a segment and handed to the channel's write thread
+ * through a single-producer/single-consumer ring of segment pointers. Neither
+ * side takes a lock, so decoding or resampling a large payload never stalls a
+ * frame on the write path.
+ *
+ * @author FreeSWITCH Community
+ * @version 1.0
+ * @date 2024
+ */
+#ifndef __PLAYBACK_RING_H__
+#define __PLAYBACK_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Number of queued segments (one per media.play payload) a ring holds */
+#define PLAYBACK_RING_SLOTS 4096
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct playback_ring playback_ring_t;
+
+    /**
+     * @brief Create an empty ring
+     * @return New ring, or NULL on allocation failure
+     */
+    playback_ring_t *playback_ring_create(void);
+
+    /**
+     * @brief Destroy a ring and every queued segment
+     *
+     * Neither the producer nor the consumer may use the ring afterwards.
+     */
+    void playback_ring_destroy(playback_ring_t *ring);
+
+    /**
+     * @brief Allocate a segment to decode into before queueing it with playback_ring_push (producer)
+     *
+     * @param len Maximum bytes that will be stored in the segment
+     * @return Writable segment data, or NULL on allocation failure
+     */
+    void *playback_ring_alloc(size_t len);
+
+    /**
+     * @brief Queue a segment returned by playback_ring_alloc (producer)
+     *
+     * The segment is owned by the ring afterwards, also when queueing fails.
+     *
+     * @param data Segment data from playback_ring_alloc
+     * @param len Bytes actually stored, at most the allocated length
+     * @return 1 on success, 0 if all slots are in use (the segment is freed)
+     */
+    int playback_ring_push(playback_ring_t *ring, void *data, size_t len);
+
+    /**
+     * @brief Copy and queue audio (producer)
+     * @return 1 on success, 0 on allocation failure or a full ring
+     */
+    int playback_ring_write(playback_ring_t *ring, const void *data, size_t len);
+
+    /**
+     * @brief Stamp the next queued segment with a receive time (producer)
+     *
+     * Marks where a received message starts so the consumer can tell when its
+     * first byte is played. A push failure loses the stamp.
+     *
+     * @param stamp_ns latency_now_ns() value, 0 clears a pending stamp
+     */
+    void playback_ring_mark(playback_ring_t *ring, uint64_t stamp_ns);
+
+    /**
+     * @brief Drop everything queued so far (producer)
+     *
+     * The consumer releases the dropped segments on its next call, and
+     * playback_ring_clear_count() changes so it can tell a read that raced the
+     * clear.
+     */
+    void playback_ring_clear(playback_ring_t *ring);
+
+    /**
+     * @brief Number of clears so far (any thread)
+     */
+    uint32_t playback_ring_clear_count(const playback_ring_t *ring);
+
+    /**
+     * @brief Bytes ready to be read (consumer)
+     */
+    size_t playback_ring_inuse(playback_ring_t *ring);
+
+    /**
+     * @brief Read up to len bytes across segments (consumer)
+     * @param stamp_ns Receives the stamp of the first marked segment whose first byte was read, else 0; may be NULL
+     * @return Bytes copied into dst
+     */
+    size_t playback_ring_read(playback_ring_t *ring, void *dst, size_t len, uint64_t *stamp_ns);
+
+    /**
+     * @brief Mix src into dst with signed 16-bit saturation
+     *
+     * Equivalent to adding each pair and clamping with switch_normalize_to_16bit(),
+     * vectorized with SSE2 or NEON where available.
+     */
+    void playback_mix_s16(int16_t *dst, const int16_t *src, size_t samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PLAYBACK_RING_H__ */
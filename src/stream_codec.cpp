@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: MIT
+#include "stream_codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <strings.h>
+
+#ifdef HAVE_OPUS
+#include <opus.h>
+#endif
+
+namespace
+{
+// bytes of a 20ms packet on average at bitrate, with headroom for the frames constrained VBR lets grow
+size_t opus_max_packet(int bitrate)
+{
+    size_t bytes = (size_t)bitrate / 400 * 3 / 2;
+    return bytes < STREAM_OPUS_MAX_PACKET ? bytes : STREAM_OPUS_MAX_PACKET;
+}
+
+bool opus_rate(int sampling)
+{
+    return sampling == 8000 || sampling == 12000 || sampling == 16000 || sampling == 24000 || sampling == 48000;
+}
+} // namespace
+
+bool stream_codec_from_name(const char *name, streaming_codec_t &codec)
+{
+    if (!name || 0 == strcasecmp(name, "l16"))
+        codec = L16;
+    else if (0 == strcasecmp(name, "mulaw"))
+        codec = ULAW;
+    else if (0 == strcasecmp(name, "opus"))
+        codec = OPUS;
+    else if (0 == strcasecmp(name, "g722"))
+        codec = G722;
+    else
+        return false;
+    return true;
+}
+
+const char *stream_codec_content_type(streaming_codec_t codec)
+{
+    switch (codec)
+    {
+        case ULAW:
+            return "audio/x-mulaw";
+        case OPUS:
+            return "audio/opus";
+        case G722:
+            return "audio/G722";
+        default:
+            return "audio/x-l16";
+    }
+}
+
+const char *stream_codec_unsupported(streaming_codec_t codec, int sampling)
+{
+    if (codec == OPUS)
+    {
+#ifndef HAVE_OPUS
+        return "module built without libopus";
+#endif
+        if (!opus_rate(sampling))
+            return "opus needs a sampling rate of 8000, 12000, 16000, 24000 or 48000";
+    }
+    else if (codec == G722 && sampling != 16000)
+    {
+        return "g722 needs a sampling rate of 16000";
+    }
+    return nullptr;
+}
+
+size_t stream_codec_chunk_bytes(streaming_codec_t codec, int sampling, int bitrate)
+{
+    switch (codec)
+    {
+        case ULAW:
+            return ULAW_FRAME_SIZE_8KHZ_20MS * (sampling / 8000);
+        case OPUS:
+            return 2 + opus_max_packet(bitrate);
+        case G722:
+            // one byte per two 16 kHz samples
+            return (size_t)sampling / 50 / 2;
+        default:
+            return L16_FRAME_SIZE_8KHZ_20MS * (sampling / 8000);
+    }
+}
+
+size_t stream_codec_pack_chunks(streaming_codec_t codec, uint8_t *chunks, size_t chunk_bytes, size_t count)
+{
+    if (codec != OPUS)
+        return chunk_bytes * count;
+
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *chunk = chunks + i * chunk_bytes;
+        size_t packet = 2 + (((size_t)chunk[0] << 8) | chunk[1]);
+        if (len != i * chunk_bytes)
+            memmove(chunks + len, chunk, packet);
+        len += packet;
+    }
+    return len;
+}
+
+StreamEncoder::StreamEncoder(streaming_codec_t codec, size_t frame_samples, size_t chunk_bytes, int bitrate)
+    : codec_(codec), frame_samples_(frame_samples), chunk_bytes_(chunk_bytes), bitrate_(bitrate), opus_(nullptr)
+{
+    g722_state_init(&g722_);
+}
+
+StreamEncoder *StreamEncoder::create(streaming_codec_t codec, int sampling, int bitrate, int complexity)
+{
+    if ((codec != OPUS && codec != G722) || stream_codec_unsupported(codec, sampling))
+        return nullptr;
+
+    StreamEncoder *encoder = new (std::nothrow)
+        StreamEncoder(codec, (size_t)sampling / 50, stream_codec_chunk_bytes(codec, sampling, bitrate), bitrate);
+    if (!encoder)
+        return nullptr;
+#ifdef HAVE_OPUS
+    if (codec == OPUS)
+    {
+        int err = OPUS_OK;
+        OpusEncoder *opus = opus_encoder_create(sampling, 1, OPUS_APPLICATION_VOIP, &err);
+        if (err != OPUS_OK || !opus)
+        {
+            delete encoder;
+            return nullptr;
+        }
+        // constrained VBR keeps every packet close to the average, so chunks can be sized for it
+        opus_encoder_ctl(opus, OPUS_SET_BITRATE(bitrate));
+        opus_encoder_ctl(opus, OPUS_SET_COMPLEXITY(complexity));
+        opus_encoder_ctl(opus, OPUS_SET_VBR_CONSTRAINT(1));
+        opus_encoder_ctl(opus, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+        encoder->opus_ = opus;
+    }
+#else
+    (void)complexity;
+#endif
+    return encoder;
+}
+
+StreamEncoder::~StreamEncoder()
+{
+#ifdef HAVE_OPUS
+    if (opus_)
+        opus_encoder_destroy(static_cast<OpusEncoder *>(opus_));
+#endif
+}
+
+bool StreamEncoder::encode(const int16_t *samples, uint8_t *chunk)
+{
+    if (codec_ == G722)
+    {
+        size_t len = g722_encode(&g722_, samples, chunk, frame_samples_);
+        if (len < chunk_bytes_)
+            memset(chunk + len, 0, chunk_bytes_ - len);
+        return true;
+    }
+
+    int len = -1;
+#ifdef HAVE_OPUS
+    len = opus_encode(
+        static_cast<OpusEncoder *>(opus_), samples, (int)frame_samples_, chunk + 2, (opus_int32)(chunk_bytes_ - 2));
+#else
+    (void)samples;
+#endif
+    // a zero length packet is decoded as lost, i.e. concealed
+    if (len < 0)
+        len = 0;
+    chunk[0] = (uint8_t)(len >> 8);
+    chunk[1] = (uint8_t)len;
+    return len > 0;
+}
+
+void StreamEncoder::reduce_bitrate(bool reduced)
+{
+#ifdef HAVE_OPUS
+    if (opus_)
+    {
+        int bitrate = reduced ? std::max(STREAM_OPUS_MIN_BITRATE, bitrate_ / 2) : bitrate_;
+        opus_encoder_ctl(static_cast<OpusEncoder *>(opus_), OPUS_SET_BITRATE(bitrate));
+    }
+#else
+    (void)reduced;
+#endif
+}
+
+StreamDecoder::StreamDecoder() : codec_(L16), sampling_(0), opus_(nullptr)
+{
+    g722_state_init(&g722_);
+}
+
+StreamDecoder::~StreamDecoder()
+{
+#ifdef HAVE_OPUS
+    if (opus_)
+        opus_decoder_destroy(static_cast<OpusDecoder *>(opus_));
+#endif
+}
+
+bool StreamDecoder::prepare(streaming_codec_t codec, int sampling)
+{
+    if (codec == codec_ && sampling == sampling_)
+        return true;
+
+    codec_ = codec;
+    sampling_ = sampling;
+    g722_state_init(&g722_);
+#ifdef HAVE_OPUS
+    if (opus_)
+    {
+        opus_decoder_destroy(static_cast<OpusDecoder *>(opus_));
+        opus_ = nullptr;
+    }
+    if (codec == OPUS)
+    {
+        int err = OPUS_OK;
+        opus_ = opus_decoder_create(sampling, 1, &err);
+        if (err != OPUS_OK)
+            opus_ = nullptr;
+    }
+#endif
+    if (codec == OPUS && !opus_)
+    {
+        // retried with the next payload
+        sampling_ = 0;
+        return false;
+    }
+    return true;
+}
+
+size_t StreamDecoder::decode(const uint8_t *data, size_t len, int16_t *samples, size_t max_samples)
+{
+    if (codec_ == G722)
+    {
+        if (len > max_samples / 2)
+            len = max_samples / 2;
+        return g722_decode(&g722_, data, samples, len);
+    }
+
+    int decoded = -1;
+#ifdef HAVE_OPUS
+    if (opus_)
+        decoded = opus_decode(
+            static_cast<OpusDecoder *>(opus_), len ? data : nullptr, (opus_int32)len, samples, (int)max_samples, 0);
+#else
+    (void)data;
+    (void)len;
+    (void)samples;
+    (void)max_samples;
+#endif
+    return decoded > 0 ? (size_t)decoded : 0;
+}
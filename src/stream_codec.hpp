@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file stream_codec.hpp
+ * @brief Compressed upstream codecs and their chunk layout
+ *
+ * L16 and μ-law chunks are plain sample arrays. Opus and G.722 keep encoder
+ * state from one 20ms frame to the next, so every buffer fed by a media bug
+ * gets its own StreamEncoder, and every bidirectional session a
+ * StreamDecoder for the audio it plays.
+ *
+ * An Opus packet varies in size, so its Buffer chunk holds the packet behind
+ * a 16-bit big-endian length and is sized for the worst packet the
+ * configured bitrate allows. That length prefix is also the wire format: a
+ * media payload is one or more length-prefixed packets, see
+ * stream_codec_pack_chunks().
+ *
+ * Opus support needs libopus at build time (HAVE_OPUS); without it the codec
+ * is refused when a stream starts.
+ */
+#ifndef __STREAM_CODEC_HPP__
+#define __STREAM_CODEC_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "g722_codec.h"
+#include "stream_utils.hpp"
+
+/** @brief Opus bitrate used unless MOD_AUDIO_STREAM_OPUS_BITRATE says otherwise, bits/s */
+#define STREAM_OPUS_DEFAULT_BITRATE 32000
+
+/** @brief Accepted Opus bitrates, bits/s */
+#define STREAM_OPUS_MIN_BITRATE 6000
+#define STREAM_OPUS_MAX_BITRATE 128000
+
+/** @brief Opus encoder complexity unless MOD_AUDIO_STREAM_OPUS_COMPLEXITY says otherwise, 0-10 */
+#define STREAM_OPUS_DEFAULT_COMPLEXITY 5
+
+/** @brief Largest Opus packet the format allows for one frame */
+#define STREAM_OPUS_MAX_PACKET 1275
+
+/**
+ * @brief Codec named in the start command ("l16", "mulaw", "opus" or "g722")
+ * @return false if the name is unknown
+ */
+bool stream_codec_from_name(const char *name, streaming_codec_t &codec);
+
+/**
+ * @brief Content type advertised in mediaFormat and expected in media.play
+ */
+const char *stream_codec_content_type(streaming_codec_t codec);
+
+/**
+ * @brief Check that a codec can stream at the given rate in this build
+ * @return nullptr if it can, otherwise the reason it cannot
+ */
+const char *stream_codec_unsupported(streaming_codec_t codec, int sampling);
+
+/**
+ * @brief Bytes of one 20ms Buffer chunk
+ *
+ * @param bitrate Opus bitrate in bits/s, ignored by the other codecs
+ */
+size_t stream_codec_chunk_bytes(streaming_codec_t codec, int sampling, int bitrate);
+
+/**
+ * @brief Turn count consecutive chunks read from a Buffer into a media payload
+ *
+ * Fixed size codecs are left as they are. Opus chunks are moved down onto
+ * each other so only the length-prefixed packets remain.
+ *
+ * @return Payload length in bytes
+ */
+size_t stream_codec_pack_chunks(streaming_codec_t codec, uint8_t *chunks, size_t chunk_bytes, size_t count);
+
+/**
+ * @brief Per-buffer encoder of the stateful codecs (producer side)
+ */
+class StreamEncoder
+{
+    // Prevent copying and assignment
+    StreamEncoder(const StreamEncoder &) = delete;
+    void operator=(const StreamEncoder &) = delete;
+
+  public:
+    /**
+     * @brief Encoder for Opus or G.722
+     *
+     * @param bitrate Opus bitrate, bits/s
+     * @param complexity Opus complexity, 0-10
+     * @return nullptr for the other codecs or if the encoder could not be created
+     */
+    static StreamEncoder *create(streaming_codec_t codec, int sampling, int bitrate, int complexity);
+
+    ~StreamEncoder();
+
+    /**
+     * @brief Encode one 20ms frame into a Buffer chunk
+     *
+     * @param samples One frame of linear samples at the stream rate, sampling / 50 of them
+     * @param chunk Receives chunk_bytes() bytes
+     * @return false if the encoder failed, the chunk then holds an empty packet
+     */
+    bool encode(const int16_t *samples, uint8_t *chunk);
+
+    /**
+     * @brief Halve the Opus bitrate (not below STREAM_OPUS_MIN_BITRATE) or go back to the configured one
+     *
+     * Used by the codec step of the backpressure ladder; the chunk size stays
+     * that of the configured bitrate. No effect on G.722.
+     */
+    void reduce_bitrate(bool reduced);
+
+    size_t chunk_bytes() const
+    {
+        return chunk_bytes_;
+    }
+
+  private:
+    StreamEncoder(streaming_codec_t codec, size_t frame_samples, size_t chunk_bytes, int bitrate);
+
+    streaming_codec_t codec_;
+    size_t frame_samples_;
+    size_t chunk_bytes_;
+    int bitrate_;
+    g722_state_t g722_;
+    void *opus_;
+};
+
+/**
+ * @brief Per-session decoder of the stateful codecs (lws service thread)
+ */
+class StreamDecoder
+{
+    // Prevent copying and assignment
+    StreamDecoder(const StreamDecoder &) = delete;
+    void operator=(const StreamDecoder &) = delete;
+
+  public:
+    StreamDecoder();
+    ~StreamDecoder();
+
+    /**
+     * @brief Get ready for audio in codec at sampling, keeping the state if nothing changed
+     * @return false if the codec cannot be decoded in this build
+     */
+    bool prepare(streaming_codec_t codec, int sampling);
+
+    /**
+     * @brief Decode G.722 bytes or one Opus packet
+     *
+     * @param max_samples Room in samples, two per G.722 byte or 120ms for Opus
+     * @return Number of samples written, 0 for a packet that does not decode
+     */
+    size_t decode(const uint8_t *data, size_t len, int16_t *samples, size_t max_samples);
+
+  private:
+    streaming_codec_t codec_;
+    int sampling_;
+    g722_state_t g722_;
+    void *opus_;
+};
+
+#endif /* __STREAM_CODEC_HPP__ */
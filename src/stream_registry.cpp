@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: MIT
+#include "stream_registry.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <switch.h>
+#include <vector>
+
+#include "latency_metrics.h"
+#include "stream_utils.hpp"
+
+/* slots are allocated 64 at a time, for up to 65536 concurrent streams */
+#define REGISTRY_SEGMENT_SLOTS 64
+#define REGISTRY_MAX_SEGMENTS 1024
+
+/* passes over the registry before a snapshot settles for one a stream finished during; at call lengths of
+   minutes a stream ending in the few microseconds of a pass is rare, four in a row do not happen */
+#define REGISTRY_SNAPSHOT_ATTEMPTS 4
+
+namespace
+{
+// one counter or gauge, alone on its cache line so threads updating neighbouring ones never share it
+struct alignas(STREAM_CACHE_LINE_SIZE) Cell
+{
+    std::atomic<uint64_t> value;
+};
+
+struct MetricName
+{
+    const char *json;
+    const char *prometheus;
+    const char *help;
+};
+
+const MetricName counter_names[STREAM_COUNTER_COUNT] = {
+    {"framesCaptured", "frames_captured_total", "Frames read from the media bug"},
+    {"framesPlayed", "frames_played_total", "Frames of incoming audio played into the channel"},
+    {"messagesSent", "messages_sent_total", "Messages written to the socket"},
+    {"bytesSent", "sent_bytes_total", "Bytes written to the socket"},
+    {"messagesReceived", "messages_received_total", "Messages received"},
+    {"bytesReceived", "received_bytes_total", "Bytes of the messages received"},
+    {"dropped", "dropped_total", "Frames or chunks of audio that were never sent"},
+    {"connects", "connects_total", "Connections established"},
+    {"connectFailures", "connect_failures_total", "Connection attempts that failed"},
+    {"reconnects", "reconnects_total", "Reconnect attempts after a failure or a drop"}};
+
+const MetricName gauge_names[STREAM_GAUGE_COUNT] = {
+    {"queuedChunks", "queued_chunks", "Chunks waiting to be sent"},
+    {"spooledChunks", "spooled_chunks", "Chunks waiting in disk spools"},
+    {"playbackBytes", "playback_queued_bytes", "Bytes of incoming audio queued for playback"},
+    {"connected", "connected_streams", "Streams with their connection up"},
+    {"degradation", "degraded_streams", "Streams degraded by the backpressure ladder"}};
+} // namespace
+
+struct stream_entry
+{
+    // odd while the slot is free or being filled in, bumped to even once it belongs to a running stream
+    std::atomic<uint32_t> generation;
+    std::atomic<int> refs;
+    // index + 1 of the next slot on the free list, 0 for the end
+    std::atomic<uint32_t> next_free;
+    uint32_t index;
+    // the fields below are written only while the generation is odd
+    std::atomic<uint64_t> started_ns;
+    char session_id[STREAM_REGISTRY_ID_LENGTH];
+    char stream_id[STREAM_REGISTRY_ID_LENGTH];
+    Cell counters[STREAM_COUNTER_COUNT];
+    Cell gauges[STREAM_GAUGE_COUNT];
+};
+
+namespace
+{
+// segments are installed once and never freed, a scrape can read any slot at any time
+std::atomic<stream_entry *> segments[REGISTRY_MAX_SEGMENTS];
+// slots handed out so far, the part of the segments a scrape walks
+std::atomic<uint32_t> slots_claimed;
+// index + 1 of the first free slot in the low half, bumped by every pop in the high half against ABA
+std::atomic<uint64_t> free_head;
+
+std::atomic<uint32_t> active_streams;
+std::atomic<uint64_t> started_streams;
+std::atomic<uint64_t> failed_streams;
+// counters of finished streams
+std::atomic<uint64_t> retired[STREAM_COUNTER_COUNT];
+// releases under way and done, a snapshot that saw either move is taken again
+std::atomic<uint32_t> retiring;
+std::atomic<uint64_t> retirements;
+
+// a copy of one running stream
+struct StreamView
+{
+    uint64_t started_ns;
+    uint64_t counters[STREAM_COUNTER_COUNT];
+    uint64_t gauges[STREAM_GAUGE_COUNT];
+    char session_id[STREAM_REGISTRY_ID_LENGTH];
+    char stream_id[STREAM_REGISTRY_ID_LENGTH];
+};
+
+stream_entry *slot_at(uint32_t index)
+{
+    stream_entry *segment = segments[index / REGISTRY_SEGMENT_SLOTS].load(std::memory_order_acquire);
+    return segment ? segment + index % REGISTRY_SEGMENT_SLOTS : nullptr;
+}
+
+stream_entry *pop_free()
+{
+    uint64_t head = free_head.load(std::memory_order_acquire);
+    while ((uint32_t)head != 0)
+    {
+        stream_entry *entry = slot_at((uint32_t)head - 1);
+        uint64_t next = (((head >> 32) + 1) << 32) | entry->next_free.load(std::memory_order_relaxed);
+        if (free_head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+            return entry;
+    }
+    return nullptr;
+}
+
+void push_free(stream_entry *entry)
+{
+    uint64_t head = free_head.load(std::memory_order_relaxed);
+    uint64_t next;
+    do
+    {
+        entry->next_free.store((uint32_t)head, std::memory_order_relaxed);
+        next = (((head >> 32) + 1) << 32) | (entry->index + 1);
+    } while (!free_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// a slot never handed out before, installing its segment if this is the first one of it
+stream_entry *new_slot()
+{
+    uint32_t index = slots_claimed.load(std::memory_order_relaxed);
+    do
+    {
+        if (index >= REGISTRY_SEGMENT_SLOTS * REGISTRY_MAX_SEGMENTS)
+            return nullptr;
+    } while (!slots_claimed.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+
+    std::atomic<stream_entry *> &segment = segments[index / REGISTRY_SEGMENT_SLOTS];
+    if (!segment.load(std::memory_order_acquire))
+    {
+        void *memory = nullptr;
+        if (posix_memalign(&memory, STREAM_CACHE_LINE_SIZE, sizeof(stream_entry) * REGISTRY_SEGMENT_SLOTS) != 0)
+            return nullptr;
+        stream_entry *fresh = static_cast<stream_entry *>(memory);
+        uint32_t first = index - index % REGISTRY_SEGMENT_SLOTS;
+        for (uint32_t i = 0; i < REGISTRY_SEGMENT_SLOTS; i++)
+        {
+            stream_entry *entry = new (fresh + i) stream_entry;
+            entry->generation.store(1, std::memory_order_relaxed);
+            entry->refs.store(0, std::memory_order_relaxed);
+            entry->next_free.store(0, std::memory_order_relaxed);
+            entry->index = first + i;
+        }
+        // another thread claimed a slot of the same segment at the same time and installed its copy first
+        stream_entry *expected = nullptr;
+        if (!segment.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel))
+            free(memory);
+    }
+    return slot_at(index);
+}
+
+// copy of a running stream, false if the slot is free or changed hands while it was read
+bool read_slot(const stream_entry *entry, StreamView &view, bool with_ids)
+{
+    uint32_t generation = entry->generation.load(std::memory_order_acquire);
+    if (generation & 1)
+        return false;
+    view.started_ns = entry->started_ns.load(std::memory_order_relaxed);
+    for (int i = 0; i < STREAM_COUNTER_COUNT; i++)
+        view.counters[i] = entry->counters[i].value.load(std::memory_order_relaxed);
+    for (int i = 0; i < STREAM_GAUGE_COUNT; i++)
+        view.gauges[i] = entry->gauges[i].value.load(std::memory_order_relaxed);
+    // a copy torn by the slot changing hands is thrown away below
+    if (with_ids)
+    {
+        memcpy(view.session_id, entry->session_id, sizeof(view.session_id));
+        memcpy(view.stream_id, entry->stream_id, sizeof(view.stream_id));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return entry->generation.load(std::memory_order_relaxed) == generation;
+}
+
+// one pass over the registry: module totals, and copies of the running streams when views is set
+void take_snapshot(stream_registry_totals_t *totals, std::vector<StreamView> *views, const char *session_id)
+{
+    StreamView view;
+    for (int attempt = 0; attempt < REGISTRY_SNAPSHOT_ATTEMPTS; attempt++)
+    {
+        bool quiet = retiring.load() == 0;
+        uint64_t before = retirements.load();
+
+        memset(totals, 0, sizeof(*totals));
+        if (views)
+            views->clear();
+        totals->started = started_streams.load(std::memory_order_relaxed);
+        totals->failed = failed_streams.load(std::memory_order_relaxed);
+        for (int i = 0; i < STREAM_COUNTER_COUNT; i++)
+            totals->counters[i] = retired[i].load(std::memory_order_relaxed);
+
+        uint32_t claimed = slots_claimed.load(std::memory_order_acquire);
+        for (uint32_t index = 0; index < claimed; index++)
+        {
+            const stream_entry *entry = slot_at(index);
+            if (!entry || !read_slot(entry, view, views != nullptr))
+                continue;
+            totals->active++;
+            for (int i = 0; i < STREAM_COUNTER_COUNT; i++)
+                totals->counters[i] += view.counters[i];
+            for (int i = 0; i < STREAM_GAUGE_COUNT; i++)
+            {
+                if (i == STREAM_GAUGE_DEGRADATION)
+                    totals->gauges[i] += view.gauges[i] > 0;
+                else
+                    totals->gauges[i] += view.gauges[i];
+            }
+            if (view.counters[STREAM_COUNTER_CONNECTS] > 0 && view.gauges[STREAM_GAUGE_CONNECTED] == 0)
+                totals->disconnected++;
+            if (views && (!session_id || 0 == strcmp(view.session_id, session_id)))
+                views->push_back(view);
+        }
+
+        if (quiet && retiring.load() == 0 && retirements.load() == before)
+            break;
+    }
+}
+
+cJSON *metrics_json(const uint64_t *counters, const uint64_t *gauges)
+{
+    cJSON *item = cJSON_CreateObject();
+    for (int i = 0; i < STREAM_COUNTER_COUNT; i++)
+        cJSON_AddItemToObject(item, counter_names[i].json, cJSON_CreateNumber((double)counters[i]));
+    for (int i = 0; i < STREAM_GAUGE_COUNT; i++)
+        cJSON_AddItemToObject(item, gauge_names[i].json, cJSON_CreateNumber((double)gauges[i]));
+    return item;
+}
+
+void append_metric(std::string &text, const char *name, const char *type, const char *help, uint64_t value)
+{
+    char lines[320];
+    snprintf(lines,
+             sizeof(lines),
+             "# HELP mod_audio_stream_%s %s\n# TYPE mod_audio_stream_%s %s\nmod_audio_stream_%s %llu\n",
+             name,
+             help,
+             name,
+             type,
+             name,
+             (unsigned long long)value);
+    text += lines;
+}
+} // namespace
+
+stream_entry_t *stream_registry_add(const char *session_id, const char *stream_id)
+{
+    stream_entry *entry = pop_free();
+    if (!entry)
+        entry = new_slot();
+    if (!entry)
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s): no stream registry slot left, the stream is not counted\n",
+                          stream_id ? stream_id : "");
+        return nullptr;
+    }
+
+    // the generation is odd, scrapes pass the slot by until it is filled in
+    snprintf(entry->session_id, sizeof(entry->session_id), "%s", session_id ? session_id : "");
+    snprintf(entry->stream_id, sizeof(entry->stream_id), "%s", stream_id ? stream_id : "");
+    entry->started_ns.store(latency_now_ns(), std::memory_order_relaxed);
+    for (int i = 0; i < STREAM_COUNTER_COUNT; i++)
+        entry->counters[i].value.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < STREAM_GAUGE_COUNT; i++)
+        entry->gauges[i].value.store(0, std::memory_order_relaxed);
+    entry->refs.store(1, std::memory_order_relaxed);
+    entry->generation.fetch_add(1, std::memory_order_release);
+
+    active_streams.fetch_add(1, std::memory_order_relaxed);
+    started_streams.fetch_add(1, std::memory_order_relaxed);
+    return entry;
+}
+
+void stream_registry_retain(stream_entry_t *entry)
+{
+    if (entry)
+        entry->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void stream_registry_release(stream_entry_t *entry)
+{
+    if (!entry || entry->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    retiring.fetch_add(1);
+    for (int i = 0; i < STREAM_COUNTER_COUNT; i++)
+        retired[i].fetch_add(entry->counters[i].value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    if (entry->counters[STREAM_COUNTER_CONNECTS].value.load(std::memory_order_relaxed) == 0 &&
+        entry->counters[STREAM_COUNTER_CONNECT_FAILURES].value.load(std::memory_order_relaxed) > 0)
+        failed_streams.fetch_add(1, std::memory_order_relaxed);
+    entry->generation.fetch_add(1, std::memory_order_release);
+    active_streams.fetch_sub(1, std::memory_order_relaxed);
+    retirements.fetch_add(1);
+    retiring.fetch_sub(1);
+    push_free(entry);
+}
+
+void stream_registry_count(stream_entry_t *entry, stream_counter_t counter, uint64_t n)
+{
+    if (entry && (unsigned int)counter < STREAM_COUNTER_COUNT)
+        entry->counters[counter].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+void stream_registry_set(stream_entry_t *entry, stream_gauge_t gauge, uint64_t value)
+{
+    if (entry && (unsigned int)gauge < STREAM_GAUGE_COUNT)
+        entry->gauges[gauge].value.store(value, std::memory_order_relaxed);
+}
+
+uint32_t stream_registry_active(void)
+{
+    return active_streams.load(std::memory_order_relaxed);
+}
+
+void stream_registry_snapshot(stream_registry_totals_t *totals)
+{
+    take_snapshot(totals, nullptr, nullptr);
+}
+
+char *stream_registry_json(const char *session_id)
+{
+    stream_registry_totals_t totals;
+    std::vector<StreamView> views;
+    take_snapshot(&totals, &views, session_id);
+
+    uint64_t now = latency_now_ns();
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "activeStreams", cJSON_CreateNumber(totals.active));
+    cJSON_AddItemToObject(root, "disconnectedStreams", cJSON_CreateNumber(totals.disconnected));
+    cJSON_AddItemToObject(root, "startedStreams", cJSON_CreateNumber((double)totals.started));
+    cJSON_AddItemToObject(root, "failedStreams", cJSON_CreateNumber((double)totals.failed));
+    cJSON_AddItemToObject(root, "totals", metrics_json(totals.counters, totals.gauges));
+    cJSON *streams = cJSON_CreateArray();
+    for (const StreamView &view : views)
+    {
+        cJSON *item = metrics_json(view.counters, view.gauges);
+        cJSON_AddItemToObject(item, "uuid", cJSON_CreateString(view.session_id));
+        cJSON_AddItemToObject(item, "streamId", cJSON_CreateString(view.stream_id));
+        cJSON_AddItemToObject(item, "ageMs", cJSON_CreateNumber((double)((now - view.started_ns) / 1000000)));
+        cJSON_AddItemToArray(streams, item);
+    }
+    cJSON_AddItemToObject(root, "streams", streams);
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return json;
+}
+
+char *stream_registry_prometheus(void)
+{
+    stream_registry_totals_t totals;
+    take_snapshot(&totals, nullptr, nullptr);
+
+    std::string text;
+    text.reserve(4096);
+    append_metric(text, "active_streams", "gauge", "Streams running", totals.active);
+    append_metric(text,
+                  "disconnected_streams",
+                  "gauge",
+                  "Running streams that lost their connection and have not got it back",
+                  totals.disconnected);
+    append_metric(text, "streams_started_total", "counter", "Streams started", totals.started);
+    append_metric(text, "streams_failed_total", "counter", "Streams that ended without ever connecting", totals.failed);
+    for (int i = 0; i < STREAM_COUNTER_COUNT; i++)
+        append_metric(text, counter_names[i].prometheus, "counter", counter_names[i].help, totals.counters[i]);
+    for (int i = 0; i < STREAM_GAUGE_COUNT; i++)
+        append_metric(text, gauge_names[i].prometheus, "gauge", gauge_names[i].help, totals.gauges[i]);
+    return strdup(text.c_str());
+}
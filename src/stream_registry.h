@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file stream_registry.h
+ * @brief Module-wide registry of running streams and their counters
+ *
+ * Every stream takes one slot of the registry while it runs. A slot holds the
+ * stream's counters and gauges, each on a cache line of its own, so the media
+ * bug, the write thread and the lws service thread update them with relaxed
+ * atomic adds and stores without sharing a line. Slots are claimed and
+ * returned through a lock-free free list in O(1) and live in segments that
+ * are never freed, so a scrape walks them without taking a lock and without
+ * looking at any session, channel private or AudioPipe: a slot that changes
+ * hands while it is read is detected by its generation and left out.
+ *
+ * When a stream ends its counters are folded into module-wide totals;
+ * module-wide queries add the streams that are still running. Latency
+ * histograms stay in latency_metrics.h, the exposition built here adds them.
+ *
+ * @author FreeSWITCH Community
+ * @version 1.0
+ * @date 2024
+ */
+#ifndef __STREAM_REGISTRY_H__
+#define __STREAM_REGISTRY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Room for the channel uuid and the stream id kept in a slot, longer ones are truncated */
+#define STREAM_REGISTRY_ID_LENGTH 256
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Monotonic per-stream counters, module totals include finished streams
+     */
+    typedef enum stream_counter
+    {
+        /** @brief Frames read from the media bug (media bug threads) */
+        STREAM_COUNTER_FRAMES_CAPTURED = 0,
+
+        /** @brief Frames of incoming audio played into the channel (write thread) */
+        STREAM_COUNTER_FRAMES_PLAYED,
+
+        /** @brief Messages written to the socket (lws thread) */
+        STREAM_COUNTER_MESSAGES_SENT,
+
+        /** @brief Bytes written to the socket (lws thread) */
+        STREAM_COUNTER_BYTES_SENT,
+
+        /** @brief Complete messages received (lws thread) */
+        STREAM_COUNTER_MESSAGES_RECEIVED,
+
+        /** @brief Bytes of the messages received (lws thread) */
+        STREAM_COUNTER_BYTES_RECEIVED,
+
+        /** @brief Frames or chunks of audio that were never sent (media bug threads and lws thread) */
+        STREAM_COUNTER_DROPPED,
+
+        /** @brief Connections established, the first one included (lws thread) */
+        STREAM_COUNTER_CONNECTS,
+
+        /** @brief Connection attempts that failed (lws thread) */
+        STREAM_COUNTER_CONNECT_FAILURES,
+
+        /** @brief Reconnect attempts after a failure or a drop (lws thread) */
+        STREAM_COUNTER_RECONNECTS,
+
+        STREAM_COUNTER_COUNT
+    } stream_counter_t;
+
+    /**
+     * @brief Per-stream gauges, module totals add up the running streams
+     */
+    typedef enum stream_gauge
+    {
+        /** @brief Chunks waiting to be sent, memory and spool, both tracks (media bug threads) */
+        STREAM_GAUGE_QUEUED_CHUNKS = 0,
+
+        /** @brief Part of the queued chunks that sits in a disk spool (media bug threads) */
+        STREAM_GAUGE_SPOOLED_CHUNKS,
+
+        /** @brief Bytes of incoming audio queued for playback (write thread) */
+        STREAM_GAUGE_PLAYBACK_BYTES,
+
+        /** @brief 1 while the connection is up (lws thread) */
+        STREAM_GAUGE_CONNECTED,
+
+        /** @brief Backpressure ladder level, DEGRADE_NONE when not degraded (media bug thread) */
+        STREAM_GAUGE_DEGRADATION,
+
+        STREAM_GAUGE_COUNT
+    } stream_gauge_t;
+
+    typedef struct stream_entry stream_entry_t;
+
+    /**
+     * @brief Module-wide view taken by one pass over the registry
+     */
+    typedef struct stream_registry_totals
+    {
+        /** @brief Streams running */
+        uint32_t active;
+
+        /** @brief Running streams that were connected once and are not now */
+        uint32_t disconnected;
+
+        /** @brief Streams registered since the module was loaded */
+        uint64_t started;
+
+        /** @brief Finished streams that failed to connect and never did */
+        uint64_t failed;
+
+        /** @brief Counters of finished and running streams */
+        uint64_t counters[STREAM_COUNTER_COUNT];
+
+        /** @brief Gauges added up over the running streams; connected and degradation count streams */
+        uint64_t gauges[STREAM_GAUGE_COUNT];
+    } stream_registry_totals_t;
+
+    /**
+     * @brief Register a starting stream
+     *
+     * @param session_id Channel uuid, truncated to STREAM_REGISTRY_ID_LENGTH
+     * @param stream_id Stream identifier, truncated likewise
+     * @return Slot holding one reference, or NULL if no slot could be allocated
+     */
+    stream_entry_t *stream_registry_add(const char *session_id, const char *stream_id);
+
+    /**
+     * @brief Take an additional reference
+     */
+    void stream_registry_retain(stream_entry_t *entry);
+
+    /**
+     * @brief Drop a reference; the last one folds the counters into the module totals and frees the slot
+     */
+    void stream_registry_release(stream_entry_t *entry);
+
+    /**
+     * @brief Add to a counter (any thread, NULL is ignored)
+     */
+    void stream_registry_count(stream_entry_t *entry, stream_counter_t counter, uint64_t n);
+
+    /**
+     * @brief Set a gauge (the thread that owns it, NULL is ignored)
+     */
+    void stream_registry_set(stream_entry_t *entry, stream_gauge_t gauge, uint64_t value);
+
+    /**
+     * @brief Streams running, without walking the registry
+     */
+    uint32_t stream_registry_active(void);
+
+    /**
+     * @brief Module-wide totals over finished and running streams
+     *
+     * Retried when a stream finishes during the pass, so the counters never
+     * count a finishing stream twice or not at all.
+     */
+    void stream_registry_snapshot(stream_registry_totals_t *totals);
+
+    /**
+     * @brief Module totals and the counters of every running stream as JSON
+     *
+     * @param session_id Only list the streams of this channel, NULL for all
+     * @return malloc'd JSON object, or NULL on allocation failure
+     */
+    char *stream_registry_json(const char *session_id);
+
+    /**
+     * @brief Module totals in the Prometheus text exposition format
+     *
+     * Running streams are not exported one by one, a series per call id would
+     * leave a new series behind with every call.
+     *
+     * @return malloc'd text, or NULL on allocation failure
+     */
+    char *stream_registry_prometheus(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STREAM_REGISTRY_H__ */
@@ -0,0 +1,489 @@
+// SPDX-License-Identifier: MIT
+#include "stream_resampler.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <new>
+
+#include <speex/speex_resampler.h>
+
+#if defined(__SSE2__)
+#define RESAMPLER_HAVE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) || (defined(__ARM_NEON) && defined(__arm__))
+#define RESAMPLER_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * The integer kernels work in Q15: coefficients are int16, products are
+ * summed in int32 and the result is rounded and saturated back to int16.
+ * Every filter is quantized so its gain sums to exactly 1.0, and the sum of
+ * the absolute taps stays well under 2.0, so the accumulator cannot
+ * overflow for any input. Tap counts are multiples of 8, one SSE2 or two
+ * NEON registers.
+ */
+class StreamResamplerKernel
+{
+  public:
+    virtual ~StreamResamplerKernel()
+    {
+    }
+
+    /**
+     * @brief Filter in_len samples, all of which are consumed
+     * @return Samples written to out
+     */
+    virtual size_t run(const int16_t *in, size_t in_len, int16_t *out) = 0;
+
+    /** @brief Most samples run() can write for in_len input */
+    virtual size_t max_output(size_t in_len) const = 0;
+
+    /** @brief Most input whose output fits in out_len samples */
+    virtual size_t max_input(size_t out_len) const = 0;
+
+    virtual const char *name() const = 0;
+};
+
+namespace
+{
+inline int32_t dot(const int16_t *x, const int16_t *h, size_t taps)
+{
+#if defined(RESAMPLER_HAVE_SSE2)
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < taps; i += 8)
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(x + i)),
+                                                _mm_loadu_si128((const __m128i *)(h + i))));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+#elif defined(RESAMPLER_HAVE_NEON)
+    int32x4_t acc = vdupq_n_s32(0);
+    for (size_t i = 0; i < taps; i += 8)
+    {
+        int16x8_t xv = vld1q_s16(x + i);
+        int16x8_t hv = vld1q_s16(h + i);
+        acc = vmlal_s16(acc, vget_low_s16(xv), vget_low_s16(hv));
+        acc = vmlal_s16(acc, vget_high_s16(xv), vget_high_s16(hv));
+    }
+#if defined(__aarch64__)
+    return vaddvq_s32(acc);
+#else
+    int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    return vget_lane_s32(vpadd_s32(sum, sum), 0);
+#endif
+#else
+    int32_t acc = 0;
+    for (size_t i = 0; i < taps; i++)
+        acc += (int32_t)x[i] * h[i];
+    return acc;
+#endif
+}
+
+inline int16_t round_q15(int32_t acc)
+{
+    acc = (acc + (1 << 14)) >> 15;
+    if (acc > 32767)
+        return 32767;
+    if (acc < -32768)
+        return -32768;
+    return (int16_t)acc;
+}
+
+// zeroth order modified Bessel function of the first kind, for the Kaiser window
+double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k = 1; k < 50 && term > 1e-12 * sum; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Kaiser window over offsets [-half, half] from the filter centre
+double kaiser(double offset, double half, double beta)
+{
+    double r = offset / half;
+    if (r < -1 || r > 1)
+        return 0;
+    return bessel_i0(beta * std::sqrt(1 - r * r)) / bessel_i0(beta);
+}
+
+// windowed sinc low-pass with cutoff fc (fraction of the input rate) at offset t samples from the centre
+double lowpass(double t, double fc, double half, double beta)
+{
+    double x = 2 * fc * t;
+    double sinc = (x == 0) ? 1 : std::sin(M_PI * x) / (M_PI * x);
+    return 2 * fc * sinc * kaiser(t, half + 1, beta);
+}
+
+int16_t to_q15(double v)
+{
+    long q = std::lround(v * 32768);
+    if (q > 32767)
+        q = 32767;
+    if (q < -32767)
+        q = -32767;
+    return (int16_t)q;
+}
+
+// push the rounding error of a quantized filter onto its two centre taps, so its gain is exactly target
+void normalize(int16_t *taps, size_t count, int32_t target, size_t centre_a, size_t centre_b)
+{
+    int32_t sum = 0;
+    for (size_t i = 0; i < count; i++)
+        sum += taps[i];
+    int32_t error = target - sum;
+    taps[centre_a] = (int16_t)(taps[centre_a] + error / 2);
+    taps[centre_b] = (int16_t)(taps[centre_b] + error - error / 2);
+}
+
+/*
+ * Half the number of non-zero odd taps of the half-band filters, and the
+ * taps per output of the polyphase ones, by quality. The Kaiser beta rises
+ * with it so longer filters also reject more.
+ */
+struct filter_shape_t
+{
+    size_t halfband;
+    size_t polyphase;
+    double beta;
+};
+
+filter_shape_t filter_shape(int quality)
+{
+    if (quality <= 3)
+        return {4, 8, 5.0};
+    if (quality <= 6)
+        return {8, 16, 7.0};
+    return {16, 24, 9.0};
+}
+
+/*
+ * 2:1 decimation by a half-band filter. Its even taps are zero except the
+ * 0.5 centre, so one output is half the centre even sample plus the odd
+ * samples around it filtered by 2T taps. Input is kept in pairs; the buffer
+ * starts on an even sample and holds 2T-1 pairs of history.
+ */
+class HalfbandDecimator : public StreamResamplerKernel
+{
+  public:
+    explicit HalfbandDecimator(const filter_shape_t &shape)
+        : taps_(2 * shape.halfband), coeffs_(taps_), buf_(2 * (taps_ - 1), 0)
+    {
+        // odd sample k of a window sits 2T - 2k - 1 input samples from the output
+        double half = taps_ - 1.0;
+        for (size_t k = 0; k < taps_; k++)
+            coeffs_[k] = to_q15(lowpass(half - 2.0 * k, 0.25, half, shape.beta));
+        normalize(coeffs_.data(), taps_, 16384, taps_ / 2 - 1, taps_ / 2);
+    }
+
+    size_t run(const int16_t *in, size_t in_len, int16_t *out) override
+    {
+        buf_.insert(buf_.end(), in, in + in_len);
+        size_t pairs = buf_.size() / 2;
+        if (pairs < taps_)
+            return 0;
+
+        even_.resize(pairs);
+        odd_.resize(pairs);
+        for (size_t i = 0; i < pairs; i++)
+        {
+            even_[i] = buf_[2 * i];
+            odd_[i] = buf_[2 * i + 1];
+        }
+        size_t count = pairs - taps_ + 1;
+        for (size_t j = 0; j < count; j++)
+            out[j] = round_q15((int32_t)even_[j + taps_ / 2] * 16384 + dot(&odd_[j], coeffs_.data(), taps_));
+
+        buf_.erase(buf_.begin(), buf_.begin() + 2 * count);
+        return count;
+    }
+
+    size_t max_output(size_t in_len) const override
+    {
+        return (in_len + 1) / 2 + 1;
+    }
+
+    size_t max_input(size_t out_len) const override
+    {
+        return out_len * 2;
+    }
+
+    const char *name() const override
+    {
+        return "halfband";
+    }
+
+  private:
+    size_t taps_;
+    std::vector<int16_t> coeffs_;
+    std::vector<int16_t> buf_;
+    std::vector<int16_t> even_;
+    std::vector<int16_t> odd_;
+};
+
+/*
+ * 1:2 interpolation by the same half-band filter. Even outputs are the input
+ * delayed to the filter centre, odd outputs the 2T taps around it at twice
+ * the gain to make up for the inserted zeros.
+ */
+class HalfbandInterpolator : public StreamResamplerKernel
+{
+  public:
+    explicit HalfbandInterpolator(const filter_shape_t &shape)
+        : taps_(2 * shape.halfband), coeffs_(taps_), buf_(taps_ - 1, 0)
+    {
+        double half = taps_ - 1.0;
+        for (size_t k = 0; k < taps_; k++)
+            coeffs_[k] = to_q15(2 * lowpass(half - 2.0 * k, 0.25, half, shape.beta));
+        normalize(coeffs_.data(), taps_, 32768, taps_ / 2 - 1, taps_ / 2);
+    }
+
+    size_t run(const int16_t *in, size_t in_len, int16_t *out) override
+    {
+        buf_.insert(buf_.end(), in, in + in_len);
+        for (size_t j = 0; j < in_len; j++)
+        {
+            out[2 * j] = buf_[j + taps_ / 2 - 1];
+            out[2 * j + 1] = round_q15(dot(&buf_[j], coeffs_.data(), taps_));
+        }
+        buf_.erase(buf_.begin(), buf_.begin() + in_len);
+        return 2 * in_len;
+    }
+
+    size_t max_output(size_t in_len) const override
+    {
+        return 2 * in_len;
+    }
+
+    size_t max_input(size_t out_len) const override
+    {
+        return out_len / 2;
+    }
+
+    const char *name() const override
+    {
+        return "halfband";
+    }
+
+  private:
+    size_t taps_;
+    std::vector<int16_t> coeffs_;
+    std::vector<int16_t> buf_;
+};
+
+/*
+ * Factor:1 decimation, one Factor * T tap low-pass per output. The buffer
+ * holds the window less the Factor samples of the next output step, plus the
+ * inputs that did not complete a step yet.
+ */
+template <int Factor> class PolyphaseDecimator : public StreamResamplerKernel
+{
+  public:
+    explicit PolyphaseDecimator(const filter_shape_t &shape)
+        : taps_(Factor * shape.polyphase), coeffs_(taps_), buf_(taps_ - Factor, 0)
+    {
+        double centre = (taps_ - 1) / 2.0;
+        for (size_t k = 0; k < taps_; k++)
+            coeffs_[k] = to_q15(lowpass(k - centre, 0.45 / Factor, centre, shape.beta));
+        normalize(coeffs_.data(), taps_, 32768, taps_ / 2 - 1, taps_ / 2);
+    }
+
+    size_t run(const int16_t *in, size_t in_len, int16_t *out) override
+    {
+        buf_.insert(buf_.end(), in, in + in_len);
+        size_t count = 0;
+        size_t pos = 0;
+        for (; pos + taps_ <= buf_.size(); pos += Factor)
+            out[count++] = round_q15(dot(&buf_[pos], coeffs_.data(), taps_));
+        buf_.erase(buf_.begin(), buf_.begin() + pos);
+        return count;
+    }
+
+    size_t max_output(size_t in_len) const override
+    {
+        return in_len / Factor + 1;
+    }
+
+    size_t max_input(size_t out_len) const override
+    {
+        return out_len * Factor;
+    }
+
+    const char *name() const override
+    {
+        return "polyphase";
+    }
+
+  private:
+    size_t taps_;
+    std::vector<int16_t> coeffs_;
+    std::vector<int16_t> buf_;
+};
+
+/*
+ * 1:Factor interpolation: the Factor * T tap prototype split into Factor
+ * phases of T taps, each run over the last T inputs at Factor times the gain.
+ */
+template <int Factor> class PolyphaseInterpolator : public StreamResamplerKernel
+{
+  public:
+    explicit PolyphaseInterpolator(const filter_shape_t &shape)
+        : taps_(shape.polyphase), coeffs_(Factor * taps_), buf_(taps_ - 1, 0)
+    {
+        size_t length = Factor * taps_;
+        double centre = (length - 1) / 2.0;
+        for (int p = 0; p < Factor; p++)
+        {
+            // phase p output n*Factor + p weighs input n - i with prototype tap i*Factor + p
+            int16_t *phase = &coeffs_[p * taps_];
+            for (size_t w = 0; w < taps_; w++)
+            {
+                size_t k = (taps_ - 1 - w) * Factor + p;
+                phase[w] = to_q15(Factor * lowpass(k - centre, 0.45 / Factor, centre, shape.beta));
+            }
+            normalize(phase, taps_, 32768, taps_ / 2 - 1, taps_ / 2);
+        }
+    }
+
+    size_t run(const int16_t *in, size_t in_len, int16_t *out) override
+    {
+        buf_.insert(buf_.end(), in, in + in_len);
+        for (size_t j = 0; j < in_len; j++)
+        {
+            for (int p = 0; p < Factor; p++)
+                *out++ = round_q15(dot(&buf_[j], &coeffs_[p * taps_], taps_));
+        }
+        buf_.erase(buf_.begin(), buf_.begin() + in_len);
+        return Factor * in_len;
+    }
+
+    size_t max_output(size_t in_len) const override
+    {
+        return Factor * in_len;
+    }
+
+    size_t max_input(size_t out_len) const override
+    {
+        return out_len / Factor;
+    }
+
+    const char *name() const override
+    {
+        return "polyphase";
+    }
+
+  private:
+    size_t taps_;
+    std::vector<int16_t> coeffs_;
+    std::vector<int16_t> buf_;
+};
+
+StreamResamplerKernel *create_kernel(int in_rate, int out_rate, int quality)
+{
+    filter_shape_t shape = filter_shape(quality);
+    if (in_rate == 2 * out_rate)
+        return new (std::nothrow) HalfbandDecimator(shape);
+    if (out_rate == 2 * in_rate)
+        return new (std::nothrow) HalfbandInterpolator(shape);
+    if (in_rate == 3 * out_rate)
+        return new (std::nothrow) PolyphaseDecimator<3>(shape);
+    if (out_rate == 3 * in_rate)
+        return new (std::nothrow) PolyphaseInterpolator<3>(shape);
+    return nullptr;
+}
+} // namespace
+
+StreamResampler::StreamResampler(int channels, int in_rate, int out_rate, int quality)
+    : channels_(channels), in_rate_(in_rate), out_rate_(out_rate), quality_(quality), kernel_(nullptr),
+      speex_(nullptr)
+{
+}
+
+StreamResampler *StreamResampler::create(int channels, int in_rate, int out_rate, int quality)
+{
+    if (channels < 1 || in_rate <= 0 || out_rate <= 0 || in_rate == out_rate)
+        return nullptr;
+    if (quality < STREAM_RESAMPLE_MIN_QUALITY)
+        quality = STREAM_RESAMPLE_MIN_QUALITY;
+    else if (quality > STREAM_RESAMPLE_MAX_QUALITY)
+        quality = STREAM_RESAMPLE_MAX_QUALITY;
+
+    StreamResampler *resampler = new (std::nothrow) StreamResampler(channels, in_rate, out_rate, quality);
+    if (!resampler)
+        return nullptr;
+    if (channels == 1)
+        resampler->kernel_ = create_kernel(in_rate, out_rate, quality);
+    if (!resampler->kernel_)
+    {
+        int err = 0;
+        resampler->speex_ = speex_resampler_init(channels, in_rate, out_rate, quality, &err);
+        if (!resampler->speex_ || err != 0)
+        {
+            delete resampler;
+            return nullptr;
+        }
+    }
+    return resampler;
+}
+
+StreamResampler::~StreamResampler()
+{
+    delete kernel_;
+    if (speex_)
+        speex_resampler_destroy(static_cast<SpeexResamplerState *>(speex_));
+}
+
+size_t StreamResampler::process(const int16_t *in, size_t &in_len, int16_t *out, size_t out_capacity)
+{
+    if (kernel_)
+    {
+        if (kernel_->max_output(in_len) > out_capacity)
+            in_len = kernel_->max_input(out_capacity > 0 ? out_capacity - 1 : 0);
+        return kernel_->run(in, in_len, out);
+    }
+
+    spx_uint32_t in_frames = (spx_uint32_t)in_len;
+    spx_uint32_t out_frames = (spx_uint32_t)out_capacity;
+    speex_resampler_process_interleaved_int(static_cast<SpeexResamplerState *>(speex_), in, &in_frames, out,
+                                            &out_frames);
+    in_len = in_frames;
+    return out_frames;
+}
+
+int16_t *StreamResampler::process(const int16_t *in, size_t in_len, size_t &out_len)
+{
+    size_t capacity = max_output(in_len);
+    if (scratch_.size() < capacity * channels_)
+        scratch_.resize(capacity * channels_);
+    size_t consumed = in_len;
+    out_len = process(in, consumed, scratch_.data(), capacity);
+    return scratch_.data();
+}
+
+size_t StreamResampler::max_output(size_t in_len) const
+{
+    if (kernel_)
+        return kernel_->max_output(in_len);
+    // speex may release a little held back input on top of the exact ratio
+    return (size_t)((uint64_t)in_len * out_rate_ / in_rate_) + 16;
+}
+
+const char *StreamResampler::implementation() const
+{
+    return kernel_ ? kernel_->name() : "speex";
+}
+
+const char *stream_resampler_simd()
+{
+#if defined(RESAMPLER_HAVE_SSE2)
+    return "sse2";
+#elif defined(RESAMPLER_HAVE_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file stream_resampler.hpp
+ * @brief Sample rate conversion for capture and playback
+ *
+ * Almost every conversion a stream does is an exact integer ratio: 8 kHz
+ * calls against 16 kHz endpoints and back, or 24 kHz providers down to
+ * 8 kHz. Those run on fixed-point polyphase kernels specialized for the
+ * factor: a half-band filter for 2:1 and 1:2, where every other tap is zero,
+ * and a plain polyphase filter for 3:1 and 1:3. The inner products use SSE2
+ * on x86 and NEON on ARM (both baseline there, so there is nothing to detect
+ * at runtime) and give bit-identical output to the scalar code.
+ *
+ * Any other ratio, or more than one channel, goes through speex.
+ *
+ * A resampler keeps its filter history and the input it could not use yet
+ * from one call to the next, so each direction of a stream needs its own
+ * and has to feed it contiguous audio. It owns its working memory; after the
+ * first few calls nothing is allocated.
+ */
+#ifndef __STREAM_RESAMPLER_HPP__
+#define __STREAM_RESAMPLER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/** @brief Accepted quality levels, the same scale as speex */
+#define STREAM_RESAMPLE_MIN_QUALITY 0
+#define STREAM_RESAMPLE_MAX_QUALITY 10
+
+class StreamResamplerKernel;
+
+/**
+ * @brief One direction of one stream, used by one thread at a time
+ */
+class StreamResampler
+{
+    // Prevent copying and assignment
+    StreamResampler(const StreamResampler &) = delete;
+    void operator=(const StreamResampler &) = delete;
+
+  public:
+    /**
+     * @brief Resampler from in_rate to out_rate
+     *
+     * @param quality 0-10, higher costs more CPU for a flatter passband and more stopband attenuation
+     * @return nullptr if the rates are equal or speex refused them
+     */
+    static StreamResampler *create(int channels, int in_rate, int out_rate, int quality);
+
+    ~StreamResampler();
+
+    /**
+     * @brief Resample into a caller's buffer
+     *
+     * @param in Interleaved input samples
+     * @param in_len Samples per channel available; receives how many were consumed, less than given
+     *        only if out was too small for max_output(in_len)
+     * @param out Receives interleaved output samples
+     * @param out_capacity Room in out, samples per channel
+     * @return Samples per channel written
+     */
+    size_t process(const int16_t *in, size_t &in_len, int16_t *out, size_t out_capacity);
+
+    /**
+     * @brief Resample all of in into the resampler's own buffer
+     *
+     * @param out_len Receives samples per channel in the returned buffer
+     * @return The output, valid until the next call
+     */
+    int16_t *process(const int16_t *in, size_t in_len, size_t &out_len);
+
+    /**
+     * @brief Most samples per channel one call with in_len input can write
+     */
+    size_t max_output(size_t in_len) const;
+
+    int in_rate() const
+    {
+        return in_rate_;
+    }
+
+    int out_rate() const
+    {
+        return out_rate_;
+    }
+
+    int quality() const
+    {
+        return quality_;
+    }
+
+    /**
+     * @brief Implementation in use, "halfband", "polyphase" or "speex"
+     */
+    const char *implementation() const;
+
+  private:
+    StreamResampler(int channels, int in_rate, int out_rate, int quality);
+
+    int channels_;
+    int in_rate_;
+    int out_rate_;
+    int quality_;
+    StreamResamplerKernel *kernel_;
+    void *speex_;
+    std::vector<int16_t> scratch_;
+};
+
+/**
+ * @brief Vector extension the integer kernels were built with, "sse2", "neon" or "scalar"
+ */
+const char *stream_resampler_simd();
+
+#endif /* __STREAM_RESAMPLER_HPP__ */
@@ -0,0 +1,403 @@
+// SPDX-License-Identifier: MIT
+#include "stream_serializer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "stream_codec.hpp"
+
+namespace
+{
+const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const char hex_digits[] = "0123456789abcdef";
+
+inline size_t base64_length(size_t n)
+{
+    return ((n + 2) / 3) * 4;
+}
+
+void append_extra_headers(SendBuffer &out, const std::string &extra_headers)
+{
+    if (extra_headers.length() > 0)
+    {
+        out.append(",\"extra_headers\":");
+        out.append_json_string(extra_headers);
+    }
+}
+} // namespace
+
+SendBuffer::SendBuffer(size_t initial_capacity) : storage_(nullptr), capacity_(0), length_(0), good_(false)
+{
+    storage_ = (uint8_t *)malloc(LWS_PRE + initial_capacity);
+    if (storage_)
+    {
+        capacity_ = initial_capacity;
+        good_ = true;
+    }
+}
+
+SendBuffer::~SendBuffer()
+{
+    if (storage_)
+        free(storage_);
+}
+
+bool SendBuffer::reserve(size_t additional)
+{
+    if (!good_)
+        return false;
+    if (length_ + additional <= capacity_)
+        return true;
+
+    size_t new_capacity = capacity_ * 2;
+    if (new_capacity < length_ + additional)
+        new_capacity = length_ + additional;
+
+    uint8_t *grown = (uint8_t *)realloc(storage_, LWS_PRE + new_capacity);
+    if (!grown)
+    {
+        good_ = false;
+        return false;
+    }
+    storage_ = grown;
+    capacity_ = new_capacity;
+    return true;
+}
+
+void SendBuffer::append(const char *src, size_t n)
+{
+    if (!reserve(n))
+        return;
+    memcpy(tail(), src, n);
+    length_ += n;
+}
+
+void SendBuffer::append_char(char c)
+{
+    if (!reserve(1))
+        return;
+    *tail() = (uint8_t)c;
+    length_ += 1;
+}
+
+void SendBuffer::append_int(long long value)
+{
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%lld", value);
+    append(digits, (size_t)n);
+}
+
+void SendBuffer::append_json_string(const char *src, size_t n)
+{
+    // worst case every byte becomes a \u00XX escape
+    if (!reserve(n * 6 + 2))
+        return;
+
+    uint8_t *p = tail();
+    *p++ = '"';
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char c = (unsigned char)src[i];
+        switch (c)
+        {
+            case '"':
+                *p++ = '\\';
+                *p++ = '"';
+                break;
+            case '\\':
+                *p++ = '\\';
+                *p++ = '\\';
+                break;
+            case '\b':
+                *p++ = '\\';
+                *p++ = 'b';
+                break;
+            case '\f':
+                *p++ = '\\';
+                *p++ = 'f';
+                break;
+            case '\n':
+                *p++ = '\\';
+                *p++ = 'n';
+                break;
+            case '\r':
+                *p++ = '\\';
+                *p++ = 'r';
+                break;
+            case '\t':
+                *p++ = '\\';
+                *p++ = 't';
+                break;
+            default:
+                if (c < 32)
+                {
+                    *p++ = '\\';
+                    *p++ = 'u';
+                    *p++ = '0';
+                    *p++ = '0';
+                    *p++ = hex_digits[c >> 4];
+                    *p++ = hex_digits[c & 0x0f];
+                }
+                else
+                {
+                    *p++ = c;
+                }
+                break;
+        }
+    }
+    *p++ = '"';
+    length_ = p - data();
+}
+
+void SendBuffer::append_base64(const uint8_t *src, size_t n)
+{
+    if (!reserve(base64_length(n)))
+        return;
+
+    uint8_t *p = tail();
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3)
+    {
+        uint32_t v = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+        *p++ = base64_chars[(v >> 18) & 0x3f];
+        *p++ = base64_chars[(v >> 12) & 0x3f];
+        *p++ = base64_chars[(v >> 6) & 0x3f];
+        *p++ = base64_chars[v & 0x3f];
+    }
+    if (i < n)
+    {
+        uint32_t v = (uint32_t)src[i] << 16;
+        if (i + 1 < n)
+            v |= (uint32_t)src[i + 1] << 8;
+        *p++ = base64_chars[(v >> 18) & 0x3f];
+        *p++ = base64_chars[(v >> 12) & 0x3f];
+        *p++ = (i + 1 < n) ? base64_chars[(v >> 6) & 0x3f] : '=';
+        *p++ = '=';
+    }
+    length_ = p - data();
+}
+
+bool serialize_start_event(SendBuffer &out,
+                           int sequence_number,
+                           const std::string &uuid,
+                           const std::string &streamid,
+                           const std::string &track,
+                           const std::string &extraHeaders,
+                           streaming_codec_t codec,
+                           int sampling,
+                           streaming_framing_t framing,
+                           unsigned int chunks_per_message)
+{
+    out.clear();
+    out.append("{\"sequenceNumber\":");
+    out.append_int(sequence_number);
+    out.append(",\"event\":\"start\",\"start\":{\"callId\":");
+    out.append_json_string(uuid);
+    out.append(",\"stream_id\":");
+    out.append_json_string(streamid);
+    if (track == "both")
+    {
+        out.append(",\"tracks\":[\"inbound\",\"outbound\"]");
+    }
+    else
+    {
+        out.append(",\"tracks\":[");
+        out.append_json_string(track);
+        out.append_char(']');
+    }
+    out.append(",\"mediaFormat\":{\"encoding\":");
+    out.append_char('"');
+    out.append(stream_codec_content_type(codec));
+    out.append_char('"');
+    out.append(",\"sampleRate\":");
+    out.append_int(sampling);
+    if (chunks_per_message > 1)
+    {
+        out.append(",\"chunksPerMessage\":");
+        out.append_int(chunks_per_message);
+    }
+    out.append_char('}');
+    if (framing == FRAMING_BINARY)
+    {
+        out.append(",\"framing\":\"binary\"");
+    }
+    out.append_char('}');
+    append_extra_headers(out, extraHeaders);
+    out.append_char('}');
+    return out.good();
+}
+
+bool serialize_media_event(SendBuffer &out,
+                           int sequence_number,
+                           const std::string &streamid,
+                           const char *track,
+                           const uint8_t *audio,
+                           size_t audio_len,
+                           switch_time_t timestamp,
+                           uint32_t chunk,
+                           uint32_t chunk_count,
+                           const std::string &extraHeaders,
+                           const char *content_type)
+{
+    // the timestamp has always been rendered into a 14 byte buffer, i.e. at most 13 digits
+    char time_str[15];
+    snprintf(time_str, 14, "%ld", (long)timestamp);
+
+    out.clear();
+    out.reserve(base64_length(audio_len) + streamid.size() + extraHeaders.size() + 160);
+    out.append("{\"sequenceNumber\":");
+    out.append_int(sequence_number);
+    out.append(",\"stream_id\":");
+    out.append_json_string(streamid);
+    out.append(",\"event\":\"media\",\"media\":{\"track\":");
+    out.append_json_string(track, strlen(track));
+    out.append(",\"timestamp\":\"");
+    out.append(time_str);
+    out.append("\",\"chunk\":");
+    out.append_int(chunk);
+    if (chunk_count > 1)
+    {
+        out.append(",\"chunks\":");
+        out.append_int(chunk_count);
+    }
+    if (content_type)
+    {
+        out.append(",\"contentType\":");
+        out.append_json_string(content_type, strlen(content_type));
+    }
+    out.append(",\"payload\":\"");
+    out.append_base64(audio, audio_len);
+    out.append("\"}");
+    append_extra_headers(out, extraHeaders);
+    out.append_char('}');
+    return out.good();
+}
+
+bool serialize_realtime_append(SendBuffer &out, const uint8_t *audio, size_t audio_len)
+{
+    out.clear();
+    out.reserve(base64_length(audio_len) + 48);
+    out.append("{\"type\":\"input_audio_buffer.append\",\"audio\":\"");
+    out.append_base64(audio, audio_len);
+    out.append("\"}");
+    return out.good();
+}
+
+bool serialize_silence_event(SendBuffer &out,
+                             int sequence_number,
+                             const std::string &streamid,
+                             const char *track,
+                             switch_time_t timestamp,
+                             uint32_t chunk,
+                             uint32_t chunk_count,
+                             uint32_t duration_ms)
+{
+    char time_str[15];
+    snprintf(time_str, 14, "%ld", (long)timestamp);
+
+    out.clear();
+    out.append("{\"sequenceNumber\":");
+    out.append_int(sequence_number);
+    out.append(",\"stream_id\":");
+    out.append_json_string(streamid);
+    out.append(",\"event\":\"silence\",\"silence\":{\"track\":");
+    out.append_json_string(track, strlen(track));
+    out.append(",\"timestamp\":\"");
+    out.append(time_str);
+    out.append("\",\"chunk\":");
+    out.append_int(chunk);
+    out.append(",\"chunks\":");
+    out.append_int(chunk_count);
+    out.append(",\"durationMs\":");
+    out.append_int(duration_ms);
+    out.append("}}");
+    return out.good();
+}
+
+bool serialize_stop_event(SendBuffer &out,
+                          int sequence_number,
+                          const std::string &uuid,
+                          const std::string &streamid,
+                          const std::string &extraHeaders)
+{
+    out.clear();
+    out.append("{\"sequenceNumber\":");
+    out.append_int(sequence_number);
+    out.append(",\"stream_id\":");
+    out.append_json_string(streamid);
+    out.append(",\"event\":\"stop\",\"stop\":{\"callId\":");
+    out.append_json_string(uuid);
+    out.append_char('}');
+    append_extra_headers(out, extraHeaders);
+    out.append_char('}');
+    return out.good();
+}
+
+bool serialize_played_event(SendBuffer &out, int sequence_number, const char *streamid, const char *name)
+{
+    out.clear();
+    out.append("{\"event\":\"playedStream\",\"sequenceNumber\":");
+    out.append_int(sequence_number);
+    out.append(",\"stream_id\":");
+    out.append_json_string(streamid, strlen(streamid));
+    out.append(",\"name\":");
+    out.append_json_string(name, strlen(name));
+    out.append_char('}');
+    return out.good();
+}
+
+bool serialize_played_events(SendBuffer &out,
+                             int sequence_number,
+                             const std::string &streamid,
+                             const std::string *names,
+                             size_t count)
+{
+    out.clear();
+    out.append("{\"event\":\"playedStream\",\"sequenceNumber\":");
+    out.append_int(sequence_number);
+    out.append(",\"stream_id\":");
+    out.append_json_string(streamid);
+    out.append(",\"name\":");
+    out.append_json_string(names[count - 1]);
+    if (count > 1)
+    {
+        out.append(",\"names\":[");
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i > 0)
+                out.append_char(',');
+            out.append_json_string(names[i]);
+        }
+        out.append_char(']');
+    }
+    out.append_char('}');
+    return out.good();
+}
+
+bool serialize_cleared_event(SendBuffer &out, int sequence_number, const std::string &streamid)
+{
+    out.clear();
+    out.append("{\"sequenceNumber\":");
+    out.append_int(sequence_number);
+    out.append(",\"streamId\":");
+    out.append_json_string(streamid);
+    out.append(",\"event\":\"media.cleared\"}");
+    return out.good();
+}
+
+bool serialize_incorrect_payload_event(SendBuffer &out,
+                                       int sequence_number,
+                                       const std::string &streamid,
+                                       const std::string &payload)
+{
+    out.clear();
+    out.append("{\"event\":\"incorrectPayload\",\"stream_id\":");
+    out.append_json_string(streamid);
+    out.append(",\"payload\":");
+    out.append_json_string(payload);
+    out.append(",\"sequenceNumber\":");
+    out.append_int(sequence_number);
+    out.append_char('}');
+    return out.good();
+}
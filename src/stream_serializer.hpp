@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file stream_serializer.hpp
+ * @brief Allocation-free serializer for outgoing stream messages
+ *
+ * The start, media, stop and playedStream messages have a fixed shape, so
+ * instead of building a cJSON tree per message they are written directly into
+ * a reusable send buffer that keeps LWS_PRE bytes of headroom in front of the
+ * payload. Once the buffer has grown to the largest message of a stream no
+ * further heap allocations happen on the send path.
+ *
+ * Output is byte-for-byte identical to cJSON_PrintUnformatted() of the tree
+ * previously built by generate_json_data_event().
+ */
+#ifndef __STREAM_SERIALIZER_HPP__
+#define __STREAM_SERIALIZER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <libwebsockets.h>
+#include <switch.h>
+
+#include "stream_utils.hpp"
+
+/**
+ * @brief Growable byte buffer with LWS_PRE headroom for lws_write()
+ *
+ * Appends never fail loudly: if growing the storage fails the buffer is
+ * marked bad, further appends are ignored and good() returns false.
+ */
+class SendBuffer
+{
+    // Prevent copying and assignment
+    SendBuffer(const SendBuffer &) = delete;
+    void operator=(const SendBuffer &) = delete;
+
+  private:
+    /** @brief Storage including LWS_PRE bytes of headroom */
+    uint8_t *storage_;
+
+    /** @brief Usable payload capacity (excluding headroom) */
+    size_t capacity_;
+
+    /** @brief Bytes of payload written so far */
+    size_t length_;
+
+    /** @brief False once an allocation has failed */
+    bool good_;
+
+  public:
+    /**
+     * @brief Constructor
+     * @param initial_capacity Initial payload capacity in bytes
+     */
+    explicit SendBuffer(size_t initial_capacity = 4096);
+
+    /**
+     * @brief Destructor - releases storage
+     */
+    ~SendBuffer();
+
+    /**
+     * @brief Discard the payload, keeping the storage
+     */
+    void clear()
+    {
+        length_ = 0;
+        good_ = storage_ != nullptr;
+    }
+
+    /**
+     * @brief Start of the payload; LWS_PRE writable bytes precede it
+     */
+    uint8_t *data()
+    {
+        return storage_ + LWS_PRE;
+    }
+
+    /**
+     * @brief Number of payload bytes written
+     */
+    size_t length() const
+    {
+        return length_;
+    }
+
+    /**
+     * @brief Whether every append since clear() succeeded
+     */
+    bool good() const
+    {
+        return good_;
+    }
+
+    /**
+     * @brief Ensure room for additional payload bytes
+     * @param additional Number of bytes about to be appended
+     * @return true if the space is available
+     */
+    bool reserve(size_t additional);
+
+    /**
+     * @brief Pointer to the first unwritten payload byte
+     *
+     * Callers that fill the buffer directly must reserve() first and
+     * commit() the number of bytes actually written.
+     */
+    uint8_t *tail()
+    {
+        return data() + length_;
+    }
+
+    /**
+     * @brief Account for bytes written through tail()
+     */
+    void commit(size_t n)
+    {
+        length_ += n;
+    }
+
+    void append(const char *src, size_t n);
+
+    void append(const char *src)
+    {
+        append(src, strlen(src));
+    }
+
+    void append_char(char c);
+
+    void append_int(long long value);
+
+    /** @brief Append a quoted JSON string, escaped the way cJSON does */
+    void append_json_string(const char *src, size_t n);
+
+    void append_json_string(const std::string &src)
+    {
+        append_json_string(src.data(), src.size());
+    }
+
+    /** @brief Append standard base64 (with padding) of the given bytes */
+    void append_base64(const uint8_t *src, size_t n);
+};
+
+/**
+ * @brief Serialize the stream start message
+ * @return true on success, false if the buffer could not grow
+ */
+bool serialize_start_event(SendBuffer &out,
+                           int sequence_number,
+                           const std::string &session_uuid,
+                           const std::string &stream_identifier,
+                           const std::string &track_type,
+                           const std::string &extra_headers,
+                           streaming_codec_t codec,
+                           int sampling_rate,
+                           streaming_framing_t framing,
+                           unsigned int chunks_per_message);
+
+/**
+ * @brief Serialize one media message carrying base64 encoded audio
+ *
+ * The payload may hold several consecutive chunks; timestamp and chunk then
+ * describe the first of them and a "chunks" member carries the count.
+ *
+ * @param timestamp Buffer send time of the first chunk (Buffer::last_send_time_)
+ * @param chunk Index of the first chunk (Buffer::transmitted_chunk_count_)
+ * @param chunk_count Number of chunks concatenated in audio
+ * @param content_type Written as "contentType" when the payload is not in the stream's codec, may be nullptr
+ * @return true on success, false if the buffer could not grow
+ */
+bool serialize_media_event(SendBuffer &out,
+                           int sequence_number,
+                           const std::string &stream_identifier,
+                           const char *track,
+                           const uint8_t *audio,
+                           size_t audio_len,
+                           switch_time_t timestamp,
+                           uint32_t chunk,
+                           uint32_t chunk_count,
+                           const std::string &extra_headers,
+                           const char *content_type = nullptr);
+
+/**
+ * @brief Serialize an OpenAI Realtime input_audio_buffer.append event
+ *
+ * Written straight from the captured chunks, the realtime counterpart of
+ * serialize_media_event(); the API wants nothing but the audio.
+ *
+ * @param audio PCM16 at REALTIME_SAMPLE_RATE
+ * @return true on success, false if the buffer could not grow
+ */
+bool serialize_realtime_append(SendBuffer &out, const uint8_t *audio, size_t audio_len);
+
+/**
+ * @brief Serialize a silence marker standing in for suppressed media
+ *
+ * Sent as text with either framing. timestamp and chunk are those the first
+ * suppressed chunk would have had; the next media message continues after
+ * the last of them.
+ *
+ * @param timestamp Buffer send time of the first suppressed chunk
+ * @param chunk Index of the first suppressed chunk
+ * @param chunk_count Number of chunks suppressed
+ * @param duration_ms Audio time the chunks stand for
+ * @return true on success, false if the buffer could not grow
+ */
+bool serialize_silence_event(SendBuffer &out,
+                             int sequence_number,
+                             const std::string &stream_identifier,
+                             const char *track,
+                             switch_time_t timestamp,
+                             uint32_t chunk,
+                             uint32_t chunk_count,
+                             uint32_t duration_ms);
+
+/**
+ * @brief Serialize the stream stop message
+ * @return true on success, false if the buffer could not grow
+ */
+bool serialize_stop_event(SendBuffer &out,
+                          int sequence_number,
+                          const std::string &session_uuid,
+                          const std::string &stream_identifier,
+                          const std::string &extra_headers);
+
+/**
+ * @brief Serialize a playedStream checkpoint notification
+ * @return true on success, false if the buffer could not grow
+ */
+bool serialize_played_event(SendBuffer &out, int sequence_number, const char *stream_identifier, const char *name);
+
+/**
+ * @brief Serialize one playedStream message for checkpoints that played together
+ *
+ * A single name gives the same message as serialize_played_event(). More
+ * than one keep the last in "name" and list all of them, in playout order,
+ * in "names".
+ *
+ * @return true on success, false if the buffer could not grow
+ */
+bool serialize_played_events(SendBuffer &out,
+                             int sequence_number,
+                             const std::string &stream_identifier,
+                             const std::string *names,
+                             size_t count);
+
+/**
+ * @brief Serialize a media.cleared acknowledgement
+ * @return true on success, false if the buffer could not grow
+ */
+bool serialize_cleared_event(SendBuffer &out, int sequence_number, const std::string &stream_identifier);
+
+/**
+ * @brief Serialize an incorrectPayload notification for a rejected message
+ * @return true on success, false if the buffer could not grow
+ */
+bool serialize_incorrect_payload_event(SendBuffer &out,
+                                       int sequence_number,
+                                       const std::string &stream_identifier,
+                                       const std::string &payload);
+
+#endif /* __STREAM_SERIALIZER_HPP__ */
@@ -1,54 +1,152 @@
 // SPDX-License-Identifier: MIT
 #include "stream_utils.hpp"
-#include "base64.hpp"
+#include "disk_spool.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <new>
 #include <switch.h>
+#include <vector>
+
+namespace
+{
+// Slot storage of destroyed buffers, handed to the next buffer of the same size.
+// Buffers of one deployment come in very few sizes, so a flat list is searched.
+struct StoragePool
+{
+    std::mutex mutex;
+    std::vector<std::pair<size_t, uint8_t *>> blocks;
+    size_t pooled_bytes = 0;
+    size_t max_bytes = BUFFER_STORAGE_POOL_DEFAULT_BYTES;
+    // slabs held by live buffers, and the budget they share
+    std::atomic<size_t> buffered_bytes{0};
+    std::atomic<size_t> budget_bytes{0};
+    std::atomic<size_t> buffers{0};
+};
+
+// never destroyed, buffers may still be released while the module's statics go away
+StoragePool &storage_pool()
+{
+    static StoragePool *pool = new StoragePool();
+    return *pool;
+}
+
+uint8_t *acquire_storage(size_t len)
+{
+    StoragePool &pool = storage_pool();
+    {
+        std::lock_guard<std::mutex> lk(pool.mutex);
+        for (size_t i = pool.blocks.size(); i-- > 0;)
+        {
+            if (pool.blocks[i].first == len)
+            {
+                uint8_t *block = pool.blocks[i].second;
+                pool.blocks[i] = pool.blocks.back();
+                pool.blocks.pop_back();
+                pool.pooled_bytes -= len;
+                return block;
+            }
+        }
+    }
+    return (uint8_t *)malloc(len);
+}
+
+void release_storage(uint8_t *block, size_t len)
+{
+    StoragePool &pool = storage_pool();
+    {
+        std::lock_guard<std::mutex> lk(pool.mutex);
+        if (pool.pooled_bytes + len <= pool.max_bytes)
+        {
+            pool.blocks.emplace_back(len, block);
+            pool.pooled_bytes += len;
+            return;
+        }
+    }
+    free(block);
+}
+} // namespace
 
 Buffer::Buffer(std::string &stream_id, size_t max_len, int step_buffer_len, int step_time_increase)
-    : stream_identifier_(stream_id), freeswitch_buffer_(nullptr),
-      time_step_increment_(step_time_increase * 1000), // Convert to microseconds
-      generated_chunk_count_(0), transmitted_chunk_count_(0), degradation_notification_sent_(1)
-{
-    maximum_capacity_bytes_ = max_len;
-    switch_buffer_create_dynamic(&freeswitch_buffer_, max_len / 10, max_len / 10, max_len);
-    chunk_size_bytes_ = step_buffer_len;
-    current_usage_bytes_ = 0;
+    : slabs_(nullptr), slab_count_(0), slab_chunks_(0), slab_bytes_(0), stamps_offset_(0), slot_count_(0),
+      spool_(nullptr), spill_chunks_(0), time_step_increment_(step_time_increase * 1000), // Convert to microseconds
+      write_index_(0), generated_chunk_count_(0), allocated_slabs_(0), budget_refused_(false), read_index_(0),
+      transmitted_chunk_count_(0), chunk_size_bytes_(step_buffer_len), degradation_notification_sent_(1),
+      stream_identifier_(stream_id)
+{
+    slot_count_ = (chunk_size_bytes_ > 0) ? max_len / chunk_size_bytes_ : 0;
+    if (slot_count_ == 0)
+        slot_count_ = 1;
+    maximum_capacity_bytes_ = slot_count_ * chunk_size_bytes_;
+    slab_chunks_ = std::min(slot_count_, (size_t)BUFFER_SLAB_CHUNKS);
+    slab_count_ = (slot_count_ + slab_chunks_ - 1) / slab_chunks_;
+    // the stamps follow the audio, 8 byte aligned
+    stamps_offset_ = (slab_chunks_ * chunk_size_bytes_ + 7) & ~(size_t)7;
+    slab_bytes_ = stamps_offset_ + slab_chunks_ * sizeof(chunk_stamps_t);
+    // only the slab table up front, the slabs come with the backlog
+    slabs_ = new (std::nothrow) uint8_t *[slab_count_]();
+    if (!slabs_)
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s) Buffer: unable to allocate %u slabs.",
+                          stream_identifier_.c_str(),
+                          (unsigned int)slab_count_);
+        slot_count_ = 0;
+    }
+    storage_pool().buffers.fetch_add(1, std::memory_order_relaxed);
     start_time_ = switch_micro_time_now();
     generated_time_ = switch_micro_time_now();
     last_send_time_ = generated_time_;
-    generated_chunk_count_ = 0;
-    transmitted_chunk_count_ = 0;
 }
 
 Buffer::~Buffer()
 {
-    if (freeswitch_buffer_)
-        switch_buffer_destroy(&freeswitch_buffer_);
+    if (slabs_)
+    {
+        for (size_t i = 0; i < slab_count_; i++)
+        {
+            if (slabs_[i])
+                give_back_slab(slabs_[i]);
+        }
+        delete[] slabs_;
+    }
+    delete spool_;
+    storage_pool().buffers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Buffer::attach_spool(DiskSpool *spool, size_t spill_chunks)
+{
+    delete spool_;
+    spool_ = spool;
+    spill_chunks_ = std::max((size_t)1, std::min(spill_chunks, slot_count_));
 }
 
-bool Buffer::read(void **data, size_t *datalen)
+size_t Buffer::spooled_chunks() const
 {
-    switch_size_t actual_read;
-    uint8_t *buffer_copy = (uint8_t *)malloc(sizeof(uint8_t) * chunk_size_bytes_);
-    actual_read = switch_buffer_read(freeswitch_buffer_, buffer_copy, chunk_size_bytes_);
-    if (actual_read != chunk_size_bytes_)
-    {
-        free(buffer_copy);
-        *datalen = 0;
+    return spool_ ? spool_->pending() : 0;
+}
+
+bool Buffer::is_full() const
+{
+    if (spool_)
+        return spool_->is_full();
+    return ring_available() >= slot_count_;
+}
+
+bool Buffer::spills(size_t write_index)
+{
+    if (!spool_)
         return false;
-    }
-    current_usage_bytes_ = switch_buffer_inuse(freeswitch_buffer_);
-    *data = buffer_copy;
-    *datalen = chunk_size_bytes_;
-    last_send_time_ += time_step_increment_;
-    transmitted_chunk_count_ += 1;
-    return true;
+    // once spilling, new chunks queue behind the spooled ones until the consumer has caught up with them
+    size_t queued = write_index - read_index_.load(std::memory_order_acquire);
+    return spool_->pending() > 0 || queued >= spill_chunks_ || slot_count_ == 0 || !slab_for_write(write_index);
 }
 
-bool Buffer::write(void *data)
+bool Buffer::spool_write(const void *data, const chunk_stamps_t &stamps)
 {
-    switch_size_t w;
-    if (!(w = switch_buffer_write(freeswitch_buffer_, data, chunk_size_bytes_)))
+    if (!spool_->append(data, stamps))
     {
         switch_log_printf(SWITCH_CHANNEL_LOG,
                           SWITCH_LOG_ERROR,
@@ -56,149 +154,394 @@ bool Buffer::write(void *data)
                           stream_identifier_.c_str());
         return false;
     }
-    current_usage_bytes_ = switch_buffer_inuse(freeswitch_buffer_);
-    generated_time_ += time_step_increment_;
-    generated_chunk_count_ += 1;
+    uint32_t chunks = stamps.silent_chunks ? stamps.silent_chunks : 1;
+    generated_time_ += time_step_increment_ * chunks;
+    generated_chunk_count_ += chunks;
     return true;
 }
 
-char *generate_json_data_event(client_event_type_t event,
-                               int sequenceNumber,
-                               std::string &uuid,
-                               std::string &streamid,
-                               std::string &track,
-                               Buffer *buffer,
-                               std::string &extraHeaders,
-                               streaming_codec_t codec,
-                               int sampling)
+uint8_t *Buffer::take_slab()
 {
-    cJSON *data = cJSON_CreateObject();
-    char *result = NULL;
-    cJSON *member = NULL;
-    void *payload = NULL;
-
-    switch (event)
+    StoragePool &pool = storage_pool();
+    size_t budget = pool.budget_bytes.load(std::memory_order_relaxed);
+    if (budget)
     {
-        case CLIENT_EVENT_START:
+        // within its fair share a buffer always gets a slab, beyond it only while the module is under budget
+        size_t share = budget / std::max((size_t)1, pool.buffers.load(std::memory_order_relaxed));
+        size_t total = pool.buffered_bytes.load(std::memory_order_relaxed);
+        if (allocated_bytes() + slab_bytes_ > share && total + slab_bytes_ > budget)
         {
-            cJSON *start;
-            cJSON *media_format;
+            if (!budget_refused_)
+            {
+                switch_log_printf(SWITCH_CHANNEL_LOG,
+                                  SWITCH_LOG_ERROR,
+                                  "mod_audio_stream(%s) Buffer: over the memory budget, %u of %u bytes buffered, "
+                                  "this buffer %u.",
+                                  stream_identifier_.c_str(),
+                                  (unsigned int)total,
+                                  (unsigned int)budget,
+                                  (unsigned int)allocated_bytes());
+                budget_refused_ = true;
+            }
+            return nullptr;
+        }
+    }
+    uint8_t *slab = acquire_storage(slab_bytes_);
+    if (!slab)
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s) Buffer: unable to allocate %u bytes.",
+                          stream_identifier_.c_str(),
+                          (unsigned int)slab_bytes_);
+        return nullptr;
+    }
+    pool.buffered_bytes.fetch_add(slab_bytes_, std::memory_order_relaxed);
+    allocated_slabs_++;
+    budget_refused_ = false;
+    return slab;
+}
 
-            member = cJSON_CreateNumber(sequenceNumber);
-            cJSON_AddItemToObject(data, "sequenceNumber", member);
+void Buffer::give_back_slab(uint8_t *slab)
+{
+    storage_pool().buffered_bytes.fetch_sub(slab_bytes_, std::memory_order_relaxed);
+    allocated_slabs_--;
+    release_storage(slab, slab_bytes_);
+}
 
-            member = cJSON_CreateString("start");
-            cJSON_AddItemToObject(data, "event", member);
+bool Buffer::slab_in_use(size_t slab, size_t read_index, size_t write_index) const
+{
+    size_t queued = write_index - read_index;
+    if (queued == 0)
+        return false;
+    // a backlog this long may wrap into the slab it started in
+    if (queued > slot_count_ - slab_chunks_)
+        return true;
+    size_t first = (read_index % slot_count_) / slab_chunks_;
+    size_t last = ((write_index - 1) % slot_count_) / slab_chunks_;
+    return (slab + slab_count_ - first) % slab_count_ <= (last + slab_count_ - first) % slab_count_;
+}
 
-            start = cJSON_AddObjectToObject(data, "start");
+uint8_t *Buffer::slab_for_write(size_t write_index)
+{
+    size_t position = write_index % slot_count_;
+    size_t slab = position / slab_chunks_;
+    if (slabs_[slab] && position % slab_chunks_ != 0)
+        return slabs_[slab];
 
-            member = cJSON_CreateString(uuid.c_str());
-            cJSON_AddItemToObject(start, "callId", member);
+    // entering a slab: an empty one takes a slab the consumer has finished with, any other finished slab goes
+    // back to the pool. The consumer advances read_index_ only after it is done with a slot, so a slab without
+    // a queued slot is no longer touched.
+    size_t read_index = read_index_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < slab_count_; i++)
+    {
+        if (i == slab || !slabs_[i] || slab_in_use(i, read_index, write_index))
+            continue;
+        if (slabs_[slab])
+            give_back_slab(slabs_[i]);
+        else
+            slabs_[slab] = slabs_[i];
+        slabs_[i] = nullptr;
+    }
+    if (!slabs_[slab])
+        slabs_[slab] = take_slab();
+    return slabs_[slab];
+}
 
-            member = cJSON_CreateString(streamid.c_str());
-            cJSON_AddItemToObject(start, "stream_id", member);
+void Buffer::set_memory_budget(size_t max_bytes)
+{
+    storage_pool().budget_bytes.store(max_bytes, std::memory_order_relaxed);
+}
 
-            {
-                cJSON *tracks = cJSON_AddArrayToObject(start, "tracks");
-                if (track == "both")
-                {
-                    member = cJSON_CreateString("inbound");
-                    cJSON_AddItemToArray(tracks, member);
-                    member = cJSON_CreateString("outbound");
-                    cJSON_AddItemToArray(tracks, member);
-                }
-                else
-                {
-                    member = cJSON_CreateString(track.c_str());
-                    cJSON_AddItemToArray(tracks, member);
-                }
-            }
+size_t Buffer::memory_budget()
+{
+    return storage_pool().budget_bytes.load(std::memory_order_relaxed);
+}
 
-            media_format = cJSON_AddObjectToObject(start, "mediaFormat");
-            if (codec == L16)
-            {
-                member = cJSON_CreateString("audio/x-l16");
-            }
-            else
-            {
-                member = cJSON_CreateString("audio/x-mulaw");
-            }
-            cJSON_AddItemToObject(media_format, "encoding", member);
+size_t Buffer::buffered_bytes()
+{
+    return storage_pool().buffered_bytes.load(std::memory_order_relaxed);
+}
 
-            member = cJSON_CreateNumber(sampling);
-            cJSON_AddItemToObject(media_format, "sampleRate", member);
+size_t Buffer::live_buffers()
+{
+    return storage_pool().buffers.load(std::memory_order_relaxed);
+}
 
-            if (extraHeaders.length() > 0)
-            {
-                member = cJSON_CreateString(extraHeaders.c_str());
-                cJSON_AddItemToObject(data, "extra_headers", member);
-            }
-            break;
-        }
-        case CLIENT_EVENT_MEDIA:
+size_t Buffer::pooled_bytes()
+{
+    StoragePool &pool = storage_pool();
+    std::lock_guard<std::mutex> lk(pool.mutex);
+    return pool.pooled_bytes;
+}
+
+void Buffer::set_storage_pool_limit(size_t max_bytes)
+{
+    StoragePool &pool = storage_pool();
+    std::vector<std::pair<size_t, uint8_t *>> dropped;
+    {
+        std::lock_guard<std::mutex> lk(pool.mutex);
+        pool.max_bytes = max_bytes;
+        while (pool.pooled_bytes > max_bytes)
         {
-            char time_str[15];
-            size_t datalen = 0;
-            buffer->read(&payload, &datalen);
-            if (payload == NULL || datalen == 0)
-            {
-                cJSON_Delete(data);
-                return NULL;
-            }
-            cJSON *media;
-            member = cJSON_CreateNumber(sequenceNumber);
-            cJSON_AddItemToObject(data, "sequenceNumber", member);
-            member = cJSON_CreateString(streamid.c_str());
-            cJSON_AddItemToObject(data, "stream_id", member);
-            member = cJSON_CreateString("media");
-            cJSON_AddItemToObject(data, "event", member);
-            media = cJSON_AddObjectToObject(data, "media");
-            member = cJSON_CreateString(track.c_str());
-            cJSON_AddItemToObject(media, "track", member);
-            snprintf(time_str, 14, "%ld", buffer->last_send_time_);
-            member = cJSON_CreateString(time_str);
-            cJSON_AddItemToObject(media, "timestamp", member);
-            member = cJSON_CreateNumber(buffer->transmitted_chunk_count_);
-            cJSON_AddItemToObject(media, "chunk", member);
-            std::string payload_str = base64::base64_encode((unsigned char *)payload, datalen);
-            member = cJSON_CreateString(payload_str.c_str());
-            cJSON_AddItemToObject(media, "payload", member);
-            if (extraHeaders.length() > 0)
-            {
-                member = cJSON_CreateString(extraHeaders.c_str());
-                cJSON_AddItemToObject(data, "extra_headers", member);
-            }
-            break;
+            dropped.push_back(pool.blocks.back());
+            pool.pooled_bytes -= pool.blocks.back().first;
+            pool.blocks.pop_back();
         }
-        case CLIENT_EVENT_STOP:
+    }
+    for (auto &block : dropped)
+        free(block.second);
+}
+
+// the ring's slots come first, the spooled ones follow them
+const chunk_stamps_t *Buffer::queued_stamps(size_t offset) const
+{
+    size_t read_index = read_index_.load(std::memory_order_relaxed);
+    size_t queued = write_index_.load(std::memory_order_acquire) - read_index;
+    if (offset < queued)
+        return stamps_at(read_index + offset);
+    return spool_ ? spool_->stamps_at(offset - queued) : nullptr;
+}
+
+uint32_t Buffer::silence_at(size_t offset) const
+{
+    const chunk_stamps_t *stamps = queued_stamps(offset);
+    return stamps ? stamps->silent_chunks : 0;
+}
+
+bool Buffer::mulaw_at(size_t offset) const
+{
+    const chunk_stamps_t *stamps = queued_stamps(offset);
+    return stamps && stamps->mulaw != 0;
+}
+
+uint32_t Buffer::read_silence(switch_time_t &timestamp, uint32_t &first_chunk)
+{
+    uint32_t chunks = silence_at(0);
+    if (chunks == 0)
+        return 0;
+    size_t read_index = read_index_.load(std::memory_order_relaxed);
+    if (write_index_.load(std::memory_order_acquire) != read_index)
+        read_index_.store(read_index + 1, std::memory_order_release);
+    else
+        spool_->skip(1);
+
+    timestamp = last_send_time_ + time_step_increment_;
+    first_chunk = transmitted_chunk_count_ + 1;
+    last_send_time_ += time_step_increment_ * chunks;
+    transmitted_chunk_count_ += chunks;
+    return chunks;
+}
+
+bool Buffer::read(void *destination, chunk_stamps_t *stamps)
+{
+    size_t read_index = read_index_.load(std::memory_order_relaxed);
+    if (write_index_.load(std::memory_order_acquire) != read_index)
+    {
+        memcpy(destination, chunk_at(read_index), chunk_size_bytes_);
+        if (stamps)
+            *stamps = *stamps_at(read_index);
+        read_index_.store(read_index + 1, std::memory_order_release);
+    }
+    else if (!spool_ || !spool_->read(destination, stamps))
+    {
+        return false;
+    }
+
+    last_send_time_ += time_step_increment_;
+    transmitted_chunk_count_ += 1;
+    return true;
+}
+
+size_t Buffer::discard(size_t count)
+{
+    size_t wanted = count;
+    size_t read_index = read_index_.load(std::memory_order_relaxed);
+    size_t available = write_index_.load(std::memory_order_acquire) - read_index;
+    if (count > available)
+        count = available;
+    size_t chunks = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t silent = stamps_at(read_index + i)->silent_chunks;
+        chunks += silent ? silent : 1;
+    }
+    read_index_.store(read_index + count, std::memory_order_release);
+
+    // the rest from the spool behind the ring
+    if (spool_ && count < wanted)
+    {
+        size_t spooled = 0;
+        const chunk_stamps_t *stamps;
+        while (spooled < wanted - count && (stamps = spool_->stamps_at(spooled)) != nullptr)
         {
-            cJSON *stop;
-            member = cJSON_CreateNumber(sequenceNumber);
-            cJSON_AddItemToObject(data, "sequenceNumber", member);
-            member = cJSON_CreateString(streamid.c_str());
-            cJSON_AddItemToObject(data, "stream_id", member);
-            member = cJSON_CreateString("stop");
-            cJSON_AddItemToObject(data, "event", member);
-            stop = cJSON_AddObjectToObject(data, "stop");
-            member = cJSON_CreateString(uuid.c_str());
-            cJSON_AddItemToObject(stop, "callId", member);
-            if (extraHeaders.length() > 0)
-            {
-                member = cJSON_CreateString(extraHeaders.c_str());
-                cJSON_AddItemToObject(data, "extra_headers", member);
-            }
-            break;
+            chunks += stamps->silent_chunks ? stamps->silent_chunks : 1;
+            spooled++;
         }
+        count += spool_->skip(spooled);
     }
 
-    result = cJSON_Print(data);
-    cJSON_Delete(data);
-    if (result == NULL)
+    last_send_time_ += time_step_increment_ * chunks;
+    transmitted_chunk_count_ += chunks;
+    return count;
+}
+
+bool Buffer::write(void *data, const chunk_stamps_t &stamps, bool mulaw)
+{
+    size_t write_index = write_index_.load(std::memory_order_relaxed);
+    if (spills(write_index))
+    {
+        chunk_stamps_t record = stamps;
+        record.silent_chunks = 0;
+        record.mulaw = mulaw ? 1 : 0;
+        return spool_write(data, record);
+    }
+    if (slot_count_ == 0 || write_index - read_index_.load(std::memory_order_acquire) >= slot_count_)
     {
-        fprintf(stderr, "Failed to print monitor.\n");
-        return NULL;
+        switch_log_printf(SWITCH_CHANNEL_LOG,
+                          SWITCH_LOG_ERROR,
+                          "mod_audio_stream(%s) Buffer:write failed.",
+                          stream_identifier_.c_str());
+        return false;
     }
-    if (payload != NULL)
-        free(payload);
-    return result;
+    if (!slab_for_write(write_index))
+        return false;
+
+    memcpy(chunk_at(write_index), data, chunk_size_bytes_);
+    chunk_stamps_t *slot = stamps_at(write_index);
+    *slot = stamps;
+    slot->silent_chunks = 0;
+    slot->mulaw = mulaw ? 1 : 0;
+    write_index_.store(write_index + 1, std::memory_order_release);
+
+    generated_time_ += time_step_increment_;
+    generated_chunk_count_ += 1;
+    return true;
+}
+
+bool Buffer::write_silence(uint32_t chunks, const chunk_stamps_t &stamps)
+{
+    size_t write_index = write_index_.load(std::memory_order_relaxed);
+    if (chunks > 0 && spills(write_index))
+    {
+        chunk_stamps_t record = stamps;
+        record.silent_chunks = chunks;
+        record.mulaw = 0;
+        return spool_write(nullptr, record);
+    }
+    if (chunks == 0 || slot_count_ == 0 || write_index - read_index_.load(std::memory_order_acquire) >= slot_count_)
+        return false;
+    if (!slab_for_write(write_index))
+        return false;
+
+    chunk_stamps_t *slot = stamps_at(write_index);
+    *slot = stamps;
+    slot->silent_chunks = chunks;
+    slot->mulaw = 0;
+    write_index_.store(write_index + 1, std::memory_order_release);
+
+    generated_time_ += time_step_increment_ * chunks;
+    generated_chunk_count_ += chunks;
+    return true;
+}
+
+EventRing::EventRing(size_t capacity) : slots_(nullptr), capacity_(capacity), head_(0), count_(0)
+{
+    slots_ = new (std::nothrow) slot[capacity_];
+    if (!slots_)
+        capacity_ = 0;
+}
+
+EventRing::~EventRing()
+{
+    delete[] slots_;
+}
+
+bool EventRing::push(control_event_type_t type, const char *data, size_t len, uint64_t enqueued_ns)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (count_ == capacity_)
+        return false;
+    slot &entry = slots_[(head_ + count_) % capacity_];
+    // assign() reuses the slot's storage when it is large enough
+    if (len > 0)
+        entry.text.assign(data, len);
+    else
+        entry.text.clear();
+    entry.type = type;
+    entry.enqueued_ns = enqueued_ns;
+    count_++;
+    return true;
+}
+
+bool EventRing::pop(std::string &out, control_event_type_t &type, uint64_t &enqueued_ns)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (count_ == 0)
+        return false;
+    slot &entry = slots_[head_];
+    out.swap(entry.text);
+    entry.text.clear();
+    type = entry.type;
+    enqueued_ns = entry.enqueued_ns;
+    head_ = (head_ + 1) % capacity_;
+    count_--;
+    return true;
+}
+
+bool EventRing::pop_if(control_event_type_t type, uint64_t not_after_ns, std::string &out)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (count_ == 0)
+        return false;
+    slot &entry = slots_[head_];
+    if (entry.type != type || entry.enqueued_ns > not_after_ns)
+        return false;
+    out.swap(entry.text);
+    entry.text.clear();
+    head_ = (head_ + 1) % capacity_;
+    count_--;
+    return true;
+}
+
+static inline void put_be32(uint8_t *dst, uint32_t v)
+{
+    dst[0] = (uint8_t)(v >> 24);
+    dst[1] = (uint8_t)(v >> 16);
+    dst[2] = (uint8_t)(v >> 8);
+    dst[3] = (uint8_t)v;
+}
+
+static inline uint32_t get_be32(const uint8_t *src)
+{
+    return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | (uint32_t)src[3];
+}
+
+size_t encode_binary_media_header(uint8_t *dst, const binary_media_header_t &header)
+{
+    dst[0] = BINARY_MEDIA_HEADER_VERSION;
+    dst[1] = header.track;
+    dst[2] = (uint8_t)header.codec;
+    dst[3] = 0;
+    put_be32(dst + 4, header.sequence_number);
+    put_be32(dst + 8, header.chunk);
+    put_be32(dst + 12, (uint32_t)(header.timestamp >> 32));
+    put_be32(dst + 16, (uint32_t)header.timestamp);
+    put_be32(dst + 20, header.sample_rate);
+    return BINARY_MEDIA_HEADER_SIZE;
+}
+
+bool decode_binary_media_header(const uint8_t *src, size_t len, binary_media_header_t &header)
+{
+    if (len < BINARY_MEDIA_HEADER_SIZE || src[0] != BINARY_MEDIA_HEADER_VERSION || src[2] > G722)
+        return false;
+
+    header.version = src[0];
+    header.track = src[1];
+    header.codec = (streaming_codec_t)src[2];
+    header.sequence_number = get_be32(src + 4);
+    header.chunk = get_be32(src + 8);
+    header.timestamp = ((uint64_t)get_be32(src + 12) << 32) | get_be32(src + 16);
+    header.sample_rate = get_be32(src + 20);
+    return true;
 }
@@ -5,7 +5,8 @@
  *
  * This header defines utility classes and functions used throughout the
  * audio streaming module, including ring buffers for audio data management,
- * codec definitions, and JSON message generation utilities.
+ * codec definitions, and binary media framing helpers. JSON messages are
+ * produced by stream_serializer.hpp.
  *
  * @author FreeSWITCH Community
  * @version 1.0
@@ -14,6 +15,7 @@
 #ifndef __STREAM_UTILS_HPP__
 #define __STREAM_UTILS_HPP__
 
+#include <atomic>
 #include <mutex>
 #include <string>
 #include <switch.h>
@@ -32,9 +34,42 @@
 /** @brief Maximum number of connection attempts before giving up */
 #define MAX_CONNECTION_ATTEMPTS 3
 
-/** @brief Delay in seconds between reconnection attempts */
+/** @brief Delay in seconds before the first reconnection attempt, later ones back off exponentially */
 #define RECONNECTION_DELAY_SECONDS 1
 
+/** @brief Maximum number of text events queued on one stream before new ones are refused */
+#define MAX_PENDING_EVENTS 256
+
+/** @brief Upper bound for the events of one type merged into a single message */
+#define MAX_COALESCED_EVENTS 64
+
+/** @brief Upper bound for the window within which consecutive events are merged, in ms */
+#define MAX_EVENT_COALESCE_MS 1000
+
+/** @brief Default upper bound, in bytes, on Buffer slot storage kept for reuse across calls */
+#define BUFFER_STORAGE_POOL_DEFAULT_BYTES (64 * 1024 * 1024)
+
+/** @brief Chunks per Buffer slab, the unit its storage grows and shrinks by (1s of 20ms chunks) */
+#define BUFFER_SLAB_CHUNKS 50
+
+/** @brief Version byte carried in every binary media frame header */
+#define BINARY_MEDIA_HEADER_VERSION 1
+
+/** @brief Size in bytes of the fixed binary media frame header */
+#define BINARY_MEDIA_HEADER_SIZE 24
+
+/** @brief Upper bound for the number of 20ms chunks packed into one media message */
+#define MAX_CHUNKS_PER_MESSAGE 10
+
+/** @brief Upper bound for the audio kept while connecting and flushed on connect, in ms */
+#define MAX_PREROLL_MS 10000
+
+/** @brief Rate of the PCM16 audio the OpenAI Realtime API takes and sends */
+#define REALTIME_SAMPLE_RATE 24000
+
+/** @brief Assumed cache line size used to keep producer and consumer state apart */
+#define STREAM_CACHE_LINE_SIZE 64
+
 /** @} */ // End of AudioConstants group
 
 /** @defgroup DataTypes Data Types and Enumerations
@@ -53,15 +88,121 @@ typedef enum streaming_codec
     L16,
 
     /** @brief μ-law codec (8-bit compressed, lower bandwidth) */
-    ULAW
+    ULAW,
+
+    /** @brief Opus, 20ms packets at a configurable bitrate (needs libopus at build time) */
+    OPUS,
+
+    /** @brief G.722 at 64 kbit/s, 16 kHz audio only */
+    G722
 } streaming_codec_t;
 
 /**
- * @brief Thread-safe ring buffer for audio data streaming
+ * @brief WebSocket framing used for media messages
+ *
+ * JSON framing wraps every chunk in a base64 encoded text message. Binary
+ * framing sends raw audio in binary frames behind a fixed size header and is
+ * only used when requested at stream start. Realtime framing speaks the
+ * OpenAI Realtime event protocol instead of the module's own messages.
+ */
+typedef enum streaming_framing
+{
+    /** @brief JSON text messages with base64 payload (default) */
+    FRAMING_JSON,
+
+    /** @brief Binary frames with a fixed header followed by raw audio */
+    FRAMING_BINARY,
+
+    /**
+     * @brief OpenAI Realtime events: the start metadata is sent as is (a session.update), media goes out as
+     * input_audio_buffer.append and response.audio.delta is played back; no start, stop or silence messages
+     */
+    FRAMING_REALTIME
+} streaming_framing_t;
+
+/**
+ * @brief Decoded binary media frame header
+ *
+ * Wire layout, multi-byte fields in network byte order:
+ *
+ *   offset  size  field
+ *        0     1  version (BINARY_MEDIA_HEADER_VERSION)
+ *        1     1  track (0 = inbound, 1 = outbound)
+ *        2     1  encoding (0 = L16, 1 = μ-law, 2 = Opus, 3 = G.722)
+ *        3     1  reserved, must be zero
+ *        4     4  sequence number
+ *        8     4  chunk index
+ *       12     8  timestamp in microseconds
+ *       20     4  sample rate in Hz
  *
- * This class provides a thread-safe ring buffer implementation for managing
- * audio data chunks during streaming operations. It includes timing information
- * for proper audio synchronization and flow control.
+ * The raw audio bytes follow the header directly; Opus audio is a sequence
+ * of packets, each preceded by its length as a 16-bit big-endian integer.
+ */
+typedef struct binary_media_header
+{
+    uint8_t version;
+    uint8_t track;
+    streaming_codec_t codec;
+    uint32_t sequence_number;
+    uint32_t chunk;
+    uint64_t timestamp;
+    uint32_t sample_rate;
+} binary_media_header_t;
+
+/**
+ * @brief Latency stamps carried with each buffered chunk (latency_now_ns() values)
+ */
+typedef struct chunk_stamps
+{
+    /** @brief When switch_core_media_bug_read returned the frame the chunk came from */
+    uint64_t captured_ns;
+
+    /** @brief When the chunk was written into the buffer */
+    uint64_t enqueued_ns;
+
+    /** @brief Suppressed chunks a silence marker slot stands for, 0 for a slot holding audio */
+    uint32_t silent_chunks;
+
+    /** @brief 1 when an L16 stream's slot holds μ-law in its first half (backpressure codec step) */
+    uint32_t mulaw;
+} chunk_stamps_t;
+
+class DiskSpool;
+
+/**
+ * @brief Lock-free ring buffer of audio chunks between media bug and lws thread
+ *
+ * Each stream buffer has exactly one producer (the media bug callback calling
+ * write()) and one consumer (the lws service thread calling read()), so the
+ * chunks are kept in a fixed number of equally sized slots indexed by two
+ * monotonically increasing atomic counters. Neither side ever blocks; a full
+ * ring makes write() fail and an empty ring makes read() fail.
+ *
+ * A slot can also be a silence marker written by write_silence(): it holds
+ * no audio and stands for a run of chunks voice activity detection kept
+ * back, so the chunk counter and send timeline still move on by the whole
+ * run when the consumer takes it with read_silence().
+ *
+ * Slots are grouped into slabs of BUFFER_SLAB_CHUNKS, allocated only when the
+ * producer first writes into one. Whenever it enters an empty slab it moves
+ * there a slab the consumer has finished with and hands any other finished
+ * slab back to the storage pool, so a buffer holds about its backlog plus a
+ * slab rather than its whole capacity. Slabs count against a module-wide
+ * budget (set_memory_budget()): a buffer always gets slabs up to its fair
+ * share of it, beyond that only while the module is under budget, and a
+ * refused slab fails the write like a full ring.
+ *
+ * A buffer can have a DiskSpool behind it (attach_spool()). From
+ * spill_chunks queued on, or when the ring has no room, chunks are appended
+ * to the spool instead, and keep going there as long as it holds any, so
+ * the ring only ever holds chunks older than the spooled ones. The consumer
+ * side reads the ring first and the spool after it; offsets, counts and
+ * discard() run across both as one queue.
+ *
+ * The producer and consumer counters live on separate cache lines so the two
+ * threads do not invalidate each other's line on every chunk. Timing fields
+ * follow the same split: generated_* is only touched by the producer,
+ * last_send_time_ and transmitted_chunk_count_ only by the consumer.
  */
 class Buffer
 {
@@ -70,11 +211,29 @@ class Buffer
     void operator=(const Buffer &) = delete;
 
   private:
-    /** @brief Recursive mutex for thread-safe buffer access */
-    std::recursive_mutex mutex_;
+    /** @brief Storage of each group of slab_chunks_ slots, nullptr while unused; set by the producer only */
+    uint8_t **slabs_;
+
+    /** @brief Number of entries in slabs_ */
+    size_t slab_count_;
+
+    /** @brief Slots per slab */
+    size_t slab_chunks_;
+
+    /** @brief Bytes of one slab: its audio, then its latency stamps */
+    size_t slab_bytes_;
+
+    /** @brief Offset of the stamps in a slab, 8 byte aligned */
+    size_t stamps_offset_;
+
+    /** @brief Number of chunk slots in the ring */
+    size_t slot_count_;
+
+    /** @brief Overflow file, nullptr unless the stream spools; owned, set before either side starts */
+    DiskSpool *spool_;
 
-    /** @brief Underlying FreeSWITCH buffer for data storage */
-    switch_buffer_t *freeswitch_buffer_;
+    /** @brief Chunks queued in the ring from which new ones go to the spool */
+    size_t spill_chunks_;
 
     /** @brief Time increment per audio chunk (typically 20ms) */
     switch_time_t time_step_increment_;
@@ -82,8 +241,58 @@ class Buffer
     /** @brief Timestamp when buffering started */
     switch_time_t start_time_;
 
-    /** @brief Timestamp when buffering ended */
-    switch_time_t end_time_;
+    /**
+     * @brief Storage of a slot that is written (or about to be)
+     */
+    uint8_t *chunk_at(size_t index) const
+    {
+        size_t position = index % slot_count_;
+        return slabs_[position / slab_chunks_] + (position % slab_chunks_) * chunk_size_bytes_;
+    }
+
+    chunk_stamps_t *stamps_at(size_t index) const
+    {
+        size_t position = index % slot_count_;
+        return (chunk_stamps_t *)(slabs_[position / slab_chunks_] + stamps_offset_) + position % slab_chunks_;
+    }
+
+    /**
+     * @brief Slab the slot write_index goes to, allocated or recycled on first use (producer side)
+     * @return nullptr if no slab could be had
+     */
+    uint8_t *slab_for_write(size_t write_index);
+
+    /** @brief Whether a queued slot lies in the slab */
+    bool slab_in_use(size_t slab, size_t read_index, size_t write_index) const;
+
+    /**
+     * @brief Whether the chunk at write_index goes to the spool instead of the ring (producer side)
+     */
+    bool spills(size_t write_index);
+
+    /** @brief Append a slot to the spool and account for it like a ring write (producer side) */
+    bool spool_write(const void *data, const chunk_stamps_t &stamps);
+
+    /** @brief Stamps of the slot offset slots behind the next one to read, ring then spool (consumer side) */
+    const chunk_stamps_t *queued_stamps(size_t offset) const;
+
+    /**
+     * @brief Slots queued in the ring alone
+     */
+    size_t ring_available() const
+    {
+        return write_index_.load(std::memory_order_acquire) - read_index_.load(std::memory_order_acquire);
+    }
+
+    /** @brief A slab from the storage pool, within the memory budget */
+    uint8_t *take_slab();
+
+    void give_back_slab(uint8_t *slab);
+
+    char producer_pad_[STREAM_CACHE_LINE_SIZE];
+
+    /** @brief Index of the next slot to write, advanced by the producer */
+    std::atomic<size_t> write_index_;
 
     /** @brief Generated time (updated regardless of packet drops) */
     switch_time_t generated_time_;
@@ -91,32 +300,43 @@ class Buffer
     /** @brief Generated chunk counter */
     uint32_t generated_chunk_count_;
 
+    /** @brief Slabs currently held (producer only) */
+    size_t allocated_slabs_;
+
+    /** @brief Set once a slab refusal has been logged, cleared by the next slab granted */
+    bool budget_refused_;
+
+    char consumer_pad_[STREAM_CACHE_LINE_SIZE];
+
+    /** @brief Index of the next slot to read, advanced by the consumer */
+    std::atomic<size_t> read_index_;
+
   public:
+    /** @brief Timestamp of last data transmission */
+    switch_time_t last_send_time_;
+
+    /** @brief Counter for transmitted chunks */
+    uint32_t transmitted_chunk_count_;
+
+    char shared_pad_[STREAM_CACHE_LINE_SIZE];
+
     /** @brief Size of each audio chunk in bytes (typically 20ms worth of data) */
     uint32_t chunk_size_bytes_;
 
-    /** @brief Current number of bytes used in buffer */
-    uint32_t current_usage_bytes_;
-
-    /** @brief Maximum buffer capacity in bytes */
+    /** @brief Maximum buffer capacity in bytes (whole chunks only) */
     uint32_t maximum_capacity_bytes_;
 
-    /** @brief Flag indicating if degradation notification has been sent */
+    /** @brief Flag indicating if degradation notification has been sent (producer only) */
     uint8_t degradation_notification_sent_;
 
     /** @brief Stream identifier for this buffer */
     std::string stream_identifier_;
 
-    /** @brief Timestamp of last data transmission */
-    switch_time_t last_send_time_;
-
-    /** @brief Counter for transmitted chunks */
-    uint32_t transmitted_chunk_count_;
     /**
      * @brief Constructor for audio buffer
      *
      * @param stream_id Unique identifier for the stream
-     * @param max_capacity_bytes Maximum buffer capacity in bytes
+     * @param max_capacity_bytes Maximum buffer capacity in bytes, rounded down to whole chunks
      * @param chunk_size_bytes Size of each audio chunk in bytes
      * @param time_increment_microseconds Time increment per chunk in microseconds
      */
@@ -128,54 +348,121 @@ class Buffer
     ~Buffer();
 
     /**
-     * @brief Attempt to acquire buffer lock without blocking
-     * @return true if lock was acquired, false otherwise
+     * @brief Write one chunk of audio data (producer side)
+     * @param data Pointer to chunk_size_bytes_ bytes of audio data
+     * @param stamps Capture and enqueue time of the chunk, handed back by read()
+     * @param mulaw The chunk is μ-law in place of the stream's L16, only its first half is audio
+     * @return true if data was written successfully, false if buffer is full
+     */
+    bool write(void *data, const chunk_stamps_t &stamps, bool mulaw = false);
+
+    /**
+     * @brief Write a silence marker for chunks that were suppressed (producer side)
+     * @param chunks Number of chunks the marker stands for, at least 1
+     * @param stamps Stamps of the marker, silent_chunks is set from chunks
+     * @return true if the marker was written, false if the buffer is full
+     */
+    bool write_silence(uint32_t chunks, const chunk_stamps_t &stamps);
+
+    /**
+     * @brief Read one chunk into caller provided memory (consumer side)
+     * @param destination Receives chunk_size_bytes_ bytes
+     * @param stamps Receives the chunk's latency stamps, may be nullptr
+     * @return true if a complete chunk was copied, false if buffer is empty
+     */
+    bool read(void *destination, chunk_stamps_t *stamps = nullptr);
+
+    /**
+     * @brief Chunks of the silence marker offset slots behind the next one to read (consumer side)
+     * @return 0 if that slot holds audio or is not written yet
+     */
+    uint32_t silence_at(size_t offset) const;
+
+    /**
+     * @brief Whether the slot offset slots behind the next one to read was written as μ-law (consumer side)
+     * @return false if it was not or is not written yet
+     */
+    bool mulaw_at(size_t offset) const;
+
+    /**
+     * @brief Take the silence marker at the head of the buffer (consumer side)
+     *
+     * Advances the send timeline and chunk counter by the chunks it stands
+     * for. timestamp and first_chunk describe the first of them the way
+     * last_send_time_ and transmitted_chunk_count_ describe a chunk after
+     * read().
+     *
+     * @return Chunks the marker stands for, 0 (and nothing read) if the head holds audio or the buffer is empty
+     */
+    uint32_t read_silence(switch_time_t &timestamp, uint32_t &first_chunk);
+
+    /**
+     * @brief Drop the oldest chunks unsent (consumer side)
+     *
+     * The send timeline and chunk counter advance as if the chunks had been
+     * read, so the chunks that follow keep their timestamps. A silence marker
+     * counts as one slot and advances them by the chunks it stands for.
+     *
+     * @param count Slots to drop, at most the ones queued
+     * @return Number of slots dropped
+     */
+    size_t discard(size_t count);
+
+    /**
+     * @brief Number of bytes currently queued in memory
+     *
+     * Safe to call from either thread; the result is a snapshot.
      */
-    bool try_lock()
+    uint32_t current_usage_bytes() const
     {
-        return mutex_.try_lock();
+        return (uint32_t)(ring_available() * chunk_size_bytes_);
     }
 
     /**
-     * @brief Acquire buffer lock (blocking)
-     * @return true when lock is acquired
+     * @brief Number of complete chunks currently queued, spooled ones included
      */
-    bool lock()
+    size_t chunks_available() const
     {
-        mutex_.lock();
-        return true;
+        return ring_available() + spooled_chunks();
     }
 
     /**
-     * @brief Release buffer lock
+     * @brief Check if a write would fail for lack of room, in the ring or else the spool
      */
-    void unlock()
+    bool is_full() const;
+
+    /**
+     * @brief Check if buffer contains data
+     * @return true if data is available, false if buffer is empty
+     */
+    bool is_data_available() const
     {
-        mutex_.unlock();
+        return chunks_available() != 0;
     }
 
     /**
-     * @brief Write audio data to buffer
-     * @param data Pointer to audio data to write
-     * @return true if data was written successfully, false if buffer is full
+     * @brief Put a spool behind the ring, before the buffer is first written
+     * @param spool Overflow file, owned by the buffer from now on
+     * @param spill_chunks Chunks queued in memory from which new ones are spooled, at most the ring's slots
      */
-    bool write(void *data);
+    void attach_spool(DiskSpool *spool, size_t spill_chunks);
+
+    bool has_spool() const
+    {
+        return spool_ != nullptr;
+    }
 
     /**
-     * @brief Read audio data from buffer
-     * @param data Pointer to receive data pointer
-     * @param data_length Pointer to receive data length
-     * @return true if data was read successfully, false if buffer is empty
+     * @brief Chunks waiting in the spool
      */
-    bool read(void **data, size_t *data_length);
+    size_t spooled_chunks() const;
 
     /**
-     * @brief Check if buffer contains data
-     * @return true if data is available, false if buffer is empty
+     * @brief Audio time of one chunk
      */
-    bool is_data_available()
+    unsigned int chunk_duration_ms() const
     {
-        return (current_usage_bytes_ > 0);
+        return (unsigned int)(time_step_increment_ / 1000);
     }
 
     /**
@@ -186,25 +473,153 @@ class Buffer
     {
         start_time_ = time;
     }
+
+    /**
+     * @brief Limit the slot storage kept for reuse once buffers are destroyed
+     *
+     * Slot storage is handed back to a module-wide pool when a Buffer goes
+     * away and given to the next Buffer of the same size, so call setup does
+     * not go back to the allocator (and fault in fresh pages) for every
+     * stream. Blocks beyond the limit are freed; 0 disables pooling.
+     *
+     * @param max_bytes Upper bound on pooled bytes
+     */
+    static void set_storage_pool_limit(size_t max_bytes);
+
+    /**
+     * @brief Bytes of slab storage all live buffers may hold together, 0 for no limit
+     */
+    static void set_memory_budget(size_t max_bytes);
+
+    static size_t memory_budget();
+
+    /**
+     * @brief Slab storage held by live buffers, in bytes (any thread)
+     */
+    static size_t buffered_bytes();
+
+    /**
+     * @brief Number of live buffers, the fair share of the budget is budget / live_buffers()
+     */
+    static size_t live_buffers();
+
+    /**
+     * @brief Storage kept for reuse, in bytes
+     */
+    static size_t pooled_bytes();
+
+    /**
+     * @brief Slab storage this buffer holds (producer side)
+     */
+    size_t allocated_bytes() const
+    {
+        return allocated_slabs_ * slab_bytes_;
+    }
 };
 
 /**
- * @brief Client event types for JSON message generation
+ * @brief Kind of a queued control event
+ *
+ * Events the module generates carry only their argument and are serialized
+ * on the lws service thread, straight into the send buffer and numbered in
+ * the order they go out.
+ */
+typedef enum control_event_type
+{
+    /** @brief Empty event that only wakes the service thread */
+    CONTROL_EVENT_WAKE,
+
+    /** @brief Text sent as given (send_text) */
+    CONTROL_EVENT_TEXT,
+
+    /** @brief playedStream, the argument is the checkpoint name */
+    CONTROL_EVENT_PLAYED,
+
+    /** @brief media.cleared, no argument */
+    CONTROL_EVENT_CLEARED,
+
+    /** @brief incorrectPayload, the argument is the rejected message */
+    CONTROL_EVENT_INCORRECT_PAYLOAD
+} control_event_type_t;
+
+/**
+ * @brief Fixed-capacity FIFO of pending control events
  *
- * Defines the types of events that can be sent to the remote WebSocket server
- * as part of the streaming protocol.
+ * Filled from any thread, drained by the lws service thread ahead of any
+ * audio. Slots keep their string storage between uses and pop() swaps it
+ * with the caller's string, so once the ring has warmed up queueing an event
+ * does not allocate and dequeueing is O(1). pop_if() takes the next event
+ * only when it continues a run, which is how consecutive events of one type
+ * are merged into a single message.
  */
-typedef enum client_event_type
+class EventRing
 {
-    /** @brief Stream start event - initial handshake */
-    CLIENT_EVENT_START,
+    // Prevent copying and assignment
+    EventRing(const EventRing &) = delete;
+    void operator=(const EventRing &) = delete;
+
+  private:
+    /** @brief Guards the slots and indices */
+    std::mutex mutex_;
+
+    struct slot
+    {
+        /** @brief Event text or argument */
+        std::string text;
+        control_event_type_t type;
+        uint64_t enqueued_ns;
+    };
+
+    /** @brief Queued events, capacity_ entries */
+    slot *slots_;
 
-    /** @brief Media data event - contains audio payload */
-    CLIENT_EVENT_MEDIA,
+    /** @brief Number of slots */
+    size_t capacity_;
 
-    /** @brief Stream stop event - graceful termination */
-    CLIENT_EVENT_STOP
-} client_event_type_t;
+    /** @brief Index of the oldest queued event */
+    size_t head_;
+
+    /** @brief Number of queued events */
+    size_t count_;
+
+  public:
+    /**
+     * @brief Constructor
+     * @param capacity Maximum number of queued events
+     */
+    explicit EventRing(size_t capacity);
+
+    ~EventRing();
+
+    /**
+     * @brief Queue a copy of an event
+     * @param type Kind of the event
+     * @param data Event text or argument, may be null when len is 0
+     * @param len Length of the text
+     * @param enqueued_ns latency_now_ns() at the time of queueing
+     * @return false if the ring is full
+     */
+    bool push(control_event_type_t type, const char *data, size_t len, uint64_t enqueued_ns);
+
+    /**
+     * @brief Take the oldest event
+     *
+     * On success out holds the event and its previous storage is kept by the
+     * ring for a later push.
+     *
+     * @param out Receives the event text
+     * @param type Receives the kind of the event
+     * @param enqueued_ns Receives the time it was queued
+     * @return false if no event is queued
+     */
+    bool pop(std::string &out, control_event_type_t &type, uint64_t &enqueued_ns);
+
+    /**
+     * @brief Take the oldest event if it is of type and was queued by not_after_ns
+     * @return false, leaving the ring as it is, if it is not
+     */
+    bool pop_if(control_event_type_t type, uint64_t not_after_ns, std::string &out);
+};
 
 /** @} */ // End of DataTypes group
 
@@ -213,32 +628,23 @@ typedef enum client_event_type
  */
 
 /**
- * @brief Generate JSON message for WebSocket transmission
- *
- * Creates a JSON-formatted message containing audio data and metadata
- * for transmission to the remote WebSocket server. The message format
- * follows the streaming protocol specification.
- *
- * @param event_type Type of event (start, media, stop)
- * @param sequence_number Sequential message number for ordering
- * @param session_uuid FreeSWITCH session UUID
- * @param stream_identifier Unique stream identifier
- * @param track_type Audio track type ("inbound", "outbound", "both")
- * @param audio_buffer Buffer containing audio data (NULL for non-media events)
- * @param extra_headers Additional HTTP headers as JSON string
- * @param codec Audio codec being used (L16 or ULAW)
- * @param sampling_rate Audio sampling rate in Hz
- * @return Allocated JSON string (caller must free) or NULL on error
+ * @brief Write a binary media frame header
+ *
+ * @param dst Destination, at least BINARY_MEDIA_HEADER_SIZE bytes
+ * @param header Header fields to encode
+ * @return Number of bytes written (BINARY_MEDIA_HEADER_SIZE)
+ */
+size_t encode_binary_media_header(uint8_t *dst, const binary_media_header_t &header);
+
+/**
+ * @brief Parse and validate a binary media frame header
+ *
+ * @param src Start of the received binary message
+ * @param len Length of the received binary message
+ * @param header Receives the decoded header fields
+ * @return true if the header is complete and well formed, false otherwise
  */
-char *generate_json_data_event(client_event_type_t event_type,
-                               int sequence_number,
-                               std::string &session_uuid,
-                               std::string &stream_identifier,
-                               std::string &track_type,
-                               Buffer *audio_buffer,
-                               std::string &extra_headers,
-                               streaming_codec_t codec,
-                               int sampling_rate);
+bool decode_binary_media_header(const uint8_t *src, size_t len, binary_media_header_t &header);
 
 /** @} */ // End of UtilityFunctions group
 
@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file timer_wheel.hpp
+ * @brief Intrusive hierarchical timer wheel
+ *
+ * Timers are entries embedded in the objects they belong to, so scheduling,
+ * rescheduling and cancelling never allocate and cost O(1) however many
+ * timers are pending. Time is counted in caller-defined ticks; four levels of
+ * 64 slots cover 2^24 ticks, later expiries are clamped to that horizon.
+ *
+ * The wheel is not synchronised: one thread owns it, or callers hold a lock
+ * around every call.
+ */
+#ifndef __TIMER_WHEEL_HPP__
+#define __TIMER_WHEEL_HPP__
+
+#include <cstdint>
+
+/**
+ * @brief Timer entry, embedded in its owner
+ */
+struct TimerWheelEntry
+{
+    TimerWheelEntry *next = nullptr;
+    TimerWheelEntry **pprev = nullptr; // link that points at this entry, null while idle
+    uint64_t expires = 0;              // tick the entry fires at
+    void *owner = nullptr;             // for the caller, untouched by the wheel
+
+    bool scheduled() const
+    {
+        return pprev != nullptr;
+    }
+};
+
+/**
+ * @brief Hierarchical timer wheel
+ *
+ * Entries due within 64 ticks sit in the first level and fire from there;
+ * later ones sit in coarser levels and cascade down as their slot comes up.
+ */
+class TimerWheel
+{
+    // Prevent copying and assignment
+    TimerWheel(const TimerWheel &) = delete;
+    void operator=(const TimerWheel &) = delete;
+
+  public:
+    static const unsigned LEVELS = 4;
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned SLOTS = 1u << SLOT_BITS;
+    static const uint64_t HORIZON = (uint64_t)1 << (LEVELS * SLOT_BITS);
+
+  private:
+    TimerWheelEntry *slots_[LEVELS][SLOTS];
+    uint64_t current_; // next tick to be processed
+    unsigned pending_;
+
+    static void link(TimerWheelEntry **head, TimerWheelEntry *entry)
+    {
+        entry->next = *head;
+        if (entry->next)
+            entry->next->pprev = &entry->next;
+        entry->pprev = head;
+        *head = entry;
+    }
+
+    void place(TimerWheelEntry *entry)
+    {
+        uint64_t delta = entry->expires - current_;
+        unsigned level = 0;
+        while (level + 1 < LEVELS && delta >= ((uint64_t)1 << ((level + 1) * SLOT_BITS)))
+            level++;
+        link(&slots_[level][(entry->expires >> (level * SLOT_BITS)) & (SLOTS - 1)], entry);
+    }
+
+    // re-place the entries of the level's current slot, returns its index
+    unsigned cascade(unsigned level)
+    {
+        unsigned index = (current_ >> (level * SLOT_BITS)) & (SLOTS - 1);
+        TimerWheelEntry *entry = slots_[level][index];
+        slots_[level][index] = nullptr;
+        while (entry)
+        {
+            TimerWheelEntry *next = entry->next;
+            place(entry);
+            entry = next;
+        }
+        return index;
+    }
+
+  public:
+    /**
+     * @param now First tick that advance() will process
+     */
+    explicit TimerWheel(uint64_t now = 0) : current_(now), pending_(0)
+    {
+        for (unsigned level = 0; level < LEVELS; level++)
+            for (unsigned slot = 0; slot < SLOTS; slot++)
+                slots_[level][slot] = nullptr;
+    }
+
+    /**
+     * @brief (Re)schedule an entry to fire at tick expires
+     *
+     * Ticks already processed fire on the next advance(); ticks beyond the
+     * horizon are clamped to it.
+     */
+    void schedule(TimerWheelEntry *entry, uint64_t expires)
+    {
+        cancel(entry);
+        if (expires < current_)
+            expires = current_;
+        else if (expires - current_ >= HORIZON)
+            expires = current_ + HORIZON - 1;
+        entry->expires = expires;
+        place(entry);
+        pending_++;
+    }
+
+    /**
+     * @brief Cancel an entry, a no-op if it is not scheduled
+     */
+    void cancel(TimerWheelEntry *entry)
+    {
+        if (!entry->scheduled())
+            return;
+        *entry->pprev = entry->next;
+        if (entry->next)
+            entry->next->pprev = entry->pprev;
+        entry->next = nullptr;
+        entry->pprev = nullptr;
+        pending_--;
+    }
+
+    /**
+     * @brief Process every tick up to and including now
+     *
+     * @param expired Called with each due entry, already unscheduled, so it
+     *                may reschedule or cancel any entry including itself
+     * @return Number of entries that fired
+     */
+    template <typename Visitor> unsigned advance(uint64_t now, Visitor &&expired)
+    {
+        unsigned fired = 0;
+        while (current_ <= now)
+        {
+            unsigned index = current_ & (SLOTS - 1);
+            for (unsigned level = 1; index == 0 && level < LEVELS; level++)
+                index = cascade(level);
+
+            // detach the slot so that entry is the list head, the visitor
+            // can still cancel any of the due entries through its pprev
+            TimerWheelEntry *entry = slots_[0][current_ & (SLOTS - 1)];
+            slots_[0][current_ & (SLOTS - 1)] = nullptr;
+            if (entry)
+                entry->pprev = &entry;
+            // entries rescheduled from the visitor land on later ticks
+            current_++;
+            while (entry)
+            {
+                TimerWheelEntry *due = entry;
+                cancel(due);
+                expired(due);
+                fired++;
+            }
+        }
+        return fired;
+    }
+
+    /**
+     * @brief Next tick advance() will process
+     */
+    uint64_t current() const
+    {
+        return current_;
+    }
+
+    /**
+     * @brief First tick advance() has work at, to sleep until then
+     *
+     * Exact for entries due before the next 64 tick boundary, otherwise that
+     * boundary, where coarser levels cascade. Only meaningful while entries
+     * are pending.
+     */
+    uint64_t next_due() const
+    {
+        if ((current_ & (SLOTS - 1)) == 0)
+            return current_;
+        uint64_t boundary = (current_ | (SLOTS - 1)) + 1;
+        for (uint64_t tick = current_; tick < boundary; tick++)
+            if (slots_[0][tick & (SLOTS - 1)])
+                return tick;
+        return boundary;
+    }
+
+    /**
+     * @brief Number of scheduled entries
+     */
+    unsigned pending() const
+    {
+        return pending_;
+    }
+};
+
+#endif /* __TIMER_WHEEL_HPP__ */
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+#include "voice_activity.hpp"
+
+#include <cmath>
+
+#if defined(__SSE2__)
+#define VAD_HAVE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) || (defined(__ARM_NEON) && defined(__arm__))
+#define VAD_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* full scale of a 16-bit sample, squared */
+#define VAD_FULL_SCALE_ENERGY (32768.0 * 32768.0)
+
+/* a voice frame stands this far above the noise floor (6 dB) */
+#define VAD_FLOOR_MARGIN 4.0
+
+/* the floor follows a rising level by 0.05 dB per frame and a falling one at once */
+#define VAD_FLOOR_RISE 1.0116
+
+/* frames within this factor of the threshold (10 dB) also need a voice-like zero-crossing rate */
+#define VAD_MARGINAL_FACTOR 10.0
+
+void vad_measure(const int16_t *samples, size_t count, uint64_t &energy, size_t &crossings)
+{
+    energy = 0;
+    crossings = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+#if defined(VAD_HAVE_SSE2)
+    // each pair of squares is at most 2^31, exact as an unsigned 32-bit lane before widening
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+        __m128i squares = _mm_madd_epi16(x, x);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(squares, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(squares, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    energy = lanes[0] + lanes[1];
+
+    // a sign change sets the sign bit of a ^ b, shifted down to -1 and subtracted
+    __m128i changes = zero;
+    for (; j + 9 <= count; j += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(samples + j));
+        __m128i b = _mm_loadu_si128((const __m128i *)(samples + j + 1));
+        changes = _mm_sub_epi16(changes, _mm_srai_epi16(_mm_xor_si128(a, b), 15));
+    }
+    __m128i sums = _mm_madd_epi16(changes, _mm_set1_epi16(1));
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+    crossings = (size_t)_mm_cvtsi128_si32(sums);
+#elif defined(VAD_HAVE_NEON)
+    uint64x2_t acc = vdupq_n_u64(0);
+    for (; i + 8 <= count; i += 8)
+    {
+        int16x8_t x = vld1q_s16(samples + i);
+        int32x4_t low = vmull_s16(vget_low_s16(x), vget_low_s16(x));
+        int32x4_t high = vmull_s16(vget_high_s16(x), vget_high_s16(x));
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(low));
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(high));
+    }
+    energy = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+
+    int16x8_t changes = vdupq_n_s16(0);
+    for (; j + 9 <= count; j += 8)
+    {
+        int16x8_t a = vld1q_s16(samples + j);
+        int16x8_t b = vld1q_s16(samples + j + 1);
+        changes = vsubq_s16(changes, vshrq_n_s16(veorq_s16(a, b), 15));
+    }
+    int64x2_t wide = vpaddlq_s32(vpaddlq_s16(changes));
+    crossings = (size_t)(vgetq_lane_s64(wide, 0) + vgetq_lane_s64(wide, 1));
+#endif
+
+    for (; i < count; i++)
+        energy += (uint64_t)((int32_t)samples[i] * samples[i]);
+    for (; j + 1 < count; j++)
+        crossings += ((samples[j] ^ samples[j + 1]) < 0) ? 1 : 0;
+}
+
+VoiceActivityDetector::VoiceActivityDetector(int threshold_db, unsigned int hangover_ms)
+    : threshold_(VAD_FULL_SCALE_ENERGY * std::pow(10.0, threshold_db / 10.0)), floor_(threshold_ / VAD_FLOOR_MARGIN),
+      hangover_frames_(hangover_ms / 20), hangover_left_(0), pending_(0), frames_(0), suppressed_(0)
+{
+}
+
+bool VoiceActivityDetector::is_voice(const int16_t *samples, size_t count)
+{
+    frames_++;
+    uint64_t energy = 0;
+    size_t crossings = 0;
+    vad_measure(samples, count, energy, crossings);
+    double level = count ? (double)energy / count : 0;
+
+    // kept off zero so digital silence does not pin it there
+    if (level < floor_)
+        floor_ = level > 1.0 ? level : 1.0;
+    else
+        floor_ *= VAD_FLOOR_RISE;
+
+    bool voice = level > threshold_ && level > floor_ * VAD_FLOOR_MARGIN;
+    if (voice && level < threshold_ * VAD_MARGINAL_FACTOR && crossings > count / 2)
+        voice = false;
+
+    if (voice)
+    {
+        hangover_left_ = hangover_frames_;
+        return true;
+    }
+    if (hangover_left_ > 0)
+    {
+        hangover_left_--;
+        return true;
+    }
+    pending_++;
+    suppressed_++;
+    return false;
+}
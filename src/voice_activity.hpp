@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+/**
+ * @file voice_activity.hpp
+ * @brief Energy and zero-crossing voice activity detection for the capture path
+ *
+ * Silence suppression runs on the linear audio of each 20ms frame, after
+ * resampling and before encoding. A frame counts as voice when its energy is
+ * above the configured threshold and clearly above the noise floor the
+ * detector tracks; near the threshold, a frame crossing zero on more than
+ * half of its samples is taken for hiss rather than speech. Voice keeps the
+ * detector open for a hangover period so word endings and short pauses are
+ * sent as they are.
+ *
+ * Suppressed frames are not dropped from the timeline: the media bug counts
+ * them and writes one silence marker into the stream Buffer per run (or per
+ * VAD_MAX_SILENCE_CHUNKS), which the lws thread turns into a "silence" event
+ * and which advances the Buffer's chunk and timestamp counters as if the
+ * audio had been sent.
+ */
+#ifndef __VOICE_ACTIVITY_HPP__
+#define __VOICE_ACTIVITY_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+/** @brief Voice threshold unless MOD_AUDIO_STREAM_VAD_THRESHOLD_DB says otherwise, dBFS */
+#define VAD_DEFAULT_THRESHOLD_DB -45
+
+/** @brief Accepted thresholds, dBFS */
+#define VAD_MIN_THRESHOLD_DB -90
+#define VAD_MAX_THRESHOLD_DB 0
+
+/** @brief Time sent after the last voice frame unless MOD_AUDIO_STREAM_VAD_HANGOVER_MS says otherwise */
+#define VAD_DEFAULT_HANGOVER_MS 300
+#define VAD_MAX_HANGOVER_MS 5000
+
+/** @brief Longest run of suppressed chunks one silence marker stands for (1s of 20ms chunks) */
+#define VAD_MAX_SILENCE_CHUNKS 50
+
+/**
+ * @brief Sum of squares and number of sign changes of a frame
+ *
+ * Uses SSE2 or NEON where the build has them; the results are exact either way.
+ */
+void vad_measure(const int16_t *samples, size_t count, uint64_t &energy, size_t &crossings);
+
+/**
+ * @brief Detector for one direction of a stream (media bug thread)
+ */
+class VoiceActivityDetector
+{
+  public:
+    /**
+     * @param threshold_db Level below which a frame is silence, dBFS
+     * @param hangover_ms Time kept open after the last voice frame, in 20ms frames
+     */
+    VoiceActivityDetector(int threshold_db, unsigned int hangover_ms);
+
+    /**
+     * @brief Classify one frame
+     * @return true if the frame is to be sent, false if it is suppressed and counted as pending silence
+     */
+    bool is_voice(const int16_t *samples, size_t count);
+
+    /**
+     * @brief Suppressed chunks not yet written as a silence marker
+     */
+    uint32_t pending_silence() const
+    {
+        return pending_;
+    }
+
+    /**
+     * @brief Hand the pending silence over to a marker
+     * @return Chunks the marker stands for
+     */
+    uint32_t take_silence()
+    {
+        uint32_t pending = pending_;
+        pending_ = 0;
+        return pending;
+    }
+
+    uint64_t frames() const
+    {
+        return frames_;
+    }
+
+    uint64_t suppressed() const
+    {
+        return suppressed_;
+    }
+
+  private:
+    double threshold_;
+    double floor_;
+    unsigned int hangover_frames_;
+    unsigned int hangover_left_;
+    uint32_t pending_;
+    uint64_t frames_;
+    uint64_t suppressed_;
+};
+
+#endif /* __VOICE_ACTIVITY_HPP__ */
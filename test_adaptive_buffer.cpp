@@ -60,6 +60,54 @@ int main()
     std::cout << "  - Priority: " << (int)retrieved_msg.priority << std::endl;
     std::cout << "  - Sequence: " << retrieved_msg.sequence_number << std::endl;
 
+    // Test 4b: Priority order, FIFO within a priority, peek view and move enqueue
+    const message_priority_t order[] = {PRIORITY_NORMAL, PRIORITY_HIGH, PRIORITY_NORMAL, PRIORITY_CRITICAL};
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        buffered_message_t queued;
+        queued.data.assign(160, (uint8_t)i);
+        queued.priority = order[i];
+        queued.timestamp = std::chrono::system_clock::now();
+        queued.sequence_number = 10 + i;
+        queued.deadline = queued.timestamp + std::chrono::milliseconds(5000);
+        queued.retry_count = 0;
+        if (i == 2)
+        {
+            queued.metadata["track"] = "inbound";
+        }
+        if (!manager.enqueue_message(stream_id, std::move(queued)))
+        {
+            std::cerr << "Failed to move-enqueue message " << i << std::endl;
+            return 1;
+        }
+    }
+
+    buffered_message_view_t view;
+    if (!manager.peek_message(stream_id, view) || view.sequence_number != 13 || view.size != 160 || view.data[0] != 3)
+    {
+        std::cerr << "Peek did not return the critical message" << std::endl;
+        return 1;
+    }
+
+    const uint32_t expected[] = {13, 11, 10, 12};
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        if (!manager.dequeue_message(stream_id, retrieved_msg, std::chrono::milliseconds(100)) ||
+            retrieved_msg.sequence_number != expected[i] || retrieved_msg.data.size() != 160 ||
+            retrieved_msg.data[0] != expected[i] - 10)
+        {
+            std::cerr << "Dequeue " << i << " returned the wrong message" << std::endl;
+            return 1;
+        }
+    }
+    if (retrieved_msg.metadata.size() != 1 || retrieved_msg.metadata["track"] != "inbound")
+    {
+        std::cerr << "Metadata was not carried through the queue" << std::endl;
+        return 1;
+    }
+
+    std::cout << "✓ Priority order, FIFO, peek view and move enqueue verified" << std::endl;
+
     // Test 5: Get buffer statistics
     auto stats = manager.get_buffer_statistics(stream_id);
     std::cout << "✓ Buffer statistics retrieved:" << std::endl;
@@ -167,6 +215,7 @@ int main()
     std::cout << "✓ Buffer manager initialization" << std::endl;
     std::cout << "✓ Buffer creation and destruction" << std::endl;
     std::cout << "✓ Message enqueue and dequeue operations" << std::endl;
+    std::cout << "✓ Priority ordering and payload recycling" << std::endl;
     std::cout << "✓ Statistics collection" << std::endl;
     std::cout << "✓ Network condition adaptation" << std::endl;
     std::cout << "✓ Buffer utilization calculation" << std::endl;
@@ -0,0 +1,120 @@
+#include "src/backpressure_ladder.hpp"
+#include <iostream>
+
+namespace
+{
+const uint64_t FRAME_NS = 20000000;
+const unsigned int ALL_STEPS =
+    (1u << DEGRADE_BATCH) | (1u << DEGRADE_CODEC) | (1u << DEGRADE_DROP_OUTBOUND) | (1u << DEGRADE_DROP_OLDEST);
+
+bool thresholds_are(
+    const char *spec, unsigned int batch, unsigned int codec, unsigned int outbound, unsigned int oldest)
+{
+    unsigned int ms[DEGRADE_LEVELS];
+    if (!degradation_parse_thresholds(spec, ms))
+        return false;
+    return ms[DEGRADE_NONE] == 0 && ms[DEGRADE_BATCH] == batch && ms[DEGRADE_CODEC] == codec &&
+           ms[DEGRADE_DROP_OUTBOUND] == outbound && ms[DEGRADE_DROP_OLDEST] == oldest;
+}
+
+// one 20ms frame: a slot written, queued slots sampled; returns false if a change skipped a level
+bool frame(BackpressureLadder &ladder, uint64_t &now, size_t queued, int &changes)
+{
+    ladder.produced();
+    int before = ladder.level();
+    now += FRAME_NS;
+    if (!ladder.update(now, queued))
+        return true;
+    changes++;
+    int step = ladder.level() - before;
+    return ladder.previous() == before && (step == 1 || step == -1);
+}
+} // namespace
+
+int main()
+{
+    std::cout << "Testing backpressure ladder..." << std::endl;
+
+    unsigned int ms[DEGRADE_LEVELS];
+    if (!thresholds_are("on", 200, 1000, 2000, 4000) || !thresholds_are("300, 0, 2500", 300, 0, 2500, 0) ||
+        !thresholds_are("500,100", 500, 500, 0, 0) || degradation_parse_thresholds("off", ms) ||
+        degradation_parse_thresholds("", ms) || degradation_parse_thresholds("fast", ms) ||
+        degradation_parse_thresholds("0,0", ms))
+    {
+        std::cerr << "thresholds not parsed" << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Thresholds parsed" << std::endl;
+
+    // a stalled uplink walks down every step in order, then a drained queue walks back one step a window
+    degradation_parse_thresholds("on", ms);
+    BackpressureLadder ladder(ms, 20, ALL_STEPS);
+    uint64_t now = 1;
+    int changes = 0;
+    size_t queued = 0;
+    ladder.update(now, queued);
+    while (ladder.level() != DEGRADE_DROP_OLDEST && queued < 1000)
+    {
+        if (!frame(ladder, now, ++queued, changes))
+        {
+            std::cerr << "level " << ladder.level() << " skipped a step" << std::endl;
+            return 1;
+        }
+    }
+    if (ladder.level() != DEGRADE_DROP_OLDEST || changes != 4 || queued * 20 > 4000 || ladder.uplink_percent() != 0)
+    {
+        std::cerr << "stalled uplink reached level " << ladder.level() << " at " << queued * 20 << " ms" << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Stalled uplink degrades step by step" << std::endl;
+
+    uint64_t recovered_at = now;
+    for (int i = 0; i < 400 && ladder.level() != DEGRADE_NONE; i++)
+    {
+        if (!frame(ladder, now, 0, changes))
+        {
+            std::cerr << "recovery skipped a step" << std::endl;
+            return 1;
+        }
+    }
+    uint64_t recovery_ms = (now - recovered_at) / 1000000;
+    if (ladder.level() != DEGRADE_NONE || changes != 8 || recovery_ms < 4 * DEGRADE_WINDOW_MS ||
+        recovery_ms > 6 * DEGRADE_WINDOW_MS || ladder.uplink_percent() != 100)
+    {
+        std::cerr << "recovered to level " << ladder.level() << " in " << recovery_ms << " ms" << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Drained queue recovers one step per window" << std::endl;
+
+    // a steady batch-sized backlog on a healthy uplink does not degrade
+    BackpressureLadder steady(ms, 20, ALL_STEPS);
+    now = 1;
+    changes = 0;
+    steady.update(now, 0);
+    for (int i = 0; i < 500; i++)
+        frame(steady, now, (size_t)(i % 10), changes);
+    if (changes != 0 || steady.level() != DEGRADE_NONE)
+    {
+        std::cerr << "healthy uplink degraded to level " << steady.level() << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Healthy uplink left alone" << std::endl;
+
+    // steps that do not apply are skipped, the backlog threshold still holds
+    BackpressureLadder single(ms, 20, (1u << DEGRADE_BATCH) | (1u << DEGRADE_DROP_OLDEST));
+    now = 1;
+    single.update(now, 0);
+    now += FRAME_NS;
+    single.update(now, 10);
+    now += FRAME_NS;
+    if (single.level() != DEGRADE_BATCH || !single.update(now, 200) || single.level() != DEGRADE_DROP_OLDEST ||
+        single.previous() != DEGRADE_BATCH || single.drops_outbound())
+    {
+        std::cerr << "inapplicable steps not skipped, level " << single.level() << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Inapplicable steps skipped" << std::endl;
+
+    std::cout << "All backpressure ladder tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "src/message_scanner.hpp"
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace
+{
+bool scan_delta(const std::string &message, std::string &delta)
+{
+    json_string_view_t view;
+    if (!scan_realtime_audio_delta(message.data(), message.size(), view))
+        return false;
+    delta.assign(view.data, view.len);
+    return true;
+}
+} // namespace
+
+int main()
+{
+    std::cout << "Testing message scanning..." << std::endl;
+
+    // media.play fields in any order, nested values skipped
+    const std::string play = "{\"streamId\":\"s1\",\"media\":{\"payload\":\"AAEC\",\"extra\":{\"a\":[1,2]},"
+                             "\"sampleRate\":16000,\"contentType\":\"audio/x-l16\"},\"event\":\"media.play\"}";
+    media_play_view_t view;
+    if (!scan_media_play(play.data(), play.size(), view) || !view.payload.equals("AAEC") ||
+        !view.content_type.equals("audio/x-l16") || view.sample_rate != 16000)
+    {
+        std::cerr << "media.play not scanned" << std::endl;
+        return 1;
+    }
+    std::cout << "✓ media.play scanned" << std::endl;
+
+    // both names of the realtime audio delta, with the other members the provider sends
+    std::string delta;
+    const std::string realtime = "{\"type\":\"response.audio.delta\",\"event_id\":\"event_1\","
+                                 "\"response_id\":\"resp_1\",\"item_id\":\"item_1\",\"output_index\":0,"
+                                 "\"content_index\":0,\"delta\":\"UklGRg==\"}";
+    if (!scan_delta(realtime, delta) || delta != "UklGRg==")
+    {
+        std::cerr << "response.audio.delta not scanned" << std::endl;
+        return 1;
+    }
+    if (!scan_delta("{ \"delta\" : \"AAAA\" , \"type\" : \"response.output_audio.delta\" }", delta) ||
+        delta != "AAAA")
+    {
+        std::cerr << "response.output_audio.delta not scanned" << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Realtime audio deltas scanned" << std::endl;
+
+    // everything the generic path has to see
+    const char *rejected[] = {
+        "{\"type\":\"response.audio_transcript.delta\",\"delta\":\"hello\"}",
+        "{\"type\":\"response.audio.delta\",\"delta\":\"AA\\/A\"}",
+        "{\"type\":\"response.audio.delta\"}",
+        "{\"type\":\"response.audio.delta\",\"delta\":\"AAAA\",\"delta\":\"BBBB\"}",
+        "{\"type\":\"response.audio.delta\",\"delta\":\"AAAA\"",
+        "{\"type\":\"response.audio.delta\",\"delta\":\"AAAA\"} trailing",
+        "{\"type\":\"response.audio.delta\",\"delta\":42}",
+        "[\"response.audio.delta\"]",
+    };
+    for (const char *message : rejected)
+    {
+        if (scan_delta(message, delta))
+        {
+            std::cerr << "scanned " << message << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "✓ Other events and malformed deltas left to cJSON" << std::endl;
+
+    std::cout << "All message scanner tests passed!" << std::endl;
+    return 0;
+}
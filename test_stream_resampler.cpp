@@ -0,0 +1,161 @@
+#include "src/stream_resampler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+std::vector<int16_t> tone(double frequency, int rate, size_t samples, int amplitude)
+{
+    std::vector<int16_t> input(samples);
+    for (size_t i = 0; i < samples; i++)
+        input[i] = (int16_t)(amplitude * std::sin(2 * M_PI * frequency * i / rate));
+    return input;
+}
+
+// Resample in 20ms frames the way the media bug does
+std::vector<int16_t> resample(StreamResampler &resampler, const std::vector<int16_t> &input, size_t frame)
+{
+    std::vector<int16_t> output;
+    for (size_t pos = 0; pos < input.size(); pos += frame)
+    {
+        size_t len = std::min(frame, input.size() - pos);
+        size_t out_len = 0;
+        const int16_t *out = resampler.process(&input[pos], len, out_len);
+        output.insert(output.end(), out, out + out_len);
+    }
+    return output;
+}
+
+// Fit a sine and cosine at frequency past the filter's start-up and return their amplitude and the SNR of the rest
+double fit_tone(const std::vector<int16_t> &output, double frequency, int rate, double &amplitude)
+{
+    size_t start = (size_t)rate / 10;
+    double ss = 0, sc = 0;
+    for (size_t i = start; i < output.size(); i++)
+    {
+        ss += output[i] * std::sin(2 * M_PI * frequency * i / rate);
+        sc += output[i] * std::cos(2 * M_PI * frequency * i / rate);
+    }
+    double a = 2 * ss / (output.size() - start), b = 2 * sc / (output.size() - start);
+    amplitude = std::sqrt(a * a + b * b);
+
+    double signal = 0, noise = 0;
+    for (size_t i = start; i < output.size(); i++)
+    {
+        double fit = a * std::sin(2 * M_PI * frequency * i / rate) + b * std::cos(2 * M_PI * frequency * i / rate);
+        signal += fit * fit;
+        noise += (output[i] - fit) * (output[i] - fit);
+    }
+    return 10 * std::log10(signal / (noise + 1));
+}
+} // namespace
+
+int main()
+{
+    std::cout << "Testing stream resampler..." << std::endl;
+
+    struct
+    {
+        int in_rate;
+        int out_rate;
+        const char *implementation;
+    } ratios[] = {{8000, 16000, "halfband"},
+                  {16000, 8000, "halfband"},
+                  {8000, 24000, "polyphase"},
+                  {24000, 8000, "polyphase"}};
+    const int qualities[] = {0, 5, 10};
+
+    for (auto &ratio : ratios)
+    {
+        for (int quality : qualities)
+        {
+            std::unique_ptr<StreamResampler> resampler(
+                StreamResampler::create(1, ratio.in_rate, ratio.out_rate, quality));
+            if (!resampler || std::string(resampler->implementation()) != ratio.implementation)
+            {
+                std::cerr << ratio.in_rate << " -> " << ratio.out_rate << " did not get the "
+                          << ratio.implementation << " kernel" << std::endl;
+                return 1;
+            }
+
+            // one second in 20ms frames gives exactly one second out
+            std::vector<int16_t> input = tone(1000, ratio.in_rate, ratio.in_rate, 8000);
+            std::vector<int16_t> output = resample(*resampler, input, ratio.in_rate / 50);
+            size_t expected = (size_t)ratio.out_rate;
+            if (output.size() + 2 < expected || output.size() > expected)
+            {
+                std::cerr << ratio.in_rate << " -> " << ratio.out_rate << " wrote " << output.size()
+                          << " samples" << std::endl;
+                return 1;
+            }
+
+            double amplitude = 0;
+            double snr = fit_tone(output, 1000, ratio.out_rate, amplitude);
+            if (snr < 40 || std::fabs(amplitude - 8000) > 200)
+            {
+                std::cerr << ratio.in_rate << " -> " << ratio.out_rate << " quality " << quality << " SNR " << snr
+                          << " dB, amplitude " << amplitude << std::endl;
+                return 1;
+            }
+            std::cout << "✓ " << ratio.in_rate << " -> " << ratio.out_rate << " quality " << quality << " SNR "
+                      << snr << " dB" << std::endl;
+        }
+    }
+
+    // frame boundaries must not show in the output
+    {
+        std::unique_ptr<StreamResampler> bulk(StreamResampler::create(1, 24000, 8000, 5));
+        std::unique_ptr<StreamResampler> chunked(StreamResampler::create(1, 24000, 8000, 5));
+        std::vector<int16_t> input = tone(1234, 24000, 24000, 12000);
+        std::vector<int16_t> a = resample(*bulk, input, input.size());
+        std::vector<int16_t> b = resample(*chunked, input, 7);
+        if (a != b)
+        {
+            std::cerr << "chunked output differs from the output of one call" << std::endl;
+            return 1;
+        }
+        std::cout << "✓ Chunked and bulk output identical" << std::endl;
+    }
+
+    // a tone above the output Nyquist rate is filtered rather than folded back
+    {
+        std::unique_ptr<StreamResampler> resampler(StreamResampler::create(1, 16000, 8000, 10));
+        std::vector<int16_t> output = resample(*resampler, tone(6000, 16000, 16000, 16000), 320);
+        double amplitude = 0;
+        fit_tone(output, 2000, 8000, amplitude);
+        if (amplitude > 160)
+        {
+            std::cerr << "6 kHz alias at 2 kHz with amplitude " << amplitude << std::endl;
+            return 1;
+        }
+        std::cout << "✓ Alias rejected, residual amplitude " << amplitude << std::endl;
+    }
+
+    // a caller's buffer that is too small limits the input consumed instead of overflowing
+    {
+        std::unique_ptr<StreamResampler> resampler(StreamResampler::create(1, 8000, 16000, 5));
+        std::vector<int16_t> input(160, 1000);
+        std::vector<int16_t> output(101, 0x7777);
+        size_t in_len = input.size();
+        size_t written = resampler->process(input.data(), in_len, output.data(), 100);
+        if (in_len != 49 || written != 98 || output[100] != 0x7777)
+        {
+            std::cerr << "short buffer consumed " << in_len << " and wrote " << written << std::endl;
+            return 1;
+        }
+        std::cout << "✓ Short output buffer respected" << std::endl;
+    }
+
+    if (StreamResampler::create(1, 8000, 8000, 5))
+    {
+        std::cerr << "resampler created for equal rates" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All stream resampler tests passed! (" << stream_resampler_simd() << ")" << std::endl;
+    return 0;
+}
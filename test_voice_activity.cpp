@@ -0,0 +1,115 @@
+#include "src/voice_activity.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+void reference_measure(const int16_t *samples, size_t count, uint64_t &energy, size_t &crossings)
+{
+    energy = 0;
+    crossings = 0;
+    for (size_t i = 0; i < count; i++)
+        energy += (uint64_t)((int64_t)samples[i] * samples[i]);
+    for (size_t i = 0; i + 1 < count; i++)
+        crossings += ((samples[i] < 0) != (samples[i + 1] < 0)) ? 1 : 0;
+}
+
+std::vector<int16_t> frame_of(double frequency, double amplitude, size_t offset)
+{
+    std::vector<int16_t> frame(160);
+    for (size_t i = 0; i < frame.size(); i++)
+        frame[i] = (int16_t)(amplitude * std::sin(2 * M_PI * frequency * (offset + i) / 8000.0));
+    return frame;
+}
+} // namespace
+
+int main()
+{
+    std::cout << "Testing voice activity detection..." << std::endl;
+
+    // full scale extremes, odd lengths and unaligned starts against the plain loops
+    std::vector<int16_t> samples(1024);
+    srand(7);
+    for (size_t i = 0; i < samples.size(); i++)
+        samples[i] = (i % 97 == 0) ? -32768 : (int16_t)(rand() - RAND_MAX / 2);
+    const size_t lengths[] = {0, 1, 7, 8, 9, 17, 160, 320, 1001};
+    for (size_t offset = 0; offset < 3; offset++)
+    {
+        for (size_t length : lengths)
+        {
+            uint64_t energy, expected_energy;
+            size_t crossings, expected_crossings;
+            vad_measure(&samples[offset], length, energy, crossings);
+            reference_measure(&samples[offset], length, expected_energy, expected_crossings);
+            if (energy != expected_energy || crossings != expected_crossings)
+            {
+                std::cerr << "vad_measure differs at offset " << offset << " length " << length << std::endl;
+                return 1;
+            }
+        }
+    }
+    std::vector<int16_t> loudest(320, -32768);
+    uint64_t energy;
+    size_t crossings;
+    vad_measure(loudest.data(), loudest.size(), energy, crossings);
+    if (energy != 320ull * 32768 * 32768 || crossings != 0)
+    {
+        std::cerr << "full scale frame measured " << energy << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Energy and zero crossings exact" << std::endl;
+
+    // quiet noise is suppressed, speech-level tone is sent, the hangover keeps 300ms after it
+    VoiceActivityDetector vad(-45, 300);
+    size_t offset = 0;
+    for (int i = 0; i < 10; i++, offset += 160)
+    {
+        std::vector<int16_t> quiet = frame_of(440, 20, offset);
+        if (vad.is_voice(quiet.data(), quiet.size()))
+        {
+            std::cerr << "quiet frame " << i << " taken for voice" << std::endl;
+            return 1;
+        }
+    }
+    if (vad.pending_silence() != 10 || vad.take_silence() != 10 || vad.pending_silence() != 0)
+    {
+        std::cerr << "pending silence not counted" << std::endl;
+        return 1;
+    }
+    std::vector<int16_t> voice = frame_of(300, 6000, offset);
+    if (!vad.is_voice(voice.data(), voice.size()))
+    {
+        std::cerr << "tone at -15 dBFS suppressed" << std::endl;
+        return 1;
+    }
+    int hangover = 0;
+    for (int i = 0; i < 30; i++)
+    {
+        std::vector<int16_t> quiet = frame_of(440, 20, offset);
+        if (vad.is_voice(quiet.data(), quiet.size()))
+            hangover++;
+    }
+    if (hangover != 15 || vad.pending_silence() != 15)
+    {
+        std::cerr << "hangover kept " << hangover << " frames" << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Silence suppressed, voice and hangover sent" << std::endl;
+
+    // hiss just above the threshold crosses zero on most samples and is not voice
+    VoiceActivityDetector hiss_vad(-45, 0);
+    std::vector<int16_t> hiss(160);
+    for (size_t i = 0; i < hiss.size(); i++)
+        hiss[i] = (i % 2) ? 300 : -300;
+    if (hiss_vad.is_voice(hiss.data(), hiss.size()))
+    {
+        std::cerr << "hiss taken for voice" << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Hiss near the threshold rejected" << std::endl;
+
+    std::cout << "All voice activity tests passed!" << std::endl;
+    return 0;
+}